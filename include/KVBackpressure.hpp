@@ -0,0 +1,78 @@
+#ifndef KVBACKPRESSURE_HPP
+#define KVBACKPRESSURE_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+// Server side admission control for data requests. A request is turned away when
+// too many handlers already wait in the pool (everyone would wait behind them) or
+// when its client has used up its token bucket. Rejecting costs no store access,
+// so an overloaded server drains its queue instead of growing it.
+class KVAdmission {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    // 0 for max_queue or client_ops_per_sec disables that check
+    KVAdmission(std::size_t max_queue, double client_ops_per_sec, double client_burst, uint32_t retry_after_ms);
+
+    // 0 if a request of ops operations from client may run while queued handlers
+    // wait in the pool; otherwise the number of ms the client should back off
+    uint32_t admit(const std::string& client, std::size_t queued, std::size_t ops);
+
+    uint64_t admitted() const { return admitted_count.load(std::memory_order_relaxed); }
+    uint64_t rejectedQueue() const { return queue_rejections.load(std::memory_order_relaxed); }
+    uint64_t rejectedRate() const { return rate_rejections.load(std::memory_order_relaxed); }
+
+private:
+    struct Bucket {
+        double tokens = 0;
+        Clock::time_point refilled;
+    };
+
+    static constexpr std::size_t MAX_CLIENTS = 4096;   // Idle buckets are dropped beyond this
+    static constexpr std::chrono::seconds IDLE_AFTER{10};
+
+    std::size_t max_queue;
+    double rate;
+    double burst;
+    uint32_t retry_after_ms;
+
+    std::mutex mutex;
+    std::unordered_map<std::string, Bucket> buckets;   // Client endpoint -> its bucket
+    std::atomic<uint64_t> admitted_count{0};
+    std::atomic<uint64_t> queue_rejections{0};
+    std::atomic<uint64_t> rate_rejections{0};
+
+    uint32_t takeTokens(const std::string& client, std::size_t ops);
+};
+
+// Client side: how many ops may be in flight to each server. Additive increase,
+// multiplicative decrease: the window halves whenever a server rejects a request
+// as overloaded and grows by INCREASE ops for each window's worth of ops it
+// accepts, up to max_window.
+class KVSendWindows {
+public:
+    explicit KVSendWindows(std::size_t max_window);
+
+    void setMaxWindow(std::size_t max_window);
+    std::size_t get(const std::string& endpoint);
+    void onAccepted(const std::string& endpoint, std::size_t ops);
+    void onOverloaded(const std::string& endpoint);
+
+    uint64_t rejections() const { return rejection_count.load(std::memory_order_relaxed); }
+    std::unordered_map<std::string, std::size_t> snapshot();
+
+private:
+    static constexpr double INCREASE = 16;
+
+    std::mutex mutex;
+    double max_window;
+    std::unordered_map<std::string, double> windows;   // Endpoint -> window, max_window if absent
+    std::atomic<uint64_t> rejection_count{0};
+};
+
+#endif // KVBACKPRESSURE_HPP
@@ -0,0 +1,54 @@
+#ifndef KVCACHE_HPP
+#define KVCACHE_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Bounded client-side cache for values owned by remote nodes.
+// Entries are only valid until the read lease granted by the owning server expires;
+// eviction uses the CLOCK (second chance) policy independently in each shard.
+class KVCache {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    KVCache(std::size_t capacity, std::size_t shard_count);
+
+    bool get(int key, std::string& value);
+    void put(int key, const std::string& value, Clock::time_point expires_at);
+    void invalidate(int key);
+    void clear();
+
+    uint64_t hits() const { return hit_count.load(std::memory_order_relaxed); }
+    uint64_t misses() const { return miss_count.load(std::memory_order_relaxed); }
+
+private:
+    struct Slot {
+        int key = 0;
+        std::string value;
+        Clock::time_point expires_at;
+        bool referenced = false;
+        bool occupied = false;
+    };
+
+    struct Shard {
+        std::mutex mutex;
+        std::vector<Slot> slots;
+        std::unordered_map<int, std::size_t> index;
+        std::size_t hand = 0;
+    };
+
+    std::vector<std::unique_ptr<Shard>> shards;
+    std::atomic<uint64_t> hit_count{0};
+    std::atomic<uint64_t> miss_count{0};
+
+    Shard& shardFor(int key);
+    std::size_t findVictim(Shard& shard, Clock::time_point now);
+};
+
+#endif // KVCACHE_HPP
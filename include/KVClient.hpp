@@ -1,23 +1,131 @@
 #ifndef KVCLIENT_HPP
 #define KVCLIENT_HPP
 
+#include <atomic>
+#include <chrono>
 #include <iostream>
+#include <memory>
+#include <shared_mutex>
 #include <thallium.hpp>
 #include <unordered_map>
+#include <vector>
+#include "KVBackpressure.hpp"
+#include "KVHotKeys.hpp"
+#include "KVMembership.hpp"
+#include "KVMetrics.hpp"
+#include "KVProtocol.hpp"
+#include "KVReplication.hpp"
 #include "KVStore.hpp"
+#include "KVTrace.hpp"
 
 namespace tl = thallium;
 
+// Safe to share between threads: any number of them may call it at once, as long
+// as the engine has a dedicated progress thread (progress.dedicated_thread), since
+// application threads never drive Margo's progress loop themselves.
 class KVClient {
 private:
     tl::engine myEngine;
     uint16_t provider_id;
+    std::atomic<uint64_t> epoch{0};   // Sent with every request
+    std::atomic<double> timeout_ms{0};            // Per RPC; 0 waits forever
+    std::atomic<bool> propagate_deadlines{false}; // Stamp requests with the time the client gives up
+    KVSendWindows windows{1024};      // Ops in flight per server, cut when servers are overloaded
+    std::atomic<uint32_t> max_retries{8};         // Resends of a request rejected as OVERLOADED
+
+    // Registered once by the constructor
+    std::unique_ptr<tl::remote_procedure> remote_kv_request;
+    std::unique_ptr<tl::remote_procedure> remote_kv_batch;
+    std::unique_ptr<tl::remote_procedure> remote_kv_get_map;
+    std::unique_ptr<tl::remote_procedure> remote_kv_set_map;
+    std::unique_ptr<tl::remote_procedure> remote_kv_range_stats;
+    std::unique_ptr<tl::remote_procedure> remote_kv_hot_keys;
+    std::unique_ptr<tl::remote_procedure> remote_kv_replication_status;
+    std::unique_ptr<tl::remote_procedure> remote_kv_stats;
+    std::unique_ptr<tl::remote_procedure> remote_kv_trace;
+    std::unique_ptr<tl::remote_procedure> remote_kv_memory;
+
+    // Resolved server addresses, shared by all threads
+    std::shared_mutex endpoint_mutex;
+    std::unordered_map<std::string, tl::endpoint> endpoints;
+
+    void defineRpcs();
+    tl::endpoint lookup(const std::string& server_endpoint);
+    void forget(const std::string& server_endpoint);
+    // op as sent: with its deadline when deadlines are propagated, and with the
+    // calling thread's trace (KVTrace.hpp) when it is tracing
+    KvOp prepare(const KvOp& op) const;
+
+    // Forwards with the configured timeout; tl::timeout is thrown when it expires
+    template <typename... Args>
+    auto forward(const tl::callable_remote_procedure& rpc, Args&&... args) {
+        double timeout = timeout_ms.load();
+        if (timeout > 0) {
+            return rpc.timed(std::chrono::duration<double, std::milli>(timeout), std::forward<Args>(args)...);
+        }
+        return rpc(std::forward<Args>(args)...);
+    }
+    template <typename... Args>
+    tl::async_response forwardAsync(const tl::callable_remote_procedure& rpc, Args&&... args) {
+        double timeout = timeout_ms.load();
+        if (timeout > 0) {
+            return rpc.timed_async(std::chrono::duration<double, std::milli>(timeout), std::forward<Args>(args)...);
+        }
+        return rpc.async(std::forward<Args>(args)...);
+    }
 public:
     KVClient(const std::string& protocol, uint16_t provider_id);
-    std::string fetch(int key, std::string &server_endpoint);
-    void insert(int key, const std::string value, const std::string& server_endpoint);
-    void update(int key, const std::string value, const std::string& server_endpoint);
-    void deleteKey(int key, const std::string& server_endpoint);
+    // margo_config: Margo JSON configuration of the engine (see MargoConfigJson)
+    KVClient(const std::string& protocol, uint16_t provider_id, const std::string& margo_config);
+
+    // Every RPC gives up after timeout_ms (0: never). With propagate, requests also
+    // carry that moment as their deadline, and servers drop those still queued then.
+    void setTimeout(uint32_t new_timeout_ms, bool propagate);
+    double getTimeout() const { return timeout_ms.load(); }
+    // At most window ops in flight per server (halved on every OVERLOADED reply,
+    // grown back as requests are accepted); a rejected request is retried up to
+    // retries times after the delay the server asked for
+    void setBackpressure(std::size_t window, uint32_t retries);
+    uint64_t overloadRejections() const { return windows.rejections(); }
+    std::unordered_map<std::string, std::size_t> reducedWindows() { return windows.snapshot(); }
+
+    // Single-key operations over the kv_request envelope. A server that cannot be
+    // reached is reported as KvStatus::UNAVAILABLE rather than thrown, one that did
+    // not answer in time as KvStatus::DEADLINE_EXCEEDED.
+    KvReply fetch(int key, uint32_t lease_ms, const std::string& server_endpoint);
+    KvReply insert(int key, const std::string& value, const std::string& server_endpoint);
+    KvReply update(int key, const std::string& value, const std::string& server_endpoint);
+    KvReply deleteKey(int key, const std::string& server_endpoint);
+    KvReply call(const KvOp& op, const std::string& server_endpoint);
+
+    // Hedged read: sends op to server_endpoint and, if no reply came within
+    // hedge_after_ms (or that server failed), hedge_op to hedge_endpoint too. The
+    // first usable reply wins; the hedge's only counts if it is OK or NOT_FOUND.
+    // hedged and hedge_won report whether the second request was sent and answered first.
+    KvReply callHedged(const KvOp& op, const std::string& server_endpoint, const KvOp& hedge_op,
+                       const std::string& hedge_endpoint, double hedge_after_ms, bool& hedged, bool& hedge_won);
+
+    // Scatter-gather: one kv_batch RPC per (endpoint, ops) group, all in flight at
+    // once. Results are returned in the order of the groups.
+    std::vector<BatchResult> batchAll(const std::vector<std::pair<std::string, std::vector<KvOp>>>& groups);
+
+    // Cluster map of the caller, attached to every kv_request and kv_batch
+    void setEpoch(uint64_t new_epoch) { epoch = new_epoch; }
+    uint64_t getEpoch() const { return epoch; }
+
+    // Membership RPCs. getClusterMap returns false if the server could not be reached;
+    // publishClusterMap returns the epoch the server holds afterwards, 0 on failure.
+    bool getClusterMap(const std::string& server_endpoint, ClusterMap& map);
+    uint64_t publishClusterMap(const std::string& server_endpoint, const ClusterMap& map, int node_id);
+    bool getRangeStats(const std::string& server_endpoint, RangeReport& report);
+    // Up to limit of the server's most accessed keys; false if it could not be reached
+    bool getHotKeys(const std::string& server_endpoint, uint32_t limit, HotKeyReport& report);
+    bool getReplicationStatus(const std::string& server_endpoint, ReplicationStatus& status);
+    bool getStats(const std::string& server_endpoint, KvStatsReport& report);
+    // The server's recorded spans as Chrome trace events (see TraceEventsJson), then
+    // dropped from the server if clear is set
+    bool getTraceEvents(const std::string& server_endpoint, bool clear, std::string& events);
+    bool getMemoryProfile(const std::string& server_endpoint, MemoryProfile& profile);
 };
 
 #endif // KVCLIENT_HPP
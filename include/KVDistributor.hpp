@@ -1,35 +1,235 @@
 #ifndef KVDISTRIBUTOR_HPP
 #define KVDISTRIBUTOR_HPP
 
+#include "KVCache.hpp"
 #include "KVClient.hpp"
+#include "KVLatencyWindow.hpp"
+#include "KVMembership.hpp"
+#include "KVPlacement.hpp"
+#include "KVRebalancer.hpp"
 #include "KVStore.hpp"
+#include "KVTrace.hpp"
+#include "KVWriteBuffer.hpp"
 #include "config.hpp"
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
 #include <unordered_map>
+#include <unordered_set>
 #include <string>
+#include <vector>
 
+// Thread-safe: one distributor (and its client and engine) can serve every worker
+// thread of a process. Routing reads a snapshot of the cluster map that is replaced
+// as a whole when a new map is adopted, so the data path takes no locks of its own;
+// map changes, rebalancing and hot-key refreshes are serialized internally.
 class KVDistributor {
 private:
-    int count_of_node = 0;
-    std::unordered_map<int, std::string> node_to_ip;
+    // Everything derived from one cluster map. Never modified once published:
+    // applyClusterMap builds a new one and swaps it in.
+    struct Routing {
+        ClusterMap map;
+        std::shared_ptr<const KVPlacement> placement;
+        // Set while keys are being moved to a new membership: the placement they may still live under
+        std::shared_ptr<const KVPlacement> previous_placement;
+        std::unordered_map<int, std::string> node_to_ip;
+        int local_node_id = 0;
+        int count_of_node = 0;
+
+        int nodeFor(int key) const { return placement->nodeFor(key); }
+        std::string endpointOf(int node_id) const;
+        // With replication acknowledged by backups, local writes go through the local
+        // server, which waits for the backups; writing shared memory directly would not
+        bool writesViaServer() const;
+    };
+
     std::string protocol;
-    int local_node_id = 0;
     uint8_t provider_id = 0;
     KVClient kv_client;
     KvStore& kv;
     const Config& config;  // <-- added const reference to Config
+    // Remote values under lease, null when neither caching mode is on. Created at
+    // most once (cache_storage owns it) and never removed, so readers need no lock.
+    std::unique_ptr<KVCache> cache_storage;
+    std::atomic<KVCache*> active_cache{nullptr};
+    bool cache_all = false;          // Remote read cache enabled: every remote read is leased
+    uint32_t lease_ms = 0;
+    // Hot keys: leased and cached even when cache_all is off
+    HotKeyConfig hot_config;
+    std::atomic<bool> hot_caching{false};
+    mutable std::shared_mutex hot_mutex;   // Guards hot_keys and hot_reports
+    std::unordered_set<int> hot_keys;
+    std::unordered_map<int, HotKeyReport> hot_reports;   // node id -> last report
+    std::unique_ptr<KVWriteBuffer> write_buffer;  // Remote writes when write-behind is on
+    // Routing state. A thread reloads its copy of routing (under routing_mutex) only
+    // when routing_version has moved on.
+    const uint64_t instance_id;
+    mutable std::mutex routing_mutex;
+    std::shared_ptr<const Routing> routing;
+    std::atomic<uint64_t> routing_version{0};
+    std::atomic<uint64_t> current_epoch{0};
+    std::mutex map_mutex;   // Held while a map is applied; guards rebalancer
+    std::unique_ptr<KVRebalancer> rebalancer;
+    std::atomic<uint64_t> newest_epoch_seen{0};   // Highest epoch any server has reported
+    // Periodic work (map refresh, hot keys, range checks) is done by whichever
+    // thread finds it due first; refresh_mutex guards the timestamps below
+    std::mutex refresh_mutex;
+    std::atomic<int64_t> next_periodic_ns{0};     // steady_clock time it is next due
+    uint32_t refresh_ms = 1000;
+    std::chrono::steady_clock::time_point last_refresh;
+    std::chrono::steady_clock::time_point last_hot_refresh;
+    RangeConfig range_config;
+    std::chrono::steady_clock::time_point last_range_check;
+    ReplicationConfig replication_config;
+    std::atomic<std::size_t> next_backup_read{0};   // Round robin over a key's copies
+    // Tail latency control: RPC timeouts and hedged reads
+    DeadlineConfig deadline_config;
+    std::atomic<bool> hedging{false};
+    KVLatencyWindow read_latency;       // Remote single-key reads, for the hedge delay
+    std::atomic<uint64_t> hedges_sent{0};
+    std::atomic<uint64_t> hedges_won{0};
+    std::atomic<uint64_t> deadlines_exceeded{0};
+
+    std::shared_ptr<const Routing> currentRouting() const;
+    KVCache* cache() const { return active_cache.load(std::memory_order_acquire); }
+
+    std::unordered_map<int, BatchResult> sendBatches(const KVWriteBuffer::Batches& batches, bool apply_local);
+    bool rerouteMoved(const KVWriteBuffer::Batches& batches, std::unordered_map<int, BatchResult>& results,
+                      bool apply_local, uint64_t& routed_epoch);
+    std::vector<KvStatus> multiWrite(const std::vector<KvOp>& ops);
+    void dispatchRemote(const Routing& r, const std::vector<KvOp>& ops,
+                        const std::unordered_map<int, std::vector<std::size_t>>& remote_positions,
+                        std::vector<KvReply>& replies);
+    KvReply execute(const KvOp& op);
+    KvReply executeOnce(const Routing& r, const KvOp& op);
+    KvStatus getOnce(const Routing& r, int key, std::string& value);
+    bool readFromBackup(const Routing& r, int owner, int key, std::string& value, KvStatus& status);
+    KvReply fetchRemote(const Routing& r, int node_id, const KvOp& fetch);
+    KvStatus writeOnce(const Routing& r, const KvOp& op);
+    KvReply sendTo(const Routing& r, int node_id, const KvOp& op);
+    KvReply callRemote(const Routing& r, int node_id, const KvOp& op);
+    KvStatus getRebalancing(const Routing& r, int key, std::string& value);
+    void pullKey(const Routing& r, int key);
 
-    int getNodeId(int key);
-    std::string getNodeToIP(int node_id);
-    int getLocalNodeId();
+    std::shared_ptr<Routing> makeRouting(ClusterMap map) const;
+    void applyClusterMap(ClusterMap map);
+    bool adoptClusterMap(const ClusterMap& map);
+    bool refreshClusterMap(const std::string& endpoint);
+    bool publishClusterMap(const ClusterMap& map);
+    void maybeRefresh();
+    void schedulePeriodic();
+    void observeReply(const KvReply& reply, const std::string& endpoint);
+    void noteEpoch(uint64_t epoch);
+    void maybeRebalanceRanges();
+    uint32_t leaseFor(int key) const;
+    KvStatus write(const KvOp& op);
+
+    int getLocalNodeId(const std::unordered_map<int, std::string>& node_to_ip) const;
 
 public:
     KVDistributor(KvStore& kv_store, const Config& config);  // <-- constructor updated
+    // Stops the rebalancer and flushes buffered writes while the routing they use
+    // still exists
+    ~KVDistributor();
 
     int getNodeCount();
+    bool isLocal(int key);
+    int ownerOf(int key);
+    KvStatus get(int key, std::string& value);
+    KvStatus insert(int key, const std::string& value);
+    KvStatus update(int key, const std::string& value);
+    KvStatus deleteKey(int key);
+
+    // Convenience for display: the value, or a description of why there is none
     std::string get(int key);
-    void insert(int key, const std::string& value);
-    void update(int key, const std::string& value);
-    void deleteKey(int key);
+
+    // Multi-key operations: keys are grouped by owner, local ones are served from
+    // the store directly and every remote group is sent to its node in parallel.
+    // Results are in input order.
+    std::vector<KvReply> multiGet(const std::vector<int>& keys);
+    std::vector<KvStatus> multiInsert(const std::vector<std::pair<int, std::string>>& items);
+    std::vector<KvStatus> multiUpdate(const std::vector<std::pair<int, std::string>>& items);
+    std::vector<KvStatus> multiDelete(const std::vector<int>& keys);
+
+    // Keys in [start, end) in ascending order, at most limit (0 for all). Under
+    // "range" placement only the owners of the covered ranges are asked, in key
+    // order, stopping once limit is reached; otherwise every node is asked at once.
+    // Returns the first error met, with whatever was collected.
+    KvStatus scan(int64_t start, int64_t end, std::size_t limit, std::vector<std::pair<int, std::string>>& items);
+
+    // "range" placement: splits ranges that are too big or too busy and merges cold
+    // neighbours, publishing the new table as a migrating epoch. While a migration
+    // is under way it instead finishes it once no server holds misplaced keys.
+    bool rebalanceRanges();
+
+    // Atomic read-modify-write operations, executed by the key's owner in one round trip.
+    // A failed compare-and-swap returns CONFLICT and, if asked, the current value.
+    KvStatus compareAndSwap(int key, const std::string& expected, const std::string& desired,
+                            std::string* current = nullptr);
+    KvStatus compareAndSwapVersion(int key, uint64_t expected_version, const std::string& desired);
+    KvStatus increment(int key, int64_t delta, int64_t& result);
+    KvStatus decrement(int key, int64_t delta, int64_t& result);
+    KvStatus append(int key, const std::string& suffix);
+    KvStatus getAndSet(int key, const std::string& value, std::string& old_value);
+
+    // Hot keys. refreshHotKeys asks every server for its most accessed keys and marks
+    // those above hot_keys.min_share of their owner's traffic; with hot-key caching on
+    // (hot_keys.enabled), reads of them are leased and answered from the client cache.
+    bool refreshHotKeys();
+    void setHotKeyCaching(bool enabled);
+    bool hotKeyCaching() const { return hot_caching; }
+    std::unordered_set<int> getHotKeys() const;
+    std::unordered_map<int, HotKeyReport> getHotKeyReports() const;
+    // Remote reads answered from the client cache, and those that went to the owner
+    uint64_t cacheHits() const { return cache() ? cache()->hits() : 0; }
+    uint64_t cacheMisses() const { return cache() ? cache()->misses() : 0; }
+
+    // Tail latency control (the "deadlines" section). With hedging on, a remote read
+    // the owner has not answered within hedgeDelayMs is also sent to a backup.
+    void setHedging(bool enabled);
+    bool hedgingEnabled() const { return hedging; }
+    double hedgeDelayMs();
+    double timeoutMs() const { return kv_client.getTimeout(); }
+    uint64_t hedgesSent() const { return hedges_sent; }
+    uint64_t hedgesWon() const { return hedges_won; }
+    uint64_t deadlinesExceeded() const { return deadlines_exceeded; }
+    // Backpressure: OVERLOADED replies seen, and the servers whose send window is cut (endpoint -> ops)
+    uint64_t overloadRejections() const { return kv_client.overloadRejections(); }
+    std::unordered_map<std::string, std::size_t> reducedWindows() { return kv_client.reducedWindows(); }
+
+    // Replication state of every node in the map that answered: node id -> status
+    std::unordered_map<int, ReplicationStatus> replicationStatus();
+    // Metrics of every node in the map that answered (kv_stats): node id -> report
+    std::unordered_map<int, KvStatsReport> clusterStats();
+    // Spans recorded by every node in the map that answered (kv_trace), as Chrome
+    // trace events: node id -> events; clear drops them from the servers afterwards
+    std::unordered_map<int, std::string> clusterTrace(bool clear);
+    // Segment breakdown of every node in the map that answered (kv_memory): node id -> profile
+    std::unordered_map<int, MemoryProfile> clusterMemory();
+
+    // Cluster membership. The map in force is the newest one seen: fetched from the
+    // local server every refresh_ms, or taken from a MOVED reply.
+    uint64_t getEpoch();
+    ClusterMap getClusterMap();
+    bool refreshMembership();
+    // Publishes the node list and placement of target to every server as a new epoch,
+    // without moving data
+    bool publishMembership(const Config& target);
+
+    // Membership changes with data movement. startRebalance publishes target as a
+    // migrating epoch; each client that sees it moves its node's misplaced keys in
+    // the background. Until finishRebalance publishes the final epoch, reads fall back
+    // to a key's previous owner and a write first pulls the key across, so it must
+    // only be called once every node's rebalanceStatus is idle.
+    bool startRebalance(const Config& target);
+    RebalanceStats rebalanceStatus();
+    bool finishRebalance();
+
+    // Barrier for write-behind mode: returns once every buffered write has been
+    // applied, with the writes that failed since the last flush
+    std::vector<WriteFailure> flush();
 };
 
 #endif // KVDISTRIBUTOR_HPP
@@ -0,0 +1,89 @@
+#ifndef KVHISTOGRAM_HPP
+#define KVHISTOGRAM_HPP
+
+#include <cstdint>
+#include <vector>
+
+// Log-linear latency histogram in the style of HdrHistogram. Values below
+// SUB_BUCKETS are counted exactly; above that every power of two is split into
+// SUB_BUCKETS / 2 buckets, so a reported percentile is within 1/64 (about 1.6%)
+// of the true value. Recording is a few instructions and needs no allocation,
+// histograms of equal shape merge by adding counts, and min, max and the mean
+// are kept exactly. Not thread-safe: use one per thread and merge.
+class KVHistogram {
+public:
+    KVHistogram();
+
+    void record(uint64_t value, uint64_t count = 1);
+    void merge(const KVHistogram& other);
+    void clear();
+
+    uint64_t count() const { return total; }
+    uint64_t min() const { return total ? min_value : 0; }
+    uint64_t max() const { return max_value; }
+    double mean() const { return total ? static_cast<double>(sum) / total : 0.0; }
+    // Highest value equivalent to the given percentile (0 to 100)
+    uint64_t valueAt(double percentile) const;
+
+    // For histograms kept elsewhere in this bucket layout (e.g. as per-thread
+    // atomics): the bucket a value falls in, and adding such a histogram's counts,
+    // which may cover only the first buckets
+    static std::size_t bucketOf(uint64_t value) { return indexOf(value); }
+    void mergeBuckets(const std::vector<uint64_t>& bucket_counts, uint64_t value_sum, uint64_t min, uint64_t max);
+
+    // Only non-empty buckets are written
+    template <typename A>
+    void save(A& ar) const {
+        uint32_t used = 0;
+        for (uint64_t c : counts) {
+            used += c ? 1 : 0;
+        }
+        ar.write(&total);
+        ar.write(&sum);
+        ar.write(&min_value);
+        ar.write(&max_value);
+        ar.write(&used);
+        for (uint32_t i = 0; i < counts.size(); ++i) {
+            if (counts[i]) {
+                ar.write(&i);
+                ar.write(&counts[i]);
+            }
+        }
+    }
+
+    template <typename A>
+    void load(A& ar) {
+        clear();
+        uint32_t used = 0;
+        ar.read(&total);
+        ar.read(&sum);
+        ar.read(&min_value);
+        ar.read(&max_value);
+        ar.read(&used);
+        for (uint32_t n = 0; n < used; ++n) {
+            uint32_t i = 0;
+            uint64_t c = 0;
+            ar.read(&i);
+            ar.read(&c);
+            if (i < counts.size()) {
+                counts[i] = c;
+            }
+        }
+    }
+
+private:
+    static constexpr int SUB_BUCKET_BITS = 7;
+    static constexpr uint64_t SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+    static constexpr uint64_t HALF = SUB_BUCKETS / 2;
+
+    static std::size_t indexOf(uint64_t value);
+    static uint64_t highestEquivalent(std::size_t index);
+
+    std::vector<uint64_t> counts;
+    uint64_t total = 0;
+    uint64_t sum = 0;
+    uint64_t min_value = UINT64_MAX;
+    uint64_t max_value = 0;
+};
+
+#endif // KVHISTOGRAM_HPP
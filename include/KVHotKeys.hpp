@@ -0,0 +1,93 @@
+#ifndef KVHOTKEYS_HPP
+#define KVHOTKEYS_HPP
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+// A key the sketch believes is frequent. count overestimates the true count by at
+// most error.
+struct HotKey {
+    int key = 0;
+    uint64_t count = 0;
+    uint64_t error = 0;
+
+    template <typename A>
+    void save(A& ar) const {
+        int32_t k = key;
+        ar.write(&k);
+        ar.write(&count);
+        ar.write(&error);
+    }
+
+    template <typename A>
+    void load(A& ar) {
+        int32_t k = 0;
+        ar.read(&k);
+        ar.read(&count);
+        ar.read(&error);
+        key = k;
+    }
+};
+
+// What a server reports from kv_hot_keys: its most accessed keys, most frequent
+// first, and the number of accesses they were counted against
+struct HotKeyReport {
+    uint64_t total = 0;
+    std::vector<HotKey> keys;
+
+    template <typename A>
+    void save(A& ar) const {
+        uint32_t count = static_cast<uint32_t>(keys.size());
+        ar.write(&total);
+        ar.write(&count);
+        for (const HotKey& key : keys) {
+            key.save(ar);
+        }
+    }
+
+    template <typename A>
+    void load(A& ar) {
+        uint32_t count = 0;
+        ar.read(&total);
+        ar.read(&count);
+        keys.resize(count);
+        for (HotKey& key : keys) {
+            key.load(ar);
+        }
+    }
+};
+
+// Space-Saving heavy-hitter sketch over a fixed number of counters. Every key
+// seen more than total / capacity times is guaranteed to hold a counter. The
+// counters sit in a min-heap so an unmonitored key takes over the smallest one
+// in O(log capacity). Not thread-safe.
+class HotKeySketch {
+public:
+    explicit HotKeySketch(std::size_t capacity);
+
+    void record(int key);
+    // Halves every count, so old traffic fades out
+    void decay();
+    void clear();
+
+    // Up to limit keys, most frequent first
+    std::vector<HotKey> top(std::size_t limit) const;
+    uint64_t total() const { return seen; }
+
+private:
+    std::size_t capacity;
+    uint64_t seen = 0;
+    std::vector<HotKey> heap;                 // Min-heap on count
+    std::unordered_map<int, std::size_t> position;   // key -> index in heap
+
+    void siftDown(std::size_t i);
+    void siftUp(std::size_t i);
+    void swapEntries(std::size_t a, std::size_t b);
+};
+
+// Sums the counts (and errors) of keys found in several sketches' top lists and
+// returns up to limit keys, most frequent first
+std::vector<HotKey> MergeHotKeys(const std::vector<std::vector<HotKey>>& lists, std::size_t limit);
+
+#endif // KVHOTKEYS_HPP
@@ -0,0 +1,33 @@
+#ifndef KVLATENCYWINDOW_HPP
+#define KVLATENCYWINDOW_HPP
+
+#include <cstddef>
+#include <mutex>
+#include <vector>
+
+// The most recent request latencies, for delays derived from a percentile (such
+// as when to hedge a read). Percentiles are recomputed only every
+// RECOMPUTE_EVERY samples, so asking for one on every request stays cheap.
+class KVLatencyWindow {
+public:
+    explicit KVLatencyWindow(std::size_t capacity = 1024);
+
+    void record(double ms);
+    // The q-th quantile (0 < q < 1) of the window; fallback until MIN_SAMPLES were recorded
+    double quantile(double q, double fallback);
+    std::size_t size();
+
+private:
+    static constexpr std::size_t MIN_SAMPLES = 32;
+    static constexpr std::size_t RECOMPUTE_EVERY = 64;
+
+    std::mutex mutex;
+    std::vector<double> samples;   // Ring buffer
+    std::size_t capacity;
+    std::size_t next = 0;
+    std::size_t since_recompute = 0;
+    double cached_q = -1;
+    double cached_value = 0;
+};
+
+#endif // KVLATENCYWINDOW_HPP
@@ -0,0 +1,194 @@
+#ifndef KVLOCKPROFILE_HPP
+#define KVLOCKPROFILE_HPP
+
+#include <boost/interprocess/sync/named_mutex.hpp>
+#include <atomic>
+#include <cstdint>
+#include <vector>
+#include "KVHistogram.hpp"
+#include "KVTrace.hpp"
+
+// KvStore methods that take the store lock, i.e. who is waiting for or holding it
+enum class StoreLockSite : uint8_t {
+    INSERT,
+    UPDATE,
+    DELETE,
+    DELETE_IF_VERSION,
+    FIND,
+    FIND_WITH_LEASE,
+    FIND_MANY,
+    READ_MODIFY_WRITE,   // CompareAndSwap, Increment, Append, GetAndSet
+    SCAN,
+    MAP_SIZE,
+    LIST_KEYS,
+    GET_KEYS,
+    CHANGES_SINCE,
+    CURRENT_VERSION,
+    MEMORY_PROFILE,
+    BULK_LOAD,
+    SET_REHASH_STEP
+};
+constexpr int STORE_LOCK_SITE_COUNT = 17;
+constexpr std::size_t STORE_LOCK_TOP_N = 16;
+
+const char* StoreLockSiteName(StoreLockSite site);
+
+// One hold of the store lock, as kept in the longest-holds list
+struct StoreLockHold {
+    uint64_t hold_ns = 0;
+    uint64_t wait_ns = 0;    // Spent waiting for the lock before this hold
+    uint64_t at_us = 0;      // Wall clock when the hold ended
+    int32_t key = -1;        // -1 for operations without a single key
+    uint32_t pid = 0;
+    uint8_t site = 0;        // StoreLockSite
+
+    template <typename A>
+    void save(A& ar) const {
+        ar.write(&hold_ns);
+        ar.write(&wait_ns);
+        ar.write(&at_us);
+        ar.write(&key);
+        ar.write(&pid);
+        ar.write(&site);
+    }
+
+    template <typename A>
+    void load(A& ar) {
+        ar.read(&hold_ns);
+        ar.read(&wait_ns);
+        ar.read(&at_us);
+        ar.read(&key);
+        ar.read(&pid);
+        ar.read(&site);
+    }
+};
+
+// Lock waits and holds seen by one process, in nanoseconds, by site. Only one in
+// sample_every acquisitions is measured (0: profiling is off); acquisitions counts
+// them all. longest holds the STORE_LOCK_TOP_N longest measured holds, longest first.
+struct StoreLockProfile {
+    uint32_t sample_every = 0;
+    uint64_t acquisitions = 0;
+    KVHistogram wait[STORE_LOCK_SITE_COUNT];
+    KVHistogram hold[STORE_LOCK_SITE_COUNT];
+    std::vector<StoreLockHold> longest;
+
+    void clear();
+
+    template <typename A>
+    void save(A& ar) const {
+        ar.write(&sample_every);
+        ar.write(&acquisitions);
+        for (int i = 0; i < STORE_LOCK_SITE_COUNT; ++i) {
+            wait[i].save(ar);
+            hold[i].save(ar);
+        }
+        uint32_t n = static_cast<uint32_t>(longest.size());
+        ar.write(&n);
+        for (const StoreLockHold& h : longest) {
+            h.save(ar);
+        }
+    }
+
+    template <typename A>
+    void load(A& ar) {
+        ar.read(&sample_every);
+        ar.read(&acquisitions);
+        for (int i = 0; i < STORE_LOCK_SITE_COUNT; ++i) {
+            wait[i].load(ar);
+            hold[i].load(ar);
+        }
+        uint32_t n = 0;
+        ar.read(&n);
+        longest.resize(n);
+        for (StoreLockHold& h : longest) {
+            h.load(ar);
+        }
+    }
+};
+
+// Profile of the store lock in this process. The lock itself serializes every
+// thread and process that records, so record(), copy() and reset() must be called
+// with it held and need no synchronization of their own. Whether an acquisition is
+// measured is decided before locking, from a per-thread countdown.
+class KVLockProfiler {
+public:
+    void setSampleEvery(uint32_t n) { sample_every.store(n, std::memory_order_relaxed); }
+    uint32_t sampleEvery() const { return sample_every.load(std::memory_order_relaxed); }
+
+    // Whether the next acquisition by this thread should be measured
+    bool sampleNext();
+
+    // Lock held: counts one acquisition, measured or not
+    void count() { ++profile.acquisitions; }
+    // Lock held: adds one measured hold
+    void record(StoreLockSite site, int key, uint64_t wait_ns, uint64_t hold_ns);
+    // Lock held
+    void copy(StoreLockProfile& out) const;
+    void reset() { profile.clear(); }
+
+    static uint64_t nowNs();
+
+private:
+    std::atomic<uint32_t> sample_every{0};
+    StoreLockProfile profile;
+};
+
+// The store's scoped lock: holds the named mutex like scoped_lock<named_mutex>
+// (including unlock() and lock() while waiting out a lease) and reports each hold
+// of it to the profiler, and as wait and hold spans when the thread is tracing.
+class StoreLock {
+public:
+    StoreLock(boost::interprocess::named_mutex& mutex, KVLockProfiler& profiler, StoreLockSite site, int key = -1)
+        : mutex(mutex), profiler(profiler), site(site), key(key), sampled(profiler.sampleNext()),
+          trace_id(CurrentTraceId()) {
+        lock();
+    }
+    ~StoreLock() {
+        if (owns) {
+            unlock();
+        }
+    }
+
+    StoreLock(const StoreLock&) = delete;
+    StoreLock& operator=(const StoreLock&) = delete;
+
+    void lock() {
+        bool timed = sampled || trace_id;
+        uint64_t start = timed ? KVLockProfiler::nowNs() : 0;
+        mutex.lock();
+        owns = true;
+        profiler.count();
+        if (timed) {
+            acquired_ns = KVLockProfiler::nowNs();
+            wait_ns = acquired_ns - start;
+        }
+    }
+
+    void unlock() {
+        uint64_t hold_ns = sampled || trace_id ? KVLockProfiler::nowNs() - acquired_ns : 0;
+        if (sampled) {
+            profiler.record(site, key, wait_ns, hold_ns);
+        }
+        owns = false;
+        mutex.unlock();
+        if (trace_id) {
+            uint64_t end = TraceNowNs();
+            RecordSpan(trace_id, "store.lock_wait", end - hold_ns - wait_ns, end - hold_ns, key);
+            RecordSpan(trace_id, "store.lock_hold", end - hold_ns, end, key);
+        }
+    }
+
+private:
+    boost::interprocess::named_mutex& mutex;
+    KVLockProfiler& profiler;
+    StoreLockSite site;
+    int key;
+    bool sampled;
+    uint64_t trace_id;
+    bool owns = false;
+    uint64_t acquired_ns = 0;
+    uint64_t wait_ns = 0;
+};
+
+#endif // KVLOCKPROFILE_HPP
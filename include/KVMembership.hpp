@@ -0,0 +1,202 @@
+#ifndef KVMEMBERSHIP_HPP
+#define KVMEMBERSHIP_HPP
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include "KVPlacement.hpp"
+#include "KVProtocol.hpp"
+
+// A node as listed in the cluster map
+struct MemberNode {
+    int node_id = 0;
+    std::string endpoint;
+    double weight = 1.0;
+};
+
+// One node list plus the placement strategy used over it
+struct PlacementSpec {
+    std::string strategy = "modulo";
+    uint64_t vnodes = 128;
+    std::vector<MemberNode> nodes;
+    std::vector<KeyRange> ranges;   // Range table, "range" strategy only
+    // Copies of every key, the owner's included. The backups of a node are the
+    // replicas - 1 nodes that follow it in node id order.
+    uint32_t replicas = 1;
+    bool wait_for_backups = false;  // Acknowledge writes only once every backup has them
+
+    std::shared_ptr<const KVPlacement> build() const;
+    std::vector<int> backupsOf(int node_id) const;
+
+    template <typename A>
+    void save(A& ar) const {
+        uint32_t count = static_cast<uint32_t>(nodes.size());
+        kvwire::writeString(ar, strategy);
+        ar.write(&vnodes);
+        ar.write(&count);
+        for (const MemberNode& node : nodes) {
+            int32_t node_id = node.node_id;
+            ar.write(&node_id);
+            ar.write(&node.weight);
+            kvwire::writeString(ar, node.endpoint);
+        }
+        uint32_t range_count = static_cast<uint32_t>(ranges.size());
+        ar.write(&range_count);
+        for (const KeyRange& range : ranges) {
+            int32_t bounds[2] = {range.start, range.node_id};
+            ar.write(bounds, 2);
+        }
+        uint8_t ack = wait_for_backups ? 1 : 0;
+        ar.write(&replicas);
+        ar.write(&ack);
+    }
+
+    template <typename A>
+    void load(A& ar) {
+        uint32_t count = 0;
+        kvwire::readString(ar, strategy);
+        ar.read(&vnodes);
+        ar.read(&count);
+        nodes.resize(count);
+        for (MemberNode& node : nodes) {
+            int32_t node_id = 0;
+            ar.read(&node_id);
+            ar.read(&node.weight);
+            kvwire::readString(ar, node.endpoint);
+            node.node_id = node_id;
+        }
+        uint32_t range_count = 0;
+        ar.read(&range_count);
+        ranges.resize(range_count);
+        for (KeyRange& range : ranges) {
+            int32_t bounds[2] = {0, 0};
+            ar.read(bounds, 2);
+            range.start = bounds[0];
+            range.node_id = bounds[1];
+        }
+        uint8_t ack = 0;
+        ar.read(&replicas);
+        ar.read(&ack);
+        wait_for_backups = ack != 0;
+    }
+};
+
+class Config;
+
+// The placement the cluster config describes: every node of ip_addresses with
+// the configured strategy, weights and replication
+PlacementSpec PlacementSpecFromConfig(const Config& config);
+
+// Host part of an endpoint ("ofi+tcp://10.0.0.1:5000" -> "10.0.0.1")
+std::string EndpointHost(const std::string& endpoint);
+
+// Describes the first node whose backups include a node on its own host (so one
+// machine failing loses both copies); empty if every backup is on another host
+std::string ColocatedBackups(const PlacementSpec& spec);
+
+// Epoch-versioned routing table. Servers hold the latest map they were given and
+// hand it out; clients route with the newest map they have seen and send its
+// epoch with every request. A higher epoch always wins.
+//
+// While keys are being moved to a new membership, migrating is set and previous
+// describes where keys may still live.
+struct ClusterMap {
+    uint64_t epoch = 0;   // 0: built from local config, never published
+    PlacementSpec current;
+    bool migrating = false;
+    PlacementSpec previous;
+
+    // Endpoint of node_id in current, else in previous; empty if in neither
+    std::string endpointOf(int node_id) const;
+
+    template <typename A>
+    void save(A& ar) const {
+        uint8_t flags = migrating ? 1 : 0;
+        ar.write(&epoch);
+        ar.write(&flags);
+        current.save(ar);
+        if (migrating) {
+            previous.save(ar);
+        }
+    }
+
+    template <typename A>
+    void load(A& ar) {
+        uint8_t flags = 0;
+        ar.read(&epoch);
+        ar.read(&flags);
+        current.load(ar);
+        migrating = (flags & 1) != 0;
+        previous = PlacementSpec{};
+        if (migrating) {
+            previous.load(ar);
+        }
+    }
+};
+
+// Load of one range on its owner
+struct RangeLoad {
+    int start = 0;
+    uint64_t keys = 0;
+    uint64_t ops = 0;       // Requests since the previous report
+    int split_key = 0;      // Median stored key: the point to split at
+
+    template <typename A>
+    void save(A& ar) const {
+        int32_t bounds[2] = {start, split_key};
+        ar.write(bounds, 2);
+        ar.write(&keys);
+        ar.write(&ops);
+    }
+
+    template <typename A>
+    void load(A& ar) {
+        int32_t bounds[2] = {0, 0};
+        ar.read(bounds, 2);
+        ar.read(&keys);
+        ar.read(&ops);
+        start = bounds[0];
+        split_key = bounds[1];
+    }
+};
+
+// What a server reports from kv_range_stats: the load of every range it owns under
+// its map, plus how many stored keys that map assigns to other nodes
+struct RangeReport {
+    uint64_t epoch = 0;
+    uint64_t misplaced = 0;
+    double window_sec = 0;  // Time covered by the ops counts
+    std::vector<RangeLoad> ranges;
+
+    template <typename A>
+    void save(A& ar) const {
+        uint32_t count = static_cast<uint32_t>(ranges.size());
+        ar.write(&epoch);
+        ar.write(&misplaced);
+        ar.write(&window_sec);
+        ar.write(&count);
+        for (const RangeLoad& range : ranges) {
+            range.save(ar);
+        }
+    }
+
+    template <typename A>
+    void load(A& ar) {
+        uint32_t count = 0;
+        ar.read(&epoch);
+        ar.read(&misplaced);
+        ar.read(&window_sec);
+        ar.read(&count);
+        ranges.resize(count);
+        for (RangeLoad& range : ranges) {
+            range.load(ar);
+        }
+    }
+};
+
+// For carrying a map inside KvReply::value
+std::string EncodeClusterMap(const ClusterMap& map);
+bool DecodeClusterMap(const std::string& data, ClusterMap& map);
+
+#endif // KVMEMBERSHIP_HPP
@@ -0,0 +1,185 @@
+#ifndef KVMETRICS_HPP
+#define KVMETRICS_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "KVHistogram.hpp"
+#include "KVLockProfile.hpp"
+#include "KVProtocol.hpp"
+#include "config.hpp"
+
+// RPC handlers timed by the server
+enum class KvRpc : uint8_t {
+    FETCH,
+    INSERT,
+    UPDATE,
+    DELETE,
+    REQUEST,
+    BATCH,
+    GET_MAP,
+    SET_MAP,
+    RANGE_STATS,
+    HOT_KEYS,
+    REPLICATE,
+    REPLICATION_STATUS,
+    STATS,
+    TRACE,
+    MEMORY
+};
+constexpr int KV_RPC_COUNT = 15;
+constexpr int KV_OP_TYPE_COUNT = 11;   // Values of KvOpType
+
+const char* KvRpcName(KvRpc rpc);
+
+// Server counters. The first ones are counted per thread by KVMetrics; the last
+// two are kept by the server itself and filled in when a report is built.
+enum class KvCounter : uint8_t {
+    HITS,           // Fetches that found the key
+    MISSES,         // Fetches that did not
+    ERRORS,         // Ops that failed on the server (ERROR, OUT_OF_MEMORY, TIMEOUT)
+    BYTES_IN,       // Values received
+    BYTES_OUT,      // Values sent back
+    REDIRECTS,      // MOVED replies to clients with an old map
+    EXPIRED,        // Requests dropped because their deadline had passed
+    REJECTED        // Requests refused by admission control
+};
+constexpr int KV_COUNTER_COUNT = 8;
+
+const char* KvCounterName(KvCounter counter);
+
+// Everything a server reports through kv_stats. Histograms are in nanoseconds and,
+// like the counters, cumulative since the server started; the memory figures and
+// key count are read when the report is made. locks is the server process's
+// profile of the store lock (empty histograms when lock profiling is off).
+struct KvStatsReport {
+    double uptime_sec = 0;
+    KVHistogram rpc[KV_RPC_COUNT];
+    KVHistogram store[KV_OP_TYPE_COUNT];   // By KvOpType
+    uint64_t counters[KV_COUNTER_COUNT] = {};
+    uint64_t memory_total = 0;
+    uint64_t memory_used = 0;
+    uint64_t memory_free = 0;
+    uint64_t keys = 0;
+    StoreLockProfile locks;
+
+    uint64_t counter(KvCounter c) const { return counters[static_cast<int>(c)]; }
+
+    // Prometheus text exposition format; labels (e.g. node="0") are added to every sample
+    std::string prometheus(const std::string& labels = "") const;
+
+    template <typename A>
+    void save(A& ar) const {
+        ar.write(&uptime_sec);
+        for (const KVHistogram& h : rpc) {
+            h.save(ar);
+        }
+        for (const KVHistogram& h : store) {
+            h.save(ar);
+        }
+        ar.write(counters, KV_COUNTER_COUNT);
+        ar.write(&memory_total);
+        ar.write(&memory_used);
+        ar.write(&memory_free);
+        ar.write(&keys);
+        locks.save(ar);
+    }
+
+    template <typename A>
+    void load(A& ar) {
+        ar.read(&uptime_sec);
+        for (KVHistogram& h : rpc) {
+            h.load(ar);
+        }
+        for (KVHistogram& h : store) {
+            h.load(ar);
+        }
+        ar.read(counters, KV_COUNTER_COUNT);
+        ar.read(&memory_total);
+        ar.read(&memory_used);
+        ar.read(&memory_free);
+        ar.read(&keys);
+        locks.load(ar);
+    }
+};
+
+// Server-side latency histograms and counters, cheap enough to leave on. Every
+// thread records into its own shard with plain relaxed loads and stores (one
+// writer per shard, so no atomic read-modify-write and no lock); collect() sums
+// the shards. Recording is a thread-local lookup, a bucket index and a few stores.
+class KVMetrics {
+public:
+    KVMetrics();
+    ~KVMetrics();
+
+    KVMetrics(const KVMetrics&) = delete;
+    KVMetrics& operator=(const KVMetrics&) = delete;
+
+    static uint64_t nowNs() {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                         std::chrono::steady_clock::now().time_since_epoch()).count());
+    }
+
+    void recordRpc(KvRpc rpc, uint64_t ns);
+    void recordStore(KvOpType type, uint64_t ns);
+    void add(KvCounter counter, uint64_t n = 1);
+    // Hits, misses, errors and bytes of one executed op
+    void recordReply(const KvOp& op, const KvReply& reply);
+
+    // Fills the histograms, per-thread counters and uptime of report
+    void collect(KvStatsReport& report) const;
+
+private:
+    struct Shard;
+    Shard& shard();
+
+    const uint64_t instance_id;
+    const std::chrono::steady_clock::time_point started;
+    mutable std::mutex shards_mutex;
+    std::unordered_map<std::thread::id, std::unique_ptr<Shard>> shards;
+};
+
+// Times an RPC handler from construction to destruction, early returns included
+class KvRpcTimer {
+public:
+    KvRpcTimer(KVMetrics& metrics, KvRpc rpc) : metrics(metrics), rpc(rpc), start(KVMetrics::nowNs()) {}
+    ~KvRpcTimer() { metrics.recordRpc(rpc, KVMetrics::nowNs() - start); }
+
+private:
+    KVMetrics& metrics;
+    KvRpc rpc;
+    uint64_t start;
+};
+
+// Publishes render() in Prometheus text format (the "metrics" section): rewritten
+// to file every interval_ms (through a rename, so readers never see half a file),
+// and/or answered to every connection on the Unix socket as an HTTP response, so
+// both `curl --unix-socket` and a plain socket reader work. Runs on its own thread.
+class KVMetricsExporter {
+public:
+    KVMetricsExporter(const MetricsConfig& config, std::function<std::string()> render);
+    ~KVMetricsExporter();
+
+    KVMetricsExporter(const KVMetricsExporter&) = delete;
+    KVMetricsExporter& operator=(const KVMetricsExporter&) = delete;
+
+private:
+    void run();
+    void writeFile();
+    void serveClient(int fd);
+
+    MetricsConfig config;
+    std::function<std::string()> render;
+    int listen_fd = -1;
+    std::atomic<bool> stopping{false};
+    std::thread worker;
+};
+
+#endif // KVMETRICS_HPP
@@ -0,0 +1,116 @@
+#ifndef KVPLACEMENT_HPP
+#define KVPLACEMENT_HPP
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+// A node taking part in placement. Weight scales the share of keys it receives
+// (ring and rendezvous honour it; modulo and jump treat every node alike).
+struct PlacementNode {
+    int node_id = 0;
+    double weight = 1.0;
+};
+
+// Maps keys to the node that owns them. Implementations are immutable after
+// construction: a membership change builds a new placement.
+class KVPlacement {
+public:
+    virtual ~KVPlacement() = default;
+
+    virtual int nodeFor(int key) const = 0;
+    virtual const char* name() const = 0;
+
+    const std::vector<PlacementNode>& getNodes() const { return nodes; }
+
+protected:
+    explicit KVPlacement(std::vector<PlacementNode> nodes);
+
+    std::vector<PlacementNode> nodes;  // Sorted by node_id
+};
+
+// key % N over the sorted node ids. Kept for compatibility with existing layouts:
+// changing N remaps almost every key.
+class ModuloPlacement : public KVPlacement {
+public:
+    explicit ModuloPlacement(std::vector<PlacementNode> nodes);
+    int nodeFor(int key) const override;
+    const char* name() const override { return "modulo"; }
+};
+
+// Consistent-hash ring: every node owns round(vnodes * weight) points on a 64-bit
+// ring and a key belongs to the first point at or after its hash. Lookup is a
+// binary search, O(log V).
+class RingPlacement : public KVPlacement {
+public:
+    RingPlacement(std::vector<PlacementNode> nodes, std::size_t vnodes);
+    int nodeFor(int key) const override;
+    const char* name() const override { return "ring"; }
+
+private:
+    std::vector<std::pair<uint64_t, int>> points;  // (hash, node_id), sorted by hash
+};
+
+// Jump consistent hash (Lamping & Veach): O(log N) time and no memory, but nodes
+// can only be added or removed at the end of the sorted id list.
+class JumpPlacement : public KVPlacement {
+public:
+    explicit JumpPlacement(std::vector<PlacementNode> nodes);
+    int nodeFor(int key) const override;
+    const char* name() const override { return "jump"; }
+};
+
+// Weighted rendezvous (highest random weight) hashing: every node scores the key
+// and the best score wins. O(N) per lookup, meant for small clusters.
+class RendezvousPlacement : public KVPlacement {
+public:
+    explicit RendezvousPlacement(std::vector<PlacementNode> nodes);
+    int nodeFor(int key) const override;
+    const char* name() const override { return "rendezvous"; }
+};
+
+// One entry of a range table: node_id owns keys from start up to the next entry's start
+struct KeyRange {
+    int start = 0;
+    int node_id = 0;
+};
+
+// Range partitioning: contiguous key ranges, each owned by one node, so a scan only
+// touches the owners of the ranges it covers. The table is sorted by start and its
+// first entry starts at INT_MIN; lookup is a binary search, O(log R).
+class RangePlacement : public KVPlacement {
+public:
+    RangePlacement(std::vector<PlacementNode> nodes, std::vector<KeyRange> ranges);
+    int nodeFor(int key) const override;
+    const char* name() const override { return "range"; }
+
+    std::size_t rangeIndex(int key) const;
+    const std::vector<KeyRange>& getRanges() const { return ranges; }
+    // Exclusive upper bound of range i as a 64-bit value (INT_MAX + 1 for the last)
+    int64_t rangeEnd(std::size_t i) const;
+
+    // Splits [0, span) among the nodes in proportion to their weights; negative
+    // keys go to the first node and keys past span to the last
+    static std::vector<KeyRange> initialRanges(const std::vector<PlacementNode>& nodes, int span);
+
+private:
+    std::vector<KeyRange> ranges;
+};
+
+// Default span of the initial range table
+constexpr int DEFAULT_RANGE_SPAN = 1 << 20;
+
+// Builds the placement named by strategy ("ring", "jump", "rendezvous", "range" or
+// "modulo"). ranges is only used by "range"; when empty the initial table is used.
+// Throws std::invalid_argument for an unknown strategy, an empty node list or a bad range table.
+std::unique_ptr<KVPlacement> makePlacement(const std::string& strategy,
+                                           std::vector<PlacementNode> nodes,
+                                           std::size_t vnodes,
+                                           std::vector<KeyRange> ranges = {});
+
+// 64-bit mix of a key; sequential keys land far apart
+uint64_t placementHash(uint64_t x);
+
+#endif // KVPLACEMENT_HPP
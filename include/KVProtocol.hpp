@@ -0,0 +1,294 @@
+#ifndef KVPROTOCOL_HPP
+#define KVPROTOCOL_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "KVStore.hpp"
+
+// Request/response envelopes exchanged by KVClient and KVServer.
+//
+// Both are written with a hand-rolled compact encoding instead of the generic
+// thallium serializers: a fixed header (op or status byte, flags byte) followed by
+// only the optional fields whose flag is set. Integers are sent in host byte order;
+// all nodes of a cluster are assumed to share one architecture. Strings are
+// written straight from, and read straight into, their final std::string, so no
+// temporaries are created on either side.
+
+enum class KvOpType : uint8_t {
+    INSERT,
+    UPDATE,
+    DELETE,
+    FETCH,
+    CAS,            // Replace value if it equals expected
+    CAS_VERSION,    // Replace value if the key is still at version
+    INCREMENT,      // Add delta to an integer value (negative to decrement)
+    APPEND,         // Append value to the stored value
+    GET_AND_SET,    // Replace value, returning the previous one
+    DELETE_IF_VERSION, // Delete if the key is still at version (used by rebalancing)
+    SCAN            // Keys in [key, end_key), ascending, at most limit
+};
+
+inline const char* KvOpTypeName(KvOpType type) {
+    switch (type) {
+        case KvOpType::INSERT: return "insert";
+        case KvOpType::UPDATE: return "update";
+        case KvOpType::DELETE: return "delete";
+        case KvOpType::FETCH:  return "fetch";
+        case KvOpType::CAS:    return "compare-and-swap";
+        case KvOpType::CAS_VERSION: return "compare-and-swap-version";
+        case KvOpType::INCREMENT:   return "increment";
+        case KvOpType::APPEND:      return "append";
+        case KvOpType::GET_AND_SET: return "get-and-set";
+        case KvOpType::SCAN:        return "scan";
+        default:                    return "delete-if-version";
+    }
+}
+
+// Whether an op may change the store
+inline bool KvOpMutates(KvOpType type) {
+    return type != KvOpType::FETCH && type != KvOpType::SCAN;
+}
+
+namespace kvwire {
+
+// Optional-field flags shared by requests and replies
+enum : uint8_t {
+    HAS_VALUE   = 1 << 0,
+    HAS_LEASE   = 1 << 1,
+    HAS_VERSION = 1 << 2,
+    HAS_EXPECTED = 1 << 3,
+    HAS_DELTA   = 1 << 4,
+    HAS_EPOCH   = 1 << 5,
+    HAS_RANGE   = 1 << 6,
+    HAS_MORE    = 1 << 7    // A second flags byte follows the header
+};
+
+// Flags of the second flags byte
+enum : uint8_t {
+    HAS_STALENESS = 1 << 0,     // KvOp
+    HAS_DEADLINE  = 1 << 1,     // KvOp
+    HAS_RETRY_AFTER = 1 << 2,   // KvReply
+    HAS_TRACE     = 1 << 3      // KvOp
+};
+
+template <typename A>
+void writeString(A& ar, const std::string& s) {
+    uint32_t size = static_cast<uint32_t>(s.size());
+    ar.write(&size);
+    ar.write(s.data(), size);
+}
+
+template <typename A>
+void readString(A& ar, std::string& s) {
+    uint32_t size = 0;
+    ar.read(&size);
+    s.resize(size);
+    if (size > 0) {
+        ar.read(&s[0], size);
+    }
+}
+
+// Minimal archives over a std::string, for envelopes nested inside another
+// envelope's value (e.g. the cluster map sent back with a MOVED reply)
+class StringWriter {
+public:
+    explicit StringWriter(std::string& out) : out(out) {}
+    template <typename T>
+    void write(const T* data, std::size_t count = 1) {
+        out.append(reinterpret_cast<const char*>(data), sizeof(T) * count);
+    }
+private:
+    std::string& out;
+};
+
+// Throws std::out_of_range when asked for more bytes than remain
+class StringReader {
+public:
+    explicit StringReader(const std::string& in) : in(in) {}
+    template <typename T>
+    void read(T* data, std::size_t count = 1) {
+        std::size_t size = sizeof(T) * count;
+        if (size > in.size() - pos) {
+            throw std::out_of_range("truncated envelope");
+        }
+        std::memcpy(data, in.data() + pos, size);
+        pos += size;
+    }
+    bool done() const { return pos == in.size(); }
+private:
+    const std::string& in;
+    std::size_t pos = 0;
+};
+
+} // namespace kvwire
+
+// Request envelope: one operation on one key
+struct KvOp {
+    KvOpType type = KvOpType::FETCH;
+    int key = 0;
+    std::string value;      // INSERT / UPDATE / CAS / APPEND / GET_AND_SET payload
+    uint32_t lease_ms = 0;  // FETCH: read lease requested by a caching client
+    std::string expected;   // CAS: value the key must still hold
+    uint64_t version = 0;   // CAS_VERSION / DELETE_IF_VERSION: version the key must still be at
+    int64_t delta = 0;      // INCREMENT
+    int64_t end_key = 0;    // SCAN: exclusive upper bound (64-bit so INT_MAX can be included)
+    uint32_t limit = 0;     // SCAN: maximum number of keys, 0 for no limit
+    uint32_t max_staleness_ms = 0;  // FETCH: may be answered by a backup this far behind the primary
+    uint64_t deadline_us = 0;       // Wall clock (us since the epoch) after which the caller no longer waits; 0 for none
+    uint64_t trace_id = 0;          // Request tracing (KVTrace.hpp); 0 when the request is not traced
+    uint64_t trace_sent_ns = 0;     // Traced: wall clock when the client sent it
+
+    template <typename A>
+    void save(A& ar) const {
+        uint8_t header[2] = {static_cast<uint8_t>(type), 0};
+        if (!value.empty())    header[1] |= kvwire::HAS_VALUE;
+        if (lease_ms != 0)     header[1] |= kvwire::HAS_LEASE;
+        if (version != 0)      header[1] |= kvwire::HAS_VERSION;
+        if (!expected.empty()) header[1] |= kvwire::HAS_EXPECTED;
+        if (delta != 0)        header[1] |= kvwire::HAS_DELTA;
+        if (type == KvOpType::SCAN) header[1] |= kvwire::HAS_RANGE;
+        uint8_t more = 0;
+        if (max_staleness_ms != 0) more |= kvwire::HAS_STALENESS;
+        if (deadline_us != 0)  more |= kvwire::HAS_DEADLINE;
+        if (trace_id != 0)     more |= kvwire::HAS_TRACE;
+        if (more != 0)         header[1] |= kvwire::HAS_MORE;
+        int32_t raw_key = key;
+        ar.write(header, 2);
+        if (header[1] & kvwire::HAS_MORE)     ar.write(&more);
+        ar.write(&raw_key);
+        if (header[1] & kvwire::HAS_LEASE)    ar.write(&lease_ms);
+        if (header[1] & kvwire::HAS_VERSION)  ar.write(&version);
+        if (header[1] & kvwire::HAS_DELTA)    ar.write(&delta);
+        if (header[1] & kvwire::HAS_RANGE) {
+            ar.write(&end_key);
+            ar.write(&limit);
+        }
+        if (more & kvwire::HAS_STALENESS)     ar.write(&max_staleness_ms);
+        if (more & kvwire::HAS_DEADLINE)      ar.write(&deadline_us);
+        if (more & kvwire::HAS_TRACE) {
+            ar.write(&trace_id);
+            ar.write(&trace_sent_ns);
+        }
+        if (header[1] & kvwire::HAS_VALUE)    kvwire::writeString(ar, value);
+        if (header[1] & kvwire::HAS_EXPECTED) kvwire::writeString(ar, expected);
+    }
+
+    template <typename A>
+    void load(A& ar) {
+        uint8_t header[2] = {0, 0};
+        uint8_t more = 0;
+        int32_t raw_key = 0;
+        ar.read(header, 2);
+        if (header[1] & kvwire::HAS_MORE)     ar.read(&more);
+        ar.read(&raw_key);
+        type = static_cast<KvOpType>(header[0]);
+        key = raw_key;
+        lease_ms = 0;
+        version = 0;
+        delta = 0;
+        end_key = 0;
+        limit = 0;
+        max_staleness_ms = 0;
+        deadline_us = 0;
+        trace_id = 0;
+        trace_sent_ns = 0;
+        value.clear();
+        expected.clear();
+        if (header[1] & kvwire::HAS_LEASE)    ar.read(&lease_ms);
+        if (header[1] & kvwire::HAS_VERSION)  ar.read(&version);
+        if (header[1] & kvwire::HAS_DELTA)    ar.read(&delta);
+        if (header[1] & kvwire::HAS_RANGE) {
+            ar.read(&end_key);
+            ar.read(&limit);
+        }
+        if (more & kvwire::HAS_STALENESS)     ar.read(&max_staleness_ms);
+        if (more & kvwire::HAS_DEADLINE)      ar.read(&deadline_us);
+        if (more & kvwire::HAS_TRACE) {
+            ar.read(&trace_id);
+            ar.read(&trace_sent_ns);
+        }
+        if (header[1] & kvwire::HAS_VALUE)    kvwire::readString(ar, value);
+        if (header[1] & kvwire::HAS_EXPECTED) kvwire::readString(ar, expected);
+    }
+};
+
+// Response envelope: a typed status plus whatever metadata the op produced
+struct KvReply {
+    KvStatus status = KvStatus::ERROR;
+    // Version stamp of the key after the op, 0 if none. Deletes give the sequence
+    // number of the change instead, so every mutation reports what replication ships.
+    uint64_t version = 0;
+    uint32_t lease_ms = 0;  // Read lease granted with a FETCH, 0 if none
+    std::string value;      // FETCH result; new total of INCREMENT; previous value of
+                            // GET_AND_SET; current value when a CAS fails with CONFLICT;
+                            // the encoded ClusterMap with MOVED; encoded pairs for SCAN
+    uint64_t epoch = 0;     // Cluster map epoch of the answering server, 0 if it has none
+    uint32_t retry_after_ms = 0;    // OVERLOADED: how long the server asks the client to back off
+
+    bool ok() const { return status == KvStatus::OK; }
+
+    template <typename A>
+    void save(A& ar) const {
+        uint8_t header[2] = {static_cast<uint8_t>(status), 0};
+        if (!value.empty()) header[1] |= kvwire::HAS_VALUE;
+        if (lease_ms != 0)  header[1] |= kvwire::HAS_LEASE;
+        if (version != 0)   header[1] |= kvwire::HAS_VERSION;
+        if (epoch != 0)     header[1] |= kvwire::HAS_EPOCH;
+        uint8_t more = 0;
+        if (retry_after_ms != 0) more |= kvwire::HAS_RETRY_AFTER;
+        if (more != 0)      header[1] |= kvwire::HAS_MORE;
+        ar.write(header, 2);
+        if (header[1] & kvwire::HAS_MORE)    ar.write(&more);
+        if (header[1] & kvwire::HAS_VERSION) ar.write(&version);
+        if (header[1] & kvwire::HAS_EPOCH)   ar.write(&epoch);
+        if (header[1] & kvwire::HAS_LEASE)   ar.write(&lease_ms);
+        if (more & kvwire::HAS_RETRY_AFTER)  ar.write(&retry_after_ms);
+        if (header[1] & kvwire::HAS_VALUE)   kvwire::writeString(ar, value);
+    }
+
+    template <typename A>
+    void load(A& ar) {
+        uint8_t header[2] = {0, 0};
+        uint8_t more = 0;
+        ar.read(header, 2);
+        if (header[1] & kvwire::HAS_MORE)    ar.read(&more);
+        status = static_cast<KvStatus>(header[0]);
+        version = 0;
+        lease_ms = 0;
+        epoch = 0;
+        retry_after_ms = 0;
+        value.clear();
+        if (header[1] & kvwire::HAS_VERSION) ar.read(&version);
+        if (header[1] & kvwire::HAS_EPOCH)   ar.read(&epoch);
+        if (header[1] & kvwire::HAS_LEASE)   ar.read(&lease_ms);
+        if (more & kvwire::HAS_RETRY_AFTER)  ar.read(&retry_after_ms);
+        if (header[1] & kvwire::HAS_VALUE)   kvwire::readString(ar, value);
+    }
+};
+
+// Outcome of sending one node's batch: one reply per op, or an error for the whole batch
+struct BatchResult {
+    std::vector<KvReply> replies;
+    std::string error;
+    bool timed_out = false;   // error: no answer before the deadline
+};
+
+// SCAN results travel in KvReply::value as (int32 key, string value) pairs
+std::string EncodeScanResult(const std::vector<std::pair<int, std::string>>& items);
+bool DecodeScanResult(const std::string& data, std::vector<std::pair<int, std::string>>& items);
+
+// Deadlines travel as wall-clock time so that time spent queued on the server
+// counts against them; the client and server clocks must be kept in step (NTP)
+uint64_t WallClockMicros();
+inline bool DeadlinePassed(const KvOp& op) {
+    return op.deadline_us != 0 && WallClockMicros() >= op.deadline_us;
+}
+
+// Applies op to the local store; used by KVServer for incoming requests and by
+// KVDistributor for keys owned by this node
+KvReply ExecuteOp(KvStore& kv, const KvOp& op);
+
+#endif // KVPROTOCOL_HPP
@@ -0,0 +1,73 @@
+#ifndef KVREBALANCER_HPP
+#define KVREBALANCER_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "KVPlacement.hpp"
+#include "KVProtocol.hpp"
+#include "KVStore.hpp"
+
+// Progress of a rebalancing run, as seen by the node moving its keys out
+struct RebalanceStats {
+    std::size_t scanned = 0;     // Keys examined in the local store
+    std::size_t moved = 0;       // Copied to their new owner and removed here
+    std::size_t superseded = 0;  // New owner already had a newer value; local copy dropped
+    std::size_t raced = 0;       // Changed here while in flight; left for the next pass
+    std::size_t failed = 0;      // New owner rejected or was unreachable; kept here
+    std::size_t passes = 0;
+    bool running = false;
+};
+
+// Streams every key of the local store whose owner under the target placement is
+// another node to that node, in bulk batches and at a bounded rate, on a
+// background thread. Reads and writes keep being served throughout.
+//
+// A key is copied with an INSERT, which never overwrites a value the new owner
+// already holds (clients write there as soon as the move starts), and the local
+// copy is then removed only if its version has not changed. If it has, the copy
+// on the new owner is withdrawn the same way and the key is retried on a later pass.
+class KVRebalancer {
+public:
+    using Batches = std::unordered_map<int, std::vector<KvOp>>;
+    using SendFn = std::function<std::unordered_map<int, BatchResult>(const Batches&)>;
+
+    KVRebalancer(KvStore& kv, std::shared_ptr<const KVPlacement> target, int local_node_id,
+                 std::size_t batch_size, uint32_t max_keys_per_sec, std::size_t max_passes, SendFn send);
+    ~KVRebalancer();
+
+    void start();
+    void wait();   // Blocks until the run has finished
+    void stop();   // Abandons the run after the current batch
+
+    RebalanceStats stats() const;
+
+private:
+    KvStore& kv;
+    std::shared_ptr<const KVPlacement> target;
+    int local_node_id;
+    std::size_t batch_size;
+    uint32_t max_keys_per_sec;   // 0 for no limit
+    std::size_t max_passes;
+    SendFn send;
+
+    std::thread worker;
+    std::atomic<bool> stopping{false};
+    std::atomic<bool> running{false};
+    std::atomic<std::size_t> scanned{0};
+    std::atomic<std::size_t> moved{0};
+    std::atomic<std::size_t> superseded{0};
+    std::atomic<std::size_t> raced{0};
+    std::atomic<std::size_t> failed{0};
+    std::atomic<std::size_t> passes{0};
+
+    void run();
+    std::size_t runPass();
+    void moveBatch(const std::vector<int>& keys);
+};
+
+#endif // KVREBALANCER_HPP
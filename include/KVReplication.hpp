@@ -0,0 +1,278 @@
+#ifndef KVREPLICATION_HPP
+#define KVREPLICATION_HPP
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "KVPlacement.hpp"
+#include "KVProtocol.hpp"
+#include "KVStore.hpp"
+
+// One key as shipped to a backup: its value on the primary, or that it is gone
+struct ReplicaEntry {
+    int key = 0;
+    bool deleted = false;
+    uint64_t version = 0;   // Version on the primary
+    std::string value;
+
+    template <typename A>
+    void save(A& ar) const {
+        int32_t k = key;
+        uint8_t flags = deleted ? 1 : 0;
+        ar.write(&k);
+        ar.write(&flags);
+        ar.write(&version);
+        if (!deleted) {
+            kvwire::writeString(ar, value);
+        }
+    }
+
+    template <typename A>
+    void load(A& ar) {
+        int32_t k = 0;
+        uint8_t flags = 0;
+        ar.read(&k);
+        ar.read(&flags);
+        ar.read(&version);
+        key = k;
+        deleted = (flags & 1) != 0;
+        value.clear();
+        if (!deleted) {
+            kvwire::readString(ar, value);
+        }
+    }
+};
+
+// What a primary sends a backup in one kv_replicate call. Values are read when the
+// batch is built, so a batch may carry newer values than its changes; applying a
+// batch twice, or out of date values followed by newer ones, converges.
+struct ReplicaBatch {
+    int primary = 0;
+    bool reset = false;       // Start of a full copy: drop everything held for primary first
+    bool caught_up = false;   // The primary had no later changes when it built the batch
+    uint64_t through = 0;     // Every change of the primary up to here is covered
+    std::vector<ReplicaEntry> entries;
+
+    template <typename A>
+    void save(A& ar) const {
+        int32_t p = primary;
+        uint8_t flags = (reset ? 1 : 0) | (caught_up ? 2 : 0);
+        uint32_t count = static_cast<uint32_t>(entries.size());
+        ar.write(&p);
+        ar.write(&flags);
+        ar.write(&through);
+        ar.write(&count);
+        for (const ReplicaEntry& entry : entries) {
+            entry.save(ar);
+        }
+    }
+
+    template <typename A>
+    void load(A& ar) {
+        int32_t p = 0;
+        uint8_t flags = 0;
+        uint32_t count = 0;
+        ar.read(&p);
+        ar.read(&flags);
+        ar.read(&through);
+        ar.read(&count);
+        primary = p;
+        reset = (flags & 1) != 0;
+        caught_up = (flags & 2) != 0;
+        entries.resize(count);
+        for (ReplicaEntry& entry : entries) {
+            entry.load(ar);
+        }
+    }
+};
+
+// Replication state of one server, for kv_replication_status
+struct ReplicationStatus {
+    struct Backup {
+        int node_id = 0;
+        uint64_t acked = 0;     // Changes the backup has confirmed
+        bool syncing = false;   // Full copy pending or under way
+        bool reachable = true;
+    };
+    struct Source {
+        int primary = 0;
+        uint64_t keys = 0;
+        uint64_t through = 0;
+        double lag_ms = -1;     // Since the primary was last caught up; -1 if never
+    };
+    uint64_t current = 0;       // Latest change of the local store
+    std::vector<Backup> backups;
+    std::vector<Source> sources;
+
+    template <typename A>
+    void save(A& ar) const {
+        uint32_t backup_count = static_cast<uint32_t>(backups.size());
+        uint32_t source_count = static_cast<uint32_t>(sources.size());
+        ar.write(&current);
+        ar.write(&backup_count);
+        for (const Backup& backup : backups) {
+            int32_t id = backup.node_id;
+            uint8_t flags = (backup.syncing ? 1 : 0) | (backup.reachable ? 2 : 0);
+            ar.write(&id);
+            ar.write(&backup.acked);
+            ar.write(&flags);
+        }
+        ar.write(&source_count);
+        for (const Source& source : sources) {
+            int32_t id = source.primary;
+            ar.write(&id);
+            ar.write(&source.keys);
+            ar.write(&source.through);
+            ar.write(&source.lag_ms);
+        }
+    }
+
+    template <typename A>
+    void load(A& ar) {
+        uint32_t backup_count = 0;
+        uint32_t source_count = 0;
+        ar.read(&current);
+        ar.read(&backup_count);
+        backups.resize(backup_count);
+        for (Backup& backup : backups) {
+            int32_t id = 0;
+            uint8_t flags = 0;
+            ar.read(&id);
+            ar.read(&backup.acked);
+            ar.read(&flags);
+            backup.node_id = id;
+            backup.syncing = (flags & 1) != 0;
+            backup.reachable = (flags & 2) != 0;
+        }
+        ar.read(&source_count);
+        sources.resize(source_count);
+        for (Source& source : sources) {
+            int32_t id = 0;
+            ar.read(&id);
+            ar.read(&source.keys);
+            ar.read(&source.through);
+            ar.read(&source.lag_ms);
+            source.primary = id;
+        }
+    }
+};
+
+// Backup side: copies of other nodes' keys, held in this server's memory apart
+// from the local store, so rebalancing, scans and the local client never see them.
+class KVReplicaStore {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    // Returns the through value to acknowledge. A batch that is not a reset from a
+    // primary this store holds nothing for is refused with 0, so the primary
+    // starts a full copy (e.g. after this server restarted).
+    uint64_t apply(const ReplicaBatch& batch);
+
+    // OK or NOT_FOUND as of the primary's last catch-up, or STALE if that was more
+    // than max_staleness_ms ago (or never)
+    KvStatus read(int primary, int key, uint32_t max_staleness_ms, std::string& value, uint64_t& version);
+
+    std::vector<int> primaries();
+    // Keys primary does not own under placement are dropped, now and from every
+    // later batch, so keys moved to another owner do not linger here
+    void restrictTo(int primary, std::shared_ptr<const KVPlacement> placement);
+    // Removes everything held for primary and returns it
+    std::vector<ReplicaEntry> take(int primary);
+    void drop(int primary);
+    std::vector<ReplicationStatus::Source> status();
+
+private:
+    struct Source {
+        std::unordered_map<int, ReplicaEntry> data;
+        uint64_t through = 0;
+        bool has_caught_up = false;
+        Clock::time_point caught_up_at;
+    };
+
+    std::mutex mutex;
+    std::unordered_map<int, Source> sources;   // primary node id -> its keys
+    std::unordered_map<int, std::shared_ptr<const KVPlacement>> owners;   // See restrictTo
+};
+
+// Primary side: ships the changes of the local store's change log to this node's
+// backups on a background thread, in batches of up to batch_size keys. Only keys
+// this node owns are shipped. A backup that is new, lost state, or fell so far
+// behind that the log wrapped gets a full copy first.
+class KVReplicator {
+public:
+    // Sends batch to endpoint; returns false if it could not be delivered, else
+    // stores the backup's acknowledgement in acked
+    using SendFn = std::function<bool(const std::string& endpoint, const ReplicaBatch& batch, uint64_t& acked)>;
+    // Writes ops (INSERTs of recovered keys) to the node at endpoint
+    using ForwardFn = std::function<bool(const std::string& endpoint, const std::vector<KvOp>& ops)>;
+
+    KVReplicator(KvStore& kv, SendFn send, ForwardFn forward, std::size_t batch_size = 512);
+    ~KVReplicator();
+
+    // Takes a new map: the node's id and placement, its backups and every node's
+    // endpoint. Backups of the previous map keep their progress and are sent the
+    // keys the node has gained since; only new backups get a full copy.
+    void configure(int self_node_id, std::shared_ptr<const KVPlacement> placement,
+                   const std::vector<int>& backup_ids, const std::unordered_map<int, std::string>& endpoints);
+    // Keys of a departed primary: each is inserted at its owner under the current
+    // placement, never overwriting a value already there
+    void recover(std::vector<ReplicaEntry> entries);
+    void wake();
+
+    // Lowest change confirmed by every backup; UINT64_MAX without backups
+    uint64_t ackedThrough();
+    bool hasBackups();
+    std::vector<ReplicationStatus::Backup> status();
+
+private:
+    struct Backup {
+        int node_id = 0;
+        std::string endpoint;
+        uint64_t acked = 0;
+        bool needs_copy = true;
+        bool reachable = true;
+        std::chrono::steady_clock::time_point last_sent;
+        // Placements in force since the backup was last in step with this node's
+        // keys. Keys owned now but not under one of them were never shipped.
+        std::vector<std::shared_ptr<const KVPlacement>> resync_since;
+    };
+
+    static constexpr std::chrono::milliseconds INTERVAL{5};
+    static constexpr std::chrono::milliseconds HEARTBEAT{50};
+    static constexpr std::chrono::milliseconds RETRY{500};
+
+    KvStore& kv;
+    SendFn send;
+    ForwardFn forward;
+    std::size_t batch_size;
+
+    std::mutex mutex;
+    std::condition_variable wakeup;
+    int self = -1;
+    std::shared_ptr<const KVPlacement> placement;
+    std::unordered_map<int, std::string> endpoints;
+    std::vector<Backup> backups;
+    std::vector<ReplicaEntry> pending_recovery;
+    uint64_t generation = 0;   // Bumped by configure, to discard work begun under an older map
+    bool woken = false;
+    bool stopping = false;
+    std::thread worker;
+
+    void run();
+    bool step(Backup& backup, int self_id, const std::shared_ptr<const KVPlacement>& owner_map);
+    bool copyAll(Backup& backup, int self_id, const std::shared_ptr<const KVPlacement>& owner_map);
+    bool resync(Backup& backup, int self_id, const std::shared_ptr<const KVPlacement>& owner_map);
+    void recoverPending();
+    std::vector<ReplicaEntry> readEntries(const std::vector<int>& keys, int self_id,
+                                          const std::shared_ptr<const KVPlacement>& owner_map);
+};
+
+#endif // KVREPLICATION_HPP
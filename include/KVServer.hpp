@@ -1,25 +1,116 @@
 #ifndef KVSERVER_HPP
 #define KVSERVER_HPP
 
+#include <atomic>
 #include <iostream>
+#include <chrono>
 #include <memory>
+#include <mutex>
 #include <thallium.hpp>
 #include <thallium/serialization/stl/string.hpp>
+#include <thallium/serialization/stl/vector.hpp>
 #include <unordered_map>
+#include <vector>
+#include "KVBackpressure.hpp"
+#include "KVHotKeys.hpp"
+#include "KVMetrics.hpp"
+#include "KVMembership.hpp"
+#include "KVProtocol.hpp"
+#include "KVReplication.hpp"
 #include "KVStore.hpp"
+#include "KVTrace.hpp"
+#include "config.hpp"
 
 namespace tl = thallium;
 
 class KVServer : public tl::provider<KVServer> {
 private:
     KvStore& kv;
+
+    // Latest cluster map this server was given, and its own id in it
+    std::mutex map_mutex;
+    ClusterMap cluster_map;
+    std::shared_ptr<const KVPlacement> map_placement;
+    int self_node_id = -1;
+    bool distinct_backup_hosts = false;   // Reject maps that back a node up on its own host
+    std::chrono::steady_clock::time_point range_window_start = std::chrono::steady_clock::now();
+
+    // What redirect() needs of the map, replaced as a whole on every change, so data
+    // requests check it without taking map_mutex (see currentMapView)
+    struct MapView {
+        uint64_t epoch = 0;
+        std::shared_ptr<const KVPlacement> placement;
+        int self_node_id = -1;
+        bool wait_for_backups = false;   // Set once the replicator follows the map
+    };
+    std::shared_ptr<const MapView> map_view = std::make_shared<MapView>();   // Guarded by map_mutex
+    std::atomic<uint64_t> map_version{0};
+    std::shared_ptr<const MapView> currentMapView();
+
+    // Traffic recorded by one handler thread: requests per range start since the
+    // last kv_range_stats ("range" placement only) and its most accessed keys, with
+    // counts halved every HOT_KEY_HALF_LIFE. Each thread records into its own under
+    // a lock nobody else takes on the request path; kv_range_stats and kv_hot_keys
+    // merge them.
+    static constexpr std::size_t HOT_KEY_COUNTERS = 256;
+    static constexpr std::chrono::seconds HOT_KEY_HALF_LIFE{10};
+    struct Traffic {
+        std::mutex mutex;
+        std::unordered_map<int, uint64_t> range_ops;
+        HotKeySketch hot_keys{HOT_KEY_COUNTERS};
+        std::chrono::steady_clock::time_point hot_keys_decayed_at = std::chrono::steady_clock::now();
+    };
+    std::mutex traffic_mutex;   // Guards the list, not the entries
+    std::vector<std::shared_ptr<Traffic>> traffic;
+    Traffic& threadTraffic();
+
+    // Primary-backup replication: this node's backups are fed by replicator, and
+    // replicas holds the keys of the nodes this one backs up
+    static constexpr std::chrono::milliseconds REPLICATION_ACK_TIMEOUT{1000};
+    static constexpr int RECOVERY_ATTEMPTS = 8;   // Sends of recovered keys to an overloaded owner
+    tl::remote_procedure replicate_rpc;
+    tl::remote_procedure batch_rpc;
+    KVReplicaStore replicas;
+    std::unique_ptr<KVReplicator> replicator;
+
+    // Requests whose deadline had passed when their handler started
+    std::atomic<uint64_t> expired_requests{0};
+    // Handler and store latencies, hits, misses, errors and bytes (see kv_stats)
+    KVMetrics metrics;
+    KvReply execute(const KvOp& op);
+    KVAdmission admission;
+    uint32_t admit(const tl::request& req, std::size_t ops);
+
+    bool readReplica(const KvOp& op, KvReply& reply);
+    bool waitForBackups(uint64_t seq, uint64_t deadline_us);
+    void configureReplication();
+
+    bool redirect(uint64_t client_epoch, const KvOp& op, KvReply& reply);
     void kv_fetch(const tl::request& req, int key);
     void kv_insert(const tl::request& req, int key, std::string value);
     void kv_update(const tl::request& req, int key, std::string value);
     void kv_delete(const tl::request& req, int key);  // Add delete method
+    void kv_request(const tl::request& req, uint64_t epoch, KvOp op);
+    void kv_batch(const tl::request& req, uint64_t epoch, std::vector<KvOp> ops);
+    void kv_get_map(const tl::request& req);
+    void kv_set_map(const tl::request& req, ClusterMap map, int node_id);
+    void kv_range_stats(const tl::request& req);
+    void kv_hot_keys(const tl::request& req, uint32_t limit);
+    void kv_replicate(const tl::request& req, ReplicaBatch batch);
+    void kv_replication_status(const tl::request& req);
+    void kv_stats(const tl::request& req);
+    void kv_trace(const tl::request& req, bool clear);
+    void kv_memory(const tl::request& req);
 
 public:
-    KVServer(tl::engine &e, KvStore& kv_ref, uint16_t provider_id);
+    KVServer(tl::engine &e, KvStore& kv_ref, uint16_t provider_id, const AdmissionConfig& admission = AdmissionConfig{});
+
+    // Makes kv_set_map reject maps in which a node's backups share its host, as
+    // shard servers do: their sibling shards are on the same machine
+    void requireDistinctBackupHosts();
+
+    // What kv_stats answers: metrics since start plus the store's memory and size now
+    KvStatsReport stats();
 };
 
 #endif // KVSERVER_HPP
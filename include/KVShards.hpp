@@ -0,0 +1,23 @@
+#ifndef KVSHARDS_HPP
+#define KVSHARDS_HPP
+
+#include <cstddef>
+#include <string>
+#include <vector>
+#include "config.hpp"
+
+// One server of a shard-per-core layout
+struct ShardPlan {
+    uint32_t index = 0;
+    unsigned cpu = 0;           // Core the shard is pinned to
+    int port = 0;
+    std::string instance;       // KVM_INSTANCE, which names its segment and lock
+    std::size_t mem_size = 0;   // Bytes; the layout's memory split evenly
+};
+
+// Lays out shards.count servers on cpus cores: shard i gets port + i, core
+// (first_cpu + i * cpu_stride) mod cpus and base_instance suffixed with shard<i>
+std::vector<ShardPlan> PlanShards(const ShardConfig& shards, int port, std::size_t mem_size, unsigned cpus,
+                                  const std::string& base_instance);
+
+#endif // KVSHARDS_HPP
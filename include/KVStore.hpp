@@ -8,23 +8,125 @@
 #include <boost/interprocess/sync/named_mutex.hpp>
 #include <boost/interprocess/sync/scoped_lock.hpp>
 #include <boost/unordered_map.hpp>
+#include <cstdint>
+#include <functional>
 #include <iostream>
 #include <string>
 #include <memory>
+#include <vector>
+#include "KVLockProfile.hpp"
 
 using namespace boost::interprocess;
 
+// Outcome of a store operation
+enum class KvStatus : uint8_t {
+    OK,
+    NOT_FOUND,
+    ALREADY_EXISTS,
+    OUT_OF_MEMORY,
+    ERROR,
+    CONFLICT,           // Compare-and-swap precondition did not hold
+    INVALID_ARGUMENT,   // e.g. increment of a value that is not an integer
+    UNAVAILABLE,    // Client side only: the owning node could not be reached
+    MOVED,          // Sent with a stale cluster epoch to a node that no longer owns the key
+    STALE,          // Backup read: the replica is further behind its primary than allowed
+    TIMEOUT,        // Write applied on the primary, but its backups did not confirm it in time
+    DEADLINE_EXCEEDED,  // The caller's deadline passed: dropped unapplied by the server, or no
+                        // reply came in time (client side; the op may or may not have been applied)
+    OVERLOADED          // Rejected unapplied by admission control; retry after KvReply::retry_after_ms
+};
+
+inline const char* KvStatusName(KvStatus status) {
+    switch (status) {
+        case KvStatus::OK:             return "OK";
+        case KvStatus::NOT_FOUND:      return "NOT_FOUND";
+        case KvStatus::ALREADY_EXISTS: return "ALREADY_EXISTS";
+        case KvStatus::OUT_OF_MEMORY:  return "OUT_OF_MEMORY";
+        case KvStatus::CONFLICT:       return "CONFLICT";
+        case KvStatus::INVALID_ARGUMENT: return "INVALID_ARGUMENT";
+        case KvStatus::UNAVAILABLE:    return "UNAVAILABLE";
+        case KvStatus::MOVED:          return "MOVED";
+        case KvStatus::STALE:          return "STALE";
+        case KvStatus::TIMEOUT:        return "TIMEOUT";
+        case KvStatus::DEADLINE_EXCEEDED: return "DEADLINE_EXCEEDED";
+        case KvStatus::OVERLOADED:     return "OVERLOADED";
+        default:                       return "ERROR";
+    }
+}
+
+// Map value: the stored string plus the per-key metadata used for client cache coherence
+template <typename ShmString>
+struct KvEntry {
+    ShmString value;
+    uint64_t version;         // Bumped on every mutation
+    int64_t lease_until_ns;   // steady_clock deadline of the longest outstanding read lease
+    // Set by a writer waiting out a lease: no new leases are granted before this
+    // deadline. It lapses on its own, so a writer that dies while waiting does not
+    // keep the key from being leased again.
+    int64_t writer_until_ns;
+
+    template <typename Alloc>
+    KvEntry(const char* data, std::size_t size, uint64_t version, const Alloc& alloc)
+        : value(data, size, alloc), version(version), lease_until_ns(0), writer_until_ns(0) {}
+};
+
+// Layout of the objects in a segment or persistent file, stored in it as
+// "FormatVersion". Files without it are format 1: one plain string per key, as
+// written before entries carried a version and leases. The server migrates those
+// on open; a segment or file of any other format is refused.
+constexpr uint32_t STORE_FORMAT_VERSION = 2;
+
+// Ring of recent mutations kept in the segment next to the map. Each slot holds
+// the key and the sequence number of the change, taken from the version counter,
+// so the log is in sequence order. Replication reads it to find what to ship.
+constexpr std::size_t CHANGE_LOG_CAPACITY = 1 << 16;
+
+struct ChangeLogSlot {
+    uint64_t seq;
+    int32_t key;
+};
+
+struct ChangeLog {
+    uint64_t written;   // Changes ever logged; slot written % CHANGE_LOG_CAPACITY is next
+    ChangeLogSlot slots[CHANGE_LOG_CAPACITY];
+};
+
+// Incremental growth of the map, kept in the segment next to it ("SharedMapRehash").
+// Rather than letting the map rehash every entry on the insert that fills it, the
+// store swaps its contents into draining and gives the (now empty) map twice the
+// buckets; each operation then moves step entries, plus the key it touches, back
+// into the map until draining is empty. A key is in exactly one of the two tables.
+// step 0 leaves growth to the map itself.
+constexpr std::size_t INCREMENTAL_REHASH_MIN_KEYS = 4096;   // Smaller tables rehash at once
+
+template <typename Map>
+struct TableRehash {
+    offset_ptr<Map> draining;   // Null unless a growth is in progress
+    uint32_t step = 0;
+    uint64_t growths = 0;       // Growths completed
+};
+
+// Keys changed after some sequence number, oldest first; a key may repeat
+struct ChangeSet {
+    std::vector<int> keys;
+    uint64_t through = 0;     // Every change up to this sequence number is included
+    bool truncated = false;   // Changes after the requested point were already overwritten
+    bool caught_up = false;   // Nothing had changed after through when the log was read
+};
+
 // Memory storage type definitions
 typedef allocator<char, managed_shared_memory::segment_manager> CharAllocator;
 typedef basic_string<char, std::char_traits<char>, CharAllocator> MyShmString;
-typedef allocator<std::pair<const int, MyShmString>, managed_shared_memory::segment_manager> MemoryMapAllocator;
-typedef boost::unordered_map<int, MyShmString, boost::hash<int>, std::equal_to<int>, MemoryMapAllocator> MemoryHashMap;
+typedef KvEntry<MyShmString> MemoryEntry;
+typedef allocator<std::pair<const int, MemoryEntry>, managed_shared_memory::segment_manager> MemoryMapAllocator;
+typedef boost::unordered_map<int, MemoryEntry, boost::hash<int>, std::equal_to<int>, MemoryMapAllocator> MemoryHashMap;
 
 // Persistent storage type definitions
 typedef allocator<char, managed_mapped_file::segment_manager> MappedCharAllocator;
 typedef basic_string<char, std::char_traits<char>, MappedCharAllocator> MappedShmString;
-typedef allocator<std::pair<const int, MappedShmString>, managed_mapped_file::segment_manager> MappedMapAllocator;
-typedef boost::unordered_map<int, MappedShmString, boost::hash<int>, std::equal_to<int>, MappedMapAllocator> MappedHashMap;
+typedef KvEntry<MappedShmString> MappedEntry;
+typedef allocator<std::pair<const int, MappedEntry>, managed_mapped_file::segment_manager> MappedMapAllocator;
+typedef boost::unordered_map<int, MappedEntry, boost::hash<int>, std::equal_to<int>, MappedMapAllocator> MappedHashMap;
 
 enum class StorageMode {
     MEMORY,
@@ -43,8 +145,93 @@ struct MemoryStats {
     double usage_percent;
 };
 
+// Where the segment's bytes go, from a walk of the map (KvStore::GetMemoryProfile).
+// Out-of-line value buffers are measured block by block from the allocator; nodes
+// and buckets are computed from their count and the types' sizes, since the
+// table's internal node layout is not visible. Every allocated block also costs
+// the allocator a header, counted in allocator_overhead. Whatever is used but in
+// none of the categories (segment manager, named-object index, fragmentation) is
+// other_bytes.
+struct MemoryProfile {
+    uint64_t segment_total = 0;
+    uint64_t segment_used = 0;
+    uint64_t segment_free = 0;
+    uint64_t keys = 0;
+
+    uint64_t bucket_bytes = 0;          // Bucket array
+    uint64_t node_bytes = 0;            // Entries: key, version, lease fields and the string header
+    uint64_t value_heap_bytes = 0;      // Values too long for the string's inline buffer
+    uint64_t allocator_overhead = 0;    // Block headers of the above
+    uint64_t change_log_bytes = 0;
+    uint64_t other_bytes = 0;
+
+    uint64_t value_payload_bytes = 0;   // Sum of value sizes
+    uint64_t inline_values = 0;         // Values kept in the node itself
+    uint64_t bucket_count = 0;          // Both tables while the map grows (see TableRehash)
+    uint64_t draining_keys = 0;         // Keys still to move to the grown table
+    uint64_t table_growths = 0;
+    double load_factor = 0;
+    double max_load_factor = 0;
+    // chain_lengths[i]: buckets holding i entries; the last one counts all longer chains
+    std::vector<uint64_t> chain_lengths;
+    KVHistogram value_sizes;
+
+    template <typename A>
+    void save(A& ar) const {
+        const uint64_t* fields[] = {&segment_total, &segment_used, &segment_free, &keys, &bucket_bytes, &node_bytes,
+                                    &value_heap_bytes, &allocator_overhead, &change_log_bytes, &other_bytes,
+                                    &value_payload_bytes, &inline_values, &bucket_count, &draining_keys,
+                                    &table_growths};
+        for (const uint64_t* field : fields) {
+            ar.write(field);
+        }
+        ar.write(&load_factor);
+        ar.write(&max_load_factor);
+        uint32_t n = static_cast<uint32_t>(chain_lengths.size());
+        ar.write(&n);
+        if (n > 0) {
+            ar.write(chain_lengths.data(), n);
+        }
+        value_sizes.save(ar);
+    }
+
+    template <typename A>
+    void load(A& ar) {
+        uint64_t* fields[] = {&segment_total, &segment_used, &segment_free, &keys, &bucket_bytes, &node_bytes,
+                              &value_heap_bytes, &allocator_overhead, &change_log_bytes, &other_bytes,
+                              &value_payload_bytes, &inline_values, &bucket_count, &draining_keys,
+                              &table_growths};
+        for (uint64_t* field : fields) {
+            ar.read(field);
+        }
+        ar.read(&load_factor);
+        ar.read(&max_load_factor);
+        uint32_t n = 0;
+        ar.read(&n);
+        chain_lengths.assign(n, 0);
+        if (n > 0) {
+            ar.read(chain_lengths.data(), n);
+        }
+        value_sizes.load(ar);
+    }
+};
+
+// Result of a lookup that may also grant a read lease to a caching client
+struct LeasedValue {
+    KvStatus status = KvStatus::NOT_FOUND;
+    std::string value;
+    uint64_t version = 0;
+    uint32_t lease_ms = 0;   // 0 when no lease was granted
+};
+
+// How a writer waiting out a read lease sleeps, for ns nanoseconds. The store
+// lock is not held meanwhile.
+using LeaseSleep = std::function<void(int64_t ns)>;
+
 class KvStore {
 private:
+    // Suffixed with $KVM_INSTANCE when set, so several servers can share a host
+    static const std::string SEGMENT_NAME;
     static const std::string PERSISTENT_FILE_PATH;
     static const char* MUTEX_NAME;
     
@@ -60,21 +247,60 @@ private:
     MemoryHashMap* memory_map_ptr;
     MappedHashMap* persistent_map_ptr;
     
+    // Global mutation counter living in the segment, source of per-key versions
+    uint64_t* version_counter;
+    ChangeLog* change_log;
+    TableRehash<MemoryHashMap>* memory_rehash;
+    TableRehash<MappedHashMap>* persistent_rehash;
+
+    // Waits for and holds of the store lock by this process; see StoreLock
+    mutable KVLockProfiler lock_profiler;
+
+    // Null: the waiting thread sleeps
+    LeaseSleep lease_sleep;
+    
     // Private constructor for singleton
-    KvStore(std::size_t size, StorageMode mode, ConnectionMode conn_mode);
+    KvStore(std::size_t size, StorageMode mode, ConnectionMode conn_mode, std::size_t expected_keys);
     
     // Helper methods
-    void createMemoryStorage(std::size_t size);
-    void createPersistentStorage(std::size_t size);
+    void createMemoryStorage(std::size_t size, std::size_t expected_keys);
+    void createPersistentStorage(std::size_t size, std::size_t expected_keys);
+    void migrateFormat1File(std::size_t expected_keys);
+    template <typename Segment>
+    void requireCurrentFormat(Segment& segment, const std::string& what);
     void cleanupStorage();
     bool hasEnoughMemory(std::size_t needed_bytes) const;
 
+    // Shared body of the atomic read-modify-write operations. fn sees the current
+    // value (data == nullptr when the key is missing) and either fills next and
+    // returns OK to have it stored, or returns the status to report unchanged.
+    using RmwFn = std::function<KvStatus(const char* data, std::size_t size, uint64_t version, std::string& next)>;
+    KvStatus readModifyWrite(const char* op_name, int key, bool create_missing, const RmwFn& fn, uint64_t* new_version);
+    template <typename Map, typename CharAlloc>
+    KvStatus applyReadModifyWrite(Map* map, const CharAlloc& alloc, StoreLock& lock, int key,
+                                  bool create_missing, const RmwFn& fn, uint64_t* new_version);
+    template <typename Map, typename CharAlloc>
+    void applyBulkLoad(Map* map, const CharAlloc& alloc, StoreLock& lock,
+                       const std::vector<std::pair<int, std::string>>& entries, std::size_t& loaded);
+
     void connectToMemoryStorage();
     void connectToPersistentStorage();
+    void attachVersionCounter();
+    // Called with the store lock held, after every mutation
+    void logChange(int key, uint64_t seq);
+    // Called with the store lock held, before touching key: moves it and the next few
+    // entries of a growing map into place (see TableRehash)
+    void advanceRehash(int key);
     
 public:
+    // Upper bound on any read lease; writers never wait longer than this
+    static constexpr uint32_t MAX_LEASE_MS = 10000;
+    
     // Singleton access
-    static KvStore& get_instance(std::size_t size, StorageMode mode, ConnectionMode conn_mode = ConnectionMode::SERVER);
+    // expected_keys presizes a newly created map so that loading that many keys never
+    // grows it (0: start empty); it has no effect when attaching to an existing one
+    static KvStore& get_instance(std::size_t size, StorageMode mode, ConnectionMode conn_mode = ConnectionMode::SERVER,
+                                 std::size_t expected_keys = 0);
     
     // Disable copy constructor and assignment
     KvStore(const KvStore&) = delete;
@@ -84,18 +310,74 @@ public:
     ~KvStore();
     
     // Core operations
-    void Insert(int key, const std::string& value);
-    void Update(int key, const std::string& new_value);
-    void Delete(int key);
+    // new_version, when given, receives the version stamp assigned by the write
+    KvStatus Insert(int key, const std::string& value, uint64_t* new_version = nullptr);
+    KvStatus Update(int key, const std::string& new_value, uint64_t* new_version = nullptr);
+    // change_seq, when given, receives the sequence number of the delete in the
+    // change log (writes log theirs under their new version)
+    KvStatus Delete(int key, uint64_t* change_seq = nullptr);
+    // Deletes only if the entry still carries expected_version (CONFLICT otherwise)
+    KvStatus DeleteIfVersion(int key, uint64_t expected_version, uint64_t* change_seq = nullptr);
     std::string Find(int key);
+    LeasedValue FindWithLease(int key, uint32_t lease_ms);
+    std::vector<LeasedValue> FindMany(const std::vector<int>& keys, uint32_t lease_ms);
+    // Keys in [start, end) in ascending order, at most limit of them (0 for all).
+    // The map is unordered, so this walks every entry.
+    std::vector<std::pair<int, std::string>> Scan(int64_t start, int64_t end, std::size_t limit);
+    
+    // Writes every entry, inserting or overwriting, under one hold of the store lock
+    // and without Insert's per-key logging and syncs: for seeding a store (see
+    // kvm_import). Free memory is checked once for the whole batch (OUT_OF_MEMORY,
+    // nothing written), and read leases on overwritten keys are waited out, with
+    // the lock released meanwhile. Call Sync afterwards in persistent mode. loaded
+    // receives how many entries were written, also when an allocation fails part way.
+    KvStatus BulkLoad(const std::vector<std::pair<int, std::string>>& entries, std::size_t& loaded);
+
+    // Atomic read-modify-write operations, each done under one hold of the store lock.
+    // On CONFLICT, current receives the value that did not match.
+    KvStatus CompareAndSwap(int key, const std::string& expected, const std::string& new_value,
+                            std::string* current = nullptr, uint64_t* new_version = nullptr);
+    KvStatus CompareAndSwapVersion(int key, uint64_t expected_version, const std::string& new_value,
+                                   uint64_t* new_version = nullptr);
+    // Missing keys count as 0; the stored value must otherwise be a decimal integer
+    KvStatus Increment(int key, int64_t delta, int64_t& result, uint64_t* new_version = nullptr);
+    // Missing keys count as empty
+    KvStatus Append(int key, const std::string& suffix, uint64_t* new_version = nullptr);
+    // Fails with NOT_FOUND (and writes nothing) if the key does not exist
+    KvStatus GetAndSet(int key, const std::string& new_value, std::string& old_value,
+                       uint64_t* new_version = nullptr);
     
     // Utility operations
     void Sync();
     std::size_t GetMapSize() const;
     void ListAllKeys() const;
+    std::vector<int> GetKeys() const;  // Snapshot of every key, in map order
+
+    // Change log, for replication. ChangesSince returns at most limit changes with a
+    // sequence number above after; CurrentVersion is the latest sequence number used.
+    ChangeSet ChangesSince(uint64_t after, std::size_t limit);
+    uint64_t CurrentVersion();
+
+    // Store lock profiling in this process: one acquisition in sample_every has its
+    // wait and hold timed (1 times all of them, 0 turns profiling off)
+    void SetLockProfiling(uint32_t sample_every);
+    StoreLockProfile GetLockProfile() const;
+    void ResetLockProfile();
+
+    // Replaces the thread sleep of writers waiting out a read lease, e.g. with one
+    // that yields to other user-level threads of the same execution stream. Set it
+    // before serving requests.
+    void SetLeaseSleep(LeaseSleep sleep);
+
+    // Entries moved per operation while the map grows; 0 lets the map rehash all at
+    // once. Kept in the segment, so every process attached to the store follows it.
+    void SetIncrementalRehash(uint32_t step);
     
     // Memory management
     MemoryStats GetMemoryStats() const;
+    // Walks every entry and bucket under the store lock: meant for diagnosis, not
+    // for frequent polling of a large store
+    MemoryProfile GetMemoryProfile() const;
     void PrintMemoryStats(const std::string& operation) const;
     std::size_t GetFreeMemory() const;
     std::size_t GetUsedMemory() const;
@@ -0,0 +1,96 @@
+#ifndef KVTRACE_HPP
+#define KVTRACE_HPP
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Request tracing. A client picks one request in sample_every to trace and gives
+// it a trace id, which travels with the KvOp; the server and KvStore record their
+// spans under the same id. Spans go into a ring buffer per thread (the oldest are
+// overwritten) and are written out as Chrome trace JSON, which chrome://tracing
+// and Perfetto open. Span times are wall clock, so the spans of a client and its
+// servers line up as long as their clocks are kept in step (NTP).
+//
+// A thread's current trace is what KvStore records under; it is thread-local, so
+// code that yields to other Argobots threads while it is set suspends it first
+// (KvTraceSuspend).
+
+// Fixed up front, before any thread records: spans per thread, 1 request in
+// sample_every traced (0: none; traced requests from elsewhere are still followed)
+void ConfigureTracing(uint32_t sample_every, std::size_t buffer_spans);
+uint32_t TracingSampleEvery();
+
+// A new trace id for one request in sample_every, 0 for the others
+uint64_t TraceSample();
+// The calling thread's current trace, 0 if none
+uint64_t CurrentTraceId();
+// Wall clock in nanoseconds, the time base of every span
+uint64_t TraceNowNs();
+
+// name must be a string literal (it is kept by pointer); key -1 for none
+void RecordSpan(uint64_t trace_id, const char* name, uint64_t start_ns, uint64_t end_ns, int key = -1);
+
+// Every recorded span of this process as Chrome trace events (comma-separated JSON
+// objects), preceded by a process_name event for process_name
+std::string TraceEventsJson(const std::string& process_name);
+void ClearTraces();
+// Writes one trace file from the event lists of several processes
+bool WriteChromeTrace(const std::string& path, const std::vector<std::string>& event_lists);
+
+// Makes trace_id the calling thread's current trace for the scope (nothing if 0)
+class KvTraceContext {
+public:
+    explicit KvTraceContext(uint64_t trace_id);
+    ~KvTraceContext();
+
+    KvTraceContext(const KvTraceContext&) = delete;
+    KvTraceContext& operator=(const KvTraceContext&) = delete;
+
+private:
+    uint64_t previous;
+    bool active;
+};
+
+// Clears the thread's current trace for the scope and sets it again at the end.
+// Wraps a yield: the Argobots threads that run meanwhile then neither record
+// under it nor save it as the trace to go back to.
+class KvTraceSuspend {
+public:
+    KvTraceSuspend();
+    ~KvTraceSuspend();
+
+    KvTraceSuspend(const KvTraceSuspend&) = delete;
+    KvTraceSuspend& operator=(const KvTraceSuspend&) = delete;
+
+private:
+    uint64_t suspended;
+};
+
+// Span from construction to end() or destruction, under trace_id (by default the
+// thread's current trace); costs one thread-local read when not tracing
+class KvTraceSpan {
+public:
+    explicit KvTraceSpan(const char* name, int key = -1) : KvTraceSpan(CurrentTraceId(), name, key) {}
+    KvTraceSpan(uint64_t trace_id, const char* name, int key = -1)
+        : trace_id(trace_id), name(name), key(key), start_ns(trace_id ? TraceNowNs() : 0) {}
+    ~KvTraceSpan() { end(); }
+
+    KvTraceSpan(const KvTraceSpan&) = delete;
+    KvTraceSpan& operator=(const KvTraceSpan&) = delete;
+
+    void end() {
+        if (trace_id) {
+            RecordSpan(trace_id, name, start_ns, TraceNowNs(), key);
+            trace_id = 0;
+        }
+    }
+
+private:
+    uint64_t trace_id;
+    const char* name;
+    int key;
+    uint64_t start_ns;
+};
+
+#endif // KVTRACE_HPP
@@ -0,0 +1,74 @@
+#ifndef KVWORKLOAD_HPP
+#define KVWORKLOAD_HPP
+
+#include <cstdint>
+#include <random>
+#include <string>
+
+// Zipfian key ranks in [0, n), rank 0 the most popular (Gray et al., as used by YCSB)
+class ZipfGenerator {
+public:
+    ZipfGenerator(int n, double theta);
+
+    int next(std::mt19937& gen);
+
+private:
+    int n;
+    double theta;
+    double zetan = 0.0;
+    double alpha = 0.0;
+    double eta = 0.0;
+};
+
+// Operations of the YCSB core workloads
+enum class BenchOp : uint8_t {
+    READ,
+    UPDATE,
+    INSERT,
+    SCAN,
+    READ_MODIFY_WRITE,
+};
+constexpr int BENCH_OP_COUNT = 5;
+
+const char* BenchOpName(BenchOp op);
+
+// Proportions of each operation, summing to 1, and the key distribution the
+// workload is defined with
+struct WorkloadMix {
+    double read = 0;
+    double update = 0;
+    double insert = 0;
+    double scan = 0;
+    double read_modify_write = 0;
+    std::string distribution = "zipfian";
+
+    BenchOp pick(double u) const;
+};
+
+// YCSB core workloads A to F; throws std::invalid_argument for anything else
+//   A: 50% read, 50% update          B: 95% read, 5% update
+//   C: 100% read                     D: 95% read, 5% insert, latest keys
+//   E: 95% scan, 5% insert           F: 50% read, 50% read-modify-write
+WorkloadMix YcsbWorkload(const std::string& name);
+
+// Picks the key of the next operation among the keys inserted so far, which are
+// 0 .. count-1:
+//   uniform  every key equally likely
+//   zipfian  popular keys spread over the key space (YCSB's scrambled zipfian)
+//   latest   the most recently inserted keys are the most popular
+// The zipfian ranks are drawn over the initial record count, so keys inserted
+// later only become popular under "latest".
+class KeyChooser {
+public:
+    KeyChooser(const std::string& distribution, int64_t records, double theta = 0.99);
+
+    int64_t next(std::mt19937& gen, int64_t count);
+
+private:
+    enum class Kind { UNIFORM, ZIPFIAN, LATEST };
+    Kind kind;
+    int64_t records;
+    ZipfGenerator zipf;
+};
+
+#endif // KVWORKLOAD_HPP
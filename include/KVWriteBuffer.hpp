@@ -0,0 +1,82 @@
+#ifndef KVWRITEBUFFER_HPP
+#define KVWRITEBUFFER_HPP
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "KVProtocol.hpp"
+
+// A buffered write that the owning server did not apply
+struct WriteFailure {
+    int key;
+    KvOpType type;
+    KvStatus status;
+    std::string error;   // RPC error text, empty when the server answered
+};
+
+// Write-behind buffer for remote mutations.
+// Writes are queued per destination node; consecutive updates of a key collapse
+// into the last one. Every other op is sent as written, so a second insert or
+// delete of a key still reports its own ALREADY_EXISTS or NOT_FOUND. Buffers are
+// sent as kv_batch RPCs when a node reaches batch_size ops, every
+// flush_interval_ms, or on flush(). Writes to one key are
+// always applied in order; flush() is the ordering and durability point across keys.
+class KVWriteBuffer {
+public:
+    using Batches = std::unordered_map<int, std::vector<KvOp>>;   // node id -> ops
+    using SendFn = std::function<std::unordered_map<int, BatchResult>(const Batches&)>;
+
+    KVWriteBuffer(std::size_t batch_size, uint32_t flush_interval_ms, std::size_t max_pending, SendFn send);
+    ~KVWriteBuffer();
+
+    KVWriteBuffer(const KVWriteBuffer&) = delete;
+    KVWriteBuffer& operator=(const KVWriteBuffer&) = delete;
+
+    void add(int node_id, KvOp op);
+
+    // Whether a write to key is buffered or in flight. Buffered writes may still be
+    // rejected, so readers drain() rather than read them back.
+    bool holds(int key);
+
+    // Sends everything buffered so far and waits until it has been applied. Returns
+    // every failure since the previous flush(), including background flushes.
+    std::vector<WriteFailure> flush();
+
+    // Like flush(), but failures are kept for the next flush() call
+    void drain();
+
+private:
+    struct NodeBuffer {
+        std::vector<int> key_order;                          // Keys in first-write order
+        std::unordered_map<int, std::vector<KvOp>> by_key;   // Coalesced ops per key
+        std::size_t op_count = 0;
+    };
+
+    std::size_t batch_size;
+    std::chrono::milliseconds flush_interval;
+    std::size_t max_pending;
+    SendFn send;
+
+    std::mutex mutex;                  // Guards everything below
+    std::unordered_map<int, NodeBuffer> buffers;
+    std::size_t pending = 0;
+    std::unordered_set<int> in_flight;   // Keys of drained ops until they are applied
+    std::vector<WriteFailure> failures;
+    bool flush_requested = false;
+    bool stopping = false;
+    std::condition_variable wake;
+
+    std::mutex flush_mutex;            // One flush at a time keeps batches ordered
+    std::thread flusher;
+
+    void flushPending();
+    void run();
+};
+
+#endif // KVWRITEBUFFER_HPP
@@ -3,6 +3,160 @@
 #include <unordered_map>
 #include <nlohmann/json.hpp>
 
+// Optional client-side cache for remote values ("cache" section)
+struct CacheConfig {
+    bool enabled = false;
+    std::size_t capacity = 4096;
+    std::size_t shards = 16;
+    uint32_t lease_ms = 200;
+};
+
+// Optional write-behind buffering of remote writes ("write_behind" section)
+struct WriteBehindConfig {
+    bool enabled = false;
+    std::size_t batch_size = 256;
+    uint32_t flush_interval_ms = 10;
+    std::size_t max_pending = 65536;
+};
+
+// Key placement across nodes ("placement" section). weights maps node ids to a
+// relative share; nodes that are not listed get 1.0. The default is the original
+// key % N layout, so existing stores keep their keys where they are; switching
+// an existing cluster to another strategy moves keys and needs a rebalance.
+struct PlacementConfig {
+    std::string strategy = "modulo";
+    std::size_t vnodes = 128;
+    std::unordered_map<int, double> weights;
+    int range_span = 1 << 20;   // "range" strategy: keys [0, range_span) are split among the nodes at start
+};
+
+// Moving keys after a membership change ("rebalance" section)
+struct RebalanceConfig {
+    std::size_t batch_size = 1024;
+    uint32_t max_keys_per_sec = 0;   // 0 for no limit
+    std::size_t max_passes = 3;
+};
+
+// Automatic split/merge of key ranges under "range" placement ("ranges" section).
+// A range splits when it holds more than max_keys or serves more than
+// max_ops_per_sec; adjacent ranges merge when both are below merge_fraction of
+// both limits. check_interval_ms > 0 lets the lowest-numbered node check on its own.
+struct RangeConfig {
+    std::size_t max_keys = 100000;
+    double max_ops_per_sec = 5000;
+    double merge_fraction = 0.25;
+    uint32_t check_interval_ms = 0;
+};
+
+// Client caching of hot keys ("hot_keys" section). Every refresh_ms the client asks
+// each server for its most accessed keys; a key taking at least min_share of its
+// owner's traffic is read under a lease_ms lease and served from the client until
+// the lease runs out, even when the remote read cache is disabled.
+struct HotKeyConfig {
+    bool enabled = false;
+    double min_share = 0.01;
+    uint32_t max_keys = 64;       // Per server
+    uint32_t refresh_ms = 1000;
+    uint32_t lease_ms = 100;
+};
+
+// Primary-backup replication ("replication" section). factor is the number of copies
+// of every key; ack is "primary" (answer once the owner has applied a write) or
+// "backup" (once every backup has it too). Both take effect through the published
+// cluster map. With read_from_backups, reads are spread over a key's owner and
+// backups, and a backup answers only while it is at most max_staleness_ms behind.
+struct ReplicationConfig {
+    uint32_t factor = 1;
+    std::string ack = "primary";
+    bool read_from_backups = false;
+    uint32_t max_staleness_ms = 100;
+};
+
+// Client-side time limits ("deadlines" section). Every RPC gives up after
+// timeout_ms (0: waits forever); with propagate, requests carry that moment so
+// servers drop them if it passed while they were queued. With hedge and at least
+// two replicas, a read not answered within the hedge_percentile of recent read
+// latencies (at least hedge_min_ms) is also sent to one of the key's backups.
+struct DeadlineConfig {
+    uint32_t timeout_ms = 1000;
+    bool propagate = true;
+    bool hedge = false;
+    double hedge_percentile = 95.0;
+    double hedge_min_ms = 1.0;
+};
+
+// Overload protection ("admission" section). Servers reject data requests with
+// OVERLOADED while more than max_queue handlers wait in their pool, or when a
+// client exceeds client_ops_per_sec (with bursts up to client_burst); 0 disables
+// either check. Clients keep at most window ops per node in flight, halve that
+// on every rejection and grow it back gradually, and retry a rejected op up to
+// max_retries times after the delay the server asked for.
+struct AdmissionConfig {
+    std::size_t max_queue = 1024;
+    double client_ops_per_sec = 0;
+    double client_burst = 1000;
+    uint32_t retry_after_ms = 5;
+    std::size_t window = 1024;
+    uint32_t max_retries = 8;
+};
+
+// How the Mercury/Margo engines of clients and servers make network progress
+// ("progress" section). mode is "blocking" (the progress loop sleeps in the
+// network until something arrives), "busy_poll" (it never sleeps: lowest latency,
+// one core kept busy) or "adaptive" (it spins for spin_ms after any activity,
+// then blocks). With dedicated_thread the loop runs on its own execution stream
+// instead of sharing one with the RPC handlers; handler_threads > 0 gives a
+// server that many extra streams for its handlers.
+struct ProgressConfig {
+    std::string mode = "blocking";
+    uint32_t spin_ms = 10;
+    bool dedicated_thread = true;
+    uint32_t handler_threads = 0;
+};
+
+// Where a server publishes its metrics in Prometheus text format ("metrics"
+// section): a file rewritten every interval_ms and/or a Unix socket answering
+// each connection. Both empty: metrics are only available through kv_stats.
+struct MetricsConfig {
+    std::string file;
+    std::string socket;
+    uint32_t interval_ms = 10000;
+    uint32_t lock_sample_every = 1;   // Store lock profiling: time 1 acquisition in N, 0 for none
+};
+
+// Request tracing ("tracing" section, see KVTrace.hpp): clients trace 1 request in
+// sample_every (0: none), every thread keeps its last buffer_spans spans, and file
+// is where the client's trace command writes them unless given another path
+struct TracingConfig {
+    uint32_t sample_every = 0;
+    std::size_t buffer_spans = 16384;
+    std::string file = "kvm_trace.json";
+};
+
+// Hash table sizing ("store" section): a new map gets buckets for expected_keys
+// up front, and when it grows anyway, rehash_step entries move per operation
+// instead of all at once (0: all at once, see TableRehash in KVStore.hpp)
+struct StoreConfig {
+    std::size_t expected_keys = 0;
+    uint32_t rehash_step = 8;
+};
+
+// Shard-per-core layout ("shards" section): with count > 1, kvm_server starts
+// count servers, each pinned to one core (first_cpu, first_cpu + cpu_stride, ...)
+// with its own segment, port and KVM_INSTANCE, and one execution stream for
+// progress and handlers. Each shard is a node of the cluster config; with
+// replication, ids must alternate between hosts so no backup shares its host.
+struct ShardConfig {
+    uint32_t count = 1;
+    uint32_t first_cpu = 0;
+    uint32_t cpu_stride = 1;
+};
+
+// Cluster map refresh ("membership" section); 0 disables periodic refresh
+struct MembershipConfig {
+    uint32_t refresh_ms = 1000;
+};
+
 class Config {
 public:
     Config(const std::string& filename);
@@ -13,7 +167,25 @@ public:
     std::string get_endpoint(int node_id) const;
     size_t read_size() const;
     std::string read_ip() const;
+    CacheConfig read_cache_config() const;
+    WriteBehindConfig read_write_behind_config() const;
+    PlacementConfig read_placement_config() const;
+    RebalanceConfig read_rebalance_config() const;
+    MembershipConfig read_membership_config() const;
+    RangeConfig read_range_config() const;
+    HotKeyConfig read_hot_key_config() const;
+    ReplicationConfig read_replication_config() const;
+    DeadlineConfig read_deadline_config() const;
+    AdmissionConfig read_admission_config() const;
+    ProgressConfig read_progress_config() const;
+    MetricsConfig read_metrics_config() const;
+    TracingConfig read_tracing_config() const;
+    StoreConfig read_store_config() const;
+    ShardConfig read_shard_config() const;
 private:
     nlohmann::json config_json;
 };
 
+// Margo JSON configuration for an engine using progress
+std::string MargoConfigJson(const ProgressConfig& progress);
+
@@ -0,0 +1,98 @@
+#include "KVBackpressure.hpp"
+#include <algorithm>
+#include <cmath>
+
+KVAdmission::KVAdmission(std::size_t max_queue, double client_ops_per_sec, double client_burst,
+                         uint32_t retry_after_ms)
+    : max_queue(max_queue),
+      rate(client_ops_per_sec),
+      burst(std::max(client_burst, 1.0)),
+      retry_after_ms(std::max<uint32_t>(retry_after_ms, 1)) {}
+
+uint32_t KVAdmission::admit(const std::string& client, std::size_t queued, std::size_t ops) {
+    if (max_queue > 0 && queued >= max_queue) {
+        queue_rejections.fetch_add(1, std::memory_order_relaxed);
+        return retry_after_ms;
+    }
+    if (rate > 0) {
+        uint32_t wait_ms = takeTokens(client, ops);
+        if (wait_ms > 0) {
+            rate_rejections.fetch_add(1, std::memory_order_relaxed);
+            return wait_ms;
+        }
+    }
+    admitted_count.fetch_add(1, std::memory_order_relaxed);
+    return 0;
+}
+
+// A request is let through once the bucket holds its ops, or is full for requests
+// larger than the burst; the bucket may then go negative, which the client pays
+// off by waiting
+uint32_t KVAdmission::takeTokens(const std::string& client, std::size_t ops) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto now = Clock::now();
+    auto it = buckets.find(client);
+    if (it == buckets.end()) {
+        if (buckets.size() >= MAX_CLIENTS) {
+            for (auto idle = buckets.begin(); idle != buckets.end();) {
+                idle = now - idle->second.refilled > IDLE_AFTER ? buckets.erase(idle) : std::next(idle);
+            }
+        }
+        it = buckets.emplace(client, Bucket{burst, now}).first;
+    }
+    Bucket& bucket = it->second;
+    std::chrono::duration<double> elapsed = now - bucket.refilled;
+    bucket.tokens = std::min(burst, bucket.tokens + elapsed.count() * rate);
+    bucket.refilled = now;
+
+    double needed = std::min(static_cast<double>(ops), burst);
+    if (bucket.tokens >= needed) {
+        bucket.tokens -= static_cast<double>(ops);
+        return 0;
+    }
+    return static_cast<uint32_t>(std::ceil((needed - bucket.tokens) / rate * 1000.0));
+}
+
+KVSendWindows::KVSendWindows(std::size_t max_window) : max_window(static_cast<double>(std::max<std::size_t>(max_window, 1))) {}
+
+void KVSendWindows::setMaxWindow(std::size_t new_max_window) {
+    std::lock_guard<std::mutex> lock(mutex);
+    max_window = static_cast<double>(std::max<std::size_t>(new_max_window, 1));
+    for (auto& entry : windows) {
+        entry.second = std::min(entry.second, max_window);
+    }
+}
+
+std::size_t KVSendWindows::get(const std::string& endpoint) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = windows.find(endpoint);
+    return static_cast<std::size_t>(it == windows.end() ? max_window : it->second);
+}
+
+void KVSendWindows::onAccepted(const std::string& endpoint, std::size_t ops) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = windows.find(endpoint);
+    if (it == windows.end()) {
+        return;   // Never reduced: already at max_window
+    }
+    it->second = std::min(max_window, it->second + INCREASE * static_cast<double>(ops) / it->second);
+    if (it->second >= max_window) {
+        windows.erase(it);
+    }
+}
+
+void KVSendWindows::onOverloaded(const std::string& endpoint) {
+    rejection_count.fetch_add(1, std::memory_order_relaxed);
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = windows.emplace(endpoint, max_window).first;
+    it->second = std::max(1.0, it->second / 2);
+}
+
+std::unordered_map<std::string, std::size_t> KVSendWindows::snapshot() {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::unordered_map<std::string, std::size_t> result;
+    for (const auto& entry : windows) {
+        result[entry.first] = static_cast<std::size_t>(entry.second);
+    }
+    return result;
+}
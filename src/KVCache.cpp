@@ -0,0 +1,121 @@
+#include "KVCache.hpp"
+#include <algorithm>
+
+KVCache::KVCache(std::size_t capacity, std::size_t shard_count) {
+    shard_count = std::max<std::size_t>(shard_count, 1);
+    std::size_t per_shard = std::max<std::size_t>((capacity + shard_count - 1) / shard_count, 1);
+    for (std::size_t i = 0; i < shard_count; ++i) {
+        auto shard = std::make_unique<Shard>();
+        shard->slots.resize(per_shard);
+        shard->index.reserve(per_shard);
+        shards.push_back(std::move(shard));
+    }
+}
+
+KVCache::Shard& KVCache::shardFor(int key) {
+    // Mix the key so sequential ids do not all land in neighbouring shards
+    uint64_t h = static_cast<uint32_t>(key);
+    h ^= h >> 16;
+    h *= 0x45d9f3bULL;
+    h ^= h >> 16;
+    return *shards[h % shards.size()];
+}
+
+bool KVCache::get(int key, std::string& value) {
+    Shard& shard = shardFor(key);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+
+    auto it = shard.index.find(key);
+    if (it == shard.index.end()) {
+        miss_count.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    Slot& slot = shard.slots[it->second];
+    if (Clock::now() >= slot.expires_at) {
+        // Lease ran out: the owner may already have applied a write
+        slot.occupied = false;
+        slot.value.clear();
+        shard.index.erase(it);
+        miss_count.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    slot.referenced = true;
+    value = slot.value;
+    hit_count.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+std::size_t KVCache::findVictim(Shard& shard, Clock::time_point now) {
+    // Two sweeps are enough to clear every reference bit and find a victim
+    std::size_t n = shard.slots.size();
+    for (std::size_t step = 0; step < 2 * n; ++step) {
+        std::size_t pos = shard.hand;
+        shard.hand = (shard.hand + 1) % n;
+
+        Slot& slot = shard.slots[pos];
+        if (!slot.occupied || now >= slot.expires_at || !slot.referenced) {
+            return pos;
+        }
+        slot.referenced = false;
+    }
+    return shard.hand;
+}
+
+void KVCache::put(int key, const std::string& value, Clock::time_point expires_at) {
+    Clock::time_point now = Clock::now();
+    if (expires_at <= now) {
+        return;
+    }
+
+    Shard& shard = shardFor(key);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+
+    auto it = shard.index.find(key);
+    if (it != shard.index.end()) {
+        Slot& slot = shard.slots[it->second];
+        slot.value = value;
+        slot.expires_at = expires_at;
+        slot.referenced = true;
+        return;
+    }
+
+    std::size_t pos = findVictim(shard, now);
+    Slot& slot = shard.slots[pos];
+    if (slot.occupied) {
+        shard.index.erase(slot.key);
+    }
+    slot.key = key;
+    slot.value = value;
+    slot.expires_at = expires_at;
+    slot.referenced = false;
+    slot.occupied = true;
+    shard.index[key] = pos;
+}
+
+void KVCache::invalidate(int key) {
+    Shard& shard = shardFor(key);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+
+    auto it = shard.index.find(key);
+    if (it != shard.index.end()) {
+        Slot& slot = shard.slots[it->second];
+        slot.occupied = false;
+        slot.value.clear();
+        shard.index.erase(it);
+    }
+}
+
+void KVCache::clear() {
+    for (auto& shard : shards) {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        for (auto& slot : shard->slots) {
+            slot.occupied = false;
+            slot.referenced = false;
+            slot.value.clear();
+        }
+        shard->index.clear();
+        shard->hand = 0;
+    }
+}
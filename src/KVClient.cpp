@@ -1,78 +1,405 @@
 #include "KVClient.hpp"
 #include <chrono>
 #include <ctime>
+#include <thread>
 #include <thallium/serialization/stl/string.hpp>
+#include <thallium/serialization/stl/vector.hpp>
 #include "KVStore.hpp"
+namespace {
+// Lets the progress loop run while polling. Application threads are not Argobots
+// threads, and for them tl::thread::yield() has nothing to yield to.
+void yieldThread() {
+        ABT_unit_type type = ABT_UNIT_TYPE_EXT;
+        if (ABT_self_get_type(&type) == ABT_SUCCESS && type != ABT_UNIT_TYPE_EXT) {
+                tl::thread::yield();
+        } else {
+                std::this_thread::yield();
+        }
+}
+}  // namespace
 KVClient::KVClient(const std::string& protocol, uint16_t provider_id)
         :myEngine(protocol, THALLIUM_CLIENT_MODE),provider_id(provider_id) {
                 std::cout << "[DEBUG] Thallium initialized with protocol: " << protocol << std::endl;
+                defineRpcs();
+        }
+KVClient::KVClient(const std::string& protocol, uint16_t provider_id, const std::string& margo_config)
+        :myEngine(protocol, THALLIUM_CLIENT_MODE, margo_config),provider_id(provider_id) {
+                defineRpcs();
+        }
+// Defined once and shared by every thread: registering an RPC takes Margo's locks
+void KVClient::defineRpcs() {
+        remote_kv_request = std::make_unique<tl::remote_procedure>(myEngine.define("kv_request"));
+        remote_kv_batch = std::make_unique<tl::remote_procedure>(myEngine.define("kv_batch"));
+        remote_kv_get_map = std::make_unique<tl::remote_procedure>(myEngine.define("kv_get_map"));
+        remote_kv_set_map = std::make_unique<tl::remote_procedure>(myEngine.define("kv_set_map"));
+        remote_kv_range_stats = std::make_unique<tl::remote_procedure>(myEngine.define("kv_range_stats"));
+        remote_kv_hot_keys = std::make_unique<tl::remote_procedure>(myEngine.define("kv_hot_keys"));
+        remote_kv_replication_status = std::make_unique<tl::remote_procedure>(myEngine.define("kv_replication_status"));
+        remote_kv_stats = std::make_unique<tl::remote_procedure>(myEngine.define("kv_stats"));
+        remote_kv_trace = std::make_unique<tl::remote_procedure>(myEngine.define("kv_trace"));
+        remote_kv_memory = std::make_unique<tl::remote_procedure>(myEngine.define("kv_memory"));
+}
+// Addresses are resolved once per server and shared by all threads; most calls
+// only take the read lock
+tl::endpoint KVClient::lookup(const std::string& server_endpoint) {
+        {
+                std::shared_lock<std::shared_mutex> lock(endpoint_mutex);
+                auto it = endpoints.find(server_endpoint);
+                if (it != endpoints.end()) {
+                        return it->second;
+                }
         }
-std::string KVClient::fetch(int key, std::string& server_endpoint) {
-        std::string value = "";
-        try{
-                std::cout << "Key not found locally. Fetching from server.\n";
-                tl::remote_procedure remote_kv_fetch = myEngine.define("kv_fetch");
-                tl::endpoint server_ep = myEngine.lookup(server_endpoint);
+        tl::endpoint server_ep = myEngine.lookup(server_endpoint);
+        std::unique_lock<std::shared_mutex> lock(endpoint_mutex);
+        return endpoints.emplace(server_endpoint, server_ep).first->second;
+}
+// After a failure the server may have restarted at the same address: resolve it again next time
+void KVClient::forget(const std::string& server_endpoint) {
+        std::unique_lock<std::shared_mutex> lock(endpoint_mutex);
+        endpoints.erase(server_endpoint);
+}
+void KVClient::setBackpressure(std::size_t window, uint32_t retries) {
+        windows.setMaxWindow(window);
+        max_retries = retries;
+}
+void KVClient::setTimeout(uint32_t new_timeout_ms, bool propagate) {
+        timeout_ms = new_timeout_ms;
+        propagate_deadlines = propagate && new_timeout_ms > 0;
+}
+KvOp KVClient::prepare(const KvOp& op) const {
+        KvOp stamped = op;
+        if (propagate_deadlines) {
+                stamped.deadline_us = WallClockMicros() + static_cast<uint64_t>(timeout_ms.load() * 1000);
+        }
+        if (uint64_t trace_id = CurrentTraceId()) {
+                stamped.trace_id = trace_id;
+                stamped.trace_sent_ns = TraceNowNs();
+        }
+        return stamped;
+}
+KvReply KVClient::call(const KvOp& op, const std::string& server_endpoint) {
+        KvReply reply;
+        try {
+                KvTraceSpan lookup_span("client.lookup_endpoint", op.key);
+                tl::endpoint server_ep = lookup(server_endpoint);
+                lookup_span.end();
                 tl::provider_handle ph(server_ep, provider_id);
                 std::chrono::time_point<std::chrono::system_clock> start, end;
                 start = std::chrono::system_clock::now();
-                value = remote_kv_fetch.on(ph)(key).as<std::string>();
+                for (uint32_t attempt = 0;; ++attempt) {
+                        // Encoding, Mercury both ways and the server's work; decoding the reply apart
+                        KvTraceSpan rpc_span("client.rpc", op.key);
+                        auto response = forward(remote_kv_request->on(ph), epoch.load(), prepare(op));
+                        rpc_span.end();
+                        KvTraceSpan decode_span("client.decode_reply", op.key);
+                        reply = response.as<KvReply>();
+                        decode_span.end();
+                        if (reply.status != KvStatus::OVERLOADED) {
+                                windows.onAccepted(server_endpoint, 1);
+                                break;
+                        }
+                        // Back off as the server asked, unless that would outlast the timeout
+                        windows.onOverloaded(server_endpoint);
+                        std::chrono::duration<double, std::milli> waited = std::chrono::system_clock::now() - start;
+                        double timeout = timeout_ms.load();
+                        if (attempt >= max_retries || (timeout > 0 && waited.count() + reply.retry_after_ms > timeout)) {
+                                break;
+                        }
+                        std::this_thread::sleep_for(std::chrono::milliseconds(reply.retry_after_ms));
+                }
                 end = std::chrono::system_clock::now();
                 std::chrono::duration<double, std::milli> elapsed_seconds = end - start;
-                std::cout << "Key Found on the Server.\n";
-                std::cout << key << "->" << value << '\n';
+                std::cout << "Remote " << KvOpTypeName(op.type) << " of " << op.key << ": "
+                          << KvStatusName(reply.status) << std::endl;
                 std::cout << "elapsed time: " << elapsed_seconds.count() << " ms" << std::endl;
-        } catch (const std::exception &e) {
-                std::cerr << "Fetch operation failed: " << e.what() << std::endl;
-                return e.what();
+        } catch (const tl::timeout&) {
+                std::cerr << "Remote " << KvOpTypeName(op.type) << " of " << op.key << " timed out after "
+                          << timeout_ms.load() << " ms" << std::endl;
+                reply.status = KvStatus::DEADLINE_EXCEEDED;
+        } catch (const std::exception& e) {
+                std::cerr << "Remote " << KvOpTypeName(op.type) << " of " << op.key << " failed: " << e.what() << std::endl;
+                reply.status = KvStatus::UNAVAILABLE;
+                forget(server_endpoint);
         }
-        return value;
+        return reply;
 }
-void KVClient::insert(int key, const std::string value, const std::string& server_endpoint) {
+KvReply KVClient::callHedged(const KvOp& op, const std::string& server_endpoint, const KvOp& hedge_op,
+                             const std::string& hedge_endpoint, double hedge_after_ms, bool& hedged, bool& hedge_won) {
+        hedged = false;
+        hedge_won = false;
+        auto start = std::chrono::steady_clock::now();
+        uint64_t request_epoch = epoch.load();
+
+        // Outcome of one of the two requests once it completed
+        auto collect = [&](tl::async_response& response, const KvOp& sent, KvReply& reply) {
+                try {
+                        reply = response.wait().as<KvReply>();
+                } catch (const tl::timeout&) {
+                        reply.status = KvStatus::DEADLINE_EXCEEDED;
+                } catch (const std::exception& e) {
+                        std::cerr << "Remote " << KvOpTypeName(sent.type) << " of " << sent.key << " failed: "
+                                  << e.what() << std::endl;
+                        reply.status = KvStatus::UNAVAILABLE;
+                }
+        };
+
+        std::vector<tl::async_response> responses;   // [0] the owner, [1] the hedge once sent
+        responses.reserve(2);
+        KvReply primary_reply;
+        bool primary_done = false;
         try {
-                tl::remote_procedure remote_kv_insert = myEngine.define("kv_insert");
-                tl::endpoint server_ep = myEngine.lookup(server_endpoint);
+                tl::provider_handle ph(lookup(server_endpoint), provider_id);
+                responses.push_back(forwardAsync(remote_kv_request->on(ph), request_epoch, prepare(op)));
+        } catch (const std::exception&) {
+                primary_reply.status = KvStatus::UNAVAILABLE;
+                primary_done = true;
+        }
+        KvReply hedge_reply;
+        bool hedge_done = false;
+
+        // Polls rather than blocks so the hedge can be sent while the first request
+        // is outstanding; yielding lets the progress loop run in between
+        while (true) {
+                if (!primary_done && responses[0].received()) {
+                        collect(responses[0], op, primary_reply);
+                        primary_done = true;
+                }
+                bool primary_failed = primary_done && (primary_reply.status == KvStatus::UNAVAILABLE ||
+                                                       primary_reply.status == KvStatus::DEADLINE_EXCEEDED ||
+                                                       primary_reply.status == KvStatus::OVERLOADED);
+                if (primary_done && !primary_failed) {
+                        return primary_reply;
+                }
+                if (hedged && !hedge_done && responses.back().received()) {
+                        collect(responses.back(), hedge_op, hedge_reply);
+                        hedge_done = true;
+                        if (hedge_reply.status == KvStatus::OK || hedge_reply.status == KvStatus::NOT_FOUND) {
+                                hedge_won = true;
+                                return hedge_reply;
+                        }
+                }
+                // An unreachable owner is hedged at once; one that timed out used up the caller's time
+                bool may_hedge = !hedged && !hedge_endpoint.empty() &&
+                                 primary_reply.status != KvStatus::DEADLINE_EXCEEDED;
+                if (primary_done && !may_hedge && (!hedged || hedge_done)) {
+                        return primary_reply;
+                }
+                double waited = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+                if (may_hedge && (primary_done || waited >= hedge_after_ms)) {
+                        hedged = true;
+                        try {
+                                tl::provider_handle ph(lookup(hedge_endpoint), provider_id);
+                                responses.push_back(forwardAsync(remote_kv_request->on(ph), request_epoch, prepare(hedge_op)));
+                        } catch (const std::exception&) {
+                                hedge_reply.status = KvStatus::UNAVAILABLE;
+                                hedge_done = true;
+                        }
+                        continue;
+                }
+                yieldThread();
+        }
+}
+KvReply KVClient::fetch(int key, uint32_t lease_ms, const std::string& server_endpoint) {
+        KvOp op;
+        op.type = KvOpType::FETCH;
+        op.key = key;
+        op.lease_ms = lease_ms;
+        return call(op, server_endpoint);
+}
+KvReply KVClient::insert(int key, const std::string& value, const std::string& server_endpoint) {
+        return call(KvOp{KvOpType::INSERT, key, value}, server_endpoint);
+}
+KvReply KVClient::update(int key, const std::string& value, const std::string& server_endpoint) {
+        return call(KvOp{KvOpType::UPDATE, key, value}, server_endpoint);
+}
+KvReply KVClient::deleteKey(int key, const std::string& server_endpoint) {
+        return call(KvOp{KvOpType::DELETE, key, ""}, server_endpoint);
+}
+// Each group is sent in chunks of at most its server's window, one chunk per
+// server in flight, all servers in parallel. A server admits or rejects a whole
+// chunk, so a rejected chunk is resent as it was and the ops of a group are still
+// applied in order.
+std::vector<BatchResult> KVClient::batchAll(const std::vector<std::pair<std::string, std::vector<KvOp>>>& groups) {
+        std::vector<BatchResult> results(groups.size());
+        uint64_t request_epoch = epoch.load();
+        std::chrono::time_point<std::chrono::system_clock> start, end;
+        start = std::chrono::system_clock::now();
+
+        std::vector<std::size_t> next(groups.size(), 0);        // First op of each group not yet answered
+        std::vector<uint32_t> retries(groups.size(), 0);
+        std::vector<bool> failed(groups.size(), false);
+        for (std::size_t i = 0; i < groups.size(); ++i) {
+                results[i].replies.resize(groups[i].second.size());
+        }
+        while (true) {
+                std::vector<tl::async_response> requests;
+                std::vector<std::pair<std::size_t, std::size_t>> chunks;   // (group, op count) per request
+                for (std::size_t i = 0; i < groups.size(); ++i) {
+                        const std::vector<KvOp>& group_ops = groups[i].second;
+                        if (failed[i] || next[i] >= group_ops.size()) {
+                                continue;
+                        }
+                        std::size_t count = std::min(group_ops.size() - next[i], windows.get(groups[i].first));
+                        try {
+                                tl::endpoint server_ep = lookup(groups[i].first);
+                                tl::provider_handle ph(server_ep, provider_id);
+                                std::vector<KvOp> ops(group_ops.begin() + next[i], group_ops.begin() + next[i] + count);
+                                if (propagate_deadlines) {
+                                        uint64_t deadline_us = prepare(KvOp{}).deadline_us;
+                                        for (KvOp& op : ops) {
+                                                op.deadline_us = deadline_us;
+                                        }
+                                }
+                                requests.push_back(forwardAsync(remote_kv_batch->on(ph), request_epoch, ops));
+                                chunks.emplace_back(i, count);
+                        } catch (const std::exception& e) {
+                                results[i].error = e.what();
+                                failed[i] = true;
+                        }
+                }
+                if (requests.empty()) {
+                        break;
+                }
+
+                uint32_t backoff_ms = 0;
+                for (std::size_t j = 0; j < requests.size(); ++j) {
+                        std::size_t i = chunks[j].first;
+                        std::size_t count = chunks[j].second;
+                        BatchResult& result = results[i];
+                        try {
+                                std::vector<KvReply> replies = requests[j].wait().as<std::vector<KvReply>>();
+                                replies.resize(count);
+                                if (!replies.empty() && replies[0].status == KvStatus::OVERLOADED &&
+                                    retries[i] < max_retries) {
+                                        windows.onOverloaded(groups[i].first);
+                                        backoff_ms = std::max(backoff_ms, replies[0].retry_after_ms);
+                                        ++retries[i];
+                                        continue;   // Resent in the next round
+                                }
+                                windows.onAccepted(groups[i].first, count);
+                                std::move(replies.begin(), replies.end(), result.replies.begin() + next[i]);
+                                next[i] += count;
+                        } catch (const tl::timeout&) {
+                                result.error = "timed out";
+                                result.timed_out = true;
+                                failed[i] = true;
+                        } catch (const std::exception& e) {
+                                result.error = e.what();
+                                failed[i] = true;
+                                forget(groups[i].first);
+                        }
+                }
+                if (backoff_ms > 0) {
+                        std::this_thread::sleep_for(std::chrono::milliseconds(backoff_ms));
+                }
+        }
+
+        // If part of a group got through, its answered replies stand and only the rest fail
+        for (std::size_t i = 0; i < groups.size(); ++i) {
+                if (failed[i] && next[i] > 0) {
+                        KvStatus status = results[i].timed_out ? KvStatus::DEADLINE_EXCEEDED : KvStatus::UNAVAILABLE;
+                        for (std::size_t k = next[i]; k < results[i].replies.size(); ++k) {
+                                results[i].replies[k].status = status;
+                        }
+                        results[i].error.clear();
+                        results[i].timed_out = false;
+                }
+        }
+
+        end = std::chrono::system_clock::now();
+        std::chrono::duration<double, std::milli> elapsed_seconds = end - start;
+        std::cout << "Batches sent to " << groups.size() << " servers" << std::endl;
+        std::cout << "elapsed time: " << elapsed_seconds.count() << " ms" << std::endl;
+        return results;
+}
+bool KVClient::getClusterMap(const std::string& server_endpoint, ClusterMap& map) {
+        try {
+                tl::endpoint server_ep = lookup(server_endpoint);
                 tl::provider_handle ph(server_ep, provider_id);
-                std::chrono::time_point<std::chrono::system_clock> start, end;
-                start = std::chrono::system_clock::now();
-                remote_kv_insert.on(ph)(key, value);
-                end = std::chrono::system_clock::now();
-                std::chrono::duration<double, std::milli> elapsed_seconds = end - start;
-                std::cout << "Inserted on the server successfully: " << key << " -> " << value << std::endl;
-                std::cout << "elapsed time: " << elapsed_seconds.count() << " ms" << std::endl;
+                map = forward(remote_kv_get_map->on(ph)).as<ClusterMap>();
+                return true;
         } catch (const std::exception& e) {
-                std::cerr << "Insert operation failed: " << e.what() << std::endl;
+                std::cerr << "Fetching cluster map from " << server_endpoint << " failed: " << e.what() << std::endl;
+                return false;
         }
 }
-void KVClient::update(int key, const std::string value, const std::string& server_endpoint) {
+uint64_t KVClient::publishClusterMap(const std::string& server_endpoint, const ClusterMap& map, int node_id) {
         try {
-                tl::remote_procedure remote_kv_update = myEngine.define("kv_update");
-                tl::endpoint server_ep = myEngine.lookup(server_endpoint);
+                tl::endpoint server_ep = lookup(server_endpoint);
                 tl::provider_handle ph(server_ep, provider_id);
-                std::chrono::time_point<std::chrono::system_clock> start, end;
-                start = std::chrono::system_clock::now();
-                remote_kv_update.on(ph)(key, value);
-                end = std::chrono::system_clock::now();
-                std::chrono::duration<double, std::milli> elapsed_seconds = end - start;
-                std::cout << "Updated successfully: " << key << " -> " << value << std::endl;
-                std::cout << "elapsed time: " << elapsed_seconds.count() << " ms" << std::endl;
+                return forward(remote_kv_set_map->on(ph), map, node_id).as<uint64_t>();
         } catch (const std::exception& e) {
-                std::cerr << "Update operation failed: " << e.what() << std::endl;
+                std::cerr << "Publishing cluster map to " << server_endpoint << " failed: " << e.what() << std::endl;
+                return 0;
         }
 }
-void KVClient::deleteKey(int key, const std::string& server_endpoint) {
+bool KVClient::getRangeStats(const std::string& server_endpoint, RangeReport& report) {
         try {
-                tl::remote_procedure remote_kv_delete = myEngine.define("kv_delete");
-                tl::endpoint server_ep = myEngine.lookup(server_endpoint);
+                tl::endpoint server_ep = lookup(server_endpoint);
                 tl::provider_handle ph(server_ep, provider_id);
-                std::chrono::time_point<std::chrono::system_clock> start, end;
-                start = std::chrono::system_clock::now();
-                remote_kv_delete.on(ph)(key);
-                end = std::chrono::system_clock::now();
-                std::chrono::duration<double, std::milli> elapsed_seconds = end - start;
-                std::cout << "Deleted successfully: " << key << std::endl;
-                std::cout << "elapsed time: " << elapsed_seconds.count() << " ms" << std::endl;
+                report = forward(remote_kv_range_stats->on(ph)).as<RangeReport>();
+                return true;
+        } catch (const std::exception& e) {
+                std::cerr << "Fetching range stats from " << server_endpoint << " failed: " << e.what() << std::endl;
+                return false;
+        }
+}
+
+bool KVClient::getHotKeys(const std::string& server_endpoint, uint32_t limit, HotKeyReport& report) {
+        try {
+                tl::endpoint server_ep = lookup(server_endpoint);
+                tl::provider_handle ph(server_ep, provider_id);
+                report = forward(remote_kv_hot_keys->on(ph), limit).as<HotKeyReport>();
+                return true;
+        } catch (const std::exception& e) {
+                std::cerr << "Fetching hot keys from " << server_endpoint << " failed: " << e.what() << std::endl;
+                return false;
+        }
+}
+
+bool KVClient::getReplicationStatus(const std::string& server_endpoint, ReplicationStatus& status) {
+        try {
+                tl::endpoint server_ep = lookup(server_endpoint);
+                tl::provider_handle ph(server_ep, provider_id);
+                status = forward(remote_kv_replication_status->on(ph)).as<ReplicationStatus>();
+                return true;
+        } catch (const std::exception& e) {
+                std::cerr << "Fetching replication status from " << server_endpoint << " failed: " << e.what() << std::endl;
+                return false;
+        }
+}
+
+bool KVClient::getStats(const std::string& server_endpoint, KvStatsReport& report) {
+        try {
+                tl::endpoint server_ep = lookup(server_endpoint);
+                tl::provider_handle ph(server_ep, provider_id);
+                report = forward(remote_kv_stats->on(ph)).as<KvStatsReport>();
+                return true;
+        } catch (const std::exception& e) {
+                std::cerr << "Fetching stats from " << server_endpoint << " failed: " << e.what() << std::endl;
+                return false;
+        }
+}
+bool KVClient::getTraceEvents(const std::string& server_endpoint, bool clear, std::string& events) {
+        try {
+                tl::endpoint server_ep = lookup(server_endpoint);
+                tl::provider_handle ph(server_ep, provider_id);
+                events = forward(remote_kv_trace->on(ph), clear).as<std::string>();
+                return true;
+        } catch (const std::exception& e) {
+                std::cerr << "Fetching trace from " << server_endpoint << " failed: " << e.what() << std::endl;
+                return false;
+        }
+}
+
+bool KVClient::getMemoryProfile(const std::string& server_endpoint, MemoryProfile& profile) {
+        try {
+                tl::endpoint server_ep = lookup(server_endpoint);
+                tl::provider_handle ph(server_ep, provider_id);
+                profile = forward(remote_kv_memory->on(ph)).as<MemoryProfile>();
+                return true;
         } catch (const std::exception& e) {
-                std::cerr << "Delete operation failed: " << e.what() << std::endl;
+                std::cerr << "Fetching memory profile from " << server_endpoint << " failed: " << e.what() << std::endl;
+                return false;
         }
 }
@@ -1,31 +1,245 @@
 #include "KVDistributor.hpp"
+#include <algorithm>
 #include <iostream>
+#include <limits>
+
+namespace {
+
+// A MOVED reply makes the client adopt a newer map and retry; bounded in case
+// servers disagree about who owns a key
+const int MAX_REDIRECTS = 3;
+
+// Tells distributors apart in the per-thread routing copies
+std::atomic<uint64_t> next_instance_id{1};
+
+int64_t steadyNanos(std::chrono::steady_clock::time_point time) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(time.time_since_epoch()).count();
+}
+
+}  // namespace
+
+std::string KVDistributor::Routing::endpointOf(int node_id) const {
+    auto it = node_to_ip.find(node_id);
+    return it == node_to_ip.end() ? "" : it->second;
+}
+
+bool KVDistributor::Routing::writesViaServer() const {
+    return map.current.replicas > 1 && map.current.wait_for_backups;
+}
 
 KVDistributor::KVDistributor(KvStore& kv_store, const Config& config)
-    : kv(kv_store),
-      config(config),  // bind config reference
-      count_of_node(config.read_count()),
-      protocol(config.read_protocol()),
+    : protocol(config.read_protocol()),
       provider_id(1),
-      kv_client(protocol, 1) {
+      kv_client(protocol, 1, MargoConfigJson(config.read_progress_config())),
+      kv(kv_store),
+      config(config),  // bind config reference
+      instance_id(next_instance_id++) {
      //std::cout<<protocol<<"  "<<provider_id<<'\n';
-    for (int i = 0; i < count_of_node; ++i) {
-        std::string endpoint = config.get_endpoint(i);
-        node_to_ip[i] = endpoint;
+    // Start from the local config (epoch 0); a map published to the servers
+    // replaces it on the first refresh
+    ClusterMap initial;
+    initial.current = PlacementSpecFromConfig(config);
+    applyClusterMap(std::move(initial));
+    refresh_ms = config.read_membership_config().refresh_ms;
+    range_config = config.read_range_config();
+    last_refresh = std::chrono::steady_clock::now();
+    last_range_check = std::chrono::steady_clock::now();
+
+    CacheConfig cache_config = config.read_cache_config();
+    if (cache_config.enabled) {
+        cache_storage = std::make_unique<KVCache>(cache_config.capacity, cache_config.shards);
+        active_cache = cache_storage.get();
+        cache_all = true;
+        lease_ms = cache_config.lease_ms;
+        std::cout << "[KVDistributor] Remote read cache enabled: " << cache_config.capacity
+                  << " entries, " << lease_ms << " ms leases" << std::endl;
+    }
+    replication_config = config.read_replication_config();
+    deadline_config = config.read_deadline_config();
+    kv_client.setTimeout(deadline_config.timeout_ms, deadline_config.propagate);
+    if (deadline_config.timeout_ms > 0) {
+        std::cout << "[KVDistributor] RPCs time out after " << deadline_config.timeout_ms << " ms"
+                  << (deadline_config.propagate ? ", deadlines sent to servers" : "") << std::endl;
+    }
+    setHedging(deadline_config.hedge);
+    AdmissionConfig admission = config.read_admission_config();
+    kv_client.setBackpressure(admission.window, admission.max_retries);
+    hot_config = config.read_hot_key_config();
+    last_hot_refresh = std::chrono::steady_clock::now();
+    if (hot_config.enabled) {
+        setHotKeyCaching(true);
+    }
+
+    WriteBehindConfig write_behind = config.read_write_behind_config();
+    if (write_behind.enabled) {
+        write_buffer = std::make_unique<KVWriteBuffer>(
+            write_behind.batch_size, write_behind.flush_interval_ms, write_behind.max_pending,
+            [this](const KVWriteBuffer::Batches& batches) { return sendBatches(batches, true); });
+        std::cout << "[KVDistributor] Write-behind enabled: batches of " << write_behind.batch_size
+                  << ", flushed every " << write_behind.flush_interval_ms << " ms" << std::endl;
+    }
+    schedulePeriodic();
+}
+
+KVDistributor::~KVDistributor() {
+    {
+        // Stops and joins its thread, which also sends through sendBatches
+        std::lock_guard<std::mutex> map_lock(map_mutex);
+        rebalancer.reset();
+    }
+    // Its destructor sends what is still buffered through sendBatches, which needs
+    // the routing state declared after it
+    write_buffer.reset();
+}
+
+// Each thread keeps the snapshot it last used and checks one atomic per call to
+// see whether it is still current; the lock is only taken after a map change
+std::shared_ptr<const KVDistributor::Routing> KVDistributor::currentRouting() const {
+    struct Cached {
+        uint64_t instance = 0;
+        uint64_t version = 0;
+        std::shared_ptr<const Routing> routing;
+    };
+    thread_local Cached cached;
+    uint64_t version = routing_version.load(std::memory_order_acquire);
+    if (cached.instance != instance_id || cached.version != version) {
+        std::lock_guard<std::mutex> lock(routing_mutex);
+        cached.instance = instance_id;
+        cached.version = version;
+        cached.routing = routing;
+    }
+    return cached.routing;
+}
+
+// Called from the write buffer's flusher thread and the rebalancer's thread.
+// apply_local: ops whose key turns out to belong to this node are applied to the
+// local store (write-behind); otherwise they are left MOVED (rebalancing, which
+// must not delete its own copy after "moving" it onto itself).
+std::unordered_map<int, BatchResult> KVDistributor::sendBatches(const KVWriteBuffer::Batches& batches,
+                                                                bool apply_local) {
+    std::shared_ptr<const Routing> r = currentRouting();
+    std::vector<int> nodes;
+    std::vector<std::pair<std::string, std::vector<KvOp>>> groups;
+    for (const auto& entry : batches) {
+        nodes.push_back(entry.first);
+        groups.emplace_back(r->endpointOf(entry.first), entry.second);
+    }
+
+    std::vector<BatchResult> sent = kv_client.batchAll(groups);
+    std::unordered_map<int, BatchResult> results;
+    for (std::size_t i = 0; i < nodes.size(); ++i) {
+        if (!sent[i].error.empty()) {
+            std::cerr << "Error sending batch to node " << nodes[i] << ": " << sent[i].error << std::endl;
+        }
+        for (const KvReply& reply : sent[i].replies) {
+            noteEpoch(reply.epoch);
+        }
+        results[nodes[i]] = std::move(sent[i]);
+    }
+    uint64_t routed_epoch = r->map.epoch;
+    for (int attempt = 0; attempt < MAX_REDIRECTS && rerouteMoved(batches, results, apply_local, routed_epoch);
+         ++attempt) {
+    }
+    return results;
+}
+
+// Resends the ops of batches answered MOVED under the newest map carried by those
+// replies, and puts the new replies in their place in results. The map is only
+// used here, not installed: installing flushes the write buffer and replaces the
+// rebalancer, whose threads are the callers. A newer epoch was noted, so the next
+// foreground op installs it. routed_epoch is the newest epoch the ops were sent
+// under. Returns whether anything was resent.
+bool KVDistributor::rerouteMoved(const KVWriteBuffer::Batches& batches, std::unordered_map<int, BatchResult>& results,
+                                 bool apply_local, uint64_t& routed_epoch) {
+    ClusterMap newest;
+    for (const auto& entry : results) {
+        for (const KvReply& reply : entry.second.replies) {
+            ClusterMap map;
+            if (reply.status == KvStatus::MOVED && reply.epoch > newest.epoch && DecodeClusterMap(reply.value, map)) {
+                newest = std::move(map);
+            }
+        }
+    }
+    uint64_t epoch = newest.epoch;
+    if (epoch <= std::max(routed_epoch, current_epoch.load())) {
+        return false;
+    }
+    routed_epoch = epoch;
+    std::shared_ptr<Routing> r;
+    try {
+        r = makeRouting(std::move(newest));
+    } catch (const std::exception& e) {
+        std::cerr << "[KVDistributor] Cannot route by epoch " << epoch << ": " << e.what() << std::endl;
+        return false;
+    }
+
+    // (node id, position) of each resent op, grouped by its new owner
+    std::unordered_map<int, std::vector<std::pair<int, std::size_t>>> moved;
+    for (auto& entry : results) {
+        const std::vector<KvOp>& ops = batches.at(entry.first);
+        std::vector<KvReply>& replies = entry.second.replies;
+        for (std::size_t j = 0; j < replies.size() && j < ops.size(); ++j) {
+            if (replies[j].status != KvStatus::MOVED) {
+                continue;
+            }
+            int owner = r->nodeFor(ops[j].key);
+            if (owner != r->local_node_id) {
+                moved[owner].emplace_back(entry.first, j);
+            } else if (apply_local && !r->writesViaServer()) {
+                replies[j] = ExecuteOp(kv, ops[j]);
+            }
+        }
+    }
+    if (moved.empty()) {
+        return false;
     }
 
-    local_node_id = getLocalNodeId();
+    std::vector<int> owners;
+    std::vector<std::pair<std::string, std::vector<KvOp>>> groups;
+    for (const auto& entry : moved) {
+        std::vector<KvOp> ops;
+        for (const auto& position : entry.second) {
+            ops.push_back(batches.at(position.first)[position.second]);
+        }
+        owners.push_back(entry.first);
+        groups.emplace_back(r->endpointOf(entry.first), std::move(ops));
+    }
+    std::cout << "[KVDistributor] Resending ops of " << groups.size() << " batches under epoch " << r->map.epoch
+              << std::endl;
+    std::vector<BatchResult> sent = kv_client.batchAll(groups);
+    for (std::size_t g = 0; g < owners.size(); ++g) {
+        const auto& positions = moved[owners[g]];
+        for (std::size_t k = 0; k < positions.size(); ++k) {
+            KvReply& reply = results[positions[k].first].replies[positions[k].second];
+            if (!sent[g].error.empty() || k >= sent[g].replies.size()) {
+                reply = KvReply{};
+                reply.status = sent[g].timed_out ? KvStatus::DEADLINE_EXCEEDED : KvStatus::UNAVAILABLE;
+                continue;
+            }
+            noteEpoch(sent[g].replies[k].epoch);
+            reply = std::move(sent[g].replies[k]);
+        }
+    }
+    return true;
 }
 
-int KVDistributor::getNodeId(int key) {
-    return key % count_of_node;
+std::vector<WriteFailure> KVDistributor::flush() {
+    if (!write_buffer) {
+        return {};
+    }
+    return write_buffer->flush();
 }
 
-std::string KVDistributor::getNodeToIP(int node_id) {
-    return node_to_ip[node_id];
+bool KVDistributor::isLocal(int key) {
+    std::shared_ptr<const Routing> r = currentRouting();
+    return r->nodeFor(key) == r->local_node_id;
 }
 
-int KVDistributor::getLocalNodeId() {
+int KVDistributor::ownerOf(int key) {
+    return currentRouting()->nodeFor(key);
+}
+
+int KVDistributor::getLocalNodeId(const std::unordered_map<int, std::string>& node_to_ip) const {
     std::string local_ip = config.read_ip();
     for (const auto& pair : node_to_ip) {
         if (pair.second == local_ip) {
@@ -36,78 +250,1143 @@ int KVDistributor::getLocalNodeId() {
 }
 
 int KVDistributor::getNodeCount() {
-    return count_of_node;
+    return currentRouting()->count_of_node;
 }
 
-std::string KVDistributor::get(int key) {
-    int node_id = getNodeId(key);
-    //std::cout<<"get: "<<node_id<<"    "<<local_node_id<<std::endl;
-    std::string value;
-    if(node_id == local_node_id) {
-        value = kv.Find(key);
+void KVDistributor::noteEpoch(uint64_t epoch) {
+    uint64_t seen = newest_epoch_seen.load();
+    while (epoch > seen && !newest_epoch_seen.compare_exchange_weak(seen, epoch)) {
+    }
+}
+
+// Routing for map: placements, endpoints and this node's id in it
+std::shared_ptr<KVDistributor::Routing> KVDistributor::makeRouting(ClusterMap map) const {
+    auto next = std::make_shared<Routing>();
+    next->placement = map.current.build();
+    next->previous_placement = map.migrating ? map.previous.build() : nullptr;
+
+    // Departing nodes stay reachable while they are still previous owners
+    for (const MemberNode& node : map.previous.nodes) {
+        next->node_to_ip[node.node_id] = node.endpoint;
+    }
+    for (const MemberNode& node : map.current.nodes) {
+        next->node_to_ip[node.node_id] = node.endpoint;
+    }
+    next->count_of_node = static_cast<int>(map.current.nodes.size());
+    next->local_node_id = getLocalNodeId(next->node_to_ip);
+    if (map.epoch > 0 && next->node_to_ip.count(next->local_node_id) == 0) {
+        next->local_node_id = -1;   // This node has left the cluster
+    }
+    next->map = std::move(map);
+    return next;
+}
+
+// Installs map unconditionally: routing, node list, and the local rebalancer.
+// Threads still working under the old snapshot finish with it; a write they
+// send to a node that no longer owns the key comes back MOVED and is retried.
+void KVDistributor::applyClusterMap(ClusterMap map) {
+    std::lock_guard<std::mutex> map_lock(map_mutex);
+    std::shared_ptr<Routing> next = makeRouting(std::move(map));
+
+    // A running rebalance either completes (the map ends it) or is superseded
+    if (rebalancer) {
+        if (next->map.migrating) {
+            rebalancer->stop();
+        }
+        rebalancer->wait();
+        rebalancer.reset();
+    }
+    // Buffered writes were routed under the old map; apply them first. The buffer
+    // is bypassed while a rebalance is in progress.
+    if (write_buffer) {
+        std::vector<WriteFailure> failures = write_buffer->flush();
+        if (!failures.empty()) {
+            std::cerr << "[KVDistributor] " << failures.size() << " buffered writes failed before epoch "
+                      << next->map.epoch << std::endl;
+        }
+    }
+
+    const Routing& installed = *next;
+    {
+        std::lock_guard<std::mutex> lock(routing_mutex);
+        routing = std::move(next);
+    }
+    routing_version.fetch_add(1, std::memory_order_release);
+    current_epoch = installed.map.epoch;
+    kv_client.setEpoch(installed.map.epoch);
+    next_periodic_ns = 0;   // The strategy may have changed: recompute what is due
+    if (KVCache* values = cache()) {
+        values->clear();
+    }
+
+    std::cout << "[KVDistributor] Epoch " << installed.map.epoch << ": " << installed.placement->name()
+              << " placement over " << installed.count_of_node << " nodes"
+              << (installed.map.migrating ? ", rebalancing" : "") << std::endl;
+
+    if (installed.map.migrating && installed.local_node_id >= 0) {
+        RebalanceConfig rebalance_config = config.read_rebalance_config();
+        rebalancer = std::make_unique<KVRebalancer>(
+            kv, installed.placement, installed.local_node_id, rebalance_config.batch_size,
+            rebalance_config.max_keys_per_sec, rebalance_config.max_passes,
+            [this](const KVRebalancer::Batches& batches) { return sendBatches(batches, false); });
+        rebalancer->start();
+    }
+}
+
+bool KVDistributor::adoptClusterMap(const ClusterMap& map) {
+    if (map.epoch <= current_epoch.load()) {
+        return false;
+    }
+    try {
+        applyClusterMap(map);
+        return true;
+    } catch (const std::exception& e) {
+        std::cerr << "[KVDistributor] Ignoring cluster map epoch " << map.epoch << ": " << e.what() << std::endl;
+        return false;
+    }
+}
+
+bool KVDistributor::refreshClusterMap(const std::string& endpoint) {
+    ClusterMap map;
+    return kv_client.getClusterMap(endpoint, map) && adoptClusterMap(map);
+}
+
+// Asks the local server for its map every refresh_ms, and straight away once any
+// reply has shown that a newer epoch exists. On most calls this is two atomic
+// loads; a thread that finds work due while another is doing it carries on.
+void KVDistributor::maybeRefresh() {
+    bool hinted = newest_epoch_seen.load(std::memory_order_relaxed) > current_epoch.load(std::memory_order_relaxed);
+    if (!hinted && steadyNanos(std::chrono::steady_clock::now()) < next_periodic_ns.load(std::memory_order_relaxed)) {
+        return;
+    }
+    std::unique_lock<std::mutex> lock(refresh_mutex, std::try_to_lock);
+    if (!lock.owns_lock()) {
+        return;
+    }
+    auto now = std::chrono::steady_clock::now();
+    bool due = refresh_ms > 0 && now - last_refresh >= std::chrono::milliseconds(refresh_ms);
+    if (hinted || due) {
+        last_refresh = now;
+        refreshClusterMap(config.read_ip());
+    }
+    maybeRebalanceRanges();
+    if (hot_caching && hot_config.refresh_ms > 0 &&
+        std::chrono::steady_clock::now() - last_hot_refresh >= std::chrono::milliseconds(hot_config.refresh_ms)) {
+        last_hot_refresh = std::chrono::steady_clock::now();
+        refreshHotKeys();
+    }
+    schedulePeriodic();
+}
+
+// Earliest time one of the periodic tasks is due; called with refresh_mutex held
+// or before other threads exist
+void KVDistributor::schedulePeriodic() {
+    auto next = std::chrono::steady_clock::time_point::max();
+    if (refresh_ms > 0) {
+        next = std::min(next, last_refresh + std::chrono::milliseconds(refresh_ms));
+    }
+    if (hot_caching && hot_config.refresh_ms > 0) {
+        next = std::min(next, last_hot_refresh + std::chrono::milliseconds(hot_config.refresh_ms));
+    }
+    if (range_config.check_interval_ms > 0) {
+        next = std::min(next, last_range_check + std::chrono::milliseconds(range_config.check_interval_ms));
+    }
+    next_periodic_ns = next == std::chrono::steady_clock::time_point::max() ? std::numeric_limits<int64_t>::max()
+                                                                             : steadyNanos(next);
+}
+
+// Only the lowest-numbered node checks on its own, so two clients never publish
+// competing range tables for the same epoch
+void KVDistributor::maybeRebalanceRanges() {
+    std::shared_ptr<const Routing> r = currentRouting();
+    if (range_config.check_interval_ms == 0 || r->map.current.strategy != "range" ||
+        r->map.current.nodes.empty() ||
+        std::chrono::steady_clock::now() - last_range_check < std::chrono::milliseconds(range_config.check_interval_ms)) {
+        return;
+    }
+    last_range_check = std::chrono::steady_clock::now();
+    int coordinator = r->map.current.nodes.front().node_id;
+    for (const MemberNode& node : r->map.current.nodes) {
+        coordinator = std::min(coordinator, node.node_id);
+    }
+    if (coordinator == r->local_node_id) {
+        rebalanceRanges();
+    }
+}
+
+// Every remote single-key request goes through here. A MOVED reply carries the
+// newer map, which is adopted so the caller can retry with fresh routing.
+KvReply KVDistributor::callRemote(const Routing& r, int node_id, const KvOp& op) {
+    const std::string endpoint = r.endpointOf(node_id);
+    KvReply reply = kv_client.call(op, endpoint);
+    if (reply.status == KvStatus::DEADLINE_EXCEEDED) {
+        ++deadlines_exceeded;
+    }
+    observeReply(reply, endpoint);
+    return reply;
+}
+
+// Remote read from a key's owner, timed for the hedge delay. With hedging on, the
+// read is also sent to one of the owner's backups (in turn) if the owner has not
+// answered within the delay or cannot be reached.
+KvReply KVDistributor::fetchRemote(const Routing& r, int node_id, const KvOp& fetch) {
+    auto start = std::chrono::steady_clock::now();
+    std::vector<int> backups;
+    if (hedging && r.map.current.replicas > 1) {
+        backups = r.map.current.backupsOf(node_id);
+    }
+    KvReply reply;
+    if (backups.empty()) {
+        reply = callRemote(r, node_id, fetch);
     } else {
-        try {
-	    std::string ep = node_to_ip[node_id];
-            value = kv_client.fetch(key, ep);
-	    //std::cout<<ep<<" Hello"<<'\n';
-        } catch (const std::exception& e2) {
-            std::cerr << "Error fetching key " << key << ": " << e2.what() << std::endl;
-            return "RPC Failed";
+        int backup = backups[next_backup_read.fetch_add(1, std::memory_order_relaxed) % backups.size()];
+        KvOp hedge_op{KvOpType::FETCH, fetch.key, ""};
+        hedge_op.max_staleness_ms = replication_config.max_staleness_ms;
+        bool hedged = false;
+        bool hedge_won = false;
+        const std::string endpoint = r.endpointOf(node_id);
+        const std::string backup_endpoint = r.endpointOf(backup);
+        reply = kv_client.callHedged(fetch, endpoint, hedge_op, backup_endpoint, hedgeDelayMs(), hedged, hedge_won);
+        if (reply.status == KvStatus::OVERLOADED) {
+            reply = kv_client.call(fetch, endpoint);   // Neither copy took it: back off and retry
         }
+        hedges_sent += hedged ? 1 : 0;
+        hedges_won += hedge_won ? 1 : 0;
+        if (reply.status == KvStatus::DEADLINE_EXCEEDED) {
+            ++deadlines_exceeded;
+        }
+        observeReply(reply, hedge_won ? backup_endpoint : endpoint);
     }
-    return value;
+    read_latency.record(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+    return reply;
+}
+
+double KVDistributor::hedgeDelayMs() {
+    // Until enough reads were timed, only an unreachable owner is hedged
+    double delay = read_latency.quantile(deadline_config.hedge_percentile / 100.0,
+                                         std::numeric_limits<double>::infinity());
+    return std::max(delay, deadline_config.hedge_min_ms);
 }
 
-void KVDistributor::insert(int key, const std::string& value) {
-    int node_id = getNodeId(key);
-    //std::cout<<"insert: "<<node_id<<"    "<<local_node_id<<std::endl;
-    if (node_id == local_node_id) {
-        try {
-            kv.Insert(key, value);
-        } catch (const std::exception& e) {
-            std::cerr << "Error inserting key " << key << ": " << e.what() << std::endl;
+void KVDistributor::setHedging(bool enabled) {
+    hedging = enabled;
+    if (enabled && currentRouting()->map.current.replicas < 2) {
+        std::cout << "[KVDistributor] Hedged reads need replication.factor of 2 or more; "
+                  << "reads are not hedged until then" << std::endl;
+    } else if (enabled) {
+        std::cout << "[KVDistributor] Hedged reads enabled at the p" << deadline_config.hedge_percentile
+                  << " read latency" << std::endl;
+    }
+}
+
+void KVDistributor::observeReply(const KvReply& reply, const std::string& endpoint) {
+    if (reply.epoch <= current_epoch.load()) {
+        return;
+    }
+    if (reply.status == KvStatus::MOVED) {
+        ClusterMap map;
+        if ((DecodeClusterMap(reply.value, map) && adoptClusterMap(map)) || refreshClusterMap(endpoint)) {
+            return;
         }
-    } else {
-        try {
-	   std::string ep = node_to_ip[node_id];
-	   //std::cout<<ep<<" Hello"<<'\n';
-            kv_client.insert(key, value, ep);
-        } catch (const std::exception& e) {
-            std::cerr << "Error inserting key " << key << " via RPC: " << e.what() << std::endl;
+        // Another thread may have adopted it meanwhile
+        if (reply.epoch <= current_epoch.load()) {
+            return;
+        }
+    }
+    noteEpoch(reply.epoch);
+}
+
+uint64_t KVDistributor::getEpoch() {
+    return current_epoch.load();
+}
+
+ClusterMap KVDistributor::getClusterMap() {
+    return currentRouting()->map;
+}
+
+bool KVDistributor::refreshMembership() {
+    return refreshClusterMap(config.read_ip());
+}
+
+// Sends map to every server in it (current and previous members), then adopts it
+bool KVDistributor::publishClusterMap(const ClusterMap& map) {
+    std::unordered_map<int, std::string> members;
+    for (const MemberNode& node : map.previous.nodes) {
+        members[node.node_id] = node.endpoint;
+    }
+    for (const MemberNode& node : map.current.nodes) {
+        members[node.node_id] = node.endpoint;
+    }
+    std::size_t accepted = 0;
+    for (const auto& member : members) {
+        uint64_t held = kv_client.publishClusterMap(member.second, map, member.first);
+        if (held == map.epoch) {
+            ++accepted;
+        } else {
+            std::cerr << "[KVDistributor] Node " << member.first << " holds epoch " << held
+                      << " instead of " << map.epoch << std::endl;
         }
     }
+    std::cout << "[KVDistributor] Published epoch " << map.epoch << " to " << accepted << " of "
+              << members.size() << " nodes" << std::endl;
+    return adoptClusterMap(map);
 }
 
-void KVDistributor::update(int key, const std::string& value) {
-    int node_id = getNodeId(key);
-    if (node_id == local_node_id) {
-        try {
-            kv.Update(key, value);
-        } catch (const std::exception& e) {
-            std::cerr << "Error updating key " << key << ": " << e.what() << std::endl;
+bool KVDistributor::publishMembership(const Config& target) {
+    refreshMembership();
+    std::shared_ptr<const Routing> r = currentRouting();
+    if (r->map.migrating) {
+        std::cout << "[KVDistributor] A rebalance is in progress; finish it first" << std::endl;
+        return false;
+    }
+    ClusterMap next;
+    next.epoch = std::max(r->map.epoch, newest_epoch_seen.load()) + 1;
+    next.current = PlacementSpecFromConfig(target);
+    return publishClusterMap(next);
+}
+
+// Runs an op on its owner without write-behind buffering. Anything still buffered
+// for the key is flushed first so the op observes the caller's earlier writes.
+KvReply KVDistributor::execute(const KvOp& op) {
+    // A request made on behalf of a traced one stays in its trace
+    uint64_t trace_id = CurrentTraceId() ? 0 : TraceSample();
+    KvTraceContext trace(trace_id);
+    KvTraceSpan span(trace_id, "client.execute", op.key);
+    maybeRefresh();
+    KvReply reply;
+    for (int attempt = 0; attempt < MAX_REDIRECTS; ++attempt) {
+        reply = executeOnce(*currentRouting(), op);
+        if (reply.status != KvStatus::MOVED) {
+            break;
         }
+    }
+    return reply;
+}
+
+KvReply KVDistributor::executeOnce(const Routing& r, const KvOp& op) {
+    if (r.previous_placement) {
+        pullKey(r, op.key);
+        return sendTo(r, r.nodeFor(op.key), op);
+    }
+    int node_id = r.nodeFor(op.key);
+    if (node_id == r.local_node_id && !r.writesViaServer()) {
+        return ExecuteOp(kv, op);
+    }
+    if (write_buffer && write_buffer->holds(op.key)) {
+        write_buffer->drain();
+    }
+    if (KVCache* values = cache()) {
+        values->invalidate(op.key);
+    }
+    return callRemote(r, node_id, op);
+}
+
+KvReply KVDistributor::sendTo(const Routing& r, int node_id, const KvOp& op) {
+    if (node_id == r.local_node_id && !(KvOpMutates(op.type) && r.writesViaServer())) {
+        return ExecuteOp(kv, op);
+    }
+    return callRemote(r, node_id, op);
+}
+
+bool KVDistributor::startRebalance(const Config& target) {
+    refreshMembership();
+    std::shared_ptr<const Routing> r = currentRouting();
+    if (r->map.migrating) {
+        std::cout << "[KVDistributor] A rebalance is already in progress" << std::endl;
+        return false;
+    }
+    ClusterMap next;
+    next.epoch = std::max(r->map.epoch, newest_epoch_seen.load()) + 1;
+    next.current = PlacementSpecFromConfig(target);
+    next.migrating = true;
+    next.previous = r->map.current;
+    return publishClusterMap(next);
+}
+
+RebalanceStats KVDistributor::rebalanceStatus() {
+    std::lock_guard<std::mutex> lock(map_mutex);
+    return rebalancer ? rebalancer->stats() : RebalanceStats{};
+}
+
+bool KVDistributor::finishRebalance() {
+    refreshMembership();
+    std::shared_ptr<const Routing> r = currentRouting();
+    if (!r->map.migrating) {
+        return false;
+    }
+    ClusterMap next;
+    next.epoch = std::max(r->map.epoch, newest_epoch_seen.load()) + 1;
+    next.current = r->map.current;
+    return publishClusterMap(next);
+}
+
+// Moves one key from its previous owner to its current one ahead of a write, with
+// the same copy-then-remove-if-unchanged steps the rebalancer uses
+void KVDistributor::pullKey(const Routing& r, int key) {
+    int previous = r.previous_placement->nodeFor(key);
+    int owner = r.nodeFor(key);
+    if (previous == owner) {
+        return;
+    }
+    KvReply found = sendTo(r, previous, KvOp{KvOpType::FETCH, key, ""});
+    if (!found.ok()) {
+        return;
+    }
+    KvReply copied = sendTo(r, owner, KvOp{KvOpType::INSERT, key, found.value});
+    if (!copied.ok() && copied.status != KvStatus::ALREADY_EXISTS) {
+        return;
+    }
+    KvOp remove{KvOpType::DELETE_IF_VERSION, key, ""};
+    remove.version = found.version;
+    KvReply removed = sendTo(r, previous, remove);
+    if (!removed.ok() && copied.ok()) {
+        KvOp withdraw{KvOpType::DELETE_IF_VERSION, key, ""};
+        withdraw.version = copied.version;
+        sendTo(r, owner, withdraw);
+    }
+}
+
+// No caching while keys move: a key missing at its new owner may not have arrived yet
+KvStatus KVDistributor::getRebalancing(const Routing& r, int key, std::string& value) {
+    int owner = r.nodeFor(key);
+    int previous = r.previous_placement->nodeFor(key);
+    KvReply reply = sendTo(r, owner, KvOp{KvOpType::FETCH, key, ""});
+    if (reply.status == KvStatus::NOT_FOUND && previous != owner) {
+        reply = sendTo(r, previous, KvOp{KvOpType::FETCH, key, ""});
+    }
+    value = std::move(reply.value);
+    return reply.status;
+}
+
+KvStatus KVDistributor::get(int key, std::string& value) {
+    uint64_t trace_id = CurrentTraceId() ? 0 : TraceSample();
+    KvTraceContext trace(trace_id);
+    KvTraceSpan span(trace_id, "client.get", key);
+    maybeRefresh();
+    KvStatus status = KvStatus::MOVED;
+    for (int attempt = 0; attempt < MAX_REDIRECTS && status == KvStatus::MOVED; ++attempt) {
+        status = getOnce(*currentRouting(), key, value);
+    }
+    return status;
+}
+
+KvStatus KVDistributor::getOnce(const Routing& r, int key, std::string& value) {
+    if (r.previous_placement) {
+        return getRebalancing(r, key, value);
+    }
+    // Everything up to the store or the remote read: placement, buffered writes, cache
+    KvTraceSpan route_span("client.route", key);
+    int node_id = r.nodeFor(key);
+    if (node_id == r.local_node_id) {
+        route_span.end();
+        LeasedValue found = kv.FindWithLease(key, 0);
+        value = std::move(found.value);
+        return found.status;
+    }
+
+    // Read-your-writes: the server may still reject a buffered write, so the read
+    // waits until it has been applied instead of answering from the buffer
+    if (write_buffer && write_buffer->holds(key)) {
+        write_buffer->drain();
+    }
+    KVCache* values = cache();
+    if (values && values->get(key, value)) {
+        return KvStatus::OK;
+    }
+    KvStatus backup_status;
+    if (readFromBackup(r, node_id, key, value, backup_status)) {
+        return backup_status;
+    }
+
+    // The lease is counted from before the request was sent, so the local
+    // copy always expires no later than the lease held on the owner
+    auto requested_at = KVCache::Clock::now();
+    KvOp fetch{KvOpType::FETCH, key, ""};
+    fetch.lease_ms = leaseFor(key);
+    route_span.end();
+    KvReply reply = fetchRemote(r, node_id, fetch);
+    if (reply.ok() && values && reply.lease_ms > 0) {
+        values->put(key, reply.value, requested_at + std::chrono::milliseconds(reply.lease_ms));
+    }
+    value = std::move(reply.value);
+    return reply.status;
+}
+
+// Spreads reads of a key over its owner and the owner's backups. A backup answers
+// from its replica unless that is older than max_staleness_ms; a refusal (or a
+// failed call) is answered by the caller asking the owner instead.
+bool KVDistributor::readFromBackup(const Routing& r, int owner, int key, std::string& value, KvStatus& status) {
+    if (!replication_config.read_from_backups || r.map.current.replicas < 2) {
+        return false;
+    }
+    std::vector<int> backups = r.map.current.backupsOf(owner);
+    if (backups.empty()) {
+        return false;
+    }
+    // The local server is the cheapest copy to ask when it holds one
+    int node_id = -1;
+    if (std::find(backups.begin(), backups.end(), r.local_node_id) != backups.end()) {
+        node_id = r.local_node_id;
     } else {
-        try {
-            kv_client.update(key, value, node_to_ip[node_id]);
-        } catch (const std::exception& e) {
-            std::cerr << "Error updating key " << key << " via RPC: " << e.what() << std::endl;
+        std::size_t pick = next_backup_read.fetch_add(1, std::memory_order_relaxed) % (backups.size() + 1);
+        if (pick == backups.size()) {
+            return false;   // The owner's turn
         }
+        node_id = backups[pick];
+    }
+    KvOp fetch{KvOpType::FETCH, key, ""};
+    fetch.max_staleness_ms = replication_config.max_staleness_ms;
+    KvReply reply = callRemote(r, node_id, fetch);
+    if (reply.status != KvStatus::OK && reply.status != KvStatus::NOT_FOUND) {
+        return false;
     }
+    value = std::move(reply.value);
+    status = reply.status;
+    return true;
 }
 
-void KVDistributor::deleteKey(int key) {
-    int node_id = getNodeId(key);
-    if (node_id == local_node_id) {
-        try {
-            kv.Delete(key);
-        } catch (const std::exception& e) {
-            std::cerr << "Error deleting key " << key << ": " << e.what() << std::endl;
+std::string KVDistributor::get(int key) {
+    std::string value;
+    KvStatus status = get(key, value);
+    if (status == KvStatus::OK) {
+        return value;
+    }
+    if (status == KvStatus::NOT_FOUND) {
+        return "key not found";
+    }
+    return std::string("Error: ") + KvStatusName(status);
+}
+
+KvStatus KVDistributor::write(const KvOp& op) {
+    uint64_t trace_id = CurrentTraceId() ? 0 : TraceSample();
+    KvTraceContext trace(trace_id);
+    KvTraceSpan span(trace_id, "client.write", op.key);
+    maybeRefresh();
+    KvStatus status = KvStatus::MOVED;
+    for (int attempt = 0; attempt < MAX_REDIRECTS && status == KvStatus::MOVED; ++attempt) {
+        status = writeOnce(*currentRouting(), op);
+    }
+    return status;
+}
+
+KvStatus KVDistributor::writeOnce(const Routing& r, const KvOp& op) {
+    if (r.previous_placement) {
+        pullKey(r, op.key);
+        return sendTo(r, r.nodeFor(op.key), op).status;
+    }
+    int node_id = r.nodeFor(op.key);
+    if (node_id == r.local_node_id) {
+        return r.writesViaServer() ? callRemote(r, node_id, op).status : ExecuteOp(kv, op).status;
+    }
+    if (KVCache* values = cache()) {
+        values->invalidate(op.key);
+    }
+    if (write_buffer) {
+        // Reported OK once buffered; rejections surface from flush()
+        write_buffer->add(node_id, op);
+        return KvStatus::OK;
+    }
+    return callRemote(r, node_id, op).status;
+}
+
+KvStatus KVDistributor::insert(int key, const std::string& value) {
+    return write(KvOp{KvOpType::INSERT, key, value});
+}
+
+KvStatus KVDistributor::update(int key, const std::string& value) {
+    return write(KvOp{KvOpType::UPDATE, key, value});
+}
+
+KvStatus KVDistributor::deleteKey(int key) {
+    return write(KvOp{KvOpType::DELETE, key, ""});
+}
+
+// Sends each node's ops as one kv_batch, all nodes in parallel, and scatters the
+// replies back to the input positions
+void KVDistributor::dispatchRemote(const Routing& r, const std::vector<KvOp>& ops,
+                                   const std::unordered_map<int, std::vector<std::size_t>>& remote_positions,
+                                   std::vector<KvReply>& replies) {
+    std::vector<const std::vector<std::size_t>*> group_positions;
+    std::vector<std::pair<std::string, std::vector<KvOp>>> groups;
+    for (const auto& entry : remote_positions) {
+        std::vector<KvOp> group_ops;
+        group_ops.reserve(entry.second.size());
+        for (std::size_t i : entry.second) {
+            group_ops.push_back(ops[i]);
         }
-    } else {
-        try {
-            kv_client.deleteKey(key, node_to_ip[node_id]);
-        } catch (const std::exception& e) {
-            std::cerr << "Error deleting key " << key << " via RPC: " << e.what() << std::endl;
+        groups.emplace_back(r.endpointOf(entry.first), std::move(group_ops));
+        group_positions.push_back(&entry.second);
+    }
+
+    std::vector<BatchResult> sent = kv_client.batchAll(groups);
+    for (std::size_t g = 0; g < groups.size(); ++g) {
+        const std::vector<std::size_t>& positions = *group_positions[g];
+        if (!sent[g].error.empty()) {
+            std::cerr << "Error sending batch to " << groups[g].first << ": " << sent[g].error << std::endl;
+            for (std::size_t i : positions) {
+                replies[i].status = sent[g].timed_out ? KvStatus::DEADLINE_EXCEEDED : KvStatus::UNAVAILABLE;
+            }
+            continue;
+        }
+        for (std::size_t j = 0; j < positions.size(); ++j) {
+            observeReply(sent[g].replies[j], groups[g].first);
+            replies[positions[j]] = std::move(sent[g].replies[j]);
+        }
+    }
+
+    // Ops sent with a stale map are redone one by one under the map just adopted
+    for (const auto& entry : remote_positions) {
+        for (std::size_t i : entry.second) {
+            if (replies[i].status != KvStatus::MOVED) {
+                continue;
+            }
+            replies[i] = KvReply{};
+            if (ops[i].type == KvOpType::FETCH) {
+                replies[i].status = get(ops[i].key, replies[i].value);
+            } else {
+                replies[i].status = write(ops[i]);
+            }
+        }
+    }
+}
+
+std::vector<KvReply> KVDistributor::multiGet(const std::vector<int>& keys) {
+    maybeRefresh();
+    std::shared_ptr<const Routing> r = currentRouting();
+    std::vector<KvReply> replies(keys.size());
+    if (r->previous_placement) {
+        // Keys are looked up one by one while a rebalance may leave them on either owner
+        for (std::size_t i = 0; i < keys.size(); ++i) {
+            replies[i].status = getRebalancing(*r, keys[i], replies[i].value);
+        }
+        return replies;
+    }
+    KVCache* values = cache();
+    std::vector<int> local_keys;
+    std::vector<std::size_t> local_positions;
+    std::vector<KvOp> ops(keys.size());
+    std::unordered_map<int, std::vector<std::size_t>> remote_positions;   // node id -> input positions
+    bool drained = false;
+
+    for (std::size_t i = 0; i < keys.size(); ++i) {
+        int key = keys[i];
+        int node_id = r->nodeFor(key);
+        if (node_id == r->local_node_id) {
+            local_keys.push_back(key);
+            local_positions.push_back(i);
+            continue;
+        }
+        if (write_buffer && !drained && write_buffer->holds(key)) {
+            // As in getOnce: buffered writes are applied before they are read
+            write_buffer->drain();
+            drained = true;
+        }
+        if (values && values->get(key, replies[i].value)) {
+            replies[i].status = KvStatus::OK;
+            continue;
+        }
+        ops[i].type = KvOpType::FETCH;
+        ops[i].key = key;
+        ops[i].lease_ms = leaseFor(key);
+        remote_positions[node_id].push_back(i);
+    }
+
+    if (!local_keys.empty()) {
+        std::vector<LeasedValue> found = kv.FindMany(local_keys, 0);
+        for (std::size_t j = 0; j < local_keys.size(); ++j) {
+            KvReply& reply = replies[local_positions[j]];
+            reply.status = found[j].status;
+            reply.version = found[j].version;
+            reply.value = std::move(found[j].value);
+        }
+    }
+
+    if (!remote_positions.empty()) {
+        auto requested_at = KVCache::Clock::now();
+        dispatchRemote(*r, ops, remote_positions, replies);
+        if (values) {
+            for (const auto& entry : remote_positions) {
+                for (std::size_t i : entry.second) {
+                    if (replies[i].ok() && replies[i].lease_ms > 0) {
+                        values->put(keys[i], replies[i].value,
+                                    requested_at + std::chrono::milliseconds(replies[i].lease_ms));
+                    }
+                }
+            }
         }
     }
+    return replies;
+}
+
+std::vector<KvStatus> KVDistributor::multiWrite(const std::vector<KvOp>& ops) {
+    maybeRefresh();
+    std::shared_ptr<const Routing> r = currentRouting();
+    if (r->previous_placement) {
+        std::vector<KvStatus> statuses;
+        for (const KvOp& op : ops) {
+            statuses.push_back(write(op));
+        }
+        return statuses;
+    }
+    KVCache* values = cache();
+    std::vector<KvReply> replies(ops.size());
+    std::unordered_map<int, std::vector<std::size_t>> remote_positions;   // node id -> input positions
+
+    for (std::size_t i = 0; i < ops.size(); ++i) {
+        const KvOp& op = ops[i];
+        int node_id = r->nodeFor(op.key);
+        if (node_id == r->local_node_id) {
+            if (r->writesViaServer()) {
+                remote_positions[node_id].push_back(i);
+            } else {
+                replies[i] = ExecuteOp(kv, op);
+            }
+            continue;
+        }
+        if (values) {
+            values->invalidate(op.key);
+        }
+        if (write_buffer) {
+            // Reported OK once buffered; rejections surface from flush()
+            write_buffer->add(node_id, op);
+            replies[i].status = KvStatus::OK;
+            continue;
+        }
+        remote_positions[node_id].push_back(i);
+    }
+
+    if (!remote_positions.empty()) {
+        dispatchRemote(*r, ops, remote_positions, replies);
+    }
+
+    std::vector<KvStatus> statuses;
+    statuses.reserve(replies.size());
+    for (const KvReply& reply : replies) {
+        statuses.push_back(reply.status);
+    }
+    return statuses;
+}
+
+std::vector<KvStatus> KVDistributor::multiInsert(const std::vector<std::pair<int, std::string>>& items) {
+    std::vector<KvOp> ops;
+    ops.reserve(items.size());
+    for (const auto& item : items) {
+        ops.push_back(KvOp{KvOpType::INSERT, item.first, item.second});
+    }
+    return multiWrite(ops);
+}
+
+std::vector<KvStatus> KVDistributor::multiUpdate(const std::vector<std::pair<int, std::string>>& items) {
+    std::vector<KvOp> ops;
+    ops.reserve(items.size());
+    for (const auto& item : items) {
+        ops.push_back(KvOp{KvOpType::UPDATE, item.first, item.second});
+    }
+    return multiWrite(ops);
+}
+
+std::vector<KvStatus> KVDistributor::multiDelete(const std::vector<int>& keys) {
+    std::vector<KvOp> ops;
+    ops.reserve(keys.size());
+    for (int key : keys) {
+        ops.push_back(KvOp{KvOpType::DELETE, key, ""});
+    }
+    return multiWrite(ops);
+}
+
+KvStatus KVDistributor::compareAndSwap(int key, const std::string& expected, const std::string& desired,
+                                       std::string* current) {
+    KvOp op{KvOpType::CAS, key, desired};
+    op.expected = expected;
+    KvReply reply = execute(op);
+    if (reply.status == KvStatus::CONFLICT && current) {
+        *current = std::move(reply.value);
+    }
+    return reply.status;
+}
+
+KvStatus KVDistributor::compareAndSwapVersion(int key, uint64_t expected_version, const std::string& desired) {
+    KvOp op{KvOpType::CAS_VERSION, key, desired};
+    op.version = expected_version;
+    return execute(op).status;
+}
+
+KvStatus KVDistributor::increment(int key, int64_t delta, int64_t& result) {
+    KvOp op{KvOpType::INCREMENT, key, ""};
+    op.delta = delta;
+    KvReply reply = execute(op);
+    if (reply.ok()) {
+        result = std::stoll(reply.value);
+    }
+    return reply.status;
+}
+
+KvStatus KVDistributor::decrement(int key, int64_t delta, int64_t& result) {
+    return increment(key, -delta, result);
+}
+
+KvStatus KVDistributor::append(int key, const std::string& suffix) {
+    return execute(KvOp{KvOpType::APPEND, key, suffix}).status;
+}
+
+KvStatus KVDistributor::getAndSet(int key, const std::string& value, std::string& old_value) {
+    KvReply reply = execute(KvOp{KvOpType::GET_AND_SET, key, value});
+    if (reply.ok()) {
+        old_value = std::move(reply.value);
+    }
+    return reply.status;
+}
+
+KvStatus KVDistributor::scan(int64_t start, int64_t end, std::size_t limit,
+                             std::vector<std::pair<int, std::string>>& items) {
+    maybeRefresh();
+    std::shared_ptr<const Routing> r = currentRouting();
+    start = std::max<int64_t>(start, std::numeric_limits<int>::min());
+    if (start >= end) {
+        return KvStatus::OK;
+    }
+    KvStatus status = KvStatus::OK;
+
+    auto* ranges = dynamic_cast<const RangePlacement*>(r->placement.get());
+    if (ranges && !r->previous_placement) {
+        const std::vector<KeyRange>& table = ranges->getRanges();
+        std::size_t i = ranges->rangeIndex(static_cast<int>(start));
+        while (i < table.size() && table[i].start < end) {
+            // Neighbouring ranges on the same node go in one request
+            std::size_t last = i;
+            while (last + 1 < table.size() && table[last + 1].node_id == table[i].node_id && table[last + 1].start < end) {
+                ++last;
+            }
+            KvOp op{KvOpType::SCAN, static_cast<int>(std::max<int64_t>(start, table[i].start)), ""};
+            op.end_key = std::min(end, ranges->rangeEnd(last));
+            op.limit = static_cast<uint32_t>(limit > 0 ? limit - items.size() : 0);
+            KvReply reply = sendTo(*r, table[i].node_id, op);
+            if (!reply.ok() || !DecodeScanResult(reply.value, items)) {
+                status = reply.ok() ? KvStatus::ERROR : reply.status;
+            }
+            if (limit > 0 && items.size() >= limit) {
+                break;
+            }
+            i = last + 1;
+        }
+        return status;
+    }
+
+    // Hash placement (or a range table in flux) can put any key anywhere: ask every node
+    KvOp op{KvOpType::SCAN, static_cast<int>(start), ""};
+    op.end_key = end;
+    op.limit = static_cast<uint32_t>(limit);
+    std::vector<int> nodes;
+    std::vector<std::pair<std::string, std::vector<KvOp>>> groups;
+    std::vector<std::pair<int, std::string>> found;
+    std::vector<int> found_on;
+    for (const auto& entry : r->node_to_ip) {
+        if (entry.first == r->local_node_id) {
+            for (auto& item : kv.Scan(start, end, limit)) {
+                found.push_back(std::move(item));
+                found_on.push_back(entry.first);
+            }
+            continue;
+        }
+        nodes.push_back(entry.first);
+        groups.emplace_back(entry.second, std::vector<KvOp>{op});
+    }
+    std::vector<BatchResult> sent = kv_client.batchAll(groups);
+    for (std::size_t g = 0; g < groups.size(); ++g) {
+        if (!sent[g].error.empty() || !sent[g].replies[0].ok() || !DecodeScanResult(sent[g].replies[0].value, found)) {
+            status = KvStatus::UNAVAILABLE;
+        }
+        found_on.resize(found.size(), nodes[g]);
+    }
+
+    // Sort by key; a key present on two nodes mid-rebalance is taken from its current owner
+    std::vector<std::size_t> order(found.size());
+    for (std::size_t i = 0; i < order.size(); ++i) {
+        order[i] = i;
+    }
+    std::sort(order.begin(), order.end(), [&](std::size_t a, std::size_t b) {
+        if (found[a].first != found[b].first) {
+            return found[a].first < found[b].first;
+        }
+        return (found_on[a] == r->nodeFor(found[a].first)) > (found_on[b] == r->nodeFor(found[b].first));
+    });
+    for (std::size_t i : order) {
+        if (!items.empty() && items.back().first == found[i].first) {
+            continue;
+        }
+        if (limit > 0 && items.size() >= limit) {
+            break;
+        }
+        items.push_back(std::move(found[i]));
+    }
+    return status;
+}
+
+bool KVDistributor::rebalanceRanges() {
+    refreshMembership();
+    std::shared_ptr<const Routing> r = currentRouting();
+    const ClusterMap& cluster_map = r->map;
+    auto* ranges = dynamic_cast<const RangePlacement*>(r->placement.get());
+    if (!ranges) {
+        std::cout << "[KVDistributor] Range rebalancing needs \"range\" placement" << std::endl;
+        return false;
+    }
+
+    // Every member must answer for the epoch in force, or the picture is incomplete
+    std::unordered_map<int, RangeLoad> loads;   // range start -> load
+    double window_sec = 0;
+    bool complete = true;
+    uint64_t misplaced = 0;
+    for (const MemberNode& node : cluster_map.current.nodes) {
+        RangeReport report;
+        if (!kv_client.getRangeStats(node.endpoint, report) || report.epoch != cluster_map.epoch) {
+            complete = false;
+            continue;
+        }
+        misplaced += report.misplaced;
+        window_sec = std::max(window_sec, report.window_sec);
+        for (const RangeLoad& load : report.ranges) {
+            loads[load.start] = load;
+        }
+    }
+
+    if (cluster_map.migrating) {
+        if (complete && misplaced == 0) {
+            std::cout << "[KVDistributor] All keys are in place, finishing the range move" << std::endl;
+            return finishRebalance();
+        }
+        std::cout << "[KVDistributor] Ranges still moving: " << misplaced << " keys misplaced" << std::endl;
+        return false;
+    }
+    if (!complete) {
+        std::cout << "[KVDistributor] Not every node reported range stats; leaving ranges as they are" << std::endl;
+        return false;
+    }
+
+    // Current load per node, updated as ranges are reassigned, to pick split targets
+    std::unordered_map<int, double> node_rate;
+    std::unordered_map<int, double> node_keys;
+    for (const MemberNode& node : cluster_map.current.nodes) {
+        node_rate[node.node_id] = 0;
+        node_keys[node.node_id] = 0;
+    }
+    double window = std::max(window_sec, 1e-3);
+    for (const KeyRange& range : ranges->getRanges()) {
+        node_rate[range.node_id] += loads[range.start].ops / window;
+        node_keys[range.node_id] += static_cast<double>(loads[range.start].keys);
+    }
+    auto coolest = [&]() {
+        int best = cluster_map.current.nodes.front().node_id;
+        for (const auto& entry : node_rate) {
+            if (entry.second < node_rate[best] ||
+                (entry.second == node_rate[best] && node_keys[entry.first] < node_keys[best])) {
+                best = entry.first;
+            }
+        }
+        return best;
+    };
+
+    double merge_keys = range_config.merge_fraction * static_cast<double>(range_config.max_keys);
+    double merge_rate = range_config.merge_fraction * range_config.max_ops_per_sec;
+    std::vector<KeyRange> next;
+    std::vector<double> next_keys;
+    std::vector<double> next_rate;
+    std::vector<bool> next_fixed;    // Created or kept by a split this round: not merged
+    bool owners_changed = false;
+    int splits = 0;
+    int merges = 0;
+
+    for (const KeyRange& range : ranges->getRanges()) {
+        const RangeLoad& load = loads[range.start];
+        double keys = static_cast<double>(load.keys);
+        double rate = load.ops / window;
+
+        bool hot = keys > range_config.max_keys || rate > range_config.max_ops_per_sec;
+        if (hot && load.split_key > range.start) {
+            int target = coolest();
+            next.push_back(range);
+            next_keys.push_back(keys / 2);
+            next_rate.push_back(rate / 2);
+            next_fixed.push_back(true);
+            next.push_back({load.split_key, target});
+            next_keys.push_back(keys / 2);
+            next_rate.push_back(rate / 2);
+            next_fixed.push_back(true);
+            node_rate[range.node_id] -= rate / 2;
+            node_keys[range.node_id] -= keys / 2;
+            node_rate[target] += rate / 2;
+            node_keys[target] += keys / 2;
+            owners_changed = owners_changed || target != range.node_id;
+            ++splits;
+            std::cout << "[KVDistributor] Splitting range at " << range.start << " (" << load.keys << " keys, "
+                      << rate << " ops/s) at " << load.split_key << ", upper half to node " << target << std::endl;
+            continue;
+        }
+
+        bool cold = keys < merge_keys && rate < merge_rate;
+        if (cold && !next.empty() && !next_fixed.back() &&
+            next_keys.back() + keys < merge_keys && next_rate.back() + rate < merge_rate) {
+            // Absorbed by the range to its left, and so by that range's owner
+            owners_changed = owners_changed || next.back().node_id != range.node_id;
+            next_keys.back() += keys;
+            next_rate.back() += rate;
+            ++merges;
+            std::cout << "[KVDistributor] Merging range at " << range.start << " into range at "
+                      << next.back().start << std::endl;
+            continue;
+        }
+        next.push_back(range);
+        next_keys.push_back(keys);
+        next_rate.push_back(rate);
+        next_fixed.push_back(!cold);
+    }
+
+    if (splits == 0 && merges == 0) {
+        std::cout << "[KVDistributor] Ranges are within limits" << std::endl;
+        return false;
+    }
+    ClusterMap map;
+    map.epoch = std::max(cluster_map.epoch, newest_epoch_seen.load()) + 1;
+    map.current = cluster_map.current;
+    map.current.ranges = next;
+    map.migrating = owners_changed;
+    if (owners_changed) {
+        map.previous = cluster_map.current;
+    }
+    std::cout << "[KVDistributor] " << splits << " splits, " << merges << " merges: " << next.size() << " ranges" << std::endl;
+    return publishClusterMap(map);
+}
+
+std::unordered_map<int, ReplicationStatus> KVDistributor::replicationStatus() {
+    maybeRefresh();
+    std::shared_ptr<const Routing> r = currentRouting();
+    std::unordered_map<int, ReplicationStatus> statuses;
+    for (const MemberNode& node : r->map.current.nodes) {
+        ReplicationStatus status;
+        if (kv_client.getReplicationStatus(node.endpoint, status)) {
+            statuses[node.node_id] = std::move(status);
+        } else {
+            std::cerr << "[KVDistributor] Node " << node.node_id << " did not report its replication state" << std::endl;
+        }
+    }
+    return statuses;
+}
+
+std::unordered_map<int, KvStatsReport> KVDistributor::clusterStats() {
+    maybeRefresh();
+    std::shared_ptr<const Routing> r = currentRouting();
+    std::unordered_map<int, KvStatsReport> reports;
+    for (const MemberNode& node : r->map.current.nodes) {
+        KvStatsReport report;
+        if (kv_client.getStats(node.endpoint, report)) {
+            reports[node.node_id] = std::move(report);
+        } else {
+            std::cerr << "[KVDistributor] Node " << node.node_id << " did not report its stats" << std::endl;
+        }
+    }
+    return reports;
+}
+
+std::unordered_map<int, std::string> KVDistributor::clusterTrace(bool clear) {
+    maybeRefresh();
+    std::shared_ptr<const Routing> r = currentRouting();
+    std::unordered_map<int, std::string> traces;
+    for (const MemberNode& node : r->map.current.nodes) {
+        std::string events;
+        if (kv_client.getTraceEvents(node.endpoint, clear, events)) {
+            traces[node.node_id] = std::move(events);
+        } else {
+            std::cerr << "[KVDistributor] Node " << node.node_id << " did not send its trace" << std::endl;
+        }
+    }
+    return traces;
+}
+
+std::unordered_map<int, MemoryProfile> KVDistributor::clusterMemory() {
+    maybeRefresh();
+    std::shared_ptr<const Routing> r = currentRouting();
+    std::unordered_map<int, MemoryProfile> profiles;
+    for (const MemberNode& node : r->map.current.nodes) {
+        MemoryProfile profile;
+        if (kv_client.getMemoryProfile(node.endpoint, profile)) {
+            profiles[node.node_id] = std::move(profile);
+        } else {
+            std::cerr << "[KVDistributor] Node " << node.node_id << " did not report its memory" << std::endl;
+        }
+    }
+    return profiles;
+}
+
+uint32_t KVDistributor::leaseFor(int key) const {
+    if (cache_all) {
+        return lease_ms;
+    }
+    if (hot_caching) {
+        std::shared_lock<std::shared_mutex> lock(hot_mutex);
+        if (hot_keys.count(key) > 0) {
+            return hot_config.lease_ms;
+        }
+    }
+    return 0;
+}
+
+void KVDistributor::setHotKeyCaching(bool enabled) {
+    {
+        std::lock_guard<std::mutex> lock(map_mutex);
+        if (enabled && !cache_storage) {
+            // Only hot keys are ever put in it, so it needs room for the hot set of every node
+            std::size_t nodes = currentRouting()->node_to_ip.size();
+            std::size_t capacity = std::max<std::size_t>(static_cast<std::size_t>(hot_config.max_keys) * nodes, 64);
+            cache_storage = std::make_unique<KVCache>(capacity, 4);
+            active_cache = cache_storage.get();
+        }
+    }
+    hot_caching = enabled;
+    next_periodic_ns = 0;
+    if (!enabled && cache() && !cache_all) {
+        cache()->clear();
+    }
+    std::cout << "[KVDistributor] Hot-key caching " << (enabled ? "on" : "off") << std::endl;
+}
+
+// Local keys are read straight from the store and never cached, so only the shares
+// reported by other nodes' servers matter here
+bool KVDistributor::refreshHotKeys() {
+    std::shared_ptr<const Routing> r = currentRouting();
+    std::unordered_set<int> hot;
+    std::unordered_map<int, HotKeyReport> reports;
+    bool all_reported = true;
+    for (const auto& entry : r->node_to_ip) {
+        HotKeyReport report;
+        if (!kv_client.getHotKeys(entry.second, hot_config.max_keys, report)) {
+            all_reported = false;
+            continue;
+        }
+        double threshold = hot_config.min_share * static_cast<double>(report.total);
+        for (const HotKey& key : report.keys) {
+            if (report.total > 0 && static_cast<double>(key.count) >= threshold) {
+                hot.insert(key.key);
+            }
+        }
+        reports[entry.first] = std::move(report);
+    }
+    std::unique_lock<std::shared_mutex> lock(hot_mutex);
+    if (hot.size() != hot_keys.size()) {
+        std::cout << "[KVDistributor] " << hot.size() << " hot keys" << std::endl;
+    }
+    hot_keys = std::move(hot);
+    for (auto& entry : reports) {
+        hot_reports[entry.first] = std::move(entry.second);
+    }
+    return all_reported;
+}
+
+std::unordered_set<int> KVDistributor::getHotKeys() const {
+    std::shared_lock<std::shared_mutex> lock(hot_mutex);
+    return hot_keys;
+}
+
+std::unordered_map<int, HotKeyReport> KVDistributor::getHotKeyReports() const {
+    std::shared_lock<std::shared_mutex> lock(hot_mutex);
+    return hot_reports;
 }
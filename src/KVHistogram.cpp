@@ -0,0 +1,89 @@
+#include "KVHistogram.hpp"
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+int highestBit(uint64_t value) {
+    return 63 - __builtin_clzll(value);
+}
+
+}  // namespace
+
+// Exact buckets for [0, SUB_BUCKETS), then HALF buckets per power of two up to 2^64
+KVHistogram::KVHistogram() : counts(SUB_BUCKETS + (64 - SUB_BUCKET_BITS) * HALF, 0) {}
+
+std::size_t KVHistogram::indexOf(uint64_t value) {
+    if (value < SUB_BUCKETS) {
+        return static_cast<std::size_t>(value);
+    }
+    int shift = highestBit(value) - (SUB_BUCKET_BITS - 1);   // value >> shift lies in [HALF, SUB_BUCKETS)
+    return static_cast<std::size_t>(shift + 1) * HALF + ((value >> shift) - HALF);
+}
+
+uint64_t KVHistogram::highestEquivalent(std::size_t index) {
+    if (index < SUB_BUCKETS) {
+        return index;
+    }
+    std::size_t shift = index / HALF - 1;
+    uint64_t sub = index % HALF + HALF;
+    return ((sub + 1) << shift) - 1;
+}
+
+void KVHistogram::record(uint64_t value, uint64_t count) {
+    counts[indexOf(value)] += count;
+    total += count;
+    sum += value * count;
+    min_value = std::min(min_value, value);
+    max_value = std::max(max_value, value);
+}
+
+void KVHistogram::merge(const KVHistogram& other) {
+    for (std::size_t i = 0; i < counts.size(); ++i) {
+        counts[i] += other.counts[i];
+    }
+    total += other.total;
+    sum += other.sum;
+    min_value = std::min(min_value, other.min_value);
+    max_value = std::max(max_value, other.max_value);
+}
+
+void KVHistogram::mergeBuckets(const std::vector<uint64_t>& bucket_counts, uint64_t value_sum, uint64_t min,
+                               uint64_t max) {
+    uint64_t added = 0;
+    for (std::size_t i = 0; i < bucket_counts.size() && i < counts.size(); ++i) {
+        counts[i] += bucket_counts[i];
+        added += bucket_counts[i];
+    }
+    if (added == 0) {
+        return;
+    }
+    total += added;
+    sum += value_sum;
+    min_value = std::min(min_value, min);
+    max_value = std::max(max_value, max);
+}
+
+void KVHistogram::clear() {
+    std::fill(counts.begin(), counts.end(), 0);
+    total = 0;
+    sum = 0;
+    min_value = UINT64_MAX;
+    max_value = 0;
+}
+
+uint64_t KVHistogram::valueAt(double percentile) const {
+    if (total == 0) {
+        return 0;
+    }
+    uint64_t rank = static_cast<uint64_t>(std::ceil(std::clamp(percentile, 0.0, 100.0) / 100.0 * total));
+    rank = std::max<uint64_t>(rank, 1);
+    uint64_t seen = 0;
+    for (std::size_t i = 0; i < counts.size(); ++i) {
+        seen += counts[i];
+        if (seen >= rank) {
+            return std::min(highestEquivalent(i), max_value);
+        }
+    }
+    return max_value;
+}
@@ -0,0 +1,113 @@
+#include "KVHotKeys.hpp"
+#include <algorithm>
+
+HotKeySketch::HotKeySketch(std::size_t capacity) : capacity(std::max<std::size_t>(capacity, 1)) {
+    heap.reserve(this->capacity);
+    position.reserve(this->capacity);
+}
+
+void HotKeySketch::record(int key) {
+    ++seen;
+    auto it = position.find(key);
+    if (it != position.end()) {
+        ++heap[it->second].count;
+        siftDown(it->second);
+        return;
+    }
+    if (heap.size() < capacity) {
+        heap.push_back({key, 1, 0});
+        position[key] = heap.size() - 1;
+        siftUp(heap.size() - 1);
+        return;
+    }
+    // Evict the least counted key; the newcomer inherits its count as error
+    HotKey& victim = heap.front();
+    position.erase(victim.key);
+    victim.error = victim.count;
+    victim.count += 1;
+    victim.key = key;
+    position[key] = 0;
+    siftDown(0);
+}
+
+void HotKeySketch::decay() {
+    seen /= 2;
+    for (HotKey& entry : heap) {
+        entry.count /= 2;
+        entry.error /= 2;
+    }
+    // Halving keeps the heap order
+}
+
+void HotKeySketch::clear() {
+    seen = 0;
+    heap.clear();
+    position.clear();
+}
+
+std::vector<HotKey> HotKeySketch::top(std::size_t limit) const {
+    std::vector<HotKey> sorted = heap;
+    std::sort(sorted.begin(), sorted.end(), [](const HotKey& a, const HotKey& b) { return a.count > b.count; });
+    while (!sorted.empty() && (sorted.size() > limit || sorted.back().count == 0)) {
+        sorted.pop_back();
+    }
+    return sorted;
+}
+
+void HotKeySketch::siftDown(std::size_t i) {
+    while (true) {
+        std::size_t smallest = i;
+        std::size_t left = 2 * i + 1;
+        std::size_t right = left + 1;
+        if (left < heap.size() && heap[left].count < heap[smallest].count) {
+            smallest = left;
+        }
+        if (right < heap.size() && heap[right].count < heap[smallest].count) {
+            smallest = right;
+        }
+        if (smallest == i) {
+            return;
+        }
+        swapEntries(i, smallest);
+        i = smallest;
+    }
+}
+
+void HotKeySketch::siftUp(std::size_t i) {
+    while (i > 0) {
+        std::size_t parent = (i - 1) / 2;
+        if (heap[parent].count <= heap[i].count) {
+            return;
+        }
+        swapEntries(i, parent);
+        i = parent;
+    }
+}
+
+void HotKeySketch::swapEntries(std::size_t a, std::size_t b) {
+    std::swap(heap[a], heap[b]);
+    position[heap[a].key] = a;
+    position[heap[b].key] = b;
+}
+
+std::vector<HotKey> MergeHotKeys(const std::vector<std::vector<HotKey>>& lists, std::size_t limit) {
+    std::unordered_map<int, HotKey> merged;
+    for (const std::vector<HotKey>& list : lists) {
+        for (const HotKey& hot : list) {
+            HotKey& sum = merged[hot.key];
+            sum.key = hot.key;
+            sum.count += hot.count;
+            sum.error += hot.error;
+        }
+    }
+    std::vector<HotKey> sorted;
+    sorted.reserve(merged.size());
+    for (const auto& entry : merged) {
+        sorted.push_back(entry.second);
+    }
+    std::sort(sorted.begin(), sorted.end(), [](const HotKey& a, const HotKey& b) { return a.count > b.count; });
+    if (sorted.size() > limit) {
+        sorted.resize(limit);
+    }
+    return sorted;
+}
@@ -0,0 +1,38 @@
+#include "KVLatencyWindow.hpp"
+#include <algorithm>
+
+KVLatencyWindow::KVLatencyWindow(std::size_t capacity) : capacity(std::max<std::size_t>(capacity, 1)) {
+    samples.reserve(this->capacity);
+}
+
+void KVLatencyWindow::record(double ms) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (samples.size() < capacity) {
+        samples.push_back(ms);
+    } else {
+        samples[next] = ms;
+    }
+    next = (next + 1) % capacity;
+    ++since_recompute;
+}
+
+double KVLatencyWindow::quantile(double q, double fallback) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (samples.size() < MIN_SAMPLES) {
+        return fallback;
+    }
+    if (q != cached_q || since_recompute >= RECOMPUTE_EVERY) {
+        std::vector<double> sorted(samples);
+        std::size_t rank = std::min(sorted.size() - 1, static_cast<std::size_t>(q * sorted.size()));
+        std::nth_element(sorted.begin(), sorted.begin() + rank, sorted.end());
+        cached_q = q;
+        cached_value = sorted[rank];
+        since_recompute = 0;
+    }
+    return cached_value;
+}
+
+std::size_t KVLatencyWindow::size() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return samples.size();
+}
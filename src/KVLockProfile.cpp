@@ -0,0 +1,97 @@
+#include "KVLockProfile.hpp"
+#include <algorithm>
+#include <chrono>
+#include <unistd.h>
+
+const char* StoreLockSiteName(StoreLockSite site) {
+    switch (site) {
+        case StoreLockSite::INSERT:            return "insert";
+        case StoreLockSite::UPDATE:            return "update";
+        case StoreLockSite::DELETE:            return "delete";
+        case StoreLockSite::DELETE_IF_VERSION: return "delete_if_version";
+        case StoreLockSite::FIND:              return "find";
+        case StoreLockSite::FIND_WITH_LEASE:   return "find_with_lease";
+        case StoreLockSite::FIND_MANY:         return "find_many";
+        case StoreLockSite::READ_MODIFY_WRITE: return "read_modify_write";
+        case StoreLockSite::SCAN:              return "scan";
+        case StoreLockSite::MAP_SIZE:          return "map_size";
+        case StoreLockSite::LIST_KEYS:         return "list_keys";
+        case StoreLockSite::GET_KEYS:          return "get_keys";
+        case StoreLockSite::CHANGES_SINCE:     return "changes_since";
+        case StoreLockSite::CURRENT_VERSION:   return "current_version";
+        case StoreLockSite::MEMORY_PROFILE:    return "memory_profile";
+        case StoreLockSite::BULK_LOAD:         return "bulk_load";
+        case StoreLockSite::SET_REHASH_STEP:   return "set_rehash_step";
+    }
+    return "unknown";
+}
+
+void StoreLockProfile::clear() {
+    acquisitions = 0;
+    for (int i = 0; i < STORE_LOCK_SITE_COUNT; ++i) {
+        wait[i].clear();
+        hold[i].clear();
+    }
+    longest.clear();
+}
+
+uint64_t KVLockProfiler::nowNs() {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                     std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+bool KVLockProfiler::sampleNext() {
+    uint32_t every = sampleEvery();
+    if (every == 0) {
+        return false;
+    }
+    if (every == 1) {
+        return true;
+    }
+    thread_local uint32_t countdown = 0;
+    if (countdown == 0) {
+        countdown = every;
+    }
+    return --countdown == 0;
+}
+
+void KVLockProfiler::record(StoreLockSite site, int key, uint64_t wait_ns, uint64_t hold_ns) {
+    int i = static_cast<int>(site);
+    profile.wait[i].record(wait_ns);
+    profile.hold[i].record(hold_ns);
+
+    // Kept sorted longest first; most holds are shorter than the shortest kept and
+    // cost a single comparison
+    std::vector<StoreLockHold>& longest = profile.longest;
+    if (longest.size() == STORE_LOCK_TOP_N && hold_ns <= longest.back().hold_ns) {
+        return;
+    }
+    StoreLockHold entry;
+    entry.hold_ns = hold_ns;
+    entry.wait_ns = wait_ns;
+    entry.at_us = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+                                            std::chrono::system_clock::now().time_since_epoch()).count());
+    entry.key = key;
+    entry.pid = static_cast<uint32_t>(getpid());
+    entry.site = static_cast<uint8_t>(site);
+    if (longest.size() == STORE_LOCK_TOP_N) {
+        longest.pop_back();
+    }
+    auto pos = std::upper_bound(longest.begin(), longest.end(), hold_ns,
+                                [](uint64_t ns, const StoreLockHold& h) { return ns > h.hold_ns; });
+    longest.insert(pos, entry);
+}
+
+void KVLockProfiler::copy(StoreLockProfile& out) const {
+    // Runs under the store lock, so only the histograms that were used are copied
+    out.clear();
+    out.sample_every = sampleEvery();
+    out.acquisitions = profile.acquisitions;
+    for (int i = 0; i < STORE_LOCK_SITE_COUNT; ++i) {
+        if (profile.wait[i].count()) {
+            out.wait[i] = profile.wait[i];
+            out.hold[i] = profile.hold[i];
+        }
+    }
+    out.longest = profile.longest;
+}
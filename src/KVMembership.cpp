@@ -0,0 +1,113 @@
+#include "KVMembership.hpp"
+#include "config.hpp"
+#include <algorithm>
+
+std::shared_ptr<const KVPlacement> PlacementSpec::build() const {
+    std::vector<PlacementNode> placement_nodes;
+    placement_nodes.reserve(nodes.size());
+    for (const MemberNode& node : nodes) {
+        placement_nodes.push_back({node.node_id, node.weight});
+    }
+    return makePlacement(strategy, std::move(placement_nodes), vnodes, ranges);
+}
+
+std::vector<int> PlacementSpec::backupsOf(int node_id) const {
+    std::vector<int> ids;
+    for (const MemberNode& node : nodes) {
+        ids.push_back(node.node_id);
+    }
+    std::sort(ids.begin(), ids.end());
+    std::vector<int> backups;
+    auto self = std::find(ids.begin(), ids.end(), node_id);
+    if (self == ids.end()) {
+        return backups;
+    }
+    std::size_t count = std::min<std::size_t>(replicas > 0 ? replicas - 1 : 0, ids.size() - 1);
+    std::size_t index = static_cast<std::size_t>(self - ids.begin());
+    for (std::size_t i = 1; i <= count; ++i) {
+        backups.push_back(ids[(index + i) % ids.size()]);
+    }
+    return backups;
+}
+
+PlacementSpec PlacementSpecFromConfig(const Config& config) {
+    PlacementConfig placement_config = config.read_placement_config();
+    PlacementSpec spec;
+    spec.strategy = placement_config.strategy;
+    spec.vnodes = placement_config.vnodes;
+    for (int i = 0; i < config.read_count(); ++i) {
+        auto weight = placement_config.weights.find(i);
+        spec.nodes.push_back({i, config.get_endpoint(i), weight == placement_config.weights.end() ? 1.0 : weight->second});
+    }
+    if (spec.strategy == "range") {
+        std::vector<PlacementNode> nodes;
+        for (const MemberNode& node : spec.nodes) {
+            nodes.push_back({node.node_id, node.weight});
+        }
+        spec.ranges = RangePlacement::initialRanges(nodes, placement_config.range_span);
+    }
+    ReplicationConfig replication = config.read_replication_config();
+    spec.replicas = replication.factor;
+    spec.wait_for_backups = replication.ack == "backup";
+    return spec;
+}
+
+std::string EndpointHost(const std::string& endpoint) {
+    std::size_t scheme = endpoint.find("://");
+    std::size_t start = scheme == std::string::npos ? 0 : scheme + 3;
+    std::size_t port = endpoint.rfind(':');
+    if (port == std::string::npos || port < start) {
+        return endpoint.substr(start);
+    }
+    return endpoint.substr(start, port - start);
+}
+
+std::string ColocatedBackups(const PlacementSpec& spec) {
+    if (spec.replicas <= 1) {
+        return "";
+    }
+    for (const MemberNode& node : spec.nodes) {
+        std::string host = EndpointHost(node.endpoint);
+        for (int backup : spec.backupsOf(node.node_id)) {
+            for (const MemberNode& other : spec.nodes) {
+                if (other.node_id == backup && EndpointHost(other.endpoint) == host) {
+                    return "node " + std::to_string(node.node_id) + " and its backup node " + std::to_string(backup) +
+                           " are both on " + host;
+                }
+            }
+        }
+    }
+    return "";
+}
+
+std::string ClusterMap::endpointOf(int node_id) const {
+    for (const MemberNode& node : current.nodes) {
+        if (node.node_id == node_id) {
+            return node.endpoint;
+        }
+    }
+    for (const MemberNode& node : previous.nodes) {
+        if (node.node_id == node_id) {
+            return node.endpoint;
+        }
+    }
+    return "";
+}
+
+std::string EncodeClusterMap(const ClusterMap& map) {
+    std::string data;
+    kvwire::StringWriter writer(data);
+    map.save(writer);
+    return data;
+}
+
+bool DecodeClusterMap(const std::string& data, ClusterMap& map) {
+    try {
+        kvwire::StringReader reader(data);
+        map.load(reader);
+        return true;
+    } catch (const std::exception& e) {
+        std::cerr << "Malformed cluster map: " << e.what() << std::endl;
+        return false;
+    }
+}
@@ -0,0 +1,340 @@
+#include "KVMetrics.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <poll.h>
+#include <sstream>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace {
+
+// Shards keep the first buckets of KVHistogram's layout: every value below 2^37 ns
+// (over two minutes) exactly as KVHistogram would, anything longer in the last one
+constexpr std::size_t SHARD_BUCKETS = 2048;
+
+// Tells KVMetrics instances apart in the per-thread shard pointers
+std::atomic<uint64_t> next_metrics_id{1};
+
+// Single writer: a relaxed load and store, no locked instruction
+inline void bump(std::atomic<uint64_t>& value, uint64_t n) {
+    value.store(value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+std::string labelSet(const std::string& extra, const std::string& own) {
+    if (extra.empty() && own.empty()) {
+        return "";
+    }
+    if (extra.empty() || own.empty()) {
+        return "{" + extra + own + "}";
+    }
+    return "{" + extra + "," + own + "}";
+}
+
+void writeSummary(std::ostringstream& out, const char* name, const std::string& labels, const std::string& own,
+                  const KVHistogram& h) {
+    for (double quantile : {0.5, 0.9, 0.99, 0.999}) {
+        std::ostringstream q;
+        q << own << ",quantile=\"" << quantile << "\"";
+        out << name << labelSet(labels, q.str()) << " " << h.valueAt(quantile * 100) / 1e9 << "\n";
+    }
+    out << name << "_sum" << labelSet(labels, own) << " " << h.mean() * h.count() / 1e9 << "\n";
+    out << name << "_count" << labelSet(labels, own) << " " << h.count() << "\n";
+}
+
+}  // namespace
+
+const char* KvRpcName(KvRpc rpc) {
+    switch (rpc) {
+        case KvRpc::FETCH:              return "kv_fetch";
+        case KvRpc::INSERT:             return "kv_insert";
+        case KvRpc::UPDATE:             return "kv_update";
+        case KvRpc::DELETE:             return "kv_delete";
+        case KvRpc::REQUEST:            return "kv_request";
+        case KvRpc::BATCH:              return "kv_batch";
+        case KvRpc::GET_MAP:            return "kv_get_map";
+        case KvRpc::SET_MAP:            return "kv_set_map";
+        case KvRpc::RANGE_STATS:        return "kv_range_stats";
+        case KvRpc::HOT_KEYS:           return "kv_hot_keys";
+        case KvRpc::REPLICATE:          return "kv_replicate";
+        case KvRpc::REPLICATION_STATUS: return "kv_replication_status";
+        case KvRpc::STATS:              return "kv_stats";
+        case KvRpc::TRACE:              return "kv_trace";
+        case KvRpc::MEMORY:             return "kv_memory";
+    }
+    return "unknown";
+}
+
+const char* KvCounterName(KvCounter counter) {
+    switch (counter) {
+        case KvCounter::HITS:      return "hits";
+        case KvCounter::MISSES:    return "misses";
+        case KvCounter::ERRORS:    return "errors";
+        case KvCounter::BYTES_IN:  return "bytes_received";
+        case KvCounter::BYTES_OUT: return "bytes_sent";
+        case KvCounter::REDIRECTS: return "redirects";
+        case KvCounter::EXPIRED:   return "expired_requests";
+        case KvCounter::REJECTED:  return "rejected_requests";
+    }
+    return "unknown";
+}
+
+std::string KvStatsReport::prometheus(const std::string& labels) const {
+    std::ostringstream out;
+    out << "# HELP kv_rpc_duration_seconds Time spent in server RPC handlers since start.\n"
+        << "# TYPE kv_rpc_duration_seconds summary\n";
+    for (int i = 0; i < KV_RPC_COUNT; ++i) {
+        std::string own = std::string("rpc=\"") + KvRpcName(static_cast<KvRpc>(i)) + "\"";
+        writeSummary(out, "kv_rpc_duration_seconds", labels, own, rpc[i]);
+    }
+    out << "# HELP kv_store_duration_seconds Time spent in KvStore operations since start.\n"
+        << "# TYPE kv_store_duration_seconds summary\n";
+    for (int i = 0; i < KV_OP_TYPE_COUNT; ++i) {
+        std::string own = std::string("op=\"") + KvOpTypeName(static_cast<KvOpType>(i)) + "\"";
+        writeSummary(out, "kv_store_duration_seconds", labels, own, store[i]);
+    }
+    for (int i = 0; i < KV_COUNTER_COUNT; ++i) {
+        std::string name = std::string("kv_") + KvCounterName(static_cast<KvCounter>(i)) + "_total";
+        out << "# TYPE " << name << " counter\n" << name << labelSet(labels, "") << " " << counters[i] << "\n";
+    }
+    auto gauge = [&](const char* name, const char* help, double value) {
+        out << "# HELP " << name << " " << help << "\n# TYPE " << name << " gauge\n"
+            << name << labelSet(labels, "") << " " << value << "\n";
+    };
+    gauge("kv_memory_total_bytes", "Size of the storage segment.", static_cast<double>(memory_total));
+    gauge("kv_memory_used_bytes", "Bytes allocated in the storage segment.", static_cast<double>(memory_used));
+    gauge("kv_memory_free_bytes", "Bytes free in the storage segment.", static_cast<double>(memory_free));
+    gauge("kv_keys", "Keys in the local store.", static_cast<double>(keys));
+    gauge("kv_uptime_seconds", "Time since the server started.", uptime_sec);
+    out << "# HELP kv_store_lock_acquisitions_total Acquisitions of the store lock by the server process.\n"
+        << "# TYPE kv_store_lock_acquisitions_total counter\n"
+        << "kv_store_lock_acquisitions_total" << labelSet(labels, "") << " " << locks.acquisitions << "\n";
+    gauge("kv_store_lock_sample_every", "One store lock acquisition in this many is timed (0: not profiled).",
+          locks.sample_every);
+    if (locks.sample_every > 0) {
+        out << "# HELP kv_store_lock_wait_seconds Time spent waiting for the store lock, by operation.\n"
+            << "# TYPE kv_store_lock_wait_seconds summary\n";
+        for (int i = 0; i < STORE_LOCK_SITE_COUNT; ++i) {
+            std::string own = std::string("op=\"") + StoreLockSiteName(static_cast<StoreLockSite>(i)) + "\"";
+            writeSummary(out, "kv_store_lock_wait_seconds", labels, own, locks.wait[i]);
+        }
+        out << "# HELP kv_store_lock_hold_seconds Time the store lock was held, by operation.\n"
+            << "# TYPE kv_store_lock_hold_seconds summary\n";
+        for (int i = 0; i < STORE_LOCK_SITE_COUNT; ++i) {
+            std::string own = std::string("op=\"") + StoreLockSiteName(static_cast<StoreLockSite>(i)) + "\"";
+            writeSummary(out, "kv_store_lock_hold_seconds", labels, own, locks.hold[i]);
+        }
+    }
+    return out.str();
+}
+
+// One thread's histograms and counters; only that thread writes them
+struct KVMetrics::Shard {
+    struct Histogram {
+        std::atomic<uint64_t> counts[SHARD_BUCKETS];
+        std::atomic<uint64_t> sum{0};
+        std::atomic<uint64_t> min{UINT64_MAX};
+        std::atomic<uint64_t> max{0};
+
+        void record(uint64_t value) {
+            bump(counts[std::min(KVHistogram::bucketOf(value), SHARD_BUCKETS - 1)], 1);
+            bump(sum, value);
+            if (value < min.load(std::memory_order_relaxed)) {
+                min.store(value, std::memory_order_relaxed);
+            }
+            if (value > max.load(std::memory_order_relaxed)) {
+                max.store(value, std::memory_order_relaxed);
+            }
+        }
+
+        void addTo(KVHistogram& h) const {
+            std::vector<uint64_t> copy(SHARD_BUCKETS);
+            for (std::size_t i = 0; i < SHARD_BUCKETS; ++i) {
+                copy[i] = counts[i].load(std::memory_order_relaxed);
+            }
+            h.mergeBuckets(copy, sum.load(std::memory_order_relaxed), min.load(std::memory_order_relaxed),
+                           max.load(std::memory_order_relaxed));
+        }
+    };
+
+    Histogram rpc[KV_RPC_COUNT];
+    Histogram store[KV_OP_TYPE_COUNT];
+    std::atomic<uint64_t> counters[KV_COUNTER_COUNT];
+};
+
+KVMetrics::KVMetrics() : instance_id(next_metrics_id++), started(std::chrono::steady_clock::now()) {}
+
+KVMetrics::~KVMetrics() = default;
+
+// A handler that yields may resume on another thread, so the shard is looked up
+// afresh by every record call and never held across one
+KVMetrics::Shard& KVMetrics::shard() {
+    struct Cached {
+        uint64_t instance = 0;
+        Shard* shard = nullptr;
+    };
+    thread_local Cached cached;
+    if (cached.instance != instance_id) {
+        std::lock_guard<std::mutex> lock(shards_mutex);
+        std::unique_ptr<Shard>& owned = shards[std::this_thread::get_id()];
+        if (!owned) {
+            owned = std::make_unique<Shard>();
+        }
+        cached.instance = instance_id;
+        cached.shard = owned.get();
+    }
+    return *cached.shard;
+}
+
+void KVMetrics::recordRpc(KvRpc rpc, uint64_t ns) {
+    shard().rpc[static_cast<int>(rpc)].record(ns);
+}
+
+void KVMetrics::recordStore(KvOpType type, uint64_t ns) {
+    shard().store[static_cast<int>(type)].record(ns);
+}
+
+void KVMetrics::add(KvCounter counter, uint64_t n) {
+    bump(shard().counters[static_cast<int>(counter)], n);
+}
+
+void KVMetrics::recordReply(const KvOp& op, const KvReply& reply) {
+    Shard& s = shard();
+    if (op.type == KvOpType::FETCH && reply.status == KvStatus::OK) {
+        bump(s.counters[static_cast<int>(KvCounter::HITS)], 1);
+    } else if (op.type == KvOpType::FETCH && reply.status == KvStatus::NOT_FOUND) {
+        bump(s.counters[static_cast<int>(KvCounter::MISSES)], 1);
+    }
+    if (reply.status == KvStatus::ERROR || reply.status == KvStatus::OUT_OF_MEMORY ||
+        reply.status == KvStatus::TIMEOUT) {
+        bump(s.counters[static_cast<int>(KvCounter::ERRORS)], 1);
+    }
+    bump(s.counters[static_cast<int>(KvCounter::BYTES_IN)], op.value.size() + op.expected.size());
+    bump(s.counters[static_cast<int>(KvCounter::BYTES_OUT)], reply.value.size());
+}
+
+void KVMetrics::collect(KvStatsReport& report) const {
+    report.uptime_sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+    std::lock_guard<std::mutex> lock(shards_mutex);
+    for (const auto& entry : shards) {
+        const Shard& s = *entry.second;
+        for (int i = 0; i < KV_RPC_COUNT; ++i) {
+            s.rpc[i].addTo(report.rpc[i]);
+        }
+        for (int i = 0; i < KV_OP_TYPE_COUNT; ++i) {
+            s.store[i].addTo(report.store[i]);
+        }
+        for (int i = 0; i < KV_COUNTER_COUNT; ++i) {
+            report.counters[i] += s.counters[i].load(std::memory_order_relaxed);
+        }
+    }
+}
+
+KVMetricsExporter::KVMetricsExporter(const MetricsConfig& config, std::function<std::string()> render)
+    : config(config), render(std::move(render)) {
+    if (!config.socket.empty()) {
+        sockaddr_un addr{};
+        addr.sun_family = AF_UNIX;
+        if (config.socket.size() >= sizeof(addr.sun_path)) {
+            throw std::runtime_error("metrics socket path too long: " + config.socket);
+        }
+        std::strcpy(addr.sun_path, config.socket.c_str());
+        unlink(config.socket.c_str());
+        listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (listen_fd < 0 || bind(listen_fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 ||
+            listen(listen_fd, 16) != 0) {
+            std::string error = std::strerror(errno);
+            if (listen_fd >= 0) {
+                close(listen_fd);
+            }
+            throw std::runtime_error("cannot listen on metrics socket " + config.socket + ": " + error);
+        }
+        std::cout << "[Metrics] Serving on unix:" << config.socket << std::endl;
+    }
+    if (!config.file.empty()) {
+        std::cout << "[Metrics] Writing " << config.file << " every " << config.interval_ms << " ms" << std::endl;
+    }
+    worker = std::thread([this] { run(); });
+}
+
+KVMetricsExporter::~KVMetricsExporter() {
+    stopping = true;
+    if (worker.joinable()) {
+        worker.join();
+    }
+    if (listen_fd >= 0) {
+        close(listen_fd);
+        unlink(config.socket.c_str());
+    }
+}
+
+// Wakes at least every 200 ms to notice shutdown
+void KVMetricsExporter::run() {
+    auto next_write = std::chrono::steady_clock::now();
+    while (!stopping) {
+        auto now = std::chrono::steady_clock::now();
+        if (!config.file.empty() && now >= next_write) {
+            writeFile();
+            next_write = now + std::chrono::milliseconds(config.interval_ms);
+        }
+        auto wait = std::chrono::milliseconds(200);
+        if (!config.file.empty()) {
+            wait = std::min(wait, std::chrono::duration_cast<std::chrono::milliseconds>(next_write - now));
+        }
+        if (listen_fd < 0) {
+            std::this_thread::sleep_for(wait);
+            continue;
+        }
+        pollfd pfd{listen_fd, POLLIN, 0};
+        if (poll(&pfd, 1, static_cast<int>(std::max<int64_t>(wait.count(), 1))) > 0) {
+            int fd = accept(listen_fd, nullptr, nullptr);
+            if (fd >= 0) {
+                serveClient(fd);
+                close(fd);
+            }
+        }
+    }
+}
+
+void KVMetricsExporter::writeFile() {
+    std::string tmp = config.file + ".tmp";
+    {
+        std::ofstream out(tmp, std::ios::trunc);
+        if (!out) {
+            std::cerr << "[Metrics] Cannot write " << tmp << std::endl;
+            return;
+        }
+        out << render();
+    }
+    if (std::rename(tmp.c_str(), config.file.c_str()) != 0) {
+        std::cerr << "[Metrics] Cannot rename " << tmp << ": " << std::strerror(errno) << std::endl;
+    }
+}
+
+// Reads whatever request comes within 100 ms (an HTTP client sends one, a plain
+// reader none) so closing does not reset the connection, then answers
+void KVMetricsExporter::serveClient(int fd) {
+    pollfd pfd{fd, POLLIN, 0};
+    if (poll(&pfd, 1, 100) > 0) {
+        char request[4096];
+        if (read(fd, request, sizeof(request)) < 0) {
+            return;
+        }
+    }
+    std::string body = render();
+    std::string response = "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: " +
+                           std::to_string(body.size()) + "\r\n\r\n" + body;
+    std::size_t offset = 0;
+    while (offset < response.size()) {
+        ssize_t written = send(fd, response.data() + offset, response.size() - offset, MSG_NOSIGNAL);
+        if (written <= 0) {
+            return;
+        }
+        offset += static_cast<std::size_t>(written);
+    }
+    shutdown(fd, SHUT_WR);
+}
@@ -0,0 +1,186 @@
+#include "KVPlacement.hpp"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+
+uint64_t placementHash(uint64_t x) {
+    // splitmix64 finalizer
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+namespace {
+
+uint64_t keyHash(int key) {
+    return placementHash(static_cast<uint32_t>(key));
+}
+
+uint64_t pairHash(uint64_t a, uint64_t b) {
+    return placementHash(a ^ placementHash(b));
+}
+
+}  // namespace
+
+KVPlacement::KVPlacement(std::vector<PlacementNode> node_list) : nodes(std::move(node_list)) {
+    if (nodes.empty()) {
+        throw std::invalid_argument("placement needs at least one node");
+    }
+    std::sort(nodes.begin(), nodes.end(),
+              [](const PlacementNode& a, const PlacementNode& b) { return a.node_id < b.node_id; });
+}
+
+ModuloPlacement::ModuloPlacement(std::vector<PlacementNode> node_list) : KVPlacement(std::move(node_list)) {}
+
+int ModuloPlacement::nodeFor(int key) const {
+    // Same result as the old key % count_of_node for ids 0..N-1 and non-negative keys
+    long long n = static_cast<long long>(nodes.size());
+    long long slot = ((static_cast<long long>(key) % n) + n) % n;
+    return nodes[slot].node_id;
+}
+
+RingPlacement::RingPlacement(std::vector<PlacementNode> node_list, std::size_t vnodes)
+    : KVPlacement(std::move(node_list)) {
+    vnodes = std::max<std::size_t>(vnodes, 1);
+    for (const PlacementNode& node : nodes) {
+        if (node.weight <= 0) {
+            continue;
+        }
+        std::size_t count = std::max<std::size_t>(static_cast<std::size_t>(std::lround(vnodes * node.weight)), 1);
+        for (std::size_t i = 0; i < count; ++i) {
+            points.emplace_back(pairHash(static_cast<uint64_t>(node.node_id), i), node.node_id);
+        }
+    }
+    if (points.empty()) {
+        throw std::invalid_argument("placement needs a node with positive weight");
+    }
+    std::sort(points.begin(), points.end());
+}
+
+int RingPlacement::nodeFor(int key) const {
+    uint64_t h = keyHash(key);
+    auto it = std::lower_bound(points.begin(), points.end(), std::make_pair(h, std::numeric_limits<int>::min()));
+    if (it == points.end()) {
+        it = points.begin();  // Wrap around the ring
+    }
+    return it->second;
+}
+
+JumpPlacement::JumpPlacement(std::vector<PlacementNode> node_list) : KVPlacement(std::move(node_list)) {}
+
+int JumpPlacement::nodeFor(int key) const {
+    uint64_t h = keyHash(key);
+    int64_t bucket = -1;
+    int64_t next = 0;
+    int64_t buckets = static_cast<int64_t>(nodes.size());
+    while (next < buckets) {
+        bucket = next;
+        h = h * 2862933555777941757ULL + 1;
+        next = static_cast<int64_t>((bucket + 1) * (static_cast<double>(1LL << 31) / static_cast<double>((h >> 33) + 1)));
+    }
+    return nodes[bucket].node_id;
+}
+
+RendezvousPlacement::RendezvousPlacement(std::vector<PlacementNode> node_list) : KVPlacement(std::move(node_list)) {}
+
+int RendezvousPlacement::nodeFor(int key) const {
+    uint64_t h = keyHash(key);
+    int best_node = nodes.front().node_id;
+    double best_score = -std::numeric_limits<double>::infinity();
+    for (const PlacementNode& node : nodes) {
+        if (node.weight <= 0) {
+            continue;
+        }
+        // Map the hash into (0, 1) and use -w / ln(u) so shares follow the weights
+        uint64_t mixed = pairHash(h, static_cast<uint64_t>(node.node_id));
+        double u = (static_cast<double>(mixed >> 11) + 0.5) / static_cast<double>(1ULL << 53);
+        double score = -node.weight / std::log(u);
+        if (score > best_score) {
+            best_score = score;
+            best_node = node.node_id;
+        }
+    }
+    return best_node;
+}
+
+RangePlacement::RangePlacement(std::vector<PlacementNode> node_list, std::vector<KeyRange> range_table)
+    : KVPlacement(std::move(node_list)), ranges(std::move(range_table)) {
+    if (ranges.empty() || ranges.front().start != std::numeric_limits<int>::min()) {
+        throw std::invalid_argument("range table must start at INT_MIN");
+    }
+    for (std::size_t i = 0; i < ranges.size(); ++i) {
+        if (i > 0 && ranges[i].start <= ranges[i - 1].start) {
+            throw std::invalid_argument("range table must be sorted by start");
+        }
+        bool known = std::any_of(nodes.begin(), nodes.end(),
+                                 [&](const PlacementNode& node) { return node.node_id == ranges[i].node_id; });
+        if (!known) {
+            throw std::invalid_argument("range owned by unknown node " + std::to_string(ranges[i].node_id));
+        }
+    }
+}
+
+std::size_t RangePlacement::rangeIndex(int key) const {
+    auto it = std::upper_bound(ranges.begin(), ranges.end(), key,
+                               [](int k, const KeyRange& range) { return k < range.start; });
+    return static_cast<std::size_t>(it - ranges.begin()) - 1;
+}
+
+int RangePlacement::nodeFor(int key) const {
+    return ranges[rangeIndex(key)].node_id;
+}
+
+int64_t RangePlacement::rangeEnd(std::size_t i) const {
+    return i + 1 < ranges.size() ? ranges[i + 1].start : static_cast<int64_t>(std::numeric_limits<int>::max()) + 1;
+}
+
+std::vector<KeyRange> RangePlacement::initialRanges(const std::vector<PlacementNode>& nodes, int span) {
+    std::vector<PlacementNode> sorted = nodes;
+    std::sort(sorted.begin(), sorted.end(),
+              [](const PlacementNode& a, const PlacementNode& b) { return a.node_id < b.node_id; });
+    double total_weight = 0;
+    for (const PlacementNode& node : sorted) {
+        total_weight += std::max(node.weight, 0.0);
+    }
+
+    std::vector<KeyRange> table;
+    double offset = 0;
+    for (const PlacementNode& node : sorted) {
+        if (node.weight <= 0 && total_weight > 0) {
+            continue;
+        }
+        int start = table.empty() ? std::numeric_limits<int>::min() : static_cast<int>(offset);
+        if (table.empty() || start > table.back().start) {
+            table.push_back({start, node.node_id});
+        }
+        offset += total_weight > 0 ? span * (node.weight / total_weight) : 0;
+    }
+    return table;
+}
+
+std::unique_ptr<KVPlacement> makePlacement(const std::string& strategy,
+                                           std::vector<PlacementNode> nodes,
+                                           std::size_t vnodes,
+                                           std::vector<KeyRange> ranges) {
+    if (strategy == "range") {
+        if (ranges.empty()) {
+            ranges = RangePlacement::initialRanges(nodes, DEFAULT_RANGE_SPAN);
+        }
+        return std::make_unique<RangePlacement>(std::move(nodes), std::move(ranges));
+    }
+    if (strategy == "ring") {
+        return std::make_unique<RingPlacement>(std::move(nodes), vnodes);
+    }
+    if (strategy == "jump") {
+        return std::make_unique<JumpPlacement>(std::move(nodes));
+    }
+    if (strategy == "rendezvous") {
+        return std::make_unique<RendezvousPlacement>(std::move(nodes));
+    }
+    if (strategy == "modulo") {
+        return std::make_unique<ModuloPlacement>(std::move(nodes));
+    }
+    throw std::invalid_argument("unknown placement strategy: " + strategy);
+}
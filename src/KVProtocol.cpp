@@ -0,0 +1,89 @@
+#include "KVProtocol.hpp"
+#include <chrono>
+
+uint64_t WallClockMicros() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+KvReply ExecuteOp(KvStore& kv, const KvOp& op) {
+    KvReply reply;
+    switch (op.type) {
+        case KvOpType::FETCH: {
+            LeasedValue found = kv.FindWithLease(op.key, op.lease_ms);
+            reply.status = found.status;
+            reply.version = found.version;
+            reply.lease_ms = found.lease_ms;
+            reply.value = std::move(found.value);
+            break;
+        }
+        case KvOpType::INSERT:
+            reply.status = kv.Insert(op.key, op.value, &reply.version);
+            break;
+        case KvOpType::UPDATE:
+            reply.status = kv.Update(op.key, op.value, &reply.version);
+            break;
+        case KvOpType::DELETE:
+            reply.status = kv.Delete(op.key, &reply.version);
+            break;
+        case KvOpType::CAS:
+            reply.status = kv.CompareAndSwap(op.key, op.expected, op.value, &reply.value, &reply.version);
+            break;
+        case KvOpType::CAS_VERSION:
+            reply.status = kv.CompareAndSwapVersion(op.key, op.version, op.value, &reply.version);
+            break;
+        case KvOpType::INCREMENT: {
+            int64_t result = 0;
+            reply.status = kv.Increment(op.key, op.delta, result, &reply.version);
+            if (reply.status == KvStatus::OK) {
+                reply.value = std::to_string(result);
+            }
+            break;
+        }
+        case KvOpType::APPEND:
+            reply.status = kv.Append(op.key, op.value, &reply.version);
+            break;
+        case KvOpType::GET_AND_SET:
+            reply.status = kv.GetAndSet(op.key, op.value, reply.value, &reply.version);
+            break;
+        case KvOpType::SCAN:
+            reply.value = EncodeScanResult(kv.Scan(op.key, op.end_key, op.limit));
+            reply.status = KvStatus::OK;
+            break;
+        case KvOpType::DELETE_IF_VERSION:
+            reply.status = kv.DeleteIfVersion(op.key, op.version, &reply.version);
+            break;
+        default:
+            reply.status = KvStatus::ERROR;
+            break;
+    }
+    return reply;
+}
+
+std::string EncodeScanResult(const std::vector<std::pair<int, std::string>>& items) {
+    std::string data;
+    kvwire::StringWriter writer(data);
+    for (const auto& item : items) {
+        int32_t key = item.first;
+        writer.write(&key);
+        kvwire::writeString(writer, item.second);
+    }
+    return data;
+}
+
+bool DecodeScanResult(const std::string& data, std::vector<std::pair<int, std::string>>& items) {
+    try {
+        kvwire::StringReader reader(data);
+        while (!reader.done()) {
+            int32_t key = 0;
+            std::string value;
+            reader.read(&key);
+            kvwire::readString(reader, value);
+            items.emplace_back(key, std::move(value));
+        }
+        return true;
+    } catch (const std::exception& e) {
+        std::cerr << "Malformed scan result: " << e.what() << std::endl;
+        return false;
+    }
+}
@@ -0,0 +1,155 @@
+#include "KVRebalancer.hpp"
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+
+KVRebalancer::KVRebalancer(KvStore& kv_store, std::shared_ptr<const KVPlacement> target_placement,
+                           int local_node_id, std::size_t batch_size, uint32_t max_keys_per_sec,
+                           std::size_t max_passes, SendFn send_fn)
+    : kv(kv_store),
+      target(std::move(target_placement)),
+      local_node_id(local_node_id),
+      batch_size(std::max<std::size_t>(batch_size, 1)),
+      max_keys_per_sec(max_keys_per_sec),
+      max_passes(std::max<std::size_t>(max_passes, 1)),
+      send(std::move(send_fn)) {}
+
+KVRebalancer::~KVRebalancer() {
+    stop();
+    wait();
+}
+
+void KVRebalancer::start() {
+    running = true;
+    worker = std::thread(&KVRebalancer::run, this);
+}
+
+void KVRebalancer::wait() {
+    if (worker.joinable()) {
+        worker.join();
+    }
+}
+
+void KVRebalancer::stop() {
+    stopping = true;
+}
+
+RebalanceStats KVRebalancer::stats() const {
+    RebalanceStats result;
+    result.scanned = scanned.load();
+    result.moved = moved.load();
+    result.superseded = superseded.load();
+    result.raced = raced.load();
+    result.failed = failed.load();
+    result.passes = passes.load();
+    result.running = running.load();
+    return result;
+}
+
+void KVRebalancer::run() {
+    auto start = std::chrono::steady_clock::now();
+    std::cout << "[Rebalance] Moving keys to their owners under " << target->name() << " placement" << std::endl;
+
+    // Keys that raced with a write are left in place and picked up by the next pass
+    while (!stopping && passes < max_passes) {
+        ++passes;
+        std::size_t raced_before = raced.load();
+        std::size_t misplaced = runPass();
+        std::cout << "[Rebalance] Pass " << passes << ": " << misplaced << " keys to move" << std::endl;
+        if (misplaced == 0 || raced.load() == raced_before) {
+            break;
+        }
+    }
+
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    std::cout << "[Rebalance] " << (stopping ? "Stopped" : "Finished") << " after " << elapsed.count()
+              << " s: " << moved << " moved, " << superseded << " superseded, " << raced << " raced, "
+              << failed << " failed" << std::endl;
+    running = false;
+}
+
+std::size_t KVRebalancer::runPass() {
+    std::vector<int> keys = kv.GetKeys();
+    scanned += keys.size();
+
+    std::vector<int> misplaced;
+    for (int key : keys) {
+        if (target->nodeFor(key) != local_node_id) {
+            misplaced.push_back(key);
+        }
+    }
+
+    auto pass_start = std::chrono::steady_clock::now();
+    for (std::size_t offset = 0; offset < misplaced.size() && !stopping; offset += batch_size) {
+        std::size_t end = std::min(offset + batch_size, misplaced.size());
+        moveBatch(std::vector<int>(misplaced.begin() + offset, misplaced.begin() + end));
+
+        // Throttle: never run ahead of max_keys_per_sec since the start of the pass
+        if (max_keys_per_sec > 0) {
+            auto due = pass_start + std::chrono::microseconds(end * 1000000ULL / max_keys_per_sec);
+            std::this_thread::sleep_until(due);
+        }
+    }
+    return misplaced.size();
+}
+
+void KVRebalancer::moveBatch(const std::vector<int>& keys) {
+    std::vector<LeasedValue> found = kv.FindMany(keys, 0);
+
+    Batches copies;
+    std::unordered_map<int, std::vector<uint64_t>> source_versions;   // node id -> version per copy
+    for (std::size_t i = 0; i < keys.size(); ++i) {
+        if (found[i].status != KvStatus::OK) {
+            continue;   // Deleted since the key list was taken
+        }
+        int owner = target->nodeFor(keys[i]);
+        copies[owner].push_back(KvOp{KvOpType::INSERT, keys[i], std::move(found[i].value)});
+        source_versions[owner].push_back(found[i].version);
+    }
+    if (copies.empty()) {
+        return;
+    }
+
+    std::unordered_map<int, BatchResult> results = send(copies);
+    Batches withdrawals;
+    for (const auto& entry : copies) {
+        int owner = entry.first;
+        const std::vector<KvOp>& ops = entry.second;
+        const BatchResult& result = results[owner];
+        if (!result.error.empty() || result.replies.size() != ops.size()) {
+            failed += ops.size();
+            continue;
+        }
+        for (std::size_t j = 0; j < ops.size(); ++j) {
+            const KvReply& reply = result.replies[j];
+            if (reply.status != KvStatus::OK && reply.status != KvStatus::ALREADY_EXISTS) {
+                failed += 1;
+                continue;
+            }
+            KvStatus removed = kv.DeleteIfVersion(ops[j].key, source_versions[owner][j]);
+            if (removed == KvStatus::NOT_FOUND && reply.status == KvStatus::ALREADY_EXISTS) {
+                superseded += 1;   // A client already pulled it across
+                continue;
+            }
+            if (removed == KvStatus::OK) {
+                if (reply.status == KvStatus::OK) {
+                    moved += 1;
+                } else {
+                    superseded += 1;
+                }
+                continue;
+            }
+            // The local copy changed while in flight: take back what was just written
+            // (if nothing has overwritten it since) and let the next pass retry
+            raced += 1;
+            if (reply.status == KvStatus::OK) {
+                KvOp withdraw{KvOpType::DELETE_IF_VERSION, ops[j].key, ""};
+                withdraw.version = reply.version;
+                withdrawals[owner].push_back(withdraw);
+            }
+        }
+    }
+    if (!withdrawals.empty()) {
+        send(withdrawals);
+    }
+}
@@ -0,0 +1,457 @@
+#include "KVReplication.hpp"
+#include <algorithm>
+#include <iostream>
+#include <limits>
+#include <unordered_set>
+
+uint64_t KVReplicaStore::apply(const ReplicaBatch& batch) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = sources.find(batch.primary);
+    if (batch.reset) {
+        sources[batch.primary] = Source{};
+        it = sources.find(batch.primary);
+    } else if (it == sources.end()) {
+        return 0;
+    }
+    Source& source = it->second;
+    auto owner = owners.find(batch.primary);
+    const KVPlacement* placement = owner == owners.end() ? nullptr : owner->second.get();
+    for (const ReplicaEntry& entry : batch.entries) {
+        if (entry.deleted || (placement && placement->nodeFor(entry.key) != batch.primary)) {
+            source.data.erase(entry.key);
+        } else {
+            source.data[entry.key] = entry;
+        }
+    }
+    source.through = std::max(source.through, batch.through);
+    if (batch.caught_up) {
+        source.has_caught_up = true;
+        source.caught_up_at = Clock::now();
+    }
+    return batch.through;
+}
+
+KvStatus KVReplicaStore::read(int primary, int key, uint32_t max_staleness_ms, std::string& value, uint64_t& version) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = sources.find(primary);
+    if (it == sources.end() || !it->second.has_caught_up ||
+        Clock::now() - it->second.caught_up_at > std::chrono::milliseconds(max_staleness_ms)) {
+        return KvStatus::STALE;
+    }
+    auto entry = it->second.data.find(key);
+    if (entry == it->second.data.end()) {
+        return KvStatus::NOT_FOUND;
+    }
+    value = entry->second.value;
+    version = entry->second.version;
+    return KvStatus::OK;
+}
+
+std::vector<int> KVReplicaStore::primaries() {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<int> ids;
+    for (const auto& entry : sources) {
+        ids.push_back(entry.first);
+    }
+    return ids;
+}
+
+void KVReplicaStore::restrictTo(int primary, std::shared_ptr<const KVPlacement> placement) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = sources.find(primary);
+    if (it != sources.end()) {
+        for (auto entry = it->second.data.begin(); entry != it->second.data.end();) {
+            entry = placement->nodeFor(entry->first) == primary ? std::next(entry) : it->second.data.erase(entry);
+        }
+    }
+    owners[primary] = std::move(placement);
+}
+
+std::vector<ReplicaEntry> KVReplicaStore::take(int primary) {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<ReplicaEntry> entries;
+    owners.erase(primary);
+    auto it = sources.find(primary);
+    if (it == sources.end()) {
+        return entries;
+    }
+    entries.reserve(it->second.data.size());
+    for (auto& entry : it->second.data) {
+        entries.push_back(std::move(entry.second));
+    }
+    sources.erase(it);
+    return entries;
+}
+
+void KVReplicaStore::drop(int primary) {
+    std::lock_guard<std::mutex> lock(mutex);
+    sources.erase(primary);
+    owners.erase(primary);
+}
+
+std::vector<ReplicationStatus::Source> KVReplicaStore::status() {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<ReplicationStatus::Source> result;
+    auto now = Clock::now();
+    for (const auto& entry : sources) {
+        ReplicationStatus::Source source;
+        source.primary = entry.first;
+        source.keys = entry.second.data.size();
+        source.through = entry.second.through;
+        if (entry.second.has_caught_up) {
+            source.lag_ms = std::chrono::duration<double, std::milli>(now - entry.second.caught_up_at).count();
+        }
+        result.push_back(source);
+    }
+    return result;
+}
+
+KVReplicator::KVReplicator(KvStore& kv_store, SendFn send_fn, ForwardFn forward_fn, std::size_t batch_size)
+    : kv(kv_store),
+      send(std::move(send_fn)),
+      forward(std::move(forward_fn)),
+      batch_size(std::max<std::size_t>(batch_size, 1)) {
+    worker = std::thread(&KVReplicator::run, this);
+}
+
+KVReplicator::~KVReplicator() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wakeup.notify_all();
+    if (worker.joinable()) {
+        worker.join();
+    }
+}
+
+void KVReplicator::configure(int self_node_id, std::shared_ptr<const KVPlacement> new_placement,
+                             const std::vector<int>& backup_ids,
+                             const std::unordered_map<int, std::string>& node_endpoints) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::shared_ptr<const KVPlacement> previous = std::move(placement);
+        bool same_node = self == self_node_id;
+        self = self_node_id;
+        placement = std::move(new_placement);
+        endpoints = node_endpoints;
+        std::vector<Backup> next;
+        for (int id : backup_ids) {
+            auto kept = std::find_if(backups.begin(), backups.end(),
+                                     [id](const Backup& backup) { return backup.node_id == id; });
+            Backup backup;
+            if (same_node && kept != backups.end()) {
+                // Still in step for the keys owned before; only the gained ones are missing
+                backup = std::move(*kept);
+                if (!backup.needs_copy && previous) {
+                    backup.resync_since.push_back(previous);
+                }
+            }
+            backup.node_id = id;
+            backup.endpoint = endpoints[id];
+            next.push_back(std::move(backup));
+        }
+        backups = std::move(next);
+        ++generation;
+        woken = true;
+    }
+    std::cout << "[Replication] Node " << self_node_id << " ships to " << backup_ids.size() << " backup(s)" << std::endl;
+    wakeup.notify_all();
+}
+
+void KVReplicator::recover(std::vector<ReplicaEntry> entries) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (ReplicaEntry& entry : entries) {
+            pending_recovery.push_back(std::move(entry));
+        }
+        woken = true;
+    }
+    wakeup.notify_all();
+}
+
+void KVReplicator::wake() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        woken = true;
+    }
+    wakeup.notify_all();
+}
+
+uint64_t KVReplicator::ackedThrough() {
+    std::lock_guard<std::mutex> lock(mutex);
+    uint64_t acked = std::numeric_limits<uint64_t>::max();
+    for (const Backup& backup : backups) {
+        acked = std::min(acked, backup.needs_copy ? 0 : backup.acked);
+    }
+    return acked;
+}
+
+bool KVReplicator::hasBackups() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return !backups.empty();
+}
+
+std::vector<ReplicationStatus::Backup> KVReplicator::status() {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<ReplicationStatus::Backup> result;
+    for (const Backup& backup : backups) {
+        result.push_back({backup.node_id, backup.acked, backup.needs_copy, backup.reachable});
+    }
+    return result;
+}
+
+// Works on copies of the backups' state so configure() never waits on the network;
+// results are written back only if no new map arrived meanwhile
+void KVReplicator::run() {
+    while (true) {
+        std::vector<Backup> work;
+        uint64_t work_generation = 0;
+        int self_id = -1;
+        std::shared_ptr<const KVPlacement> owner_map;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wakeup.wait_for(lock, INTERVAL, [this] { return woken || stopping; });
+            if (stopping) {
+                return;
+            }
+            woken = false;
+            work = backups;
+            work_generation = generation;
+            self_id = self;
+            owner_map = placement;
+        }
+        if (!owner_map) {
+            continue;
+        }
+
+        recoverPending();
+        bool busy = false;
+        for (Backup& backup : work) {
+            busy = step(backup, self_id, owner_map) || busy;
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if (generation == work_generation) {
+            backups = std::move(work);
+        } else {
+            // A new map arrived meanwhile: keep what was shipped to the backups it
+            // kept, and leave their resync to the next round
+            for (const Backup& done : work) {
+                for (Backup& backup : backups) {
+                    if (backup.node_id == done.node_id && !done.needs_copy) {
+                        backup.acked = done.acked;
+                        backup.needs_copy = false;
+                        backup.reachable = done.reachable;
+                        backup.last_sent = done.last_sent;
+                    }
+                }
+            }
+        }
+        if (busy) {
+            woken = true;   // More to ship: go again without waiting
+        }
+    }
+}
+
+// Ships the next batch of changes to one backup; true if there may be more to do
+bool KVReplicator::step(Backup& backup, int self_id, const std::shared_ptr<const KVPlacement>& owner_map) {
+    auto now = std::chrono::steady_clock::now();
+    if (!backup.reachable && now - backup.last_sent < RETRY) {
+        return false;
+    }
+    if (backup.needs_copy) {
+        return copyAll(backup, self_id, owner_map);
+    }
+    if (!backup.resync_since.empty()) {
+        return resync(backup, self_id, owner_map);
+    }
+
+    ChangeSet changes = kv.ChangesSince(backup.acked, batch_size);
+    if (changes.truncated) {
+        std::cout << "[Replication] Backup " << backup.node_id << " fell behind the change log, copying again" << std::endl;
+        backup.needs_copy = true;
+        return true;
+    }
+    if (changes.keys.empty() && changes.through == backup.acked && now - backup.last_sent < HEARTBEAT) {
+        return false;
+    }
+
+    ReplicaBatch batch;
+    batch.primary = self_id;
+    batch.caught_up = changes.caught_up;
+    batch.through = changes.through;
+    batch.entries = readEntries(changes.keys, self_id, owner_map);
+    uint64_t acked = 0;
+    backup.last_sent = now;
+    if (!send(backup.endpoint, batch, acked)) {
+        if (backup.reachable) {
+            std::cerr << "[Replication] Backup " << backup.node_id << " unreachable" << std::endl;
+        }
+        backup.reachable = false;
+        return false;
+    }
+    backup.reachable = true;
+    if (acked != batch.through) {
+        std::cout << "[Replication] Backup " << backup.node_id << " has no copy yet, sending one" << std::endl;
+        backup.needs_copy = true;
+        return true;
+    }
+    backup.acked = acked;
+    return !changes.caught_up;
+}
+
+// Full copy of every key this node owns. Changes made while it runs are shipped
+// from the log afterwards, starting from the version read before the copy.
+bool KVReplicator::copyAll(Backup& backup, int self_id, const std::shared_ptr<const KVPlacement>& owner_map) {
+    auto start = std::chrono::steady_clock::now();
+    uint64_t through = kv.CurrentVersion();
+    std::vector<int> keys;
+    for (int key : kv.GetKeys()) {
+        if (owner_map->nodeFor(key) == self_id) {
+            keys.push_back(key);
+        }
+    }
+
+    std::size_t offset = 0;
+    do {
+        std::size_t end = std::min(keys.size(), offset + batch_size);
+        ReplicaBatch batch;
+        batch.primary = self_id;
+        batch.reset = offset == 0;
+        batch.through = through;
+        batch.entries = readEntries(std::vector<int>(keys.begin() + offset, keys.begin() + end), self_id, owner_map);
+        uint64_t acked = 0;
+        backup.last_sent = std::chrono::steady_clock::now();
+        if (!send(backup.endpoint, batch, acked) || acked != through) {
+            if (backup.reachable) {
+                std::cerr << "[Replication] Copy to backup " << backup.node_id << " failed" << std::endl;
+            }
+            backup.reachable = false;
+            return false;
+        }
+        offset = end;
+    } while (offset < keys.size());
+
+    backup.reachable = true;
+    backup.needs_copy = false;
+    backup.resync_since.clear();
+    backup.acked = through;
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    std::cout << "[Replication] Copied " << keys.size() << " keys to backup " << backup.node_id << " in "
+              << elapsed.count() << " ms" << std::endl;
+    return true;
+}
+
+// Ships the keys this node gained since the backup was last in step: the log
+// entries of their earlier changes were skipped as not owned. Keys it lost are
+// dropped by the backup itself (KVReplicaStore::restrictTo).
+bool KVReplicator::resync(Backup& backup, int self_id, const std::shared_ptr<const KVPlacement>& owner_map) {
+    std::vector<int> keys;
+    for (int key : kv.GetKeys()) {
+        if (owner_map->nodeFor(key) != self_id) {
+            continue;
+        }
+        for (const auto& before : backup.resync_since) {
+            if (before->nodeFor(key) != self_id) {
+                keys.push_back(key);
+                break;
+            }
+        }
+    }
+
+    for (std::size_t offset = 0; offset < keys.size(); offset += batch_size) {
+        std::size_t end = std::min(keys.size(), offset + batch_size);
+        ReplicaBatch batch;
+        batch.primary = self_id;
+        batch.through = backup.acked;
+        batch.entries = readEntries(std::vector<int>(keys.begin() + offset, keys.begin() + end), self_id, owner_map);
+        uint64_t acked = 0;
+        backup.last_sent = std::chrono::steady_clock::now();
+        if (!send(backup.endpoint, batch, acked)) {
+            if (backup.reachable) {
+                std::cerr << "[Replication] Backup " << backup.node_id << " unreachable" << std::endl;
+            }
+            backup.reachable = false;
+            return false;
+        }
+        backup.reachable = true;
+        if (acked != batch.through) {
+            std::cout << "[Replication] Backup " << backup.node_id << " has no copy yet, sending one" << std::endl;
+            backup.needs_copy = true;
+            backup.resync_since.clear();
+            return true;
+        }
+    }
+    backup.resync_since.clear();
+    if (!keys.empty()) {
+        std::cout << "[Replication] Sent " << keys.size() << " newly owned keys to backup " << backup.node_id
+                  << std::endl;
+    }
+    return true;
+}
+
+std::vector<ReplicaEntry> KVReplicator::readEntries(const std::vector<int>& keys, int self_id,
+                                                    const std::shared_ptr<const KVPlacement>& owner_map) {
+    std::vector<int> owned;
+    std::unordered_set<int> seen;
+    for (int key : keys) {
+        if (owner_map->nodeFor(key) == self_id && seen.insert(key).second) {
+            owned.push_back(key);
+        }
+    }
+    std::vector<ReplicaEntry> entries(owned.size());
+    std::vector<LeasedValue> found = kv.FindMany(owned, 0);
+    for (std::size_t i = 0; i < owned.size(); ++i) {
+        entries[i].key = owned[i];
+        entries[i].deleted = found[i].status != KvStatus::OK;
+        entries[i].version = found[i].version;
+        entries[i].value = std::move(found[i].value);
+    }
+    return entries;
+}
+
+void KVReplicator::recoverPending() {
+    std::vector<ReplicaEntry> entries;
+    int self_id = -1;
+    std::shared_ptr<const KVPlacement> owner_map;
+    std::unordered_map<int, std::string> node_endpoints;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (pending_recovery.empty()) {
+            return;
+        }
+        entries.swap(pending_recovery);
+        self_id = self;
+        owner_map = placement;
+        node_endpoints = endpoints;
+    }
+
+    std::unordered_map<int, std::vector<KvOp>> by_owner;
+    std::size_t local = 0;
+    for (ReplicaEntry& entry : entries) {
+        int owner = owner_map->nodeFor(entry.key);
+        if (owner == self_id) {
+            if (kv.Insert(entry.key, entry.value) == KvStatus::OK) {
+                ++local;
+            }
+            continue;
+        }
+        by_owner[owner].push_back(KvOp{KvOpType::INSERT, entry.key, std::move(entry.value)});
+    }
+    std::size_t forwarded = 0;
+    for (auto& group : by_owner) {
+        for (std::size_t offset = 0; offset < group.second.size(); offset += batch_size) {
+            std::size_t end = std::min(group.second.size(), offset + batch_size);
+            std::vector<KvOp> ops(group.second.begin() + offset, group.second.begin() + end);
+            if (forward(node_endpoints[group.first], ops)) {
+                forwarded += ops.size();
+            } else {
+                std::cerr << "[Replication] Could not hand " << ops.size() << " recovered keys to node "
+                          << group.first << std::endl;
+            }
+        }
+    }
+    std::cout << "[Replication] Recovered " << entries.size() << " keys: " << local << " kept here, "
+              << forwarded << " sent to their new owners" << std::endl;
+}
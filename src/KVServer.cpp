@@ -1,27 +1,156 @@
 #include "KVServer.hpp"
 #include <thallium/serialization/stl/string.hpp>
+#include <thallium/serialization/stl/vector.hpp>
 #include <stdexcept>
 #include <chrono>
+#include <algorithm>
+#include <thread>
+#include <unordered_set>
 #include "KVStore.hpp"
-KVServer::KVServer(tl::engine &e, KvStore& kv_ref, uint16_t provider_id)
+KVServer::KVServer(tl::engine &e, KvStore& kv_ref, uint16_t provider_id, const AdmissionConfig& admission_config)
     : tl::provider<KVServer>(e, provider_id),
-      kv(kv_ref)
+      kv(kv_ref),
+      replicate_rpc(e.define("kv_replicate")),
+      batch_rpc(e.define("kv_batch")),
+      admission(admission_config.max_queue, admission_config.client_ops_per_sec, admission_config.client_burst,
+                admission_config.retry_after_ms)
 {
     define("kv_fetch", &KVServer::kv_fetch);
     define("kv_insert", &KVServer::kv_insert);
     define("kv_update", &KVServer::kv_update);
     define("kv_delete", &KVServer::kv_delete);  // Register delete method
+    define("kv_request", &KVServer::kv_request);
+    define("kv_batch", &KVServer::kv_batch);
+    define("kv_get_map", &KVServer::kv_get_map);
+    define("kv_set_map", &KVServer::kv_set_map);
+    define("kv_range_stats", &KVServer::kv_range_stats);
+    define("kv_hot_keys", &KVServer::kv_hot_keys);
+    define("kv_replicate", &KVServer::kv_replicate);
+    define("kv_replication_status", &KVServer::kv_replication_status);
+    define("kv_stats", &KVServer::kv_stats);
+    define("kv_trace", &KVServer::kv_trace);
+    define("kv_memory", &KVServer::kv_memory);
+
+    // Writers waiting out a read lease run in handler ULTs: yield the execution
+    // stream to the other handlers instead of blocking it for the whole lease
+    tl::engine engine = e;
+    kv.SetLeaseSleep([engine](int64_t ns) { tl::thread::sleep(engine, static_cast<double>(ns) / 1e6); });
+
+    // Server-to-server calls for replication go out on this server's own engine
+    replicator = std::make_unique<KVReplicator>(
+        kv,
+        [this](const std::string& endpoint, const ReplicaBatch& batch, uint64_t& acked) {
+            try {
+                tl::provider_handle ph(get_engine().lookup(endpoint), get_provider_id());
+                // Bounded, so a hung backup cannot stall shipping to the others
+                acked = replicate_rpc.on(ph).timed(REPLICATION_ACK_TIMEOUT, batch).as<uint64_t>();
+                return true;
+            } catch (const std::exception&) {
+                return false;
+            }
+        },
+        [this](const std::string& endpoint, const std::vector<KvOp>& ops) {
+            try {
+                uint64_t epoch = 0;
+                {
+                    std::lock_guard<std::mutex> lock(map_mutex);
+                    epoch = cluster_map.epoch;
+                }
+                tl::provider_handle ph(get_engine().lookup(endpoint), get_provider_id());
+                for (int attempt = 0; attempt < RECOVERY_ATTEMPTS; ++attempt) {
+                    std::vector<KvReply> replies =
+                        batch_rpc.on(ph).timed(REPLICATION_ACK_TIMEOUT, epoch, ops).as<std::vector<KvReply>>();
+                    if (replies.size() != ops.size()) {
+                        return false;
+                    }
+                    if (replies[0].status != KvStatus::OVERLOADED) {
+                        return true;
+                    }
+                    std::this_thread::sleep_for(std::chrono::milliseconds(replies[0].retry_after_ms));
+                }
+                return false;
+            } catch (const std::exception&) {
+                return false;
+            }
+        });
+}
+// Stamps reply with this server's epoch. A client whose epoch is older than ours
+// and who asks for a key we do not own under our map is answered with MOVED and
+// the map; clients that are current are trusted, since during a rebalance they
+// legitimately read from and pull keys off previous owners. Scans are never
+// redirected: they cover whatever this node stores in the range.
+bool KVServer::redirect(uint64_t client_epoch, const KvOp& op, KvReply& reply) {
+    std::shared_ptr<const MapView> view = currentMapView();
+    reply.epoch = view->epoch;
+    int key = op.key;
+    {
+        Traffic& seen = threadTraffic();
+        std::lock_guard<std::mutex> lock(seen.mutex);
+        if (auto* ranges = dynamic_cast<const RangePlacement*>(view->placement.get())) {
+            ++seen.range_ops[ranges->getRanges()[ranges->rangeIndex(key)].start];
+        }
+        if (op.type != KvOpType::SCAN) {
+            auto now = std::chrono::steady_clock::now();
+            if (now - seen.hot_keys_decayed_at >= HOT_KEY_HALF_LIFE) {
+                seen.hot_keys.decay();
+                seen.hot_keys_decayed_at = now;
+            }
+            seen.hot_keys.record(key);
+        }
+    }
+    if (!view->placement || op.type == KvOpType::SCAN || client_epoch >= view->epoch ||
+        view->placement->nodeFor(key) == view->self_node_id) {
+        return false;
+    }
+    metrics.add(KvCounter::REDIRECTS);
+    reply.status = KvStatus::MOVED;
+    std::lock_guard<std::mutex> lock(map_mutex);
+    reply.epoch = cluster_map.epoch;
+    reply.value = EncodeClusterMap(cluster_map);
+    return true;
+}
+// Each thread keeps the view it last used and checks one atomic per request to
+// see whether it is still current; map_mutex is only taken after a map change
+std::shared_ptr<const KVServer::MapView> KVServer::currentMapView() {
+    struct Cached {
+        const KVServer* server = nullptr;
+        uint64_t version = 0;
+        std::shared_ptr<const MapView> view;
+    };
+    thread_local Cached cached;
+    uint64_t version = map_version.load(std::memory_order_acquire);
+    if (cached.server != this || cached.version != version || !cached.view) {
+        std::lock_guard<std::mutex> lock(map_mutex);
+        cached.server = this;
+        cached.version = version;
+        cached.view = map_view;
+    }
+    return cached.view;
+}
+KVServer::Traffic& KVServer::threadTraffic() {
+    struct Cached {
+        const KVServer* server = nullptr;
+        std::shared_ptr<Traffic> traffic;
+    };
+    thread_local Cached cached;
+    if (cached.server != this) {
+        auto mine = std::make_shared<Traffic>();
+        {
+            std::lock_guard<std::mutex> lock(traffic_mutex);
+            traffic.push_back(mine);
+        }
+        cached.server = this;
+        cached.traffic = std::move(mine);
+    }
+    return *cached.traffic;
 }
 void KVServer::kv_fetch(const tl::request& req, int key) {
-    auto start = std::chrono::high_resolution_clock::now();  // Start timing
-    std::cout << "[Fetch] key=" << key << std::endl;
+    KvRpcTimer timer(metrics, KvRpc::FETCH);
     try {
+        uint64_t store_start = KVMetrics::nowNs();
         std::string value = kv.Find(key);
-        // Calculate and print elapsed time
-        auto end = std::chrono::high_resolution_clock::now();
-        std::chrono::duration<double, std::milli> elapsed = end - start;
-        std::cout << "[Fetch] Key: " << key << ", Value: " << value << std::endl;
-        std::cout << "[Fetch] Server-side operation completed in " << elapsed.count() << " ms" << std::endl;
+        metrics.recordStore(KvOpType::FETCH, KVMetrics::nowNs() - store_start);
+        metrics.add(KvCounter::BYTES_OUT, value.size());
         req.respond(value);
     } catch (const std::exception& e) {
         std::cerr << "[Fetch Error] " << e.what() << std::endl;
@@ -29,30 +158,26 @@ void KVServer::kv_fetch(const tl::request& req, int key) {
     }
 }
 void KVServer::kv_insert(const tl::request& req, int key, std::string value) {
-    auto start = std::chrono::high_resolution_clock::now();  // Start timing
-    std::cout << "[Insert] " << key << " -> " << value << std::endl;
+    KvRpcTimer timer(metrics, KvRpc::INSERT);
     try {
-        kv.Insert(key, value);
-        // Calculate and print elapsed time
-        auto end = std::chrono::high_resolution_clock::now();
-        std::chrono::duration<double, std::milli> elapsed = end - start;
-        std::cout << "[Insert] Server-side operation completed in " << elapsed.count() << " ms" << std::endl;
-        req.respond(1);
+        uint64_t store_start = KVMetrics::nowNs();
+        KvStatus status = kv.Insert(key, value);
+        metrics.recordStore(KvOpType::INSERT, KVMetrics::nowNs() - store_start);
+        metrics.add(KvCounter::BYTES_IN, value.size());
+        req.respond(status == KvStatus::OK ? 1 : 0);
     } catch (const std::exception& e) {
         std::cerr << "[Insert Error] " << e.what() << std::endl;
         req.respond(0);
     }
 }
 void KVServer::kv_update(const tl::request& req, int key, std::string value) {
-    auto start = std::chrono::high_resolution_clock::now();  // Start timing
-    std::cout << "[Update] " << key << " -> " << value << std::endl;
+    KvRpcTimer timer(metrics, KvRpc::UPDATE);
     try {
-        kv.Update(key, value);
-        // Calculate and print elapsed time
-        auto end = std::chrono::high_resolution_clock::now();
-        std::chrono::duration<double, std::milli> elapsed = end - start;
-        std::cout << "[Update] Server-side operation completed in " << elapsed.count() << " ms" << std::endl;
-        req.respond(1);
+        uint64_t store_start = KVMetrics::nowNs();
+        KvStatus status = kv.Update(key, value);
+        metrics.recordStore(KvOpType::UPDATE, KVMetrics::nowNs() - store_start);
+        metrics.add(KvCounter::BYTES_IN, value.size());
+        req.respond(status == KvStatus::OK ? 1 : 0);
     } catch (const std::exception& e) {
         std::cerr << "[Update Error] " << e.what() << std::endl;
         req.respond(0);
@@ -60,17 +185,429 @@ void KVServer::kv_update(const tl::request& req, int key, std::string value) {
 }
 // Add delete method implementation
 void KVServer::kv_delete(const tl::request& req, int key) {
-    auto start = std::chrono::high_resolution_clock::now();  // Start timing
-    std::cout << "[Delete] key=" << key << std::endl;
+    KvRpcTimer timer(metrics, KvRpc::DELETE);
     try {
-        kv.Delete(key);
-        // Calculate and print elapsed time
-        auto end = std::chrono::high_resolution_clock::now();
-        std::chrono::duration<double, std::milli> elapsed = end - start;
-        std::cout << "[Delete] Server-side operation completed in " << elapsed.count() << " ms" << std::endl;
-        req.respond(1);
+        uint64_t store_start = KVMetrics::nowNs();
+        KvStatus status = kv.Delete(key);
+        metrics.recordStore(KvOpType::DELETE, KVMetrics::nowNs() - store_start);
+        req.respond(status == KvStatus::OK ? 1 : 0);
     } catch (const std::exception& e) {
         std::cerr << "[Delete Error] " << e.what() << std::endl;
         req.respond(0);
     }
 }
+void KVServer::kv_request(const tl::request& req, uint64_t epoch, KvOp op) {
+    KvRpcTimer timer(metrics, KvRpc::REQUEST);
+    // Traced by the client: from its send to here is Mercury plus the handler queue
+    KvTraceSpan request_span(op.trace_id, "server.kv_request", op.key);
+    if (op.trace_id) {
+        RecordSpan(op.trace_id, "server.queue", op.trace_sent_ns, TraceNowNs(), op.key);
+    }
+    KvReply reply;
+    if (DeadlinePassed(op)) {
+        // The caller has given up: answering costs less than doing the work
+        ++expired_requests;
+        reply.status = KvStatus::DEADLINE_EXCEEDED;
+        req.respond(reply);
+        return;
+    }
+    KvTraceSpan admit_span(op.trace_id, "server.admit", op.key);
+    reply.retry_after_ms = admit(req, 1);
+    admit_span.end();
+    if (reply.retry_after_ms > 0) {
+        reply.status = KvStatus::OVERLOADED;
+        req.respond(reply);
+        return;
+    }
+    if (redirect(epoch, op, reply)) {
+        req.respond(reply);
+        return;
+    }
+    if (readReplica(op, reply)) {
+        req.respond(reply);
+        return;
+    }
+    uint64_t server_epoch = reply.epoch;
+    try {
+        {
+            // The store records its spans under the thread's current trace, and
+            // suspends it while a lease wait yields to other handlers
+            KvTraceContext trace(op.trace_id);
+            KvTraceSpan execute_span("server.execute", op.key);
+            reply = execute(op);
+        }
+        reply.epoch = server_epoch;
+        KvTraceSpan backups_span(op.trace_id, "server.wait_backups", op.key);
+        // Waits for the change this write made, not for later writes by others
+        if (KvOpMutates(op.type) && reply.ok() &&
+            !waitForBackups(reply.version ? reply.version : kv.CurrentVersion(), op.deadline_us)) {
+            reply.status = KvStatus::TIMEOUT;
+            metrics.add(KvCounter::ERRORS);
+        }
+        backups_span.end();
+    } catch (const std::exception& e) {
+        std::cerr << "[Request Error] " << e.what() << std::endl;
+        reply.status = KvStatus::ERROR;
+        metrics.add(KvCounter::ERRORS);
+    }
+    KvTraceSpan respond_span(op.trace_id, "server.respond", op.key);
+    req.respond(reply);
+}
+// Applies a batch of ops in order and answers with one reply per op
+// Only the first MOVED reply of a batch carries the map
+void KVServer::kv_batch(const tl::request& req, uint64_t epoch, std::vector<KvOp> ops) {
+    KvRpcTimer timer(metrics, KvRpc::BATCH);
+    uint32_t retry_after_ms = admit(req, ops.size());
+    if (retry_after_ms > 0) {
+        // All or nothing, so the client can resend the batch as it was
+        KvReply rejected;
+        rejected.status = KvStatus::OVERLOADED;
+        rejected.retry_after_ms = retry_after_ms;
+        req.respond(std::vector<KvReply>(ops.size(), rejected));
+        return;
+    }
+    std::vector<KvReply> replies;
+    replies.reserve(ops.size());
+    bool map_sent = false;
+    bool mutated = false;
+    uint64_t last_change = 0;   // Newest change made by this batch
+    try {
+        // The wait for backups ends at the latest deadline in the batch, if every op has one
+        uint64_t deadline_us = 0;
+        bool unbounded = false;
+        for (const KvOp& op : ops) {
+            KvReply reply;
+            if (DeadlinePassed(op)) {
+                ++expired_requests;
+                reply.status = KvStatus::DEADLINE_EXCEEDED;
+                replies.push_back(std::move(reply));
+                continue;
+            }
+            unbounded = unbounded || op.deadline_us == 0;
+            deadline_us = std::max(deadline_us, op.deadline_us);
+            if (redirect(epoch, op, reply)) {
+                if (map_sent) {
+                    reply.value.clear();
+                }
+                map_sent = true;
+                replies.push_back(std::move(reply));
+                continue;
+            }
+            if (readReplica(op, reply)) {
+                replies.push_back(std::move(reply));
+                continue;
+            }
+            uint64_t server_epoch = reply.epoch;
+            replies.push_back(execute(op));
+            replies.back().epoch = server_epoch;
+            if (KvOpMutates(op.type) && replies.back().ok()) {
+                mutated = true;
+                last_change = std::max(last_change, replies.back().version ? replies.back().version
+                                                                           : kv.CurrentVersion());
+            }
+        }
+        // One wait covers the whole batch
+        if (mutated && !waitForBackups(last_change, unbounded ? 0 : deadline_us)) {
+            for (std::size_t i = 0; i < replies.size(); ++i) {
+                if (KvOpMutates(ops[i].type) && replies[i].ok()) {
+                    replies[i].status = KvStatus::TIMEOUT;
+                    metrics.add(KvCounter::ERRORS);
+                }
+            }
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "[Batch Error] " << e.what() << std::endl;
+        metrics.add(KvCounter::ERRORS, ops.size() - replies.size());
+    }
+    // Ops that were not reached are reported as errors (KvReply defaults to ERROR)
+    replies.resize(ops.size());
+    req.respond(replies);
+}
+void KVServer::kv_get_map(const tl::request& req) {
+    KvRpcTimer timer(metrics, KvRpc::GET_MAP);
+    std::lock_guard<std::mutex> lock(map_mutex);
+    req.respond(cluster_map);
+}
+// Installs map if it is newer than ours; answers with the epoch now in force
+void KVServer::kv_set_map(const tl::request& req, ClusterMap map, int node_id) {
+    KvRpcTimer timer(metrics, KvRpc::SET_MAP);
+    std::unique_lock<std::mutex> lock(map_mutex);
+    bool installed = false;
+    if (map.epoch > cluster_map.epoch) {
+        try {
+            std::string colocated = distinct_backup_hosts ? ColocatedBackups(map.current) : "";
+            if (!colocated.empty()) {
+                throw std::runtime_error(colocated);
+            }
+            map_placement = map.current.build();
+            cluster_map = std::move(map);
+            self_node_id = node_id;
+            auto view = std::make_shared<MapView>();
+            view->epoch = cluster_map.epoch;
+            view->placement = map_placement;
+            view->self_node_id = self_node_id;
+            view->wait_for_backups = map_view->wait_for_backups;   // Until configureReplication
+            map_view = std::move(view);
+            map_version.fetch_add(1, std::memory_order_release);
+            installed = true;
+            std::cout << "[Membership] Epoch " << cluster_map.epoch << ": " << cluster_map.current.nodes.size()
+                      << " nodes, this is node " << self_node_id
+                      << (cluster_map.migrating ? " (rebalancing)" : "") << std::endl;
+        } catch (const std::exception& e) {
+            std::cerr << "[Membership Error] Rejected epoch " << map.epoch << ": " << e.what() << std::endl;
+        }
+    }
+    uint64_t epoch = cluster_map.epoch;
+    lock.unlock();
+    if (installed) {
+        configureReplication();
+    }
+    req.respond(epoch);
+}
+void KVServer::requireDistinctBackupHosts() {
+    std::lock_guard<std::mutex> lock(map_mutex);
+    distinct_backup_hosts = true;
+}
+// Per-range key counts, request counts and split points for the ranges this node
+// owns, so a client can decide what to split or merge
+void KVServer::kv_range_stats(const tl::request& req) {
+    KvRpcTimer timer(metrics, KvRpc::RANGE_STATS);
+    RangeReport report;
+    std::shared_ptr<const KVPlacement> placement;
+    int self = -1;
+    std::unordered_map<int, uint64_t> ops;
+    {
+        std::lock_guard<std::mutex> lock(map_mutex);
+        auto now = std::chrono::steady_clock::now();
+        report.epoch = cluster_map.epoch;
+        report.window_sec = std::chrono::duration<double>(now - range_window_start).count();
+        placement = map_placement;
+        self = self_node_id;
+        range_window_start = now;
+    }
+    {
+        std::lock_guard<std::mutex> lock(traffic_mutex);
+        for (const std::shared_ptr<Traffic>& seen : traffic) {
+            std::lock_guard<std::mutex> seen_lock(seen->mutex);
+            for (const auto& entry : seen->range_ops) {
+                ops[entry.first] += entry.second;
+            }
+            seen->range_ops.clear();
+        }
+    }
+
+    auto* ranges = dynamic_cast<const RangePlacement*>(placement.get());
+    std::unordered_map<std::size_t, std::vector<int>> keys_by_range;
+    for (int key : kv.GetKeys()) {
+        if (placement && placement->nodeFor(key) != self) {
+            ++report.misplaced;
+        } else if (ranges) {
+            keys_by_range[ranges->rangeIndex(key)].push_back(key);
+        }
+    }
+    if (ranges) {
+        const std::vector<KeyRange>& table = ranges->getRanges();
+        for (std::size_t i = 0; i < table.size(); ++i) {
+            if (table[i].node_id != self) {
+                continue;
+            }
+            RangeLoad load;
+            load.start = table[i].start;
+            load.ops = ops[table[i].start];
+            std::vector<int>& keys = keys_by_range[i];
+            load.keys = keys.size();
+            load.split_key = table[i].start;
+            if (!keys.empty()) {
+                std::nth_element(keys.begin(), keys.begin() + keys.size() / 2, keys.end());
+                load.split_key = keys[keys.size() / 2];
+            }
+            report.ranges.push_back(load);
+        }
+    }
+    std::cout << "[RangeStats] epoch " << report.epoch << ", " << report.ranges.size() << " ranges, "
+              << report.misplaced << " misplaced keys" << std::endl;
+    req.respond(report);
+}
+void KVServer::kv_hot_keys(const tl::request& req, uint32_t limit) {
+    KvRpcTimer timer(metrics, KvRpc::HOT_KEYS);
+    HotKeyReport report;
+    std::vector<std::vector<HotKey>> lists;
+    {
+        std::lock_guard<std::mutex> lock(traffic_mutex);
+        for (const std::shared_ptr<Traffic>& seen : traffic) {
+            std::lock_guard<std::mutex> seen_lock(seen->mutex);
+            report.total += seen->hot_keys.total();
+            lists.push_back(seen->hot_keys.top(HOT_KEY_COUNTERS));
+        }
+    }
+    report.keys = MergeHotKeys(lists, limit);
+    std::cout << "[HotKeys] " << report.keys.size() << " keys over " << report.total << " accesses" << std::endl;
+    req.respond(report);
+}
+// Admission control covers data requests only; membership, replication and
+// status RPCs are always served so an overloaded cluster can still be managed.
+// The handlers waiting in the pool are the queue a new request would join.
+uint32_t KVServer::admit(const tl::request& req, std::size_t ops) {
+    std::size_t queued = get_engine().get_handler_pool().size();
+    return admission.admit(static_cast<std::string>(req.get_endpoint()), queued, ops);
+}
+// Backup read: a FETCH that allows staleness, for a key another node owns, is
+// answered from the replicas held for that node
+bool KVServer::readReplica(const KvOp& op, KvReply& reply) {
+    if (op.type != KvOpType::FETCH || op.max_staleness_ms == 0) {
+        return false;
+    }
+    std::shared_ptr<const MapView> view = currentMapView();
+    if (!view->placement) {
+        return false;
+    }
+    int owner = view->placement->nodeFor(op.key);
+    if (owner == view->self_node_id) {
+        return false;
+    }
+    reply.status = replicas.read(owner, op.key, op.max_staleness_ms, reply.value, reply.version);
+    return true;
+}
+
+// With wait_for_backups, holds the reply until every backup has confirmed the
+// changes up to seq, giving up early once the caller's deadline (if any) has
+// passed. Sleeps through Argobots so the RPCs that carry the confirmations keep
+// making progress on this execution stream.
+bool KVServer::waitForBackups(uint64_t seq, uint64_t deadline_us) {
+    if (!currentMapView()->wait_for_backups) {
+        return true;
+    }
+    auto deadline = std::chrono::steady_clock::now() + REPLICATION_ACK_TIMEOUT;
+    replicator->wake();
+    while (replicator->ackedThrough() < seq) {
+        if (std::chrono::steady_clock::now() >= deadline || (deadline_us != 0 && WallClockMicros() >= deadline_us)) {
+            std::cerr << "[Replication] Backups did not confirm change " << seq << " in time" << std::endl;
+            return false;
+        }
+        tl::thread::sleep(get_engine(), 1);
+    }
+    return true;
+}
+
+// Points the replicator at this node's backups under the map just installed, and
+// drops replicas of nodes this one no longer backs up. Replicas of nodes that left
+// the cluster are handed to the keys' new owners instead.
+void KVServer::configureReplication() {
+    ClusterMap map;
+    std::shared_ptr<const KVPlacement> placement;
+    int self = -1;
+    {
+        std::lock_guard<std::mutex> lock(map_mutex);
+        map = cluster_map;
+        placement = map_placement;
+        self = self_node_id;
+    }
+
+    std::unordered_map<int, std::string> endpoints;
+    std::unordered_set<int> members;
+    for (const MemberNode& node : map.current.nodes) {
+        endpoints[node.node_id] = node.endpoint;
+        members.insert(node.node_id);
+    }
+    replicator->configure(self, placement, map.current.backupsOf(self), endpoints);
+    {
+        // Only now that the replicator ships to this map's backups do writes wait for them
+        std::lock_guard<std::mutex> lock(map_mutex);
+        if (map_view->epoch == map.epoch) {
+            auto view = std::make_shared<MapView>(*map_view);
+            view->wait_for_backups = map.current.wait_for_backups;
+            map_view = std::move(view);
+            map_version.fetch_add(1, std::memory_order_release);
+        }
+    }
+
+    for (int primary : replicas.primaries()) {
+        std::vector<int> backups = map.current.backupsOf(primary);
+        bool still_backed = std::find(backups.begin(), backups.end(), self) != backups.end();
+        if (members.count(primary) == 0) {
+            std::vector<ReplicaEntry> entries = replicas.take(primary);
+            std::cout << "[Replication] Node " << primary << " left the cluster; recovering "
+                      << entries.size() << " keys from its replica" << std::endl;
+            replicator->recover(std::move(entries));
+        } else if (!still_backed) {
+            replicas.drop(primary);
+        }
+    }
+    // Replicas only keep what their primary owns under this map
+    for (int primary : members) {
+        std::vector<int> backups = map.current.backupsOf(primary);
+        if (std::find(backups.begin(), backups.end(), self) != backups.end()) {
+            replicas.restrictTo(primary, placement);
+        }
+    }
+}
+
+void KVServer::kv_replicate(const tl::request& req, ReplicaBatch batch) {
+    KvRpcTimer timer(metrics, KvRpc::REPLICATE);
+    uint64_t acked = replicas.apply(batch);
+    if (batch.reset || !batch.entries.empty()) {
+        std::cout << "[Replicate] " << batch.entries.size() << " keys from node " << batch.primary
+                  << (batch.reset ? " (full copy)" : "") << " through " << batch.through << std::endl;
+    }
+    req.respond(acked);
+}
+
+void KVServer::kv_replication_status(const tl::request& req) {
+    KvRpcTimer timer(metrics, KvRpc::REPLICATION_STATUS);
+    ReplicationStatus status;
+    status.current = kv.CurrentVersion();
+    status.backups = replicator->status();
+    status.sources = replicas.status();
+    req.respond(status);
+}
+
+// Runs one op against the store, timing it and counting its outcome
+KvReply KVServer::execute(const KvOp& op) {
+    uint64_t start = KVMetrics::nowNs();
+    KvReply reply = ExecuteOp(kv, op);
+    metrics.recordStore(op.type, KVMetrics::nowNs() - start);
+    metrics.recordReply(op, reply);
+    return reply;
+}
+
+KvStatsReport KVServer::stats() {
+    KvStatsReport report;
+    metrics.collect(report);
+    report.counters[static_cast<int>(KvCounter::EXPIRED)] = expired_requests.load();
+    report.counters[static_cast<int>(KvCounter::REJECTED)] = admission.rejectedQueue() + admission.rejectedRate();
+    MemoryStats memory = kv.GetMemoryStats();
+    report.memory_total = memory.total_size;
+    report.memory_used = memory.used_memory;
+    report.memory_free = memory.free_memory;
+    report.keys = kv.GetMapSize();
+    report.locks = kv.GetLockProfile();
+    return report;
+}
+
+void KVServer::kv_stats(const tl::request& req) {
+    KvRpcTimer timer(metrics, KvRpc::STATS);
+    req.respond(stats());
+}
+
+// Spans recorded by this server (see KVTrace.hpp), as Chrome trace events
+void KVServer::kv_trace(const tl::request& req, bool clear) {
+    KvRpcTimer timer(metrics, KvRpc::TRACE);
+    int node_id = -1;
+    {
+        std::lock_guard<std::mutex> lock(map_mutex);
+        node_id = self_node_id;
+    }
+    std::string events = TraceEventsJson("kvm_server node " + std::to_string(node_id) + " (" +
+                                         static_cast<std::string>(get_engine().self()) + ")");
+    if (clear) {
+        ClearTraces();
+    }
+    req.respond(events);
+}
+
+// Where the store's segment goes (see KvStore::GetMemoryProfile). Walks the whole
+// map under the store lock, so it is for diagnosis rather than monitoring.
+void KVServer::kv_memory(const tl::request& req) {
+    KvRpcTimer timer(metrics, KvRpc::MEMORY);
+    req.respond(kv.GetMemoryProfile());
+}
@@ -0,0 +1,21 @@
+#include "KVShards.hpp"
+#include <algorithm>
+
+std::vector<ShardPlan> PlanShards(const ShardConfig& shards, int port, std::size_t mem_size, unsigned cpus,
+                                  const std::string& base_instance) {
+    std::vector<ShardPlan> plans;
+    uint32_t count = std::max<uint32_t>(shards.count, 1);
+    cpus = std::max(cpus, 1u);
+    // Whole kilobytes, as the shard is started with a "<n>K" size argument
+    std::size_t shard_mem = std::max<std::size_t>(mem_size / count / 1024, 1) * 1024;
+    for (uint32_t i = 0; i < count; ++i) {
+        ShardPlan plan;
+        plan.index = i;
+        plan.cpu = (shards.first_cpu + i * shards.cpu_stride) % cpus;
+        plan.port = port + static_cast<int>(i);
+        plan.instance = (base_instance.empty() ? "" : base_instance + "_") + "shard" + std::to_string(i);
+        plan.mem_size = shard_mem;
+        plans.push_back(plan);
+    }
+    return plans;
+}
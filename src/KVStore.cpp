@@ -1,30 +1,298 @@
 #include "KVStore.hpp"
+#include <algorithm>
+#include <charconv>
+#include <cstdlib>
+#include <chrono>
 #include <filesystem>
 #include <iomanip>
 #include <sstream>
+#include <thread>
+
+namespace {
+
+std::string instanceName(const std::string& base, const std::string& extension = "") {
+    const char* instance = std::getenv("KVM_INSTANCE");
+    if (!instance || !*instance) {
+        return base + extension;
+    }
+    return base + "_" + instance + extension;
+}
+
+const std::string MUTEX_NAME_STORAGE = instanceName("SharedMapMutex");
+
+} // namespace
 
 // Static member definitions
-const char* KvStore::MUTEX_NAME = "SharedMapMutex";
-const std::string KvStore::PERSISTENT_FILE_PATH = "./kvstore_persistent.dat";
+const std::string KvStore::SEGMENT_NAME = instanceName("Project");
+const char* KvStore::MUTEX_NAME = MUTEX_NAME_STORAGE.c_str();
+const std::string KvStore::PERSISTENT_FILE_PATH = instanceName("./kvstore_persistent", ".dat");
 
 // Memory size constants
 const std::size_t MB = 1024 * 1024;
 const std::size_t DEFAULT_MEMORY_SIZE = 500 * MB;
 
+namespace {
+
+const int64_t MAX_LEASE_NS = static_cast<int64_t>(KvStore::MAX_LEASE_MS) * 1000000;
+
+// steady_clock is CLOCK_MONOTONIC, so deadlines stored in the segment are
+// comparable across every process attached to it on this host
+int64_t steadyNowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// How much longer than the lease a waiting writer keeps new leases off the key:
+// covers its wake-up and taking the lock again
+const int64_t WRITER_GRACE_NS = 100 * 1000000LL;
+
+// Blocks with the store lock released until no read lease on key is outstanding,
+// and returns with the lock held again. While waiting the writer marks the entry
+// so no new leases are handed out and the wait cannot be starved; the mark lapses
+// WRITER_GRACE_NS after the lease if the writer never comes back. Deadlines
+// further out than MAX_LEASE_MS are stale (e.g. a persistent file reopened after
+// a reboot) and are ignored. sleep waits (null: the thread sleeps); relocked runs
+// each time the lock is taken again, to bring key back into map if a growth
+// started meanwhile.
+template <typename Map, typename Relocked>
+void waitOutLease(Map* map, int key, StoreLock& lock, const LeaseSleep& sleep, Relocked relocked) {
+    int64_t marked = 0;
+    while (true) {
+        auto it = map->find(key);
+        if (it == map->end()) {
+            return;
+        }
+        int64_t now = steadyNowNs();
+        int64_t remaining = it->second.lease_until_ns - now;
+        if (remaining <= 0 || remaining > MAX_LEASE_NS) {
+            // Cleared unless another writer has marked the key since
+            if (marked && it->second.writer_until_ns == marked) {
+                it->second.writer_until_ns = 0;
+            }
+            return;
+        }
+        marked = std::max(it->second.writer_until_ns, now + remaining + WRITER_GRACE_NS);
+        it->second.writer_until_ns = marked;
+        std::cout << "Key " << key << " is leased, waiting " << (remaining / 1000) << " us before writing\n";
+        lock.unlock();
+        {
+            // The hook may yield to other requests on this thread
+            KvTraceSpan wait_span("store.lease_wait", key);
+            KvTraceSuspend suspend;
+            if (sleep) {
+                sleep(remaining);
+            } else {
+                std::this_thread::sleep_for(std::chrono::nanoseconds(remaining));
+            }
+        }
+        lock.lock();
+        relocked();
+    }
+}
+
+template <typename Map>
+LeasedValue findWithLease(Map* map, int key, uint32_t lease_ms) {
+    LeasedValue result;
+    KvTraceSpan lookup("store.map_lookup", key);
+    auto it = map->find(key);
+    lookup.end();
+    if (it == map->end()) {
+        return result;
+    }
+    result.status = KvStatus::OK;
+    KvTraceSpan copy("store.copy_value", key);
+    result.value.assign(it->second.value.data(), it->second.value.size());
+    copy.end();
+    result.version = it->second.version;
+
+    int64_t now = steadyNowNs();
+    if (lease_ms > 0 && it->second.writer_until_ns <= now) {
+        lease_ms = std::min(lease_ms, KvStore::MAX_LEASE_MS);
+        int64_t until = now + static_cast<int64_t>(lease_ms) * 1000000;
+        int64_t current = it->second.lease_until_ns;
+        if (until > current || current - now > MAX_LEASE_NS) {
+            it->second.lease_until_ns = until;
+        }
+        result.lease_ms = lease_ms;
+    }
+    return result;
+}
+
+// The table a growing map is being emptied from, null if it is not growing
+template <typename Map>
+Map* drainingTable(const TableRehash<Map>* rehash) {
+    return rehash ? rehash->draining.get() : nullptr;
+}
+
+// Whether the next inserts would make map rehash itself. One insert of margin, as
+// the table rounds its own threshold.
+template <typename Map>
+bool nearRehash(const Map* map) {
+    return static_cast<double>(map->size() + 2) > map->bucket_count() * static_cast<double>(map->max_load_factor());
+}
+
+// See TableRehash. Nodes are moved between the tables without copying their
+// entries, so a step costs about two hash lookups per entry.
+template <typename Map, typename SegmentManager>
+void stepRehash(Map* map, TableRehash<Map>* rehash, SegmentManager* segment, int key) {
+    if (!rehash) {
+        return;
+    }
+    Map* draining = rehash->draining.get();
+    if (!draining) {
+        if (rehash->step == 0 || map->size() < INCREMENTAL_REHASH_MIN_KEYS || !nearRehash(map)) {
+            return;
+        }
+        // Paid at once: the swap, and zeroing the grown bucket array
+        draining = segment->template construct<Map>(anonymous_instance)(
+            0, map->hash_function(), map->key_eq(), map->get_allocator());
+        draining->swap(*map);
+        map->max_load_factor(draining->max_load_factor());
+        map->reserve(2 * (draining->size() + 1));
+        rehash->draining = draining;
+        std::cout << "[KvStore] Growing map to " << map->bucket_count() << " buckets, moving "
+                  << draining->size() << " keys " << rehash->step << " per operation\n";
+    }
+    auto it = draining->find(key);
+    if (it != draining->end()) {
+        map->insert(draining->extract(it));
+    }
+    // Finishes at once if the map would otherwise outgrow its new buckets first
+    std::size_t moves = rehash->step == 0 || nearRehash(map) ? draining->size() : rehash->step;
+    for (; moves > 0 && !draining->empty(); --moves) {
+        map->insert(draining->extract(draining->begin()));
+    }
+    if (draining->empty()) {
+        segment->destroy_ptr(draining);
+        rehash->draining = nullptr;
+        ++rehash->growths;
+        std::cout << "[KvStore] Map growth finished at " << map->bucket_count() << " buckets\n";
+    }
+}
+
+template <typename Map>
+std::vector<std::pair<int, std::string>> scanRange(Map* map, Map* draining, int64_t start, int64_t end,
+                                                   std::size_t limit) {
+    std::vector<int> keys;
+    for (Map* table : {map, draining}) {
+        if (!table) {
+            continue;
+        }
+        for (const auto& pair : *table) {
+            if (pair.first >= start && pair.first < end) {
+                keys.push_back(pair.first);
+            }
+        }
+    }
+    std::sort(keys.begin(), keys.end());
+    if (limit > 0 && keys.size() > limit) {
+        keys.resize(limit);
+    }
+    std::vector<std::pair<int, std::string>> result;
+    result.reserve(keys.size());
+    for (int key : keys) {
+        auto it = map->find(key);
+        if (it == map->end()) {
+            it = draining->find(key);
+        }
+        const auto& value = it->second.value;
+        result.emplace_back(key, std::string(value.data(), value.size()));
+    }
+    return result;
+}
+
+constexpr std::size_t MAX_CHAIN_LENGTH = 16;
+
+// Bytes the allocator hands out for a request of n (rounded up to its alignment);
+// the block header comes on top
+template <typename SegmentManager>
+uint64_t blockBytes(std::size_t n) {
+    const std::size_t alignment = SegmentManager::memory_algorithm::Alignment;
+    return (n + alignment - 1) / alignment * alignment;
+}
+
+// Adds the table's share to profile. A node is taken to be the entry plus the two
+// links the table keeps with it (next node and bucket); the bucket array is one
+// link per bucket plus a sentinel.
+template <typename Map, typename SegmentManager>
+void profileMap(const Map* map, const SegmentManager* segment, MemoryProfile& profile) {
+    using Link = typename Map::allocator_type::pointer;
+    uint64_t blocks = 0;
+    std::size_t inline_capacity = 0;
+    bool probed = false;
+    for (const auto& pair : *map) {
+        const auto& value = pair.second.value;
+        if (!probed) {
+            typename std::decay<decltype(value)>::type empty(value.get_allocator());
+            inline_capacity = empty.capacity();
+            probed = true;
+        }
+        profile.value_payload_bytes += value.size();
+        profile.value_sizes.record(value.size());
+        if (value.capacity() > inline_capacity) {
+            profile.value_heap_bytes += segment->size(value.data());
+            ++blocks;
+        } else {
+            ++profile.inline_values;
+        }
+    }
+    profile.keys += map->size();
+    profile.node_bytes += map->size() * blockBytes<SegmentManager>(sizeof(typename Map::value_type) + 2 * sizeof(Link));
+    blocks += map->size();
+    profile.bucket_count += map->bucket_count();
+    profile.bucket_bytes += blockBytes<SegmentManager>((map->bucket_count() + 1) * sizeof(Link));
+    ++blocks;
+    profile.allocator_overhead += blocks * SegmentManager::memory_algorithm::PayloadPerAllocation;
+    profile.chain_lengths.resize(MAX_CHAIN_LENGTH + 1, 0);
+    for (std::size_t b = 0; b < map->bucket_count(); ++b) {
+        ++profile.chain_lengths[std::min(map->bucket_size(b), MAX_CHAIN_LENGTH)];
+    }
+}
+
+template <typename Map, typename SegmentManager>
+void profileTables(const Map* map, const TableRehash<Map>* rehash, const SegmentManager* segment,
+                   MemoryProfile& profile) {
+    profileMap(map, segment, profile);
+    if (const Map* draining = drainingTable(rehash)) {
+        profileMap(draining, segment, profile);
+        profile.draining_keys = draining->size();
+    }
+    profile.table_growths = rehash ? rehash->growths : 0;
+    profile.load_factor = map->load_factor();
+    profile.max_load_factor = map->max_load_factor();
+}
+
+template <typename Map>
+KvStatus eraseIfVersion(Map* map, int key, uint64_t expected_version) {
+    auto it = map->find(key);
+    if (it == map->end()) {
+        return KvStatus::NOT_FOUND;
+    }
+    if (it->second.version != expected_version) {
+        return KvStatus::CONFLICT;
+    }
+    map->erase(it);
+    return KvStatus::OK;
+}
+
+} // namespace
+
 // Modified get_instance method
-KvStore& KvStore::get_instance(std::size_t size, StorageMode mode, ConnectionMode conn_mode) {
+KvStore& KvStore::get_instance(std::size_t size, StorageMode mode, ConnectionMode conn_mode,
+                               std::size_t expected_keys) {
     std::cout << "[get_instance] Initializing KvStore with " << (size / MB) << "MB in "
               << (mode == StorageMode::PERSISTENT ? "PERSISTENT" : "MEMORY") << " mode as "
               << (conn_mode == ConnectionMode::SERVER ? "SERVER" : "CLIENT") << "\n";
-    static KvStore instance(size > 0 ? size : DEFAULT_MEMORY_SIZE, mode, conn_mode);
+    static KvStore instance(size > 0 ? size : DEFAULT_MEMORY_SIZE, mode, conn_mode, expected_keys);
     return instance;
 }
 
 
 // Modified constructor
-KvStore::KvStore(std::size_t size, StorageMode mode, ConnectionMode conn_mode)
+KvStore::KvStore(std::size_t size, StorageMode mode, ConnectionMode conn_mode, std::size_t expected_keys)
     : total_memory_size(size), storage_mode(mode), conn_mode(conn_mode),
-      memory_map_ptr(nullptr), persistent_map_ptr(nullptr) {
+      memory_map_ptr(nullptr), persistent_map_ptr(nullptr), version_counter(nullptr), change_log(nullptr),
+      memory_rehash(nullptr), persistent_rehash(nullptr) {
     
     std::cout << "[KvStore] Constructor started with " << (size / MB) << "MB allocation in "
               << (mode == StorageMode::PERSISTENT ? "PERSISTENT" : "MEMORY") << " mode as "
@@ -33,13 +301,13 @@ KvStore::KvStore(std::size_t size, StorageMode mode, ConnectionMode conn_mode)
     try {
         if (mode == StorageMode::MEMORY) {
             if (conn_mode == ConnectionMode::SERVER) {
-                createMemoryStorage(size);
+                createMemoryStorage(size, expected_keys);
             } else {
                 connectToMemoryStorage();
             }
         } else {
             if (conn_mode == ConnectionMode::SERVER) {
-                createPersistentStorage(size);
+                createPersistentStorage(size, expected_keys);
             } else {
                 connectToPersistentStorage();
             }
@@ -67,10 +335,12 @@ KvStore::KvStore(std::size_t size, StorageMode mode, ConnectionMode conn_mode)
         std::cout << "[KvStore] Server attempting recovery...\n";
         try {
             if (storage_mode == StorageMode::MEMORY) {
-                memory_storage = std::make_unique<managed_shared_memory>(open_only, "Project");
+                memory_storage = std::make_unique<managed_shared_memory>(open_only, SEGMENT_NAME.c_str());
+                requireCurrentFormat(*memory_storage, "Shared memory " + SEGMENT_NAME);
                 memory_map_ptr = memory_storage->find<MemoryHashMap>("SharedMap").first;
             } else {
                 file_storage = std::make_unique<managed_mapped_file>(open_only, PERSISTENT_FILE_PATH.c_str());
+                requireCurrentFormat(*file_storage, PERSISTENT_FILE_PATH);
                 persistent_map_ptr = file_storage->find<MappedHashMap>("SharedMap").first;
             }
             std::cout << "[KvStore] Opened existing storage\n";
@@ -83,9 +353,9 @@ KvStore::KvStore(std::size_t size, StorageMode mode, ConnectionMode conn_mode)
             named_mutex::remove(MUTEX_NAME);
             
             if (storage_mode == StorageMode::MEMORY) {
-                createMemoryStorage(size);
+                createMemoryStorage(size, expected_keys);
             } else {
-                createPersistentStorage(size);
+                createPersistentStorage(size, expected_keys);
             }
             
             named_mutex mutex(open_or_create, MUTEX_NAME);
@@ -94,13 +364,14 @@ KvStore::KvStore(std::size_t size, StorageMode mode, ConnectionMode conn_mode)
         }
     }
     
+    attachVersionCounter();
     std::cout << "[KvStore] Constructor finished\n";
 }
 
-void KvStore::createMemoryStorage(std::size_t size) {
+void KvStore::createMemoryStorage(std::size_t size, std::size_t expected_keys) {
     // Clean up any existing shared memory segments first
     try {
-        managed_shared_memory existing_mem(open_only, "Project");
+        managed_shared_memory existing_mem(open_only, SEGMENT_NAME.c_str());
         auto result = existing_mem.find<MemoryHashMap>("SharedMap");
         if (result.first != nullptr) {
             std::cout << "[KvStore] Found existing shared memory with "
@@ -111,23 +382,26 @@ void KvStore::createMemoryStorage(std::size_t size) {
     }
     
     // Remove any existing shared memory with the same name
-    shared_memory_object::remove("Project");
+    shared_memory_object::remove(SEGMENT_NAME.c_str());
     
     // Create new shared memory
     try {
-        memory_storage = std::make_unique<managed_shared_memory>(create_only, "Project", size);
+        memory_storage = std::make_unique<managed_shared_memory>(create_only, SEGMENT_NAME.c_str(), size);
         std::cout << "[KvStore] Created new shared memory segment: " << (size / (1024 * 1024)) << "MB\n";
         
-        // Construct the unordered map in shared memory
+        // Construct the unordered map in shared memory, with a bucket per expected key
+        // (the default max load factor is 1)
         MemoryMapAllocator allocator(memory_storage->get_segment_manager());
         memory_map_ptr = memory_storage->construct<MemoryHashMap>("SharedMap")(
-            0,
+            expected_keys,
             boost::hash<int>(),
             std::equal_to<int>(),
             allocator
         );
         
-        std::cout << "[KvStore] Created new memory-based unordered map\n";
+        memory_storage->construct<uint32_t>("FormatVersion")(STORE_FORMAT_VERSION);
+        std::cout << "[KvStore] Created new memory-based unordered map with "
+                  << memory_map_ptr->bucket_count() << " buckets\n";
         
     } catch (const interprocess_exception& e) {
         std::cout << "[KvStore] Failed to create shared memory: " << e.what() << std::endl;
@@ -135,7 +409,7 @@ void KvStore::createMemoryStorage(std::size_t size) {
     }
 }
 
-void KvStore::createPersistentStorage(std::size_t size) {
+void KvStore::createPersistentStorage(std::size_t size, std::size_t expected_keys) {
     bool file_exists = std::filesystem::exists(PERSISTENT_FILE_PATH);
     std::cout << "[KvStore] Persistent file exists: " << (file_exists ? "YES" : "NO") << std::endl;
     
@@ -147,6 +421,11 @@ void KvStore::createPersistentStorage(std::size_t size) {
             // Try to find existing map
             auto result = file_storage->find<MappedHashMap>("SharedMap");
             if (result.first != nullptr) {
+                if (!file_storage->find<uint32_t>("FormatVersion").first) {
+                    migrateFormat1File(expected_keys);
+                    result = file_storage->find<MappedHashMap>("SharedMap");
+                }
+                requireCurrentFormat(*file_storage, PERSISTENT_FILE_PATH);
                 persistent_map_ptr = result.first;
                 std::cout << "[KvStore] Successfully opened existing persistent storage with "
                           << persistent_map_ptr->size() << " entries\n";
@@ -172,16 +451,18 @@ void KvStore::createPersistentStorage(std::size_t size) {
         file_storage = std::make_unique<managed_mapped_file>(create_only, PERSISTENT_FILE_PATH.c_str(), size);
         std::cout << "[KvStore] Created new memory-mapped file: " << PERSISTENT_FILE_PATH << "\n";
         
-        // Construct the unordered map in mapped file
+        // Construct the unordered map in mapped file, presized like the memory one
         MappedMapAllocator map_allocator(file_storage->get_segment_manager());
         persistent_map_ptr = file_storage->construct<MappedHashMap>("SharedMap")(
-            0,
+            expected_keys,
             boost::hash<int>(),
             std::equal_to<int>(),
             map_allocator
         );
         
-        std::cout << "[KvStore] Created new persistent unordered map\n";
+        file_storage->construct<uint32_t>("FormatVersion")(STORE_FORMAT_VERSION);
+        std::cout << "[KvStore] Created new persistent unordered map with "
+                  << persistent_map_ptr->bucket_count() << " buckets\n";
         
         // Immediate sync to ensure file is written
         file_storage->flush();
@@ -193,14 +474,73 @@ void KvStore::createPersistentStorage(std::size_t size) {
 }
 
 
+// Rewrites a format 1 file in place. A copy of the file is kept as
+// <file>.format1 for the operator to remove, and the file is grown by what the
+// larger entries and the objects format 1 did not have take.
+void KvStore::migrateFormat1File(std::size_t expected_keys) {
+    typedef allocator<std::pair<const int, MappedShmString>, managed_mapped_file::segment_manager> Format1Allocator;
+    typedef boost::unordered_map<int, MappedShmString, boost::hash<int>, std::equal_to<int>, Format1Allocator> Format1Map;
+
+    const std::string backup = PERSISTENT_FILE_PATH + ".format1";
+    try {
+        std::size_t count = file_storage->find<Format1Map>("SharedMap").first->size();
+        std::cout << "[KvStore] " << PERSISTENT_FILE_PATH << " is in store format 1 with " << count
+                  << " entries, migrating to format " << STORE_FORMAT_VERSION << " (copy kept as " << backup << ")\n";
+        file_storage->flush();
+        file_storage.reset();
+        std::filesystem::copy_file(PERSISTENT_FILE_PATH, backup, std::filesystem::copy_options::overwrite_existing);
+        std::size_t extra = count * (sizeof(MappedEntry) - sizeof(MappedShmString) + 16) + sizeof(ChangeLog) + 64 * 1024;
+        managed_mapped_file::grow(PERSISTENT_FILE_PATH.c_str(), extra);
+        file_storage = std::make_unique<managed_mapped_file>(open_only, PERSISTENT_FILE_PATH.c_str());
+
+        // Values are copied out before the old map is freed, so the new one can
+        // reuse its space
+        std::vector<std::pair<int, std::string>> entries;
+        entries.reserve(count);
+        for (const auto& item : *file_storage->find<Format1Map>("SharedMap").first) {
+            entries.emplace_back(item.first, std::string(item.second.data(), item.second.size()));
+        }
+        file_storage->destroy<Format1Map>("SharedMap");
+
+        MappedMapAllocator map_allocator(file_storage->get_segment_manager());
+        MappedCharAllocator char_allocator(file_storage->get_segment_manager());
+        MappedHashMap* map = file_storage->construct<MappedHashMap>("SharedMap")(
+            std::max(expected_keys, entries.size()), boost::hash<int>(), std::equal_to<int>(), map_allocator);
+        // Each key gets a version of its own, as if it had been written in this format
+        uint64_t* counter = file_storage->find_or_construct<uint64_t>("VersionCounter")(0);
+        for (const auto& entry : entries) {
+            map->insert(std::make_pair(entry.first,
+                                       MappedEntry(entry.second.data(), entry.second.size(), ++*counter, char_allocator)));
+        }
+        file_storage->construct<uint32_t>("FormatVersion")(STORE_FORMAT_VERSION);
+        file_storage->flush();
+        std::cout << "[KvStore] Migrated " << map->size() << " entries to store format " << STORE_FORMAT_VERSION << "\n";
+    } catch (const std::exception& e) {
+        // Not an interprocess_exception, which would have the file recreated empty
+        throw std::runtime_error("Migrating " + PERSISTENT_FILE_PATH + " failed (" + e.what() +
+                                 "); the original is kept as " + backup);
+    }
+}
+
+template <typename Segment>
+void KvStore::requireCurrentFormat(Segment& segment, const std::string& what) {
+    uint32_t* format = segment.template find<uint32_t>("FormatVersion").first;
+    if (!format || *format != STORE_FORMAT_VERSION) {
+        // std::runtime_error, so that the constructor does not recreate it empty
+        throw std::runtime_error(what + " is in store format " + std::to_string(format ? *format : 1) +
+                                 ", this build uses format " + std::to_string(STORE_FORMAT_VERSION));
+    }
+}
+
 // New method to connect to existing memory storage
 void KvStore::connectToMemoryStorage() {
     try {
         std::cout << "[KvStore] Attempting to connect to existing shared memory...\n";
-        memory_storage = std::make_unique<managed_shared_memory>(open_only, "Project");
+        memory_storage = std::make_unique<managed_shared_memory>(open_only, SEGMENT_NAME.c_str());
         
         auto result = memory_storage->find<MemoryHashMap>("SharedMap");
         if (result.first != nullptr) {
+            requireCurrentFormat(*memory_storage, "Shared memory " + SEGMENT_NAME);
             memory_map_ptr = result.first;
             std::cout << "[KvStore] Successfully connected to existing shared memory with "
                       << memory_map_ptr->size() << " entries\n";
@@ -226,6 +566,7 @@ void KvStore::connectToPersistentStorage() {
         
         auto result = file_storage->find<MappedHashMap>("SharedMap");
         if (result.first != nullptr) {
+            requireCurrentFormat(*file_storage, PERSISTENT_FILE_PATH);
             persistent_map_ptr = result.first;
             std::cout << "[KvStore] Successfully connected to existing persistent storage with "
                       << persistent_map_ptr->size() << " entries\n";
@@ -239,9 +580,37 @@ void KvStore::connectToPersistentStorage() {
 }
 
 
+void KvStore::attachVersionCounter() {
+    if (storage_mode == StorageMode::MEMORY && memory_storage) {
+        version_counter = memory_storage->find_or_construct<uint64_t>("VersionCounter")(0);
+        change_log = memory_storage->find_or_construct<ChangeLog>("ChangeLog")();
+        memory_rehash = memory_storage->find_or_construct<TableRehash<MemoryHashMap>>("SharedMapRehash")();
+    } else if (storage_mode == StorageMode::PERSISTENT && file_storage) {
+        version_counter = file_storage->find_or_construct<uint64_t>("VersionCounter")(0);
+        change_log = file_storage->find_or_construct<ChangeLog>("ChangeLog")();
+        persistent_rehash = file_storage->find_or_construct<TableRehash<MappedHashMap>>("SharedMapRehash")();
+    }
+}
+
+void KvStore::logChange(int key, uint64_t seq) {
+    if (!change_log) {
+        return;
+    }
+    change_log->slots[change_log->written % CHANGE_LOG_CAPACITY] = {seq, key};
+    ++change_log->written;
+}
+
+void KvStore::advanceRehash(int key) {
+    if (storage_mode == StorageMode::MEMORY) {
+        stepRehash(memory_map_ptr, memory_rehash, memory_storage->get_segment_manager(), key);
+    } else {
+        stepRehash(persistent_map_ptr, persistent_rehash, file_storage->get_segment_manager(), key);
+    }
+}
+
 void KvStore::cleanupStorage() {
     if (storage_mode == StorageMode::MEMORY) {
-        shared_memory_object::remove("Project");
+        shared_memory_object::remove(SEGMENT_NAME.c_str());
         
         // Clean up additional files for memory mode
         try {
@@ -304,6 +673,37 @@ MemoryStats KvStore::GetMemoryStats() const {
     return stats;
 }
 
+MemoryProfile KvStore::GetMemoryProfile() const {
+    MemoryProfile profile;
+    try {
+        if ((storage_mode == StorageMode::MEMORY && !memory_map_ptr) ||
+            (storage_mode == StorageMode::PERSISTENT && !persistent_map_ptr)) {
+            std::cout << "Map not found in storage." << std::endl;
+            return profile;
+        }
+
+        named_mutex mutex(open_only, MUTEX_NAME);
+        StoreLock lock(mutex, lock_profiler, StoreLockSite::MEMORY_PROFILE);
+
+        MemoryStats stats = GetMemoryStats();
+        profile.segment_total = stats.total_size;
+        profile.segment_used = stats.used_memory;
+        profile.segment_free = stats.free_memory;
+        if (storage_mode == StorageMode::MEMORY) {
+            profileTables(memory_map_ptr, memory_rehash, memory_storage->get_segment_manager(), profile);
+        } else {
+            profileTables(persistent_map_ptr, persistent_rehash, file_storage->get_segment_manager(), profile);
+        }
+        profile.change_log_bytes = change_log ? sizeof(ChangeLog) : 0;
+        uint64_t accounted = profile.bucket_bytes + profile.node_bytes + profile.value_heap_bytes +
+                             profile.allocator_overhead + profile.change_log_bytes;
+        profile.other_bytes = profile.segment_used > accounted ? profile.segment_used - accounted : 0;
+    } catch (const std::exception& e) {
+        std::cout << "Error profiling memory: " << e.what() << std::endl;
+    }
+    return profile;
+}
+
 void KvStore::PrintMemoryStats(const std::string& operation) const {
     MemoryStats stats = GetMemoryStats();
     std::cout << "\n========== MEMORY STATS [" << operation << "] ==========\n";
@@ -342,23 +742,26 @@ bool KvStore::hasEnoughMemory(std::size_t needed_bytes) const {
     return free_memory >= estimated_need;
 }
 
-void KvStore::Insert(int key, const std::string& value) {
+KvStatus KvStore::Insert(int key, const std::string& value, uint64_t* new_version) {
     try {
         if ((storage_mode == StorageMode::MEMORY && !memory_map_ptr) ||
             (storage_mode == StorageMode::PERSISTENT && !persistent_map_ptr)) {
             std::cout << "Map not found in storage." << std::endl;
-            return;
+            return KvStatus::ERROR;
         }
         
         named_mutex mutex(open_only, MUTEX_NAME);
-        scoped_lock<named_mutex> lock(mutex);
+        StoreLock lock(mutex, lock_profiler, StoreLockSite::INSERT, key);
+        advanceRehash(key);
+        
+        uint64_t version = 0;
         
         // Check memory requirements first
         std::size_t entry_size = value.size() + sizeof(int) + 64; // Added overhead estimate
         if (!hasEnoughMemory(entry_size)) {
             std::cout << "Error: Not enough memory for insertion.\n";
             PrintMemoryStats("Insert - Failed (Memory)");
-            return;
+            return KvStatus::OUT_OF_MEMORY;
         }
         
         if (storage_mode == StorageMode::MEMORY) {
@@ -367,11 +770,13 @@ void KvStore::Insert(int key, const std::string& value) {
             if (it != memory_map_ptr->end()) {
                 std::cout << "Key " << key << " already exists. Use update instead.\n";
                 PrintMemoryStats("Insert - Key Exists");
-                return;
+                return KvStatus::ALREADY_EXISTS;
             }
             
             CharAllocator char_allocator(memory_storage->get_segment_manager());
-            memory_map_ptr->insert(std::make_pair(key, MyShmString(value.c_str(), char_allocator)));
+            version = ++*version_counter;
+            memory_map_ptr->insert(std::make_pair(key, MemoryEntry(value.data(), value.size(), version, char_allocator)));
+            logChange(key, version);
             
         } else {
             // Check if key already exists
@@ -379,11 +784,13 @@ void KvStore::Insert(int key, const std::string& value) {
             if (it != persistent_map_ptr->end()) {
                 std::cout << "Key " << key << " already exists. Use update instead.\n";
                 PrintMemoryStats("Insert - Key Exists");
-                return;
+                return KvStatus::ALREADY_EXISTS;
             }
             
             MappedCharAllocator char_allocator(file_storage->get_segment_manager());
-            persistent_map_ptr->insert(std::make_pair(key, MappedShmString(value.c_str(), char_allocator)));
+            version = ++*version_counter;
+            persistent_map_ptr->insert(std::make_pair(key, MappedEntry(value.data(), value.size(), version, char_allocator)));
+            logChange(key, version);
             
             // Sync to disk for persistence
             Sync();
@@ -391,91 +798,122 @@ void KvStore::Insert(int key, const std::string& value) {
         
         std::cout << "Inserted key " << key << " with value: " << value << std::endl;
         PrintMemoryStats("After Insert");
+        if (new_version) {
+            *new_version = version;
+        }
+        return KvStatus::OK;
         
     } catch (const boost::interprocess::bad_alloc& e) {
         std::cout << "Error during insertion (bad_alloc): " << e.what() << std::endl;
         PrintMemoryStats("Insert - Failed (Allocation)");
+        return KvStatus::OUT_OF_MEMORY;
     } catch (const std::exception& e) {
         std::cout << "Error during insertion: " << e.what() << std::endl;
+        return KvStatus::ERROR;
     }
 }
 
-void KvStore::Update(int key, const std::string& new_value) {
+KvStatus KvStore::Update(int key, const std::string& new_value, uint64_t* new_version) {
     try {
         if ((storage_mode == StorageMode::MEMORY && !memory_map_ptr) ||
             (storage_mode == StorageMode::PERSISTENT && !persistent_map_ptr)) {
             std::cout << "Map not found in storage." << std::endl;
-            return;
+            return KvStatus::ERROR;
         }
         
         named_mutex mutex(open_only, MUTEX_NAME);
-        scoped_lock<named_mutex> lock(mutex);
+        StoreLock lock(mutex, lock_profiler, StoreLockSite::UPDATE, key);
+        advanceRehash(key);
         
         if (storage_mode == StorageMode::MEMORY) {
+            waitOutLease(memory_map_ptr, key, lock, lease_sleep, [&] { advanceRehash(key); });
             auto it = memory_map_ptr->find(key);
             if (it != memory_map_ptr->end()) {
-                std::size_t old_size = std::string(it->second.c_str()).size();
+                std::size_t old_size = it->second.value.size();
                 std::size_t new_size = new_value.size();
                 std::size_t size_diff = new_size > old_size ? (new_size - old_size) : 0;
                 
                 if (size_diff > 0 && !hasEnoughMemory(size_diff)) {
                     std::cout << "Error: Not enough memory for update.\n";
                     PrintMemoryStats("Update - Failed (Memory)");
-                    return;
+                    return KvStatus::OUT_OF_MEMORY;
                 }
                 
                 CharAllocator char_alloc(memory_storage->get_segment_manager());
-                MyShmString shm_string(new_value.c_str(), char_alloc);
-                it->second = shm_string;
+                MyShmString shm_string(new_value.data(), new_value.size(), char_alloc);
+                it->second.value = shm_string;
+                it->second.version = ++*version_counter;
+                logChange(key, it->second.version);
+                if (new_version) {
+                    *new_version = it->second.version;
+                }
                 
                 std::cout << "Key " << key << " updated to: " << new_value << std::endl;
                 PrintMemoryStats("After Update");
+                return KvStatus::OK;
             } else {
                 std::cout << "Key " << key << " not found. Cannot update." << std::endl;
                 PrintMemoryStats("Update - Key Not Found");
+                return KvStatus::NOT_FOUND;
             }
         } else {
+            waitOutLease(persistent_map_ptr, key, lock, lease_sleep, [&] { advanceRehash(key); });
             auto it = persistent_map_ptr->find(key);
             if (it != persistent_map_ptr->end()) {
-                std::size_t old_size = std::string(it->second.c_str()).size();
+                std::size_t old_size = it->second.value.size();
                 std::size_t new_size = new_value.size();
                 std::size_t size_diff = new_size > old_size ? (new_size - old_size) : 0;
                 
                 if (size_diff > 0 && !hasEnoughMemory(size_diff)) {
                     std::cout << "Error: Not enough memory for update.\n";
                     PrintMemoryStats("Update - Failed (Memory)");
-                    return;
+                    return KvStatus::OUT_OF_MEMORY;
                 }
                 
                 MappedCharAllocator char_alloc(file_storage->get_segment_manager());
-                MappedShmString shm_string(new_value.c_str(), char_alloc);
-                it->second = shm_string;
+                MappedShmString shm_string(new_value.data(), new_value.size(), char_alloc);
+                it->second.value = shm_string;
+                it->second.version = ++*version_counter;
+                logChange(key, it->second.version);
+                if (new_version) {
+                    *new_version = it->second.version;
+                }
                 
                 // Sync to disk for persistence
                 Sync();
                 
                 std::cout << "Key " << key << " updated to: " << new_value << std::endl;
                 PrintMemoryStats("After Update");
+                return KvStatus::OK;
             } else {
                 std::cout << "Key " << key << " not found. Cannot update." << std::endl;
                 PrintMemoryStats("Update - Key Not Found");
+                return KvStatus::NOT_FOUND;
             }
         }
     } catch (const std::exception& e) {
         std::cout << "Error during update: " << e.what() << std::endl;
+        return KvStatus::ERROR;
     }
 }
 
-void KvStore::Delete(int key) {
+KvStatus KvStore::Delete(int key, uint64_t* change_seq) {
     try {
         if ((storage_mode == StorageMode::MEMORY && !memory_map_ptr) ||
             (storage_mode == StorageMode::PERSISTENT && !persistent_map_ptr)) {
             std::cout << "Map not found in storage." << std::endl;
-            return;
+            return KvStatus::ERROR;
         }
         
         named_mutex mutex(open_only, MUTEX_NAME);
-        scoped_lock<named_mutex> lock(mutex);
+        StoreLock lock(mutex, lock_profiler, StoreLockSite::DELETE, key);
+        advanceRehash(key);
+        
+        if (storage_mode == StorageMode::MEMORY) {
+            waitOutLease(memory_map_ptr, key, lock, lease_sleep, [&] { advanceRehash(key); });
+        } else {
+            waitOutLease(persistent_map_ptr, key, lock, lease_sleep, [&] { advanceRehash(key); });
+        }
         
         std::size_t pre_free_memory = GetFreeMemory();
         
@@ -484,21 +922,31 @@ void KvStore::Delete(int key) {
             if (it != memory_map_ptr->end()) {
                 std::cout << "Deleting key " << key << std::endl;
                 memory_map_ptr->erase(it);
+                logChange(key, ++*version_counter);
+                if (change_seq) {
+                    *change_seq = *version_counter;
+                }
                 
                 std::size_t post_free_memory = GetFreeMemory();
                 std::size_t memory_freed = post_free_memory - pre_free_memory;
                 std::cout << "Key " << key << " deleted. Freed approximately "
                           << memory_freed << " bytes." << std::endl;
                 PrintMemoryStats("After Delete");
+                return KvStatus::OK;
             } else {
                 std::cout << "Key " << key << " not found. Nothing to delete." << std::endl;
                 PrintMemoryStats("Delete - Key Not Found");
+                return KvStatus::NOT_FOUND;
             }
         } else {
             auto it = persistent_map_ptr->find(key);
             if (it != persistent_map_ptr->end()) {
                 std::cout << "Deleting key " << key << std::endl;
                 persistent_map_ptr->erase(it);
+                logChange(key, ++*version_counter);
+                if (change_seq) {
+                    *change_seq = *version_counter;
+                }
                 
                 // Sync to disk for persistence
                 Sync();
@@ -508,13 +956,54 @@ void KvStore::Delete(int key) {
                 std::cout << "Key " << key << " deleted. Freed approximately "
                           << memory_freed << " bytes." << std::endl;
                 PrintMemoryStats("After Delete");
+                return KvStatus::OK;
             } else {
                 std::cout << "Key " << key << " not found. Nothing to delete." << std::endl;
                 PrintMemoryStats("Delete - Key Not Found");
+                return KvStatus::NOT_FOUND;
             }
         }
     } catch (const std::exception& e) {
         std::cout << "Error during delete: " << e.what() << std::endl;
+        return KvStatus::ERROR;
+    }
+}
+
+KvStatus KvStore::DeleteIfVersion(int key, uint64_t expected_version, uint64_t* change_seq) {
+    try {
+        if ((storage_mode == StorageMode::MEMORY && !memory_map_ptr) ||
+            (storage_mode == StorageMode::PERSISTENT && !persistent_map_ptr)) {
+            std::cout << "Map not found in storage." << std::endl;
+            return KvStatus::ERROR;
+        }
+        
+        named_mutex mutex(open_only, MUTEX_NAME);
+        StoreLock lock(mutex, lock_profiler, StoreLockSite::DELETE_IF_VERSION, key);
+        advanceRehash(key);
+        
+        KvStatus status;
+        if (storage_mode == StorageMode::MEMORY) {
+            waitOutLease(memory_map_ptr, key, lock, lease_sleep, [&] { advanceRehash(key); });
+            status = eraseIfVersion(memory_map_ptr, key, expected_version);
+        } else {
+            waitOutLease(persistent_map_ptr, key, lock, lease_sleep, [&] { advanceRehash(key); });
+            status = eraseIfVersion(persistent_map_ptr, key, expected_version);
+            if (status == KvStatus::OK) {
+                Sync();
+            }
+        }
+        if (status == KvStatus::OK) {
+            logChange(key, ++*version_counter);
+            if (change_seq) {
+                *change_seq = *version_counter;
+            }
+        }
+        std::cout << "DeleteIfVersion key " << key << " (version " << expected_version << "): "
+                  << KvStatusName(status) << std::endl;
+        return status;
+    } catch (const std::exception& e) {
+        std::cout << "Error during versioned delete operation: " << e.what() << std::endl;
+        return KvStatus::ERROR;
     }
 }
 
@@ -527,12 +1016,13 @@ std::string KvStore::Find(int key) {
         }
         
         named_mutex mutex(open_only, MUTEX_NAME);
-        scoped_lock<named_mutex> lock(mutex);
+        StoreLock lock(mutex, lock_profiler, StoreLockSite::FIND, key);
+        advanceRehash(key);
         
         if (storage_mode == StorageMode::MEMORY) {
             auto it = memory_map_ptr->find(key);
             if (it != memory_map_ptr->end()) {
-                std::string normal_str = std::string(it->second.c_str());
+                std::string normal_str(it->second.value.data(), it->second.value.size());
                 std::cout << "Found key " << key << " with value: " << normal_str << std::endl;
                 PrintMemoryStats("After Find");
                 return normal_str;
@@ -544,7 +1034,7 @@ std::string KvStore::Find(int key) {
         } else {
             auto it = persistent_map_ptr->find(key);
             if (it != persistent_map_ptr->end()) {
-                std::string normal_str = std::string(it->second.c_str());
+                std::string normal_str(it->second.value.data(), it->second.value.size());
                 std::cout << "Found key " << key << " with value: " << normal_str << std::endl;
                 PrintMemoryStats("After Find");
                 return normal_str;
@@ -560,6 +1050,289 @@ std::string KvStore::Find(int key) {
     }
 }
 
+LeasedValue KvStore::FindWithLease(int key, uint32_t lease_ms) {
+    try {
+        if ((storage_mode == StorageMode::MEMORY && !memory_map_ptr) ||
+            (storage_mode == StorageMode::PERSISTENT && !persistent_map_ptr)) {
+            std::cout << "Map not found in storage." << std::endl;
+            LeasedValue result;
+            result.status = KvStatus::ERROR;
+            return result;
+        }
+        
+        named_mutex mutex(open_only, MUTEX_NAME);
+        StoreLock lock(mutex, lock_profiler, StoreLockSite::FIND_WITH_LEASE, key);
+        advanceRehash(key);
+        
+        LeasedValue result = storage_mode == StorageMode::MEMORY
+            ? findWithLease(memory_map_ptr, key, lease_ms)
+            : findWithLease(persistent_map_ptr, key, lease_ms);
+        
+        if (result.status == KvStatus::OK) {
+            std::cout << "Found key " << key << " (version " << result.version
+                      << ", lease " << result.lease_ms << " ms)" << std::endl;
+        } else {
+            std::cout << "Key " << key << " not found in storage." << std::endl;
+        }
+        return result;
+    } catch (const std::exception& e) {
+        std::cout << "Error during leased find operation: " << e.what() << std::endl;
+        LeasedValue result;
+        result.status = KvStatus::ERROR;
+        return result;
+    }
+}
+
+// Looks up every key under a single acquisition of the store lock
+std::vector<LeasedValue> KvStore::FindMany(const std::vector<int>& keys, uint32_t lease_ms) {
+    std::vector<LeasedValue> results;
+    try {
+        if ((storage_mode == StorageMode::MEMORY && !memory_map_ptr) ||
+            (storage_mode == StorageMode::PERSISTENT && !persistent_map_ptr)) {
+            std::cout << "Map not found in storage." << std::endl;
+            results.resize(keys.size());
+            for (LeasedValue& result : results) {
+                result.status = KvStatus::ERROR;
+            }
+            return results;
+        }
+        
+        named_mutex mutex(open_only, MUTEX_NAME);
+        StoreLock lock(mutex, lock_profiler, StoreLockSite::FIND_MANY);
+        
+        results.reserve(keys.size());
+        std::size_t found = 0;
+        for (int key : keys) {
+            advanceRehash(key);
+            results.push_back(storage_mode == StorageMode::MEMORY
+                ? findWithLease(memory_map_ptr, key, lease_ms)
+                : findWithLease(persistent_map_ptr, key, lease_ms));
+            found += results.back().status == KvStatus::OK ? 1 : 0;
+        }
+        std::cout << "Found " << found << " of " << keys.size() << " keys" << std::endl;
+    } catch (const std::exception& e) {
+        std::cout << "Error during multi-key find operation: " << e.what() << std::endl;
+    }
+    // Keys not reached because of an error are reported as such
+    std::size_t reached = results.size();
+    results.resize(keys.size());
+    for (std::size_t i = reached; i < results.size(); ++i) {
+        results[i].status = KvStatus::ERROR;
+    }
+    return results;
+}
+
+template <typename Map, typename CharAlloc>
+KvStatus KvStore::applyReadModifyWrite(Map* map, const CharAlloc& alloc, StoreLock& lock, int key,
+                                       bool create_missing, const RmwFn& fn, uint64_t* new_version) {
+    typedef typename Map::mapped_type Entry;
+    
+    waitOutLease(map, key, lock, lease_sleep, [&] { advanceRehash(key); });
+    auto it = map->find(key);
+    if (it == map->end() && !create_missing) {
+        return KvStatus::NOT_FOUND;
+    }
+    
+    std::string next;
+    KvStatus status = it == map->end()
+        ? fn(nullptr, 0, 0, next)
+        : fn(it->second.value.data(), it->second.value.size(), it->second.version, next);
+    if (status != KvStatus::OK) {
+        return status;
+    }
+    
+    std::size_t old_size = it == map->end() ? 0 : it->second.value.size();
+    std::size_t extra = next.size() > old_size ? next.size() - old_size : 0;
+    if (it == map->end()) {
+        extra += sizeof(int) + 64; // Same overhead estimate as Insert
+    }
+    if (extra > 0 && !hasEnoughMemory(extra)) {
+        return KvStatus::OUT_OF_MEMORY;
+    }
+    
+    uint64_t version = ++*version_counter;
+    if (it == map->end()) {
+        map->insert(std::make_pair(key, Entry(next.data(), next.size(), version, alloc)));
+    } else {
+        it->second.value.assign(next.data(), next.size());
+        it->second.version = version;
+    }
+    logChange(key, version);
+    if (new_version) {
+        *new_version = version;
+    }
+    return KvStatus::OK;
+}
+
+KvStatus KvStore::readModifyWrite(const char* op_name, int key, bool create_missing, const RmwFn& fn,
+                                  uint64_t* new_version) {
+    try {
+        if ((storage_mode == StorageMode::MEMORY && !memory_map_ptr) ||
+            (storage_mode == StorageMode::PERSISTENT && !persistent_map_ptr)) {
+            std::cout << "Map not found in storage." << std::endl;
+            return KvStatus::ERROR;
+        }
+        
+        named_mutex mutex(open_only, MUTEX_NAME);
+        StoreLock lock(mutex, lock_profiler, StoreLockSite::READ_MODIFY_WRITE, key);
+        advanceRehash(key);
+        
+        KvStatus status;
+        if (storage_mode == StorageMode::MEMORY) {
+            CharAllocator char_alloc(memory_storage->get_segment_manager());
+            status = applyReadModifyWrite(memory_map_ptr, char_alloc, lock, key, create_missing, fn, new_version);
+        } else {
+            MappedCharAllocator char_alloc(file_storage->get_segment_manager());
+            status = applyReadModifyWrite(persistent_map_ptr, char_alloc, lock, key, create_missing, fn, new_version);
+            if (status == KvStatus::OK) {
+                // Sync to disk for persistence
+                Sync();
+            }
+        }
+        
+        std::cout << op_name << " on key " << key << ": " << KvStatusName(status) << std::endl;
+        return status;
+    } catch (const boost::interprocess::bad_alloc& e) {
+        std::cout << "Error during " << op_name << " (bad_alloc): " << e.what() << std::endl;
+        return KvStatus::OUT_OF_MEMORY;
+    } catch (const std::exception& e) {
+        std::cout << "Error during " << op_name << ": " << e.what() << std::endl;
+        return KvStatus::ERROR;
+    }
+}
+
+template <typename Map, typename CharAlloc>
+void KvStore::applyBulkLoad(Map* map, const CharAlloc& alloc, StoreLock& lock,
+                            const std::vector<std::pair<int, std::string>>& entries, std::size_t& loaded) {
+    typedef typename Map::mapped_type Entry;
+    
+    for (const auto& entry : entries) {
+        int key = entry.first;
+        advanceRehash(key);
+        // Clients may cache the old value under a lease, as for Update; keys nobody
+        // leased cost one extra lookup
+        waitOutLease(map, key, lock, lease_sleep, [&] { advanceRehash(key); });
+        uint64_t version = ++*version_counter;
+        auto it = map->find(entry.first);
+        if (it == map->end()) {
+            map->emplace(entry.first, Entry(entry.second.data(), entry.second.size(), version, alloc));
+        } else {
+            it->second.value.assign(entry.second.data(), entry.second.size());
+            it->second.version = version;
+        }
+        logChange(entry.first, version);
+        ++loaded;
+    }
+}
+
+KvStatus KvStore::BulkLoad(const std::vector<std::pair<int, std::string>>& entries, std::size_t& loaded) {
+    loaded = 0;
+    try {
+        if ((storage_mode == StorageMode::MEMORY && !memory_map_ptr) ||
+            (storage_mode == StorageMode::PERSISTENT && !persistent_map_ptr)) {
+            std::cout << "Map not found in storage." << std::endl;
+            return KvStatus::ERROR;
+        }
+        
+        named_mutex mutex(open_only, MUTEX_NAME);
+        StoreLock lock(mutex, lock_profiler, StoreLockSite::BULK_LOAD);
+        
+        // The whole batch is checked up front, with Insert's estimate per entry, so a
+        // batch that does not fit is refused before any of it is written
+        std::size_t needed = 0;
+        for (const auto& entry : entries) {
+            needed += entry.second.size() + sizeof(int) + 64;
+        }
+        if (!hasEnoughMemory(needed)) {
+            std::cout << "Bulk load refused: " << entries.size() << " entries need about " << needed
+                      << " bytes, " << GetFreeMemory() << " free" << std::endl;
+            PrintMemoryStats("Bulk Load - Failed (Memory)");
+            return KvStatus::OUT_OF_MEMORY;
+        }
+        
+        if (storage_mode == StorageMode::MEMORY) {
+            CharAllocator char_alloc(memory_storage->get_segment_manager());
+            applyBulkLoad(memory_map_ptr, char_alloc, lock, entries, loaded);
+        } else {
+            MappedCharAllocator char_alloc(file_storage->get_segment_manager());
+            applyBulkLoad(persistent_map_ptr, char_alloc, lock, entries, loaded);
+        }
+        return KvStatus::OK;
+    } catch (const boost::interprocess::bad_alloc& e) {
+        std::cout << "Bulk load stopped after " << loaded << " of " << entries.size()
+                  << " entries (bad_alloc): " << e.what() << std::endl;
+        PrintMemoryStats("Bulk Load - Failed (Allocation)");
+        return KvStatus::OUT_OF_MEMORY;
+    } catch (const std::exception& e) {
+        std::cout << "Error during bulk load after " << loaded << " entries: " << e.what() << std::endl;
+        return KvStatus::ERROR;
+    }
+}
+
+KvStatus KvStore::CompareAndSwap(int key, const std::string& expected, const std::string& new_value,
+                                 std::string* current, uint64_t* new_version) {
+    return readModifyWrite("CompareAndSwap", key, false,
+        [&](const char* data, std::size_t size, uint64_t, std::string& next) {
+            if (size != expected.size() || expected.compare(0, size, data, size) != 0) {
+                if (current) {
+                    current->assign(data, size);
+                }
+                return KvStatus::CONFLICT;
+            }
+            next = new_value;
+            return KvStatus::OK;
+        }, new_version);
+}
+
+KvStatus KvStore::CompareAndSwapVersion(int key, uint64_t expected_version, const std::string& new_value,
+                                        uint64_t* new_version) {
+    return readModifyWrite("CompareAndSwapVersion", key, false,
+        [&](const char*, std::size_t, uint64_t version, std::string& next) {
+            if (version != expected_version) {
+                return KvStatus::CONFLICT;
+            }
+            next = new_value;
+            return KvStatus::OK;
+        }, new_version);
+}
+
+KvStatus KvStore::Increment(int key, int64_t delta, int64_t& result, uint64_t* new_version) {
+    return readModifyWrite("Increment", key, true,
+        [&](const char* data, std::size_t size, uint64_t, std::string& next) {
+            int64_t current = 0;
+            if (data) {
+                auto parsed = std::from_chars(data, data + size, current);
+                if (parsed.ec != std::errc() || parsed.ptr != data + size) {
+                    return KvStatus::INVALID_ARGUMENT;
+                }
+            }
+            if (__builtin_add_overflow(current, delta, &result)) {
+                return KvStatus::INVALID_ARGUMENT;
+            }
+            next = std::to_string(result);
+            return KvStatus::OK;
+        }, new_version);
+}
+
+KvStatus KvStore::Append(int key, const std::string& suffix, uint64_t* new_version) {
+    return readModifyWrite("Append", key, true,
+        [&](const char* data, std::size_t size, uint64_t, std::string& next) {
+            next.reserve(size + suffix.size());
+            next.assign(data ? data : "", size);
+            next += suffix;
+            return KvStatus::OK;
+        }, new_version);
+}
+
+KvStatus KvStore::GetAndSet(int key, const std::string& new_value, std::string& old_value, uint64_t* new_version) {
+    return readModifyWrite("GetAndSet", key, false,
+        [&](const char* data, std::size_t size, uint64_t, std::string& next) {
+            old_value.assign(data, size);
+            next = new_value;
+            return KvStatus::OK;
+        }, new_version);
+}
+
 std::size_t KvStore::GetMapSize() const {
     try {
         if ((storage_mode == StorageMode::MEMORY && !memory_map_ptr) ||
@@ -568,12 +1341,15 @@ std::size_t KvStore::GetMapSize() const {
         }
         
         named_mutex mutex(open_only, MUTEX_NAME);
-        scoped_lock<named_mutex> lock(mutex);
+        StoreLock lock(mutex, lock_profiler, StoreLockSite::MAP_SIZE);
         
+        // A growing map's keys are split between its two tables
         if (storage_mode == StorageMode::MEMORY) {
-            return memory_map_ptr->size();
+            const MemoryHashMap* draining = drainingTable(memory_rehash);
+            return memory_map_ptr->size() + (draining ? draining->size() : 0);
         } else {
-            return persistent_map_ptr->size();
+            const MappedHashMap* draining = drainingTable(persistent_rehash);
+            return persistent_map_ptr->size() + (draining ? draining->size() : 0);
         }
     } catch (const std::exception& e) {
         std::cout << "Error getting map size: " << e.what() << std::endl;
@@ -590,21 +1366,31 @@ void KvStore::ListAllKeys() const {
         }
         
         named_mutex mutex(open_only, MUTEX_NAME);
-        scoped_lock<named_mutex> lock(mutex);
+        StoreLock lock(mutex, lock_profiler, StoreLockSite::LIST_KEYS);
         
         std::cout << "\n========== ALL KEYS IN STORAGE ==========\n";
         
         if (storage_mode == StorageMode::MEMORY) {
-            std::cout << "Total keys: " << memory_map_ptr->size() << "\n";
-            for (const auto& pair : *memory_map_ptr) {
-                std::cout << "Key: " << pair.first
-                         << ", Value: " << std::string(pair.second.c_str()) << "\n";
+            for (const MemoryHashMap* table : {memory_map_ptr, drainingTable(memory_rehash)}) {
+                if (!table) {
+                    continue;
+                }
+                std::cout << "Total keys: " << table->size() << "\n";
+                for (const auto& pair : *table) {
+                    std::cout << "Key: " << pair.first
+                             << ", Value: " << pair.second.value.c_str() << "\n";
+                }
             }
         } else {
-            std::cout << "Total keys: " << persistent_map_ptr->size() << "\n";
-            for (const auto& pair : *persistent_map_ptr) {
-                std::cout << "Key: " << pair.first
-                         << ", Value: " << std::string(pair.second.c_str()) << "\n";
+            for (const MappedHashMap* table : {persistent_map_ptr, drainingTable(persistent_rehash)}) {
+                if (!table) {
+                    continue;
+                }
+                std::cout << "Total keys: " << table->size() << "\n";
+                for (const auto& pair : *table) {
+                    std::cout << "Key: " << pair.first
+                             << ", Value: " << pair.second.value.c_str() << "\n";
+                }
             }
         }
         std::cout << "========================================\n";
@@ -613,6 +1399,168 @@ void KvStore::ListAllKeys() const {
     }
 }
 
+std::vector<std::pair<int, std::string>> KvStore::Scan(int64_t start, int64_t end, std::size_t limit) {
+    try {
+        if ((storage_mode == StorageMode::MEMORY && !memory_map_ptr) ||
+            (storage_mode == StorageMode::PERSISTENT && !persistent_map_ptr)) {
+            std::cout << "Map not found in storage." << std::endl;
+            return {};
+        }
+        
+        named_mutex mutex(open_only, MUTEX_NAME);
+        StoreLock lock(mutex, lock_profiler, StoreLockSite::SCAN);
+        
+        auto result = storage_mode == StorageMode::MEMORY
+            ? scanRange(memory_map_ptr, drainingTable(memory_rehash), start, end, limit)
+            : scanRange(persistent_map_ptr, drainingTable(persistent_rehash), start, end, limit);
+        std::cout << "Scan [" << start << ", " << end << "): " << result.size() << " keys" << std::endl;
+        return result;
+    } catch (const std::exception& e) {
+        std::cout << "Error during scan operation: " << e.what() << std::endl;
+        return {};
+    }
+}
+
+std::vector<int> KvStore::GetKeys() const {
+    std::vector<int> keys;
+    try {
+        if ((storage_mode == StorageMode::MEMORY && !memory_map_ptr) ||
+            (storage_mode == StorageMode::PERSISTENT && !persistent_map_ptr)) {
+            return keys;
+        }
+        
+        named_mutex mutex(open_only, MUTEX_NAME);
+        StoreLock lock(mutex, lock_profiler, StoreLockSite::GET_KEYS);
+        
+        if (storage_mode == StorageMode::MEMORY) {
+            for (const MemoryHashMap* table : {memory_map_ptr, drainingTable(memory_rehash)}) {
+                if (!table) {
+                    continue;
+                }
+                keys.reserve(keys.size() + table->size());
+                for (const auto& pair : *table) {
+                    keys.push_back(pair.first);
+                }
+            }
+        } else {
+            for (const MappedHashMap* table : {persistent_map_ptr, drainingTable(persistent_rehash)}) {
+                if (!table) {
+                    continue;
+                }
+                keys.reserve(keys.size() + table->size());
+                for (const auto& pair : *table) {
+                    keys.push_back(pair.first);
+                }
+            }
+        }
+    } catch (const std::exception& e) {
+        std::cout << "Error collecting keys: " << e.what() << std::endl;
+    }
+    return keys;
+}
+
+ChangeSet KvStore::ChangesSince(uint64_t after, std::size_t limit) {
+    ChangeSet changes;
+    try {
+        if (!change_log) {
+            changes.truncated = true;
+            return changes;
+        }
+        
+        named_mutex mutex(open_only, MUTEX_NAME);
+        StoreLock lock(mutex, lock_profiler, StoreLockSite::CHANGES_SINCE);
+        
+        uint64_t written = change_log->written;
+        uint64_t oldest = written > CHANGE_LOG_CAPACITY ? written - CHANGE_LOG_CAPACITY : 0;
+        auto seqAt = [&](uint64_t i) { return change_log->slots[i % CHANGE_LOG_CAPACITY].seq; };
+        // Every sequence number is logged, so a gap before the oldest slot means lost changes
+        if (oldest > 0 && seqAt(oldest) > after + 1) {
+            changes.truncated = true;
+            return changes;
+        }
+        // Slots are in sequence order: binary search for the first change after `after`
+        uint64_t lo = oldest;
+        uint64_t hi = written;
+        while (lo < hi) {
+            uint64_t mid = lo + (hi - lo) / 2;
+            if (seqAt(mid) <= after) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        uint64_t end = limit > 0 ? std::min<uint64_t>(written, lo + limit) : written;
+        changes.keys.reserve(end - lo);
+        for (uint64_t i = lo; i < end; ++i) {
+            changes.keys.push_back(change_log->slots[i % CHANGE_LOG_CAPACITY].key);
+        }
+        changes.caught_up = end == written;
+        changes.through = changes.caught_up ? std::max(after, *version_counter) : seqAt(end - 1);
+    } catch (const std::exception& e) {
+        std::cout << "Error reading change log: " << e.what() << std::endl;
+        changes.truncated = true;
+    }
+    return changes;
+}
+
+uint64_t KvStore::CurrentVersion() {
+    try {
+        named_mutex mutex(open_only, MUTEX_NAME);
+        StoreLock lock(mutex, lock_profiler, StoreLockSite::CURRENT_VERSION);
+        return version_counter ? *version_counter : 0;
+    } catch (const std::exception& e) {
+        std::cout << "Error reading version counter: " << e.what() << std::endl;
+        return 0;
+    }
+}
+
+void KvStore::SetLockProfiling(uint32_t sample_every) {
+    lock_profiler.setSampleEvery(sample_every);
+}
+
+void KvStore::SetLeaseSleep(LeaseSleep sleep) {
+    lease_sleep = std::move(sleep);
+}
+
+void KvStore::SetIncrementalRehash(uint32_t step) {
+    try {
+        named_mutex mutex(open_only, MUTEX_NAME);
+        StoreLock lock(mutex, lock_profiler, StoreLockSite::SET_REHASH_STEP);
+        if (storage_mode == StorageMode::MEMORY && memory_rehash) {
+            memory_rehash->step = step;
+        } else if (storage_mode == StorageMode::PERSISTENT && persistent_rehash) {
+            persistent_rehash->step = step;
+        }
+        std::cout << "[KvStore] Incremental rehash: "
+                  << (step > 0 ? std::to_string(step) + " entries per operation" : std::string("off")) << "\n";
+    } catch (const std::exception& e) {
+        std::cout << "Error setting incremental rehash: " << e.what() << std::endl;
+    }
+}
+
+// Read under the lock it describes; not itself counted as an acquisition
+StoreLockProfile KvStore::GetLockProfile() const {
+    StoreLockProfile profile;
+    try {
+        named_mutex mutex(open_only, MUTEX_NAME);
+        scoped_lock<named_mutex> lock(mutex);
+        lock_profiler.copy(profile);
+    } catch (const std::exception& e) {
+        std::cout << "Error reading lock profile: " << e.what() << std::endl;
+    }
+    return profile;
+}
+
+void KvStore::ResetLockProfile() {
+    try {
+        named_mutex mutex(open_only, MUTEX_NAME);
+        scoped_lock<named_mutex> lock(mutex);
+        lock_profiler.reset();
+    } catch (const std::exception& e) {
+        std::cout << "Error resetting lock profile: " << e.what() << std::endl;
+    }
+}
+
 KvStore::~KvStore() {
     // Check if we're in client mode - if so, don't clean up shared resources
     if (conn_mode == ConnectionMode::CLIENT) {
@@ -628,6 +1576,10 @@ KvStore::~KvStore() {
         
         if (storage_mode == StorageMode::MEMORY && memory_storage) {
             // Destroy unordered map object in shared memory
+            if (MemoryHashMap* draining = drainingTable(memory_rehash)) {
+                memory_storage->destroy_ptr(draining);
+                memory_rehash->draining = nullptr;
+            }
             if (memory_map_ptr) {
                 memory_storage->destroy<MemoryHashMap>("SharedMap");
                 std::cout << "Destroyed unordered map from shared memory." << std::endl;
@@ -643,6 +1595,10 @@ KvStore::~KvStore() {
             if (persistent_map_ptr) {
                 // Final sync before destruction
                 file_storage->flush();
+                if (MappedHashMap* draining = drainingTable(persistent_rehash)) {
+                    file_storage->destroy_ptr(draining);
+                    persistent_rehash->draining = nullptr;
+                }
                 file_storage->destroy<MappedHashMap>("SharedMap");
                 std::cout << "Destroyed persistent map from mapped file." << std::endl;
                 persistent_map_ptr = nullptr;
@@ -0,0 +1,207 @@
+#include "KVTrace.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace {
+
+struct Span {
+    uint64_t trace_id;
+    uint64_t start_ns;
+    uint64_t end_ns;
+    const char* name;
+    int32_t key;
+};
+
+// One thread's spans. Only its thread writes it; the mutex is there for dumps,
+// so the writer always finds it free.
+struct Ring {
+    std::mutex mutex;
+    std::vector<Span> spans;
+    uint64_t written = 0;   // Spans ever recorded; slot written % size is next
+    uint32_t tid = 0;
+};
+
+std::atomic<uint32_t> sample_every{0};
+std::atomic<std::size_t> buffer_spans{16384};
+
+// Rings outlive their threads, so the spans of finished threads can still be dumped
+std::mutex rings_mutex;
+std::vector<std::shared_ptr<Ring>> rings;
+
+thread_local uint64_t current_trace = 0;
+
+// Viewers read timestamps as double microseconds, which since 1970 would no longer
+// resolve a microsecond; they are written from this later fixed point instead
+// (2023-11-14 22:13:20 UTC), the same in every process
+constexpr uint64_t TRACE_EPOCH_NS = 1700000000ull * 1000000000ull;
+
+Ring& threadRing() {
+    thread_local std::shared_ptr<Ring> ring;
+    if (!ring) {
+        ring = std::make_shared<Ring>();
+        ring->spans.resize(std::max<std::size_t>(buffer_spans.load(), 1));
+        ring->tid = static_cast<uint32_t>(syscall(SYS_gettid));
+        std::lock_guard<std::mutex> lock(rings_mutex);
+        rings.push_back(ring);
+    }
+    return *ring;
+}
+
+// Microseconds with three decimals, without going through a double
+void appendMicros(std::string& out, uint64_t ns) {
+    char buffer[32];
+    std::snprintf(buffer, sizeof(buffer), "%llu.%03llu", static_cast<unsigned long long>(ns / 1000),
+                  static_cast<unsigned long long>(ns % 1000));
+    out += buffer;
+}
+
+std::string jsonEscape(const std::string& s) {
+    std::string escaped;
+    for (char c : s) {
+        if (c == '"' || c == '\\') {
+            escaped += '\\';
+            escaped += c;
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            escaped += ' ';
+        } else {
+            escaped += c;
+        }
+    }
+    return escaped;
+}
+
+}  // namespace
+
+void ConfigureTracing(uint32_t every, std::size_t spans) {
+    sample_every = every;
+    buffer_spans = spans;
+}
+
+uint32_t TracingSampleEvery() {
+    return sample_every.load(std::memory_order_relaxed);
+}
+
+uint64_t TraceSample() {
+    uint32_t every = TracingSampleEvery();
+    if (every == 0) {
+        return 0;
+    }
+    thread_local uint32_t countdown = 0;
+    if (countdown == 0) {
+        countdown = every;
+    }
+    if (--countdown != 0) {
+        return 0;
+    }
+    thread_local std::mt19937_64 gen(std::random_device{}());
+    return gen() | 1;
+}
+
+uint64_t CurrentTraceId() {
+    return current_trace;
+}
+
+uint64_t TraceNowNs() {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                     std::chrono::system_clock::now().time_since_epoch()).count());
+}
+
+void RecordSpan(uint64_t trace_id, const char* name, uint64_t start_ns, uint64_t end_ns, int key) {
+    Ring& ring = threadRing();
+    std::lock_guard<std::mutex> lock(ring.mutex);
+    Span& span = ring.spans[ring.written % ring.spans.size()];
+    span.trace_id = trace_id;
+    span.start_ns = start_ns;
+    span.end_ns = end_ns < start_ns ? start_ns : end_ns;
+    span.name = name;
+    span.key = key;
+    ++ring.written;
+}
+
+std::string TraceEventsJson(const std::string& process_name) {
+    std::string pid = std::to_string(getpid());
+    std::string out = "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":" + pid + ",\"args\":{\"name\":\"" +
+                      jsonEscape(process_name) + "\"}}";
+    std::vector<std::shared_ptr<Ring>> all;
+    {
+        std::lock_guard<std::mutex> lock(rings_mutex);
+        all = rings;
+    }
+    char trace[20];
+    for (const std::shared_ptr<Ring>& ring : all) {
+        std::lock_guard<std::mutex> lock(ring->mutex);
+        uint64_t size = ring->spans.size();
+        uint64_t first = ring->written > size ? ring->written - size : 0;
+        for (uint64_t i = first; i < ring->written; ++i) {
+            const Span& span = ring->spans[i % size];
+            std::snprintf(trace, sizeof(trace), "%016llx", static_cast<unsigned long long>(span.trace_id));
+            out += ",\n{\"name\":\"";
+            out += span.name;
+            out += "\",\"cat\":\"kv\",\"ph\":\"X\",\"ts\":";
+            appendMicros(out, span.start_ns > TRACE_EPOCH_NS ? span.start_ns - TRACE_EPOCH_NS : 0);
+            out += ",\"dur\":";
+            appendMicros(out, span.end_ns - span.start_ns);
+            out += ",\"pid\":" + pid + ",\"tid\":" + std::to_string(ring->tid) + ",\"args\":{\"trace\":\"" + trace +
+                   "\"";
+            if (span.key >= 0) {
+                out += ",\"key\":" + std::to_string(span.key);
+            }
+            out += "}}";
+        }
+    }
+    return out;
+}
+
+void ClearTraces() {
+    std::lock_guard<std::mutex> lock(rings_mutex);
+    for (const std::shared_ptr<Ring>& ring : rings) {
+        std::lock_guard<std::mutex> ring_lock(ring->mutex);
+        ring->written = 0;
+    }
+}
+
+bool WriteChromeTrace(const std::string& path, const std::vector<std::string>& event_lists) {
+    std::ofstream out(path, std::ios::trunc);
+    if (!out) {
+        return false;
+    }
+    out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n";
+    bool first = true;
+    for (const std::string& events : event_lists) {
+        if (events.empty()) {
+            continue;
+        }
+        out << (first ? "" : ",\n") << events;
+        first = false;
+    }
+    out << "\n]}\n";
+    return static_cast<bool>(out);
+}
+
+KvTraceContext::KvTraceContext(uint64_t trace_id) : previous(current_trace), active(trace_id != 0) {
+    if (active) {
+        current_trace = trace_id;
+    }
+}
+
+KvTraceContext::~KvTraceContext() {
+    if (active) {
+        current_trace = previous;
+    }
+}
+
+KvTraceSuspend::KvTraceSuspend() : suspended(current_trace) {
+    current_trace = 0;
+}
+
+KvTraceSuspend::~KvTraceSuspend() {
+    current_trace = suspended;
+}
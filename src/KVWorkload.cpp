@@ -0,0 +1,116 @@
+#include "KVWorkload.hpp"
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+ZipfGenerator::ZipfGenerator(int n, double theta) : n(n), theta(theta) {
+    for (int i = 1; i <= n; ++i) {
+        zetan += 1.0 / std::pow(i, theta);
+    }
+    double zeta2 = 1.0 + 1.0 / std::pow(2.0, theta);
+    alpha = 1.0 / (1.0 - theta);
+    eta = (1.0 - std::pow(2.0 / n, 1.0 - theta)) / (1.0 - zeta2 / zetan);
+}
+
+int ZipfGenerator::next(std::mt19937& gen) {
+    double u = std::uniform_real_distribution<>(0.0, 1.0)(gen);
+    double uz = u * zetan;
+    if (uz < 1.0) {
+        return 0;
+    }
+    if (uz < 1.0 + std::pow(0.5, theta)) {
+        return 1;
+    }
+    return std::min(n - 1, static_cast<int>(n * std::pow(eta * u - eta + 1.0, alpha)));
+}
+
+const char* BenchOpName(BenchOp op) {
+    switch (op) {
+        case BenchOp::READ: return "READ";
+        case BenchOp::UPDATE: return "UPDATE";
+        case BenchOp::INSERT: return "INSERT";
+        case BenchOp::SCAN: return "SCAN";
+        case BenchOp::READ_MODIFY_WRITE: return "READ-MODIFY-WRITE";
+    }
+    return "UNKNOWN";
+}
+
+BenchOp WorkloadMix::pick(double u) const {
+    if ((u -= read) < 0) {
+        return BenchOp::READ;
+    }
+    if ((u -= update) < 0) {
+        return BenchOp::UPDATE;
+    }
+    if ((u -= insert) < 0) {
+        return BenchOp::INSERT;
+    }
+    if ((u -= scan) < 0) {
+        return BenchOp::SCAN;
+    }
+    return read_modify_write > 0 ? BenchOp::READ_MODIFY_WRITE : BenchOp::READ;
+}
+
+WorkloadMix YcsbWorkload(const std::string& name) {
+    WorkloadMix mix;
+    std::string w = name;
+    std::transform(w.begin(), w.end(), w.begin(), ::tolower);
+    if (w == "a") {
+        mix.read = 0.5;
+        mix.update = 0.5;
+    } else if (w == "b") {
+        mix.read = 0.95;
+        mix.update = 0.05;
+    } else if (w == "c") {
+        mix.read = 1.0;
+    } else if (w == "d") {
+        mix.read = 0.95;
+        mix.insert = 0.05;
+        mix.distribution = "latest";
+    } else if (w == "e") {
+        mix.scan = 0.95;
+        mix.insert = 0.05;
+    } else if (w == "f") {
+        mix.read = 0.5;
+        mix.read_modify_write = 0.5;
+    } else {
+        throw std::invalid_argument("unknown workload \"" + name + "\" (expected a to f)");
+    }
+    return mix;
+}
+
+namespace {
+
+// FNV-1a over the rank's bytes, as YCSB scrambles its zipfian ranks
+uint64_t scramble(uint64_t rank) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (int i = 0; i < 8; ++i) {
+        hash ^= (rank >> (i * 8)) & 0xff;
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+}  // namespace
+
+KeyChooser::KeyChooser(const std::string& distribution, int64_t records, double theta)
+    : kind(distribution == "uniform" ? Kind::UNIFORM : distribution == "latest" ? Kind::LATEST : Kind::ZIPFIAN),
+      records(std::max<int64_t>(records, 1)),
+      zipf(static_cast<int>(std::min<int64_t>(this->records, INT32_MAX)), theta) {
+    if (distribution != "uniform" && distribution != "zipfian" && distribution != "latest") {
+        throw std::invalid_argument("unknown distribution \"" + distribution + "\" (expected uniform, zipfian or latest)");
+    }
+}
+
+int64_t KeyChooser::next(std::mt19937& gen, int64_t count) {
+    count = std::max<int64_t>(count, 1);
+    switch (kind) {
+        case Kind::UNIFORM:
+            return std::uniform_int_distribution<int64_t>(0, count - 1)(gen);
+        case Kind::LATEST:
+            return std::max<int64_t>(0, count - 1 - zipf.next(gen));
+        case Kind::ZIPFIAN:
+            break;
+    }
+    return static_cast<int64_t>(scramble(static_cast<uint64_t>(zipf.next(gen))) % static_cast<uint64_t>(records));
+}
@@ -0,0 +1,161 @@
+#include "KVWriteBuffer.hpp"
+#include <algorithm>
+#include <iostream>
+
+KVWriteBuffer::KVWriteBuffer(std::size_t batch_size, uint32_t flush_interval_ms, std::size_t max_pending, SendFn send)
+    : batch_size(std::max<std::size_t>(batch_size, 1)),
+      flush_interval(flush_interval_ms),
+      max_pending(std::max(max_pending, this->batch_size)),
+      send(std::move(send)),
+      flusher(&KVWriteBuffer::run, this) {
+}
+
+KVWriteBuffer::~KVWriteBuffer() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    flusher.join();
+
+    for (const WriteFailure& failure : flush()) {
+        std::cerr << "[WriteBuffer] " << KvOpTypeName(failure.type) << " of key " << failure.key
+                  << " failed: " << (failure.error.empty() ? KvStatusName(failure.status) : failure.error)
+                  << std::endl;
+    }
+}
+
+void KVWriteBuffer::add(int node_id, KvOp op) {
+    bool must_flush = false;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        NodeBuffer& buffer = buffers[node_id];
+
+        auto it = buffer.by_key.find(op.key);
+        if (it == buffer.by_key.end()) {
+            buffer.key_order.push_back(op.key);
+            buffer.by_key[op.key].push_back(std::move(op));
+            ++buffer.op_count;
+            ++pending;
+        } else if (op.type == KvOpType::UPDATE && it->second.back().type == KvOpType::UPDATE) {
+            // Applied one after the other both updates succeed or fail alike, and
+            // only the newest value matters. Nothing else merges: a second delete
+            // or insert of a key fails where the first succeeded.
+            it->second.back().value = std::move(op.value);
+        } else {
+            it->second.push_back(std::move(op));
+            ++buffer.op_count;
+            ++pending;
+        }
+
+        if (buffer.op_count >= batch_size) {
+            flush_requested = true;
+        }
+        must_flush = pending >= max_pending;
+    }
+
+    if (must_flush) {
+        // Backpressure: the caller pays for draining a full buffer
+        flushPending();
+    } else {
+        wake.notify_one();
+    }
+}
+
+bool KVWriteBuffer::holds(int key) {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (const auto& entry : buffers) {
+        if (entry.second.by_key.count(key)) {
+            return true;
+        }
+    }
+    return in_flight.count(key) > 0;
+}
+
+void KVWriteBuffer::flushPending() {
+    std::lock_guard<std::mutex> flushing(flush_mutex);
+
+    Batches drained;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto& entry : buffers) {
+            std::vector<KvOp>& ops = drained[entry.first];
+            ops.reserve(entry.second.op_count);
+            for (int key : entry.second.key_order) {
+                for (KvOp& op : entry.second.by_key[key]) {
+                    ops.push_back(std::move(op));
+                }
+                in_flight.insert(key);
+            }
+        }
+        buffers.clear();
+        pending = 0;
+        flush_requested = false;
+    }
+
+    // Send in rounds of at most batch_size ops per node; every node of a round
+    // is dispatched together and rounds are strictly ordered
+    std::vector<WriteFailure> round_failures;
+    std::unordered_map<int, std::size_t> offsets;
+    while (true) {
+        Batches round;
+        for (const auto& entry : drained) {
+            std::size_t offset = offsets[entry.first];
+            if (offset >= entry.second.size()) {
+                continue;
+            }
+            std::size_t count = std::min(batch_size, entry.second.size() - offset);
+            round[entry.first].assign(entry.second.begin() + offset, entry.second.begin() + offset + count);
+        }
+        if (round.empty()) {
+            break;
+        }
+
+        std::unordered_map<int, BatchResult> results = send(round);
+        for (const auto& entry : round) {
+            const BatchResult& result = results[entry.first];
+            for (std::size_t i = 0; i < entry.second.size(); ++i) {
+                KvStatus status = result.timed_out ? KvStatus::DEADLINE_EXCEEDED
+                                  : !result.error.empty() ? KvStatus::UNAVAILABLE
+                                  : i < result.replies.size() ? result.replies[i].status : KvStatus::ERROR;
+                if (status != KvStatus::OK) {
+                    const KvOp& op = entry.second[i];
+                    round_failures.push_back({op.key, op.type, status, result.error});
+                }
+            }
+            offsets[entry.first] += entry.second.size();
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    in_flight.clear();
+    failures.insert(failures.end(), round_failures.begin(), round_failures.end());
+}
+
+std::vector<WriteFailure> KVWriteBuffer::flush() {
+    flushPending();
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<WriteFailure> result;
+    result.swap(failures);
+    return result;
+}
+
+void KVWriteBuffer::drain() {
+    flushPending();
+}
+
+void KVWriteBuffer::run() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (!stopping) {
+        wake.wait_for(lock, flush_interval, [this] { return stopping || flush_requested; });
+        if (stopping) {
+            break;
+        }
+        if (pending == 0) {
+            continue;
+        }
+        lock.unlock();
+        flushPending();
+        lock.lock();
+    }
+}
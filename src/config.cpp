@@ -1,4 +1,5 @@
 #include "config.hpp"
+#include <algorithm>
 #include <fstream>
 #include <stdexcept>
 
@@ -37,3 +38,241 @@ size_t Config::read_size() const {
 std::string Config::read_ip() const{
     return config_json["local_ip"];  // assuming JSON has key "local_ip"
 }
+
+CacheConfig Config::read_cache_config() const {
+    CacheConfig cache;
+    if (!config_json.contains("cache")) {
+        return cache;
+    }
+    const auto& section = config_json.at("cache");
+    cache.enabled = section.value("enabled", cache.enabled);
+    cache.capacity = section.value("capacity", cache.capacity);
+    cache.shards = section.value("shards", cache.shards);
+    cache.lease_ms = section.value("lease_ms", cache.lease_ms);
+    return cache;
+}
+
+WriteBehindConfig Config::read_write_behind_config() const {
+    WriteBehindConfig write_behind;
+    if (!config_json.contains("write_behind")) {
+        return write_behind;
+    }
+    const auto& section = config_json.at("write_behind");
+    write_behind.enabled = section.value("enabled", write_behind.enabled);
+    write_behind.batch_size = section.value("batch_size", write_behind.batch_size);
+    write_behind.flush_interval_ms = section.value("flush_interval_ms", write_behind.flush_interval_ms);
+    write_behind.max_pending = section.value("max_pending", write_behind.max_pending);
+    return write_behind;
+}
+
+PlacementConfig Config::read_placement_config() const {
+    PlacementConfig placement;
+    if (!config_json.contains("placement")) {
+        return placement;
+    }
+    const auto& section = config_json.at("placement");
+    placement.strategy = section.value("strategy", placement.strategy);
+    placement.vnodes = section.value("vnodes", placement.vnodes);
+    placement.range_span = section.value("range_span", placement.range_span);
+    if (section.contains("weights")) {
+        for (const auto& [node_id, weight] : section.at("weights").items()) {
+            placement.weights[std::stoi(node_id)] = weight.get<double>();
+        }
+    }
+    return placement;
+}
+
+RebalanceConfig Config::read_rebalance_config() const {
+    RebalanceConfig rebalance;
+    if (!config_json.contains("rebalance")) {
+        return rebalance;
+    }
+    const auto& section = config_json.at("rebalance");
+    rebalance.batch_size = section.value("batch_size", rebalance.batch_size);
+    rebalance.max_keys_per_sec = section.value("max_keys_per_sec", rebalance.max_keys_per_sec);
+    rebalance.max_passes = section.value("max_passes", rebalance.max_passes);
+    return rebalance;
+}
+
+MembershipConfig Config::read_membership_config() const {
+    MembershipConfig membership;
+    if (!config_json.contains("membership")) {
+        return membership;
+    }
+    const auto& section = config_json.at("membership");
+    membership.refresh_ms = section.value("refresh_ms", membership.refresh_ms);
+    return membership;
+}
+
+RangeConfig Config::read_range_config() const {
+    RangeConfig ranges;
+    if (!config_json.contains("ranges")) {
+        return ranges;
+    }
+    const auto& section = config_json.at("ranges");
+    ranges.max_keys = section.value("max_keys", ranges.max_keys);
+    ranges.max_ops_per_sec = section.value("max_ops_per_sec", ranges.max_ops_per_sec);
+    ranges.merge_fraction = section.value("merge_fraction", ranges.merge_fraction);
+    ranges.check_interval_ms = section.value("check_interval_ms", ranges.check_interval_ms);
+    return ranges;
+}
+
+HotKeyConfig Config::read_hot_key_config() const {
+    HotKeyConfig hot_keys;
+    if (!config_json.contains("hot_keys")) {
+        return hot_keys;
+    }
+    const auto& section = config_json.at("hot_keys");
+    hot_keys.enabled = section.value("enabled", hot_keys.enabled);
+    hot_keys.min_share = section.value("min_share", hot_keys.min_share);
+    hot_keys.max_keys = section.value("max_keys", hot_keys.max_keys);
+    hot_keys.refresh_ms = section.value("refresh_ms", hot_keys.refresh_ms);
+    hot_keys.lease_ms = section.value("lease_ms", hot_keys.lease_ms);
+    return hot_keys;
+}
+
+ReplicationConfig Config::read_replication_config() const {
+    ReplicationConfig replication;
+    if (!config_json.contains("replication")) {
+        return replication;
+    }
+    const auto& section = config_json.at("replication");
+    replication.factor = section.value("factor", replication.factor);
+    replication.ack = section.value("ack", replication.ack);
+    replication.read_from_backups = section.value("read_from_backups", replication.read_from_backups);
+    replication.max_staleness_ms = section.value("max_staleness_ms", replication.max_staleness_ms);
+    if (replication.factor == 0) {
+        replication.factor = 1;
+    }
+    if (replication.ack != "primary" && replication.ack != "backup") {
+        throw std::runtime_error("replication.ack must be \"primary\" or \"backup\"");
+    }
+    return replication;
+}
+
+DeadlineConfig Config::read_deadline_config() const {
+    DeadlineConfig deadlines;
+    if (!config_json.contains("deadlines")) {
+        return deadlines;
+    }
+    const auto& section = config_json.at("deadlines");
+    deadlines.timeout_ms = section.value("timeout_ms", deadlines.timeout_ms);
+    deadlines.propagate = section.value("propagate", deadlines.propagate);
+    deadlines.hedge = section.value("hedge", deadlines.hedge);
+    deadlines.hedge_percentile = section.value("hedge_percentile", deadlines.hedge_percentile);
+    deadlines.hedge_min_ms = section.value("hedge_min_ms", deadlines.hedge_min_ms);
+    if (deadlines.hedge_percentile <= 0 || deadlines.hedge_percentile >= 100) {
+        throw std::runtime_error("deadlines.hedge_percentile must be between 0 and 100");
+    }
+    return deadlines;
+}
+
+AdmissionConfig Config::read_admission_config() const {
+    AdmissionConfig admission;
+    if (!config_json.contains("admission")) {
+        return admission;
+    }
+    const auto& section = config_json.at("admission");
+    admission.max_queue = section.value("max_queue", admission.max_queue);
+    admission.client_ops_per_sec = section.value("client_ops_per_sec", admission.client_ops_per_sec);
+    admission.client_burst = section.value("client_burst", admission.client_burst);
+    admission.retry_after_ms = section.value("retry_after_ms", admission.retry_after_ms);
+    admission.window = section.value("window", admission.window);
+    admission.max_retries = section.value("max_retries", admission.max_retries);
+    if (admission.window == 0) {
+        admission.window = 1;
+    }
+    return admission;
+}
+
+ProgressConfig Config::read_progress_config() const {
+    ProgressConfig progress;
+    if (!config_json.contains("progress")) {
+        return progress;
+    }
+    const auto& section = config_json.at("progress");
+    progress.mode = section.value("mode", progress.mode);
+    progress.spin_ms = section.value("spin_ms", progress.spin_ms);
+    progress.dedicated_thread = section.value("dedicated_thread", progress.dedicated_thread);
+    progress.handler_threads = section.value("handler_threads", progress.handler_threads);
+    if (progress.mode != "blocking" && progress.mode != "busy_poll" && progress.mode != "adaptive") {
+        throw std::runtime_error("progress.mode must be \"blocking\", \"busy_poll\" or \"adaptive\"");
+    }
+    return progress;
+}
+
+MetricsConfig Config::read_metrics_config() const {
+    MetricsConfig metrics;
+    if (!config_json.contains("metrics")) {
+        return metrics;
+    }
+    const auto& section = config_json.at("metrics");
+    metrics.file = section.value("file", metrics.file);
+    metrics.socket = section.value("socket", metrics.socket);
+    metrics.interval_ms = section.value("interval_ms", metrics.interval_ms);
+    if (metrics.interval_ms == 0) {
+        metrics.interval_ms = 1;
+    }
+    metrics.lock_sample_every = section.value("lock_sample_every", metrics.lock_sample_every);
+    return metrics;
+}
+
+TracingConfig Config::read_tracing_config() const {
+    TracingConfig tracing;
+    if (!config_json.contains("tracing")) {
+        return tracing;
+    }
+    const auto& section = config_json.at("tracing");
+    tracing.sample_every = section.value("sample_every", tracing.sample_every);
+    tracing.buffer_spans = section.value("buffer_spans", tracing.buffer_spans);
+    tracing.file = section.value("file", tracing.file);
+    if (tracing.buffer_spans == 0) {
+        tracing.buffer_spans = 1;
+    }
+    return tracing;
+}
+
+StoreConfig Config::read_store_config() const {
+    StoreConfig store;
+    if (!config_json.contains("store")) {
+        return store;
+    }
+    const auto& section = config_json.at("store");
+    store.expected_keys = section.value("expected_keys", store.expected_keys);
+    store.rehash_step = section.value("rehash_step", store.rehash_step);
+    return store;
+}
+
+ShardConfig Config::read_shard_config() const {
+    ShardConfig shards;
+    if (!config_json.contains("shards")) {
+        return shards;
+    }
+    const auto& section = config_json.at("shards");
+    shards.count = std::max<uint32_t>(section.value("count", shards.count), 1);
+    shards.first_cpu = section.value("first_cpu", shards.first_cpu);
+    shards.cpu_stride = std::max<uint32_t>(section.value("cpu_stride", shards.cpu_stride), 1);
+    return shards;
+}
+
+// progress_timeout_ub_msec bounds how long one progress call may block in the
+// network (0: never block); after any activity Margo keeps polling without
+// blocking for progress_spindown_msec. na_no_block makes Mercury poll its
+// transport instead of waiting on a file descriptor.
+std::string MargoConfigJson(const ProgressConfig& progress) {
+    json margo;
+    margo["use_progress_thread"] = progress.dedicated_thread;
+    margo["rpc_thread_count"] = progress.handler_threads;
+    if (progress.mode == "busy_poll") {
+        margo["progress_timeout_ub_msec"] = 0;
+        margo["progress_spindown_msec"] = 0;
+        margo["mercury"]["na_no_block"] = true;
+    } else if (progress.mode == "adaptive") {
+        margo["progress_timeout_ub_msec"] = 100;
+        margo["progress_spindown_msec"] = progress.spin_ms;
+    } else {
+        margo["progress_timeout_ub_msec"] = 100;
+        margo["progress_spindown_msec"] = 0;
+    }
+    return margo.dump();
+}
@@ -0,0 +1,653 @@
+#include "KVDistributor.hpp"
+#include "KVHistogram.hpp"
+#include "KVProtocol.hpp"
+#include "KVStore.hpp"
+#include "KVWorkload.hpp"
+#include "config.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+// YCSB-style load generator. "load" inserts keys 0 .. records-1; "run" drives one
+// of the core workloads against them for a warmup period and then a measured one.
+// Each of the processes attaches to the local store and builds one KVDistributor
+// shared by its threads, so the numbers cover the same path as kvm_client. The
+// parent only collects the per-operation histograms of its children and prints the
+// report (JSON or CSV); the children's own logging is discarded unless --verbose.
+//
+// Without --rate each thread issues its next operation as soon as the previous one
+// returns (closed loop). With --rate the threads send on a fixed or Poisson schedule
+// at that total rate whatever the replies do (open loop), and latency is measured
+// from each operation's intended send time, so time spent queued behind a slow
+// reply counts against it rather than silently lowering the offered load. A list
+// of rates is run one after another, giving a throughput-latency curve.
+//
+// Usage: kvm_bench load|run [--config=path] [--storage=memory|persistent]
+//            [--workload=a..f] [--distribution=uniform|zipfian|latest] [--theta=0.99]
+//            [--records=N] [--value-size=bytes] [--max-scan=N] [--threads=N]
+//            [--processes=N] [--warmup=sec] [--duration=sec]
+//            [--rate=ops/s[,ops/s...]] [--arrival=fixed|poisson] [--path=any|local|remote]
+//            [--format=json|csv] [--output=path] [--verbose]
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct BenchOptions {
+    std::string phase;
+    std::string config_path = "../config/config.json";
+    std::string storage = "memory";
+    std::string workload = "a";
+    std::string distribution;   // Empty: the workload's own
+    double theta = 0.99;
+    int64_t records = 100000;
+    std::size_t value_size = 100;
+    int max_scan = 100;
+    int threads = 1;
+    int processes = 1;
+    double warmup_sec = 5;
+    double duration_sec = 30;
+    std::vector<double> rates;  // Total target ops/s per run; empty: one closed-loop run
+    std::string arrival = "poisson";
+    std::string path = "any";   // Keys read or updated: any, only local or only remote ones
+    std::string format = "json";
+    std::string output;         // Empty: stdout
+    bool verbose = false;
+};
+
+// What one process (or, merged, the whole run) measured
+struct BenchResult {
+    double elapsed_sec = 0;                // Measured period
+    double target_rate = 0;                // Total ops/s; 0 for a closed-loop run
+    KVHistogram latency[BENCH_OP_COUNT];   // Nanoseconds, from the intended send time
+    KVHistogram service;                   // Nanoseconds, from the actual send, all operations
+    uint64_t errors[BENCH_OP_COUNT] = {};
+    uint64_t missed = 0;                   // Scheduled in the measured period but never sent
+
+    void merge(const BenchResult& other) {
+        elapsed_sec = std::max(elapsed_sec, other.elapsed_sec);
+        target_rate = other.target_rate;
+        service.merge(other.service);
+        missed += other.missed;
+        for (int i = 0; i < BENCH_OP_COUNT; ++i) {
+            latency[i].merge(other.latency[i]);
+            errors[i] += other.errors[i];
+        }
+    }
+
+    template <typename A>
+    void save(A& ar) const {
+        ar.write(&elapsed_sec);
+        ar.write(&target_rate);
+        service.save(ar);
+        ar.write(&missed);
+        for (int i = 0; i < BENCH_OP_COUNT; ++i) {
+            latency[i].save(ar);
+            ar.write(&errors[i]);
+        }
+    }
+
+    template <typename A>
+    void load(A& ar) {
+        ar.read(&elapsed_sec);
+        ar.read(&target_rate);
+        service.load(ar);
+        ar.read(&missed);
+        for (int i = 0; i < BENCH_OP_COUNT; ++i) {
+            latency[i].load(ar);
+            ar.read(&errors[i]);
+        }
+    }
+};
+
+std::vector<double> parseRates(const std::string& list) {
+    std::vector<double> rates;
+    std::size_t start = 0;
+    while (start <= list.size()) {
+        std::size_t comma = list.find(',', start);
+        if (comma == std::string::npos) {
+            comma = list.size();
+        }
+        rates.push_back(std::stod(list.substr(start, comma - start)));
+        start = comma + 1;
+    }
+    return rates;
+}
+
+bool parseOptions(int argc, char* argv[], BenchOptions& options) {
+    if (argc < 2) {
+        return false;
+    }
+    options.phase = argv[1];
+    if (options.phase != "load" && options.phase != "run") {
+        return false;
+    }
+    for (int i = 2; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--verbose") {
+            options.verbose = true;
+            continue;
+        }
+        std::size_t eq = arg.find('=');
+        if (arg.rfind("--", 0) != 0 || eq == std::string::npos) {
+            std::cerr << "Unrecognized argument: " << arg << std::endl;
+            return false;
+        }
+        std::string name = arg.substr(2, eq - 2);
+        std::string value = arg.substr(eq + 1);
+        if (name == "config") {
+            options.config_path = value;
+        } else if (name == "storage") {
+            options.storage = value;
+        } else if (name == "workload") {
+            options.workload = value;
+        } else if (name == "distribution") {
+            options.distribution = value;
+        } else if (name == "theta") {
+            options.theta = std::stod(value);
+        } else if (name == "records") {
+            options.records = std::stoll(value);
+        } else if (name == "value-size") {
+            options.value_size = std::stoul(value);
+        } else if (name == "max-scan") {
+            options.max_scan = std::stoi(value);
+        } else if (name == "threads") {
+            options.threads = std::stoi(value);
+        } else if (name == "processes") {
+            options.processes = std::stoi(value);
+        } else if (name == "warmup") {
+            options.warmup_sec = std::stod(value);
+        } else if (name == "duration") {
+            options.duration_sec = std::stod(value);
+        } else if (name == "rate") {
+            options.rates = parseRates(value);
+        } else if (name == "arrival") {
+            options.arrival = value;
+        } else if (name == "path") {
+            options.path = value;
+        } else if (name == "format") {
+            options.format = value;
+        } else if (name == "output") {
+            options.output = value;
+        } else {
+            std::cerr << "Unknown option: --" << name << std::endl;
+            return false;
+        }
+    }
+    if (options.records < 1 || options.records > INT32_MAX / 2 || options.threads < 1 || options.processes < 1 ||
+        options.max_scan < 1 || options.duration_sec <= 0 || options.warmup_sec < 0 ||
+        (options.format != "json" && options.format != "csv") ||
+        (options.arrival != "fixed" && options.arrival != "poisson") ||
+        (options.path != "any" && options.path != "local" && options.path != "remote") ||
+        std::any_of(options.rates.begin(), options.rates.end(), [](double rate) { return rate <= 0; })) {
+        std::cerr << "Invalid option value" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+std::string randomValue(std::size_t size, std::mt19937& gen) {
+    static const char charset[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
+    std::uniform_int_distribution<int> pick(0, sizeof(charset) - 2);
+    std::string value(size, ' ');
+    for (char& c : value) {
+        c = charset[pick(gen)];
+    }
+    return value;
+}
+
+uint64_t nanosBetween(Clock::time_point start, Clock::time_point end) {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+}
+
+bool failed(KvStatus status) {
+    return status != KvStatus::OK && status != KvStatus::NOT_FOUND;
+}
+
+// Inserts this thread's share of 0 .. records-1: every key congruent to its
+// global thread index
+void loadThread(KVDistributor& distributor, const BenchOptions& options, int global_thread, int total_threads,
+                BenchResult& result) {
+    std::mt19937 gen(global_thread + 1);
+    std::string value = randomValue(options.value_size, gen);
+    KVHistogram& latency = result.latency[static_cast<int>(BenchOp::INSERT)];
+    for (int64_t key = global_thread; key < options.records; key += total_threads) {
+        auto start = Clock::now();
+        KvStatus status = distributor.insert(static_cast<int>(key), value);
+        latency.record(nanosBetween(start, Clock::now()));
+        if (status != KvStatus::OK) {
+            ++result.errors[static_cast<int>(BenchOp::INSERT)];
+        }
+    }
+}
+
+// Picks keys for reads and updates, keeping only those on the requested path
+class PathKeys {
+public:
+    PathKeys(KVDistributor& distributor, const BenchOptions& options, const WorkloadMix& mix)
+        : distributor(distributor),
+          chooser(options.distribution.empty() ? mix.distribution : options.distribution, options.records,
+                  options.theta),
+          path(options.path) {}
+
+    int next(std::mt19937& gen, int64_t count) {
+        int key = static_cast<int>(chooser.next(gen, count));
+        // Bounded so that a path with very few keys degrades to "any" rather than hanging
+        for (int tries = 0; path != "any" && tries < MAX_TRIES; ++tries) {
+            if (distributor.isLocal(key) == (path == "local")) {
+                break;
+            }
+            key = static_cast<int>(chooser.next(gen, count));
+        }
+        return key;
+    }
+
+    // Whether the path has any keys at all among the first ones drawn
+    bool reachable(std::mt19937& gen, int64_t count) {
+        for (int i = 0; i < MAX_TRIES; ++i) {
+            if (path == "any" || distributor.isLocal(static_cast<int>(chooser.next(gen, count))) == (path == "local")) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+private:
+    static constexpr int MAX_TRIES = 1000;
+
+    KVDistributor& distributor;
+    KeyChooser chooser;
+    std::string path;
+};
+
+// Runs the workload until end, recording only operations due after measure_from.
+// With a rate (total ops/s, shared evenly among all threads) each operation has an
+// intended send time on this thread's schedule: the thread sleeps until it and, if
+// it is already late, sends at once; latency runs from the intended time. Without
+// one the intended time is simply the moment the previous operation returned.
+// Inserted keys follow the loaded ones, interleaved by global thread index;
+// inserted counts this process's inserts, from which the total is estimated.
+void runThread(KVDistributor& distributor, const BenchOptions& options, const WorkloadMix& mix, int global_thread,
+               int total_threads, double rate, std::atomic<int64_t>& inserted, Clock::time_point start,
+               Clock::time_point measure_from, Clock::time_point end, BenchResult& result) {
+    std::mt19937 gen(global_thread + 1);
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+    std::uniform_int_distribution<int> scan_length(1, options.max_scan);
+    double thread_rate = rate / total_threads;
+    std::exponential_distribution<double> poisson_gap(thread_rate > 0 ? thread_rate : 1.0);
+    auto nextGap = [&] {
+        double seconds = options.arrival == "fixed" ? 1.0 / thread_rate : poisson_gap(gen);
+        return std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(seconds));
+    };
+    PathKeys keys(distributor, options, mix);
+    std::string value = randomValue(options.value_size, gen);
+    int64_t own_inserts = 0;
+    // Spread the threads' first sends over one mean gap instead of starting them together
+    Clock::time_point intended = start;
+    if (rate > 0) {
+        intended += std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(uniform(gen) / thread_rate));
+    }
+
+    while (true) {
+        if (rate > 0) {
+            if (intended >= end) {
+                break;
+            }
+            Clock::time_point now = Clock::now();
+            if (now >= end) {
+                // Out of time with sends still owed: count the ones the report would otherwise omit
+                for (; intended < end; intended += nextGap()) {
+                    result.missed += intended >= measure_from ? 1 : 0;
+                }
+                break;
+            }
+            if (intended > now) {
+                std::this_thread::sleep_until(intended);
+            }
+        } else {
+            intended = Clock::now();
+            if (intended >= end) {
+                break;
+            }
+        }
+        Clock::time_point sent = Clock::now();
+        BenchOp op = mix.pick(uniform(gen));
+        int64_t count = options.records + inserted.load(std::memory_order_relaxed) * options.processes;
+        KvStatus status = KvStatus::OK;
+        switch (op) {
+            case BenchOp::READ: {
+                std::string found;
+                status = distributor.get(keys.next(gen, count), found);
+                break;
+            }
+            case BenchOp::UPDATE:
+                status = distributor.update(keys.next(gen, count), value);
+                break;
+            case BenchOp::INSERT: {
+                int64_t key = options.records + own_inserts++ * total_threads + global_thread;
+                status = distributor.insert(static_cast<int>(key), value);
+                inserted.fetch_add(1, std::memory_order_relaxed);
+                break;
+            }
+            case BenchOp::SCAN: {
+                std::vector<std::pair<int, std::string>> items;
+                int64_t first = keys.next(gen, count);
+                status = distributor.scan(first, INT32_MAX, static_cast<std::size_t>(scan_length(gen)), items);
+                break;
+            }
+            case BenchOp::READ_MODIFY_WRITE: {
+                int key = keys.next(gen, count);
+                std::string found;
+                status = distributor.get(key, found);
+                if (status == KvStatus::OK) {
+                    status = distributor.update(key, value);
+                }
+                break;
+            }
+        }
+        Clock::time_point done = Clock::now();
+        if (intended >= measure_from) {
+            result.latency[static_cast<int>(op)].record(nanosBetween(intended, done));
+            result.service.record(nanosBetween(sent, done));
+            if (failed(status) || (op == BenchOp::INSERT && status != KvStatus::OK)) {
+                ++result.errors[static_cast<int>(op)];
+            }
+        }
+        if (rate > 0) {
+            intended += nextGap();
+        }
+    }
+}
+
+bool writeAll(int fd, const std::string& data) {
+    std::size_t offset = 0;
+    while (offset < data.size()) {
+        ssize_t written = write(fd, data.data() + offset, data.size() - offset);
+        if (written <= 0) {
+            return false;
+        }
+        offset += static_cast<std::size_t>(written);
+    }
+    return true;
+}
+
+// Child process: builds its client, runs its threads once per target rate (once
+// for load or a closed-loop run) and writes one merged result per run to report_fd
+int runProcess(const BenchOptions& options, int process_index, int report_fd) {
+    if (!options.verbose && !std::freopen("/dev/null", "w", stdout)) {
+        return 1;
+    }
+    std::vector<BenchResult> runs;
+    try {
+        Config config(options.config_path);
+        StorageMode mode = options.storage == "persistent" ? StorageMode::PERSISTENT : StorageMode::MEMORY;
+        KvStore& kv_store = KvStore::get_instance(config.read_size(), mode, ConnectionMode::CLIENT);
+        KVDistributor distributor(kv_store, config);
+        WorkloadMix mix = YcsbWorkload(options.workload);
+        if (options.phase == "run") {
+            std::mt19937 gen(process_index + 1);
+            if (!PathKeys(distributor, options, mix).reachable(gen, options.records)) {
+                std::cerr << "Process " << process_index << " found no " << options.path << " keys" << std::endl;
+                return 1;
+            }
+        }
+
+        int total_threads = options.threads * options.processes;
+        std::atomic<int64_t> inserted{0};
+        std::vector<double> rates = options.phase == "run" && !options.rates.empty() ? options.rates
+                                                                                     : std::vector<double>{0};
+        for (double rate : rates) {
+            std::vector<BenchResult> results(options.threads);
+            std::vector<std::thread> workers;
+            auto start = Clock::now();
+            auto measure_from = start + std::chrono::duration_cast<Clock::duration>(
+                                            std::chrono::duration<double>(options.warmup_sec));
+            auto end = measure_from + std::chrono::duration_cast<Clock::duration>(
+                                          std::chrono::duration<double>(options.duration_sec));
+            for (int t = 0; t < options.threads; ++t) {
+                int global_thread = process_index * options.threads + t;
+                workers.emplace_back([&, t, global_thread] {
+                    if (options.phase == "load") {
+                        loadThread(distributor, options, global_thread, total_threads, results[t]);
+                    } else {
+                        runThread(distributor, options, mix, global_thread, total_threads, rate, inserted, start,
+                                  measure_from, end, results[t]);
+                    }
+                });
+            }
+            for (std::thread& worker : workers) {
+                worker.join();
+            }
+            distributor.flush();
+            BenchResult merged;
+            for (const BenchResult& result : results) {
+                merged.merge(result);
+            }
+            merged.target_rate = rate;
+            merged.elapsed_sec = options.phase == "load"
+                                     ? std::chrono::duration<double>(Clock::now() - start).count()
+                                     : options.duration_sec;
+            runs.push_back(std::move(merged));
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Process " << process_index << " failed: " << e.what() << std::endl;
+        return 1;
+    }
+
+    std::string data;
+    kvwire::StringWriter writer(data);
+    uint32_t count = static_cast<uint32_t>(runs.size());
+    writer.write(&count);
+    for (const BenchResult& run : runs) {
+        run.save(writer);
+    }
+    bool ok = writeAll(report_fd, data);
+    close(report_fd);
+    return ok ? 0 : 1;
+}
+
+std::string readAll(int fd) {
+    std::string data;
+    char buffer[65536];
+    ssize_t n = 0;
+    while ((n = read(fd, buffer, sizeof(buffer))) > 0) {
+        data.append(buffer, static_cast<std::size_t>(n));
+    }
+    return data;
+}
+
+nlohmann::json operationJson(const KVHistogram& latency, uint64_t errors, double elapsed_sec) {
+    nlohmann::json op;
+    op["count"] = latency.count();
+    op["errors"] = errors;
+    op["throughput_ops_sec"] = elapsed_sec > 0 ? latency.count() / elapsed_sec : 0.0;
+    op["mean_us"] = latency.mean() / 1000.0;
+    op["p50_us"] = latency.valueAt(50) / 1000.0;
+    op["p99_us"] = latency.valueAt(99) / 1000.0;
+    op["p999_us"] = latency.valueAt(99.9) / 1000.0;
+    op["max_us"] = latency.max() / 1000.0;
+    return op;
+}
+
+KVHistogram totalLatency(const BenchResult& result, uint64_t& errors) {
+    KVHistogram all;
+    errors = 0;
+    for (int i = 0; i < BENCH_OP_COUNT; ++i) {
+        all.merge(result.latency[i]);
+        errors += result.errors[i];
+    }
+    return all;
+}
+
+void reportCsv(const BenchOptions& options, const std::vector<BenchResult>& runs, const std::string& distribution,
+               std::ostream& out) {
+    out << "phase,workload,distribution,path,arrival,records,value_size,threads,processes,target_ops_sec,"
+           "duration_sec,operation,count,errors,missed,throughput_ops_sec,mean_us,p50_us,p99_us,p999_us,max_us\n";
+    for (const BenchResult& result : runs) {
+        std::string arrival = result.target_rate > 0 ? options.arrival : "closed";
+        auto row = [&](const std::string& name, const KVHistogram& latency, uint64_t errors, uint64_t missed) {
+            nlohmann::json op = operationJson(latency, errors, result.elapsed_sec);
+            out << options.phase << "," << options.workload << "," << distribution << "," << options.path << ","
+                << arrival << "," << options.records << "," << options.value_size << "," << options.threads << ","
+                << options.processes << "," << result.target_rate << "," << result.elapsed_sec << "," << name << ","
+                << latency.count() << "," << errors << "," << missed << ","
+                << op["throughput_ops_sec"].get<double>() << "," << op["mean_us"].get<double>() << ","
+                << op["p50_us"].get<double>() << "," << op["p99_us"].get<double>() << ","
+                << op["p999_us"].get<double>() << "," << op["max_us"].get<double>() << "\n";
+        };
+        for (int i = 0; i < BENCH_OP_COUNT; ++i) {
+            if (result.latency[i].count() > 0) {
+                row(BenchOpName(static_cast<BenchOp>(i)), result.latency[i], result.errors[i], 0);
+            }
+        }
+        uint64_t all_errors = 0;
+        KVHistogram all = totalLatency(result, all_errors);
+        row("TOTAL", all, all_errors, result.missed);
+    }
+}
+
+nlohmann::json runJson(const BenchResult& result) {
+    nlohmann::json run;
+    uint64_t all_errors = 0;
+    KVHistogram all = totalLatency(result, all_errors);
+    run["target_ops_sec"] = result.target_rate;
+    run["duration_sec"] = result.elapsed_sec;
+    run["missed"] = result.missed;
+    run["total"] = operationJson(all, all_errors, result.elapsed_sec);
+    // Send to reply, without time spent behind schedule; equal to total for a closed loop
+    run["service"] = operationJson(result.service, 0, result.elapsed_sec);
+    nlohmann::json operations = nlohmann::json::object();
+    for (int i = 0; i < BENCH_OP_COUNT; ++i) {
+        if (result.latency[i].count() > 0) {
+            operations[BenchOpName(static_cast<BenchOp>(i))] = operationJson(result.latency[i], result.errors[i],
+                                                                              result.elapsed_sec);
+        }
+    }
+    run["operations"] = operations;
+    return run;
+}
+
+void report(const BenchOptions& options, const std::vector<BenchResult>& runs, std::ostream& out) {
+    std::string distribution = options.distribution.empty() ? YcsbWorkload(options.workload).distribution
+                                                            : options.distribution;
+    if (options.phase == "load") {
+        distribution = "sequential";
+    }
+    if (options.format == "csv") {
+        reportCsv(options, runs, distribution, out);
+        return;
+    }
+
+    nlohmann::json doc;
+    doc["phase"] = options.phase;
+    doc["workload"] = options.workload;
+    doc["distribution"] = distribution;
+    doc["theta"] = options.theta;
+    doc["path"] = options.path;
+    doc["arrival"] = options.phase == "run" && !options.rates.empty() ? options.arrival : "closed";
+    doc["records"] = options.records;
+    doc["value_size"] = options.value_size;
+    doc["threads"] = options.threads;
+    doc["processes"] = options.processes;
+    doc["warmup_sec"] = options.phase == "load" ? 0.0 : options.warmup_sec;
+    doc["config"] = options.config_path;
+    nlohmann::json list = nlohmann::json::array();
+    for (const BenchResult& result : runs) {
+        list.push_back(runJson(result));
+    }
+    doc["runs"] = list;
+    out << doc.dump(2) << std::endl;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    BenchOptions options;
+    try {
+        if (!parseOptions(argc, argv, options)) {
+            std::cerr << "Usage: " << argv[0] << " load|run [--config=path] [--storage=memory|persistent]\n"
+                      << "    [--workload=a..f] [--distribution=uniform|zipfian|latest] [--theta=0.99]\n"
+                      << "    [--records=N] [--value-size=bytes] [--max-scan=N] [--threads=N] [--processes=N]\n"
+                      << "    [--warmup=sec] [--duration=sec] [--rate=ops/s[,ops/s...]] [--arrival=fixed|poisson]\n"
+                      << "    [--path=any|local|remote] [--format=json|csv] [--output=path] [--verbose]"
+                      << std::endl;
+            return 1;
+        }
+        YcsbWorkload(options.workload);
+        KeyChooser check(options.distribution.empty() ? "uniform" : options.distribution, 1);
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+
+    // Children are forked before anything initializes Margo or attaches the store
+    std::vector<pid_t> children;
+    std::vector<int> pipes;
+    std::cout.flush();
+    for (int p = 0; p < options.processes; ++p) {
+        int fds[2];
+        if (pipe(fds) != 0) {
+            std::perror("pipe");
+            return 1;
+        }
+        pid_t pid = fork();
+        if (pid == 0) {
+            close(fds[0]);
+            for (int fd : pipes) {
+                close(fd);
+            }
+            _exit(runProcess(options, p, fds[1]));
+        }
+        close(fds[1]);
+        children.push_back(pid);
+        pipes.push_back(fds[0]);
+    }
+
+    // One result per run from every process, merged run by run
+    std::vector<BenchResult> runs;
+    bool ok = true;
+    for (int p = 0; p < options.processes; ++p) {
+        std::string data = readAll(pipes[p]);
+        close(pipes[p]);
+        int status = 0;
+        waitpid(children[p], &status, 0);
+        try {
+            kvwire::StringReader reader(data);
+            uint32_t count = 0;
+            reader.read(&count);
+            runs.resize(std::max<std::size_t>(runs.size(), count));
+            for (uint32_t i = 0; i < count; ++i) {
+                BenchResult result;
+                result.load(reader);
+                runs[i].merge(result);
+            }
+        } catch (const std::exception&) {
+            std::cerr << "Process " << p << " reported no result" << std::endl;
+            ok = false;
+        }
+    }
+    if (!ok) {
+        return 1;
+    }
+
+    if (options.output.empty()) {
+        report(options, runs, std::cout);
+    } else {
+        std::ofstream out(options.output);
+        if (!out) {
+            std::cerr << "Could not write " << options.output << std::endl;
+            return 1;
+        }
+        report(options, runs, out);
+    }
+    return 0;
+}
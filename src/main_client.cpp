@@ -1,6 +1,7 @@
 #include "KVClient.hpp"
 #include "KVStore.hpp"
 #include "KVDistributor.hpp"
+#include "KVWorkload.hpp"
 #include "config.hpp"
 #include <limits>
 #include <chrono>
@@ -12,9 +13,14 @@
 #include <iomanip>
 #include <thread>
 #include <numeric>
+#include <cmath>
+#include <unordered_map>
+#include <unordered_set>
+#include <atomic>
 #include <unistd.h>
 #include <algorithm>
 #include <cctype>
+#include <ctime>
 #include "config.hpp"
 
 // Helper function to parse command arguments
@@ -36,13 +42,200 @@ void printHelp() {
     std::cout << "  get <key>                - Get a value for a key" << std::endl;
     std::cout << "  update <key> <value>     - Update an existing key-value pair" << std::endl;
     std::cout << "  delete <key>             - Delete a key-value pair" << std::endl;
+    std::cout << "  incr <key> [delta]       - Atomically add delta (default 1) to an integer value" << std::endl;
+    std::cout << "  append <key> <value>     - Atomically append to a value" << std::endl;
+    std::cout << "  cas <key> <old> <new>    - Set to new only if the value is still old" << std::endl;
+    std::cout << "  getset <key> <value>     - Set a value and print the previous one" << std::endl;
+    std::cout << "  mget <key> [key...]      - Get several keys in one round trip per node" << std::endl;
+    std::cout << "  mput <key> <value> [...] - Store several key-value pairs in one round trip per node" << std::endl;
+    std::cout << "  scan <start> <end> [n]   - List keys in [start, end) in order, at most n" << std::endl;
+    std::cout << "  flush                    - Wait for buffered (write-behind) writes to be applied" << std::endl;
+    std::cout << "  membership               - Show the cluster map in use" << std::endl;
+    std::cout << "  membership refresh       - Fetch the latest cluster map from the local server" << std::endl;
+    std::cout << "  membership publish <cfg> - Publish the nodes in cfg as a new epoch, without moving data" << std::endl;
+    std::cout << "  rebalance <config.json>  - Move to the node list and placement in config.json" << std::endl;
+    std::cout << "  rebalance status         - Show progress of the running rebalance" << std::endl;
+    std::cout << "  rebalance finish         - Stop consulting previous owners (once all nodes are done)" << std::endl;
+    std::cout << "  ranges                   - Show the range table (range placement)" << std::endl;
+    std::cout << "  ranges check             - Split hot ranges and merge cold ones now" << std::endl;
+    std::cout << "  hotkeys [on|off]         - Show each server's most accessed keys; toggle hot-key caching" << std::endl;
+    std::cout << "  replication              - Show each node's backups and the replicas it holds" << std::endl;
+    std::cout << "  deadlines [hedge on|off] - Show RPC timeout and hedging counters; toggle hedged reads" << std::endl;
+    std::cout << "  backpressure             - Show overload rejections and reduced send windows" << std::endl;
+    std::cout << "  stats [prometheus]       - Show each server's latencies and counters (or dump them for Prometheus)" << std::endl;
+    std::cout << "  stats locks              - Show each server's store lock waits, holds and longest holds" << std::endl;
+    std::cout << "  memory                   - Show where each server's segment goes: buckets, nodes, values, overhead" << std::endl;
+    std::cout << "  trace [file]             - Write this client's and every server's spans as a Chrome trace" << std::endl;
+    std::cout << "  trace every <n>|clear    - Trace 1 request in n (0: off); drop all recorded spans" << std::endl;
     std::cout << "  benchmark                - To run with sequential fetch pattern" << std::endl;
     std::cout << "  benchmark1               - Run benchmark with random fetch pattern" << std::endl;
+    std::cout << "  benchmark_zipf [theta] [n] - Zipf reads without, then with hot-key caching" << std::endl;
+    std::cout << "  benchmark_hedge [n]      - Uniform reads without, then with hedged reads" << std::endl;
+    std::cout << "  benchmark_threads [max_threads] [n] [read%] - Throughput of 1, 2, 4, ... threads sharing this client" << std::endl;
     std::cout << "  help                     - Show this help message" << std::endl;
     std::cout << "  exit                     - Exit the program" << std::endl;
 }
 
 
+// Reports buffered writes that the owning server rejected or never received
+void printWriteFailures(const std::vector<WriteFailure>& failures) {
+    for (const WriteFailure& failure : failures) {
+        std::cout << "Buffered " << KvOpTypeName(failure.type) << " of key " << failure.key << " failed: "
+                  << (failure.error.empty() ? KvStatusName(failure.status) : failure.error.c_str()) << std::endl;
+    }
+}
+
+// Latency summary of one histogram (nanoseconds), or nothing if it is empty
+void printLatency(const std::string& name, const KVHistogram& h) {
+    if (h.count() == 0) {
+        return;
+    }
+    std::cout << "  " << std::left << std::setw(24) << name << std::right << std::setw(10) << h.count()
+              << std::fixed << std::setprecision(1)
+              << std::setw(10) << h.valueAt(50) / 1000.0 << std::setw(10) << h.valueAt(99) / 1000.0
+              << std::setw(10) << h.valueAt(99.9) / 1000.0 << std::setw(12) << h.max() / 1000.0 << std::endl;
+}
+
+// Every server's kv_stats report, as tables or in Prometheus text format
+void printStats(KVDistributor& distributor, bool prometheus) {
+    auto reports = distributor.clusterStats();
+    std::vector<int> nodes;
+    for (const auto& entry : reports) {
+        nodes.push_back(entry.first);
+    }
+    std::sort(nodes.begin(), nodes.end());
+    for (int node : nodes) {
+        const KvStatsReport& report = reports[node];
+        if (prometheus) {
+            std::cout << report.prometheus("node=\"" + std::to_string(node) + "\"");
+            continue;
+        }
+        std::cout << "Node " << node << ": up " << std::fixed << std::setprecision(0) << report.uptime_sec << " s, "
+                  << report.keys << " keys, " << std::setprecision(1) << report.memory_used / (1024.0 * 1024.0)
+                  << " of " << report.memory_total / (1024.0 * 1024.0) << " MB used" << std::endl;
+        std::cout << "  hits " << report.counter(KvCounter::HITS) << ", misses " << report.counter(KvCounter::MISSES)
+                  << ", errors " << report.counter(KvCounter::ERRORS) << ", bytes in "
+                  << report.counter(KvCounter::BYTES_IN) << ", out " << report.counter(KvCounter::BYTES_OUT)
+                  << ", redirects " << report.counter(KvCounter::REDIRECTS) << ", expired "
+                  << report.counter(KvCounter::EXPIRED) << ", rejected " << report.counter(KvCounter::REJECTED)
+                  << std::endl;
+        std::cout << "  " << std::left << std::setw(24) << "latency (us)" << std::right << std::setw(10) << "count"
+                  << std::setw(10) << "p50" << std::setw(10) << "p99" << std::setw(10) << "p99.9" << std::setw(12)
+                  << "max" << std::endl;
+        for (int i = 0; i < KV_RPC_COUNT; ++i) {
+            printLatency(KvRpcName(static_cast<KvRpc>(i)), report.rpc[i]);
+        }
+        for (int i = 0; i < KV_OP_TYPE_COUNT; ++i) {
+            printLatency(std::string("store ") + KvOpTypeName(static_cast<KvOpType>(i)), report.store[i]);
+        }
+    }
+}
+
+// Every server's store lock profile: waits and holds by operation, then the
+// longest holds seen since the server started
+void printLockStats(KVDistributor& distributor) {
+    auto reports = distributor.clusterStats();
+    std::vector<int> nodes;
+    for (const auto& entry : reports) {
+        nodes.push_back(entry.first);
+    }
+    std::sort(nodes.begin(), nodes.end());
+    for (int node : nodes) {
+        const StoreLockProfile& locks = reports[node].locks;
+        std::cout << "Node " << node << ": " << locks.acquisitions << " store lock acquisitions";
+        if (locks.sample_every == 0) {
+            std::cout << ", lock profiling is off" << std::endl;
+            continue;
+        }
+        std::cout << ", 1 in " << locks.sample_every << " timed" << std::endl;
+        std::cout << "  " << std::left << std::setw(24) << "lock wait (us)" << std::right << std::setw(10) << "count"
+                  << std::setw(10) << "p50" << std::setw(10) << "p99" << std::setw(10) << "p99.9" << std::setw(12)
+                  << "max" << std::endl;
+        for (int i = 0; i < STORE_LOCK_SITE_COUNT; ++i) {
+            printLatency(StoreLockSiteName(static_cast<StoreLockSite>(i)), locks.wait[i]);
+        }
+        std::cout << "  " << std::left << std::setw(24) << "lock hold (us)" << std::right << std::setw(10) << "count"
+                  << std::setw(10) << "p50" << std::setw(10) << "p99" << std::setw(10) << "p99.9" << std::setw(12)
+                  << "max" << std::endl;
+        for (int i = 0; i < STORE_LOCK_SITE_COUNT; ++i) {
+            printLatency(StoreLockSiteName(static_cast<StoreLockSite>(i)), locks.hold[i]);
+        }
+        if (locks.longest.empty()) {
+            continue;
+        }
+        std::cout << "  Longest holds:" << std::endl;
+        std::cout << "  " << std::right << std::setw(12) << "hold (us)" << std::setw(12) << "wait (us)" << "  "
+                  << std::left << std::setw(20) << "op" << std::right << std::setw(10) << "key" << std::setw(10)
+                  << "pid" << "  ended" << std::endl;
+        for (const StoreLockHold& hold : locks.longest) {
+            std::time_t ended = static_cast<std::time_t>(hold.at_us / 1000000);
+            std::cout << "  " << std::fixed << std::setprecision(1) << std::setw(12) << hold.hold_ns / 1000.0
+                      << std::setw(12) << hold.wait_ns / 1000.0 << "  " << std::left << std::setw(20)
+                      << StoreLockSiteName(static_cast<StoreLockSite>(hold.site)) << std::right << std::setw(10);
+            if (hold.key >= 0) {
+                std::cout << hold.key;
+            } else {
+                std::cout << "-";
+            }
+            std::cout << std::setw(10) << hold.pid << "  " << std::put_time(std::localtime(&ended), "%F %T")
+                      << std::endl;
+        }
+    }
+}
+
+// Every server's memory profile: segment bytes by category and per key, value sizes,
+// and how full the hash table's buckets are
+void printMemory(KVDistributor& distributor) {
+    auto profiles = distributor.clusterMemory();
+    std::vector<int> nodes;
+    for (const auto& entry : profiles) {
+        nodes.push_back(entry.first);
+    }
+    std::sort(nodes.begin(), nodes.end());
+    for (int node : nodes) {
+        const MemoryProfile& p = profiles[node];
+        std::cout << "Node " << node << ": " << p.keys << " keys, " << std::fixed << std::setprecision(1)
+                  << p.segment_used / (1024.0 * 1024.0) << " of " << p.segment_total / (1024.0 * 1024.0)
+                  << " MB used" << std::endl;
+        const std::pair<const char*, uint64_t> categories[] = {
+            {"hash buckets (est.)", p.bucket_bytes},     {"entry nodes (est.)", p.node_bytes},
+            {"value strings", p.value_heap_bytes},       {"allocator headers", p.allocator_overhead},
+            {"change log", p.change_log_bytes},          {"other", p.other_bytes}};
+        std::cout << "  " << std::left << std::setw(24) << "category" << std::right << std::setw(14) << "bytes"
+                  << std::setw(10) << "% used" << std::setw(12) << "per key" << std::endl;
+        for (const auto& category : categories) {
+            std::cout << "  " << std::left << std::setw(24) << category.first << std::right << std::setw(14)
+                      << category.second << std::setw(10)
+                      << (p.segment_used ? 100.0 * category.second / p.segment_used : 0.0) << std::setw(12)
+                      << (p.keys ? static_cast<double>(category.second) / p.keys : 0.0) << std::endl;
+        }
+        if (p.keys == 0) {
+            continue;
+        }
+        std::cout << "  " << std::setprecision(1) << static_cast<double>(p.segment_used) / p.keys
+                  << " bytes per key for " << static_cast<double>(p.value_payload_bytes) / p.keys
+                  << " bytes of value (" << (p.segment_used ? 100.0 * p.value_payload_bytes / p.segment_used : 0.0)
+                  << "% payload), " << p.inline_values << " values stored inline" << std::endl;
+        std::cout << "  value size (bytes): p50 " << p.value_sizes.valueAt(50) << ", p90 " << p.value_sizes.valueAt(90)
+                  << ", p99 " << p.value_sizes.valueAt(99) << ", max " << p.value_sizes.max() << std::endl;
+        std::cout << "  " << p.bucket_count << " buckets, load factor " << std::setprecision(2) << p.load_factor
+                  << " (max " << p.max_load_factor << "), grown " << p.table_growths << " times";
+        if (p.draining_keys > 0) {
+            std::cout << ", growing: " << p.draining_keys << " keys still to move";
+        }
+        std::cout << std::endl;
+        std::cout << "  chain length:";
+        for (std::size_t length = 0; length < p.chain_lengths.size(); ++length) {
+            if (p.chain_lengths[length] == 0) {
+                continue;
+            }
+            std::cout << "  " << length << (length + 1 == p.chain_lengths.size() ? "+" : "") << ": "
+                      << p.chain_lengths[length];
+        }
+        std::cout << std::endl;
+    }
+}
+
 // Add these function declarations after the printHelp() function and before main()
 
 // Function to generate a random string of specified length
@@ -60,19 +253,10 @@ std::string generateRandomString(int length) {
     return result;
 }
 
-// Helper function to determine if a key is local based on consistent hashing
-bool isKeyLocal(int key, int local_node_id, int total_nodes) {
-    // Simple modulo-based distribution (modify this based on your actual hash function)
-    int target_node = key % total_nodes;
-    return target_node == local_node_id;
-}
-
 // Benchmark function with sequential fetch pattern
 void benchmark(KVDistributor& distributor) {
     const int NUM_OPERATIONS = 10000;
     const int VALUE_SIZE = 3;
-    const int LOCAL_NODE_ID = 0; // From your config file
-    const int TOTAL_NODES = 2;   // From your config file
     
     std::cout << "\n=== BENCHMARK (Sequential Fetch Pattern) ===" << std::endl;
     std::cout << "Inserting " << NUM_OPERATIONS << " key-value pairs..." << std::endl;
@@ -104,7 +288,7 @@ void benchmark(KVDistributor& distributor) {
     for (int i = 1; i <= NUM_OPERATIONS; ++i) {
         try {
             // Check if key exists locally based on hash distribution
-            bool is_local = isKeyLocal(i, LOCAL_NODE_ID, TOTAL_NODES);
+            bool is_local = distributor.isLocal(i);
             
             auto start_single_fetch = std::chrono::high_resolution_clock::now();
             std::string value = distributor.get(i);
@@ -196,8 +380,6 @@ void benchmark(KVDistributor& distributor) {
 void benchmark1(KVDistributor& distributor) {
     const int NUM_OPERATIONS = 10000;
     const int VALUE_SIZE = 3;
-    const int LOCAL_NODE_ID = 0; // From your config file
-    const int TOTAL_NODES = 2;   // From your config file
     
     std::cout << "\n=== BENCHMARK1 (Random Fetch Pattern) ===" << std::endl;
     std::cout << "Inserting " << NUM_OPERATIONS << " key-value pairs..." << std::endl;
@@ -237,7 +419,7 @@ void benchmark1(KVDistributor& distributor) {
             int random_key = key_dist(gen);
             
             // Check if key exists locally based on hash distribution
-            bool is_local = isKeyLocal(random_key, LOCAL_NODE_ID, TOTAL_NODES);
+            bool is_local = distributor.isLocal(random_key);
             
             auto start_single_fetch = std::chrono::high_resolution_clock::now();
             std::string value = distributor.get(random_key);
@@ -326,6 +508,201 @@ void benchmark1(KVDistributor& distributor) {
 }
 
 
+double percentile(std::vector<double> sorted_times, double p) {
+    if (sorted_times.empty()) {
+        return 0.0;
+    }
+    std::size_t index = static_cast<std::size_t>(p * (sorted_times.size() - 1) + 0.5);
+    return sorted_times[std::min(index, sorted_times.size() - 1)];
+}
+
+// Zipf-distributed reads, first without and then with hot-key caching. The second
+// phase starts from the hot keys the servers saw during the first.
+void benchmarkZipf(KVDistributor& distributor, double theta, int operations) {
+    const int NUM_KEYS = 10000;
+    const int VALUE_SIZE = 3;
+
+    std::cout << "\n=== ZIPF BENCHMARK (theta " << theta << ", " << operations << " reads over "
+              << NUM_KEYS << " keys) ===" << std::endl;
+    std::vector<std::pair<int, std::string>> items;
+    for (int i = 1; i <= NUM_KEYS; ++i) {
+        items.emplace_back(i, generateRandomString(VALUE_SIZE));
+    }
+    distributor.multiInsert(items);
+
+    ZipfGenerator zipf(NUM_KEYS, theta);
+    std::mt19937 gen(42);
+    bool was_caching = distributor.hotKeyCaching();
+
+    auto runPhase = [&](const std::string& label) {
+        std::vector<double> fetch_times;
+        fetch_times.reserve(operations);
+        std::unordered_map<int, int> served_by;   // Reads that reached each remote node
+        uint64_t hits_before = distributor.cacheHits();
+        auto start = std::chrono::high_resolution_clock::now();
+        for (int i = 0; i < operations; ++i) {
+            int key = zipf.next(gen) + 1;
+            uint64_t hits = distributor.cacheHits();
+            auto start_single = std::chrono::high_resolution_clock::now();
+            std::string value;
+            distributor.get(key, value);
+            auto end_single = std::chrono::high_resolution_clock::now();
+            fetch_times.push_back(std::chrono::duration<double, std::milli>(end_single - start_single).count());
+            if (!distributor.isLocal(key) && distributor.cacheHits() == hits) {
+                ++served_by[distributor.ownerOf(key)];
+            }
+        }
+        auto end = std::chrono::high_resolution_clock::now();
+        double total_ms = std::chrono::duration<double, std::milli>(end - start).count();
+
+        std::sort(fetch_times.begin(), fetch_times.end());
+        int busiest = 0;
+        int remote = 0;
+        for (const auto& entry : served_by) {
+            busiest = std::max(busiest, entry.second);
+            remote += entry.second;
+        }
+        std::cout << "--- " << label << " ---" << std::endl;
+        std::cout << std::fixed << std::setprecision(4);
+        std::cout << "Throughput: " << operations / (total_ms / 1000.0) << " ops/s" << std::endl;
+        std::cout << "Latency p50: " << percentile(fetch_times, 0.50) << " ms, p99: " << percentile(fetch_times, 0.99)
+                  << " ms, p99.9: " << percentile(fetch_times, 0.999) << " ms, max: " << fetch_times.back() << " ms"
+                  << std::endl;
+        std::cout << "Served from client cache: " << distributor.cacheHits() - hits_before << std::endl;
+        std::cout << "Reads sent to remote owners: " << remote << ", busiest node took "
+                  << (remote > 0 ? 100.0 * busiest / remote : 0.0) << "%" << std::endl;
+    };
+
+    distributor.setHotKeyCaching(false);
+    runPhase("Without hot-key caching");
+    distributor.refreshHotKeys();
+    std::cout << "Hot keys detected: " << distributor.getHotKeys().size() << std::endl;
+    distributor.setHotKeyCaching(true);
+    runPhase("With hot-key caching");
+    distributor.setHotKeyCaching(was_caching);
+}
+
+// Uniform reads over keys spread across the cluster, without and then with hedged
+// reads; the tail percentiles show what hedging buys against slow nodes
+void benchmarkHedge(KVDistributor& distributor, int operations) {
+    const int NUM_KEYS = 10000;
+    const int VALUE_SIZE = 3;
+
+    std::cout << "\n=== HEDGED READ BENCHMARK (" << operations << " reads over " << NUM_KEYS << " keys) ===" << std::endl;
+    std::vector<std::pair<int, std::string>> items;
+    for (int i = 1; i <= NUM_KEYS; ++i) {
+        items.emplace_back(i, generateRandomString(VALUE_SIZE));
+    }
+    distributor.multiInsert(items);
+
+    std::mt19937 gen(42);
+    std::uniform_int_distribution<int> keys(1, NUM_KEYS);
+    bool was_hedging = distributor.hedgingEnabled();
+
+    auto runPhase = [&](const std::string& label) {
+        std::vector<double> fetch_times;
+        fetch_times.reserve(operations);
+        uint64_t sent_before = distributor.hedgesSent();
+        uint64_t won_before = distributor.hedgesWon();
+        uint64_t exceeded_before = distributor.deadlinesExceeded();
+        auto start = std::chrono::high_resolution_clock::now();
+        for (int i = 0; i < operations; ++i) {
+            int key = keys(gen);
+            auto start_single = std::chrono::high_resolution_clock::now();
+            std::string value;
+            distributor.get(key, value);
+            auto end_single = std::chrono::high_resolution_clock::now();
+            fetch_times.push_back(std::chrono::duration<double, std::milli>(end_single - start_single).count());
+        }
+        auto end = std::chrono::high_resolution_clock::now();
+        double total_ms = std::chrono::duration<double, std::milli>(end - start).count();
+
+        std::sort(fetch_times.begin(), fetch_times.end());
+        std::cout << "--- " << label << " ---" << std::endl;
+        std::cout << std::fixed << std::setprecision(4);
+        std::cout << "Throughput: " << operations / (total_ms / 1000.0) << " ops/s" << std::endl;
+        std::cout << "Latency p50: " << percentile(fetch_times, 0.50) << " ms, p99: " << percentile(fetch_times, 0.99)
+                  << " ms, p99.9: " << percentile(fetch_times, 0.999) << " ms, max: " << fetch_times.back() << " ms"
+                  << std::endl;
+        std::cout << "Hedges sent: " << distributor.hedgesSent() - sent_before << ", won: "
+                  << distributor.hedgesWon() - won_before << ", deadlines exceeded: "
+                  << distributor.deadlinesExceeded() - exceeded_before << std::endl;
+    };
+
+    distributor.setHedging(false);
+    runPhase("Without hedging");
+    distributor.setHedging(true);
+    std::cout << "Hedge delay: " << distributor.hedgeDelayMs() << " ms" << std::endl;
+    runPhase("With hedging");
+    distributor.setHedging(was_hedging);
+}
+
+// One distributor shared by 1, 2, 4, ... max_threads worker threads. The same
+// number of operations (read_percent reads, the rest updates, on uniform random
+// keys) is split among the threads of each round, so ideal scaling halves the time.
+void benchmarkThreads(KVDistributor& distributor, int max_threads, int operations, int read_percent) {
+    const int NUM_KEYS = 10000;
+    const int VALUE_SIZE = 3;
+
+    std::cout << "\n=== MULTI-THREADED BENCHMARK (" << operations << " ops per round, " << read_percent
+              << "% reads, " << NUM_KEYS << " keys) ===" << std::endl;
+    std::vector<std::pair<int, std::string>> items;
+    for (int i = 1; i <= NUM_KEYS; ++i) {
+        items.emplace_back(i, generateRandomString(VALUE_SIZE));
+    }
+    distributor.multiInsert(items);
+
+    struct Round {
+        int threads;
+        double ops_per_sec;
+        int errors;
+    };
+    std::vector<Round> rounds;
+    for (int threads = 1;; threads = std::min(threads * 2, max_threads)) {
+        int per_thread = operations / threads;
+        std::atomic<int> errors{0};
+        std::vector<std::thread> workers;
+        auto start = std::chrono::high_resolution_clock::now();
+        for (int t = 0; t < threads; ++t) {
+            workers.emplace_back([&, t] {
+                std::mt19937 gen(t + 1);
+                std::uniform_int_distribution<int> keys(1, NUM_KEYS);
+                std::uniform_int_distribution<int> percent(0, 99);
+                std::string value = generateRandomString(VALUE_SIZE);
+                for (int i = 0; i < per_thread; ++i) {
+                    int key = keys(gen);
+                    KvStatus status;
+                    if (percent(gen) < read_percent) {
+                        std::string found;
+                        status = distributor.get(key, found);
+                    } else {
+                        status = distributor.update(key, value);
+                    }
+                    if (status != KvStatus::OK && status != KvStatus::NOT_FOUND) {
+                        ++errors;
+                    }
+                }
+            });
+        }
+        for (std::thread& worker : workers) {
+            worker.join();
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+        rounds.push_back({threads, per_thread * threads / seconds, errors.load()});
+        if (threads == max_threads) {
+            break;
+        }
+    }
+
+    std::cout << "\n--- THROUGHPUT BY THREADS ---" << std::endl;
+    std::cout << std::fixed << std::setprecision(1);
+    for (const Round& round : rounds) {
+        std::cout << std::setw(4) << round.threads << " threads: " << std::setw(12) << round.ops_per_sec
+                  << " ops/s, speedup " << std::setprecision(2) << round.ops_per_sec / rounds.front().ops_per_sec
+                  << "x, errors " << round.errors << std::setprecision(1) << std::endl;
+    }
+    distributor.flush();
+}
 
 int main(int argc, char** argv) {
     std::cout << "\nModulo-based Key-Value Store CLIENT" << std::endl;
@@ -346,8 +723,11 @@ int main(int argc, char** argv) {
         storage_mode = StorageMode::MEMORY;
     }
     
-    Config config = Config("../config/config.json");
+    // A config path may be given, e.g. one per server when several share a host
+    Config config = Config(argc >= 2 ? argv[1] : "../config/config.json");
     size_t mem_size = config.read_size();
+    TracingConfig tracing = config.read_tracing_config();
+    ConfigureTracing(tracing.sample_every, tracing.buffer_spans);
     
     try {
         // CLIENT mode - connect to existing storage instead of creating new
@@ -372,6 +752,7 @@ int main(int argc, char** argv) {
             std::string action = args[0];
             
             if (action == "exit") {
+                printWriteFailures(distributor.flush());
                 break;
             } else if (action == "help") {
                 printHelp();
@@ -382,8 +763,8 @@ int main(int argc, char** argv) {
                     for (size_t i = 3; i < args.size(); i++) {
                         value += " " + args[i];
                     }
-                    distributor.insert(key, value);
-                    std::cout << "Put operation completed successfully" << std::endl;
+                    KvStatus status = distributor.insert(key, value);
+                    std::cout << "Put operation completed: " << KvStatusName(status) << std::endl;
                 } catch (const std::exception& e) {
                     std::cout << "Error: " << e.what() << std::endl;
                 }
@@ -402,20 +783,174 @@ int main(int argc, char** argv) {
                     for (size_t i = 3; i < args.size(); i++) {
                         value += " " + args[i];
                     }
-                    distributor.update(key, value);
-                    std::cout << "Update operation completed successfully" << std::endl;
+                    KvStatus status = distributor.update(key, value);
+                    std::cout << "Update operation completed: " << KvStatusName(status) << std::endl;
                 } catch (const std::exception& e) {
                     std::cout << "Error: " << e.what() << std::endl;
                 }
             } else if (action == "delete" && args.size() >= 2) {
                 try {
                     int key = std::stoi(args[1]);
-                    distributor.deleteKey(key);
-                    std::cout << "Delete operation completed successfully" << std::endl;
+                    KvStatus status = distributor.deleteKey(key);
+                    std::cout << "Delete operation completed: " << KvStatusName(status) << std::endl;
+                } catch (const std::exception& e) {
+                    std::cout << "Error: " << e.what() << std::endl;
+                }
+            } else if (action == "incr" && args.size() >= 2) {
+                try {
+                    int key = std::stoi(args[1]);
+                    int64_t delta = args.size() >= 3 ? std::stoll(args[2]) : 1;
+                    int64_t result = 0;
+                    KvStatus status = distributor.increment(key, delta, result);
+                    if (status == KvStatus::OK) {
+                        std::cout << "Value: " << result << std::endl;
+                    } else {
+                        std::cout << "Increment failed: " << KvStatusName(status) << std::endl;
+                    }
+                } catch (const std::exception& e) {
+                    std::cout << "Error: " << e.what() << std::endl;
+                }
+            } else if (action == "append" && args.size() >= 3) {
+                try {
+                    int key = std::stoi(args[1]);
+                    KvStatus status = distributor.append(key, args[2]);
+                    std::cout << "Append operation completed: " << KvStatusName(status) << std::endl;
+                } catch (const std::exception& e) {
+                    std::cout << "Error: " << e.what() << std::endl;
+                }
+            } else if (action == "cas" && args.size() >= 4) {
+                try {
+                    int key = std::stoi(args[1]);
+                    std::string current;
+                    KvStatus status = distributor.compareAndSwap(key, args[2], args[3], &current);
+                    std::cout << "Compare-and-swap completed: " << KvStatusName(status) << std::endl;
+                    if (status == KvStatus::CONFLICT) {
+                        std::cout << "Current value: " << current << std::endl;
+                    }
+                } catch (const std::exception& e) {
+                    std::cout << "Error: " << e.what() << std::endl;
+                }
+            } else if (action == "getset" && args.size() >= 3) {
+                try {
+                    int key = std::stoi(args[1]);
+                    std::string old_value;
+                    KvStatus status = distributor.getAndSet(key, args[2], old_value);
+                    if (status == KvStatus::OK) {
+                        std::cout << "Previous value: " << old_value << std::endl;
+                    } else {
+                        std::cout << "Get-and-set failed: " << KvStatusName(status) << std::endl;
+                    }
+                } catch (const std::exception& e) {
+                    std::cout << "Error: " << e.what() << std::endl;
+                }
+            } else if (action == "mget" && args.size() >= 2) {
+                try {
+                    std::vector<int> keys;
+                    for (size_t i = 1; i < args.size(); i++) {
+                        keys.push_back(std::stoi(args[i]));
+                    }
+                    std::vector<KvReply> replies = distributor.multiGet(keys);
+                    for (size_t i = 0; i < keys.size(); i++) {
+                        std::cout << keys[i] << " -> "
+                                  << (replies[i].ok() ? replies[i].value : KvStatusName(replies[i].status)) << std::endl;
+                    }
+                } catch (const std::exception& e) {
+                    std::cout << "Error: " << e.what() << std::endl;
+                }
+            } else if (action == "mput" && args.size() >= 3 && args.size() % 2 == 1) {
+                try {
+                    std::vector<std::pair<int, std::string>> items;
+                    for (size_t i = 1; i + 1 < args.size(); i += 2) {
+                        items.emplace_back(std::stoi(args[i]), args[i + 1]);
+                    }
+                    std::vector<KvStatus> statuses = distributor.multiInsert(items);
+                    for (size_t i = 0; i < items.size(); i++) {
+                        std::cout << items[i].first << ": " << KvStatusName(statuses[i]) << std::endl;
+                    }
                 } catch (const std::exception& e) {
                     std::cout << "Error: " << e.what() << std::endl;
                 }
-            }else if (action == "benchmark") {
+            } else if (action == "flush") {
+                std::vector<WriteFailure> failures = distributor.flush();
+                printWriteFailures(failures);
+                std::cout << "Flush completed, " << failures.size() << " failed write(s)" << std::endl;
+            } else if (action == "membership") {
+                if (args.size() >= 2 && args[1] == "refresh") {
+                    distributor.refreshMembership();
+                } else if (args.size() >= 3 && args[1] == "publish") {
+                    try {
+                        Config target(args[2]);
+                        distributor.publishMembership(target);
+                    } catch (const std::exception& e) {
+                        std::cout << "Error: " << e.what() << std::endl;
+                    }
+                }
+                const ClusterMap& map = distributor.getClusterMap();
+                std::cout << "Epoch " << map.epoch << (map.epoch == 0 ? " (local config)" : "")
+                          << (map.migrating ? ", rebalancing" : "") << ", " << map.current.strategy
+                          << " placement:" << std::endl;
+                for (const MemberNode& node : map.current.nodes) {
+                    std::cout << "  node " << node.node_id << "  " << node.endpoint << "  weight " << node.weight << std::endl;
+                }
+            } else if (action == "rebalance" && args.size() >= 2) {
+                if (args[1] == "status") {
+                    RebalanceStats stats = distributor.rebalanceStatus();
+                    std::cout << "Rebalance " << (stats.running ? "running" : "idle") << ": pass " << stats.passes
+                              << ", " << stats.scanned << " scanned, " << stats.moved << " moved, "
+                              << stats.superseded << " superseded, " << stats.raced << " raced, "
+                              << stats.failed << " failed" << std::endl;
+                } else if (args[1] == "finish") {
+                    if (!distributor.finishRebalance()) {
+                        std::cout << "No rebalance in progress" << std::endl;
+                    }
+                } else {
+                    try {
+                        Config target(args[1]);
+                        distributor.startRebalance(target);
+                    } catch (const std::exception& e) {
+                        std::cout << "Error: " << e.what() << std::endl;
+                    }
+                }
+            } else if (action == "scan" && args.size() >= 3) {
+                try {
+                    int64_t start = std::stoll(args[1]);
+                    int64_t end = std::stoll(args[2]);
+                    std::size_t limit = args.size() >= 4 ? std::stoul(args[3]) : 0;
+                    std::vector<std::pair<int, std::string>> items;
+                    KvStatus status = distributor.scan(start, end, limit, items);
+                    for (const auto& item : items) {
+                        std::cout << item.first << " = " << item.second << std::endl;
+                    }
+                    std::cout << items.size() << " key(s)";
+                    if (status != KvStatus::OK) {
+                        std::cout << ", incomplete: " << KvStatusName(status);
+                    }
+                    std::cout << std::endl;
+                } catch (const std::exception& e) {
+                    std::cout << "Error: " << e.what() << std::endl;
+                }
+            } else if (action == "ranges") {
+                if (args.size() >= 2 && args[1] == "check") {
+                    distributor.rebalanceRanges();
+                }
+                const ClusterMap& map = distributor.getClusterMap();
+                if (map.current.strategy != "range") {
+                    std::cout << "Placement is " << map.current.strategy << ", not range" << std::endl;
+                } else {
+                    std::cout << "Epoch " << map.epoch << (map.migrating ? ", moving" : "") << ", "
+                              << map.current.ranges.size() << " ranges:" << std::endl;
+                    for (std::size_t i = 0; i < map.current.ranges.size(); ++i) {
+                        const KeyRange& range = map.current.ranges[i];
+                        std::cout << "  [" << range.start << ", ";
+                        if (i + 1 < map.current.ranges.size()) {
+                            std::cout << map.current.ranges[i + 1].start;
+                        } else {
+                            std::cout << "max";
+                        }
+                        std::cout << ")  node " << range.node_id << std::endl;
+                    }
+                }
+            } else if (action == "benchmark") {
                 std::cout << "Starting sequential benchmark..." << std::endl;
                 try {
                     benchmark(distributor);
@@ -429,6 +964,120 @@ int main(int argc, char** argv) {
                 } catch (const std::exception& e) {
                     std::cout << "Benchmark1 error: " << e.what() << std::endl;
                 }
+            } else if (action == "benchmark_zipf") {
+                try {
+                    double theta = args.size() >= 2 ? std::stod(args[1]) : 0.99;
+                    int operations = args.size() >= 3 ? std::stoi(args[2]) : 100000;
+                    benchmarkZipf(distributor, theta, operations);
+                } catch (const std::exception& e) {
+                    std::cout << "Zipf benchmark error: " << e.what() << std::endl;
+                }
+            } else if (action == "hotkeys") {
+                if (args.size() >= 2 && (args[1] == "on" || args[1] == "off")) {
+                    distributor.setHotKeyCaching(args[1] == "on");
+                }
+                distributor.refreshHotKeys();
+                std::unordered_set<int> hot_keys = distributor.getHotKeys();
+                for (const auto& entry : distributor.getHotKeyReports()) {
+                    std::cout << "Node " << entry.first << ": " << entry.second.total << " accesses" << std::endl;
+                    for (const HotKey& key : entry.second.keys) {
+                        std::cout << "  key " << key.key << "  " << key.count << " (+/- " << key.error << ")"
+                                  << (hot_keys.count(key.key) ? "  hot" : "") << std::endl;
+                    }
+                }
+                std::cout << hot_keys.size() << " hot keys, caching "
+                          << (distributor.hotKeyCaching() ? "on" : "off") << std::endl;
+            } else if (action == "benchmark_hedge") {
+                try {
+                    int operations = args.size() >= 2 ? std::stoi(args[1]) : 100000;
+                    benchmarkHedge(distributor, operations);
+                } catch (const std::exception& e) {
+                    std::cout << "Hedge benchmark error: " << e.what() << std::endl;
+                }
+            } else if (action == "benchmark_threads") {
+                try {
+                    int max_threads = args.size() >= 2 ? std::stoi(args[1])
+                                                       : static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+                    int operations = args.size() >= 3 ? std::stoi(args[2]) : 100000;
+                    int read_percent = args.size() >= 4 ? std::stoi(args[3]) : 90;
+                    if (max_threads < 1 || operations < max_threads) {
+                        std::cout << "Usage: benchmark_threads [max_threads] [ops >= max_threads] [read%]" << std::endl;
+                    } else {
+                        if (!config.read_progress_config().dedicated_thread) {
+                            std::cout << "Note: progress.dedicated_thread is off, so nothing drives the network "
+                                      << "while this thread waits for the workers; remote requests will time out" << std::endl;
+                        }
+                        benchmarkThreads(distributor, max_threads, operations, read_percent);
+                    }
+                } catch (const std::exception& e) {
+                    std::cout << "Threads benchmark error: " << e.what() << std::endl;
+                }
+            } else if (action == "deadlines") {
+                if (args.size() >= 3 && args[1] == "hedge" && (args[2] == "on" || args[2] == "off")) {
+                    distributor.setHedging(args[2] == "on");
+                }
+                std::cout << "RPC timeout: " << distributor.timeoutMs() << " ms" << std::endl;
+                std::cout << "Hedged reads: " << (distributor.hedgingEnabled() ? "on" : "off")
+                          << ", delay " << distributor.hedgeDelayMs() << " ms" << std::endl;
+                std::cout << "Hedges sent: " << distributor.hedgesSent() << ", won: " << distributor.hedgesWon()
+                          << ", deadlines exceeded: " << distributor.deadlinesExceeded() << std::endl;
+            } else if (action == "backpressure") {
+                std::cout << "Requests rejected as overloaded: " << distributor.overloadRejections() << std::endl;
+                auto windows = distributor.reducedWindows();
+                if (windows.empty()) {
+                    std::cout << "Every server accepts a full window" << std::endl;
+                }
+                for (const auto& entry : windows) {
+                    std::cout << "  " << entry.first << ": window " << entry.second << " ops" << std::endl;
+                }
+            } else if (action == "stats" && args.size() >= 2 && args[1] == "locks") {
+                printLockStats(distributor);
+            } else if (action == "stats") {
+                printStats(distributor, args.size() >= 2 && args[1] == "prometheus");
+            } else if (action == "trace" && args.size() >= 3 && args[1] == "every") {
+                ConfigureTracing(static_cast<uint32_t>(std::stoul(args[2])), tracing.buffer_spans);
+                std::cout << "Tracing " << (TracingSampleEvery() ? "1 request in " + args[2] : std::string("off"))
+                          << std::endl;
+            } else if (action == "trace" && args.size() >= 2 && args[1] == "clear") {
+                distributor.clusterTrace(true);
+                ClearTraces();
+                std::cout << "Dropped all recorded spans" << std::endl;
+            } else if (action == "trace") {
+                std::string path = args.size() >= 2 ? args[1] : tracing.file;
+                std::vector<std::string> event_lists = {TraceEventsJson("kvm_client " + std::to_string(getpid()))};
+                auto traces = distributor.clusterTrace(false);
+                for (auto& entry : traces) {
+                    event_lists.push_back(std::move(entry.second));
+                }
+                if (WriteChromeTrace(path, event_lists)) {
+                    std::cout << "Wrote spans of this client and " << traces.size() << " server(s) to " << path
+                              << " (open it in Perfetto or chrome://tracing)" << std::endl;
+                } else {
+                    std::cout << "Could not write " << path << std::endl;
+                }
+            } else if (action == "memory") {
+                printMemory(distributor);
+            } else if (action == "replication") {
+                const PlacementSpec& spec = distributor.getClusterMap().current;
+                std::cout << "Replicas: " << spec.replicas << ", writes acknowledged by "
+                          << (spec.wait_for_backups ? "every backup" : "the primary") << std::endl;
+                for (const auto& entry : distributor.replicationStatus()) {
+                    std::cout << "Node " << entry.first << " (change " << entry.second.current << ")" << std::endl;
+                    for (const ReplicationStatus::Backup& backup : entry.second.backups) {
+                        std::cout << "  backup " << backup.node_id << ": acked " << backup.acked
+                                  << (backup.syncing ? ", copying" : "")
+                                  << (backup.reachable ? "" : ", unreachable") << std::endl;
+                    }
+                    for (const ReplicationStatus::Source& source : entry.second.sources) {
+                        std::cout << "  replica of " << source.primary << ": " << source.keys << " keys through change "
+                                  << source.through << ", ";
+                        if (source.lag_ms < 0) {
+                            std::cout << "not caught up yet" << std::endl;
+                        } else {
+                            std::cout << source.lag_ms << " ms since caught up" << std::endl;
+                        }
+                    }
+                }
             }  else {
                 std::cout << "Unknown command. Type 'help' for available commands." << std::endl;
             }
@@ -0,0 +1,378 @@
+#include "KVStore.hpp"
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <future>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+// Bulk import of key-value records into a store, without going through Insert one
+// key at a time. The input is read through mmap a block at a time; the records of
+// a block are parsed by several threads while the previous block is being written,
+// and each batch of records is written under one hold of the store lock
+// (KvStore::BulkLoad).
+//
+// Offline (the default) the tool creates the store itself, presized for every
+// record in the input, and leaves it behind for a server to open. Only persistent
+// stores can be built this way: a server recreates its shared memory segment when
+// it starts. With --attach it writes into the store of a server running on this
+// host instead, in either mode; batches keep each lock hold short, so the server
+// goes on serving meanwhile.
+//
+// Formats, in any key order (a key that repeats keeps its last value):
+//   csv     one "key,value" per line; the value is the rest of the line
+//   binary  records of int32 key, uint32 value length, value bytes (host order)
+//
+// Store names come from KVM_INSTANCE and the persistent file is relative to the
+// working directory, so run it as the server is run.
+//
+// Usage: kvm_import <file> [--format=csv|binary] [--mode=memory|persistent] [--attach]
+//            [--size-mb=N] [--expected-keys=N] [--threads=N] [--batch=N] [--block-mb=N]
+
+namespace {
+
+using Entries = std::vector<std::pair<int, std::string>>;
+
+struct ImportOptions {
+    std::string path;
+    std::string format = "csv";
+    StorageMode mode = StorageMode::PERSISTENT;
+    bool attach = false;
+    int64_t size_mb = 0;         // 0: sized from the input
+    int64_t expected_keys = 0;   // 0: counted from the input
+    int64_t threads = 0;         // 0: one per core
+    int64_t batch = 65536;       // Records per hold of the store lock
+    int64_t block_mb = 64;       // Input parsed per step
+};
+
+// One block of input, parsed: a list of records per thread, in input order
+struct ParsedBlock {
+    std::vector<Entries> parts;
+    uint64_t records = 0;
+    uint64_t malformed = 0;
+};
+
+bool parseOptions(int argc, char* argv[], ImportOptions& options) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--attach") {
+            options.attach = true;
+            continue;
+        }
+        if (arg.rfind("--", 0) != 0) {
+            if (!options.path.empty()) {
+                std::cerr << "More than one input file: " << arg << std::endl;
+                return false;
+            }
+            options.path = arg;
+            continue;
+        }
+        std::size_t eq = arg.find('=');
+        if (eq == std::string::npos) {
+            std::cerr << "Unrecognized argument: " << arg << std::endl;
+            return false;
+        }
+        std::string name = arg.substr(2, eq - 2);
+        std::string value = arg.substr(eq + 1);
+        if (name == "format") {
+            options.format = value;
+        } else if (name == "mode") {
+            if (value != "memory" && value != "persistent") {
+                std::cerr << "Unknown mode: " << value << std::endl;
+                return false;
+            }
+            options.mode = value == "memory" ? StorageMode::MEMORY : StorageMode::PERSISTENT;
+        } else if (name == "size-mb") {
+            options.size_mb = std::stoll(value);
+        } else if (name == "expected-keys") {
+            options.expected_keys = std::stoll(value);
+        } else if (name == "threads") {
+            options.threads = std::stoll(value);
+        } else if (name == "batch") {
+            options.batch = std::stoll(value);
+        } else if (name == "block-mb") {
+            options.block_mb = std::stoll(value);
+        } else {
+            std::cerr << "Unknown option: --" << name << std::endl;
+            return false;
+        }
+    }
+    if (options.path.empty() || (options.format != "csv" && options.format != "binary") || options.size_mb < 0 ||
+        options.expected_keys < 0 || options.threads < 0 || options.batch < 1 || options.block_mb < 1) {
+        std::cerr << "Invalid option value" << std::endl;
+        return false;
+    }
+    if (!options.attach && options.mode == StorageMode::MEMORY) {
+        std::cerr << "A memory store can only be imported into with --attach (a server recreates its segment "
+                     "when it starts)" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Reads one CSV record from [p, end); false for a line that is not "key,value"
+bool parseCsvLine(const char* p, const char* end, Entries& out) {
+    if (end > p && end[-1] == '\r') {
+        --end;
+    }
+    const char* comma = static_cast<const char*>(std::memchr(p, ',', end - p));
+    if (!comma) {
+        return false;
+    }
+    int key = 0;
+    auto [key_end, ec] = std::from_chars(p, comma, key);
+    if (ec != std::errc() || key_end != comma) {
+        return false;
+    }
+    out.emplace_back(key, std::string(comma + 1, end));
+    return true;
+}
+
+// Parses the whole lines in [begin, end); empty lines are skipped
+void parseCsvRange(const char* begin, const char* end, Entries& out, uint64_t& malformed) {
+    const char* p = begin;
+    while (p < end) {
+        const char* nl = static_cast<const char*>(std::memchr(p, '\n', end - p));
+        const char* line_end = nl ? nl : end;
+        if (line_end > p && !(line_end - p == 1 && *p == '\r') && !parseCsvLine(p, line_end, out)) {
+            ++malformed;
+        }
+        p = line_end + 1;
+    }
+}
+
+// Splits a block of whole lines between threads at line boundaries
+ParsedBlock parseCsvBlock(const char* begin, const char* end, int threads) {
+    ParsedBlock block;
+    block.parts.resize(threads);
+    std::vector<uint64_t> malformed(threads, 0);
+    std::vector<std::thread> workers;
+    const char* start = begin;
+    std::size_t slice = static_cast<std::size_t>(end - begin) / threads + 1;
+    for (int t = 0; t < threads && start < end; ++t) {
+        const char* stop = end;
+        if (t + 1 < threads && static_cast<std::size_t>(end - start) > slice) {
+            const char* nl = static_cast<const char*>(std::memchr(start + slice, '\n', end - start - slice));
+            stop = nl ? nl + 1 : end;
+        }
+        workers.emplace_back([&block, &malformed, t, start, stop] {
+            parseCsvRange(start, stop, block.parts[t], malformed[t]);
+        });
+        start = stop;
+    }
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+    for (int t = 0; t < threads; ++t) {
+        block.records += block.parts[t].size();
+        block.malformed += malformed[t];
+    }
+    return block;
+}
+
+// Binary records are only found by walking their headers, so a block is parsed by
+// one thread; it still overlaps with writing the previous block
+ParsedBlock parseBinaryBlock(const char* begin, const char* end) {
+    ParsedBlock block;
+    block.parts.resize(1);
+    Entries& out = block.parts[0];
+    const char* p = begin;
+    while (p < end) {
+        int32_t key = 0;
+        uint32_t size = 0;
+        std::memcpy(&key, p, sizeof(key));
+        std::memcpy(&size, p + sizeof(key), sizeof(size));
+        p += sizeof(key) + sizeof(size);
+        out.emplace_back(key, std::string(p, size));
+        p += size;
+    }
+    block.records = out.size();
+    return block;
+}
+
+// End of the last whole record that starts in [begin, begin + max) of [begin, end);
+// end itself if the rest of the input fits. For binary input, a truncated record
+// at the end of the file is dropped and reported through truncated.
+const char* blockEnd(const ImportOptions& options, const char* begin, const char* end, std::size_t max,
+                     bool& truncated) {
+    if (options.format == "csv") {
+        if (static_cast<std::size_t>(end - begin) <= max) {
+            return end;
+        }
+        const char* nl = static_cast<const char*>(std::memchr(begin + max, '\n', end - begin - max));
+        return nl ? nl + 1 : end;
+    }
+    const char* p = begin;
+    while (end - p >= 8) {
+        uint32_t size = 0;
+        std::memcpy(&size, p + 4, sizeof(size));
+        if (static_cast<std::size_t>(end - p - 8) < size) {
+            break;
+        }
+        p += 8 + size;
+        if (static_cast<std::size_t>(p - begin) >= max) {
+            return p;
+        }
+    }
+    truncated = p != end;
+    return p;
+}
+
+// Records in the input, to presize the map: lines for CSV (counting a last line
+// without a newline), record headers for binary
+uint64_t countRecords(const ImportOptions& options, const char* begin, const char* end) {
+    uint64_t count = 0;
+    if (options.format == "csv") {
+        for (const char* p = begin; p < end; ++count) {
+            const char* nl = static_cast<const char*>(std::memchr(p, '\n', end - p));
+            p = nl ? nl + 1 : end;
+        }
+        return count;
+    }
+    bool truncated = false;
+    const char* stop = blockEnd(options, begin, end, static_cast<std::size_t>(end - begin), truncated);
+    for (const char* p = begin; p < stop; ++count) {
+        uint32_t size = 0;
+        std::memcpy(&size, p + 4, sizeof(size));
+        p += 8 + size;
+    }
+    return count;
+}
+
+// Room for the input's values plus per-entry overhead (node, string header,
+// allocator headers, buckets), with slack for fragmentation
+std::size_t segmentSize(const ImportOptions& options, std::size_t input_bytes, uint64_t records) {
+    if (options.size_mb > 0) {
+        return static_cast<std::size_t>(options.size_mb) * 1024 * 1024;
+    }
+    return (input_bytes + records * 128) / 4 * 5 + 64 * 1024 * 1024;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    ImportOptions options;
+    try {
+        if (!parseOptions(argc, argv, options)) {
+            std::cerr << "Usage: " << argv[0] << " <file> [--format=csv|binary] [--mode=memory|persistent] [--attach]\n"
+                      << "    [--size-mb=N] [--expected-keys=N] [--threads=N] [--batch=N] [--block-mb=N]"
+                      << std::endl;
+            return 1;
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+
+    int fd = open(options.path.c_str(), O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        std::perror(options.path.c_str());
+        return 1;
+    }
+    std::size_t input_bytes = static_cast<std::size_t>(st.st_size);
+    const char* input = nullptr;
+    if (input_bytes > 0) {
+        void* mapped = mmap(nullptr, input_bytes, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapped == MAP_FAILED) {
+            std::perror("mmap");
+            return 1;
+        }
+        madvise(mapped, input_bytes, MADV_SEQUENTIAL);
+        input = static_cast<const char*>(mapped);
+    }
+    const char* input_end = input + input_bytes;
+
+    auto start = std::chrono::steady_clock::now();
+    KvStore* store = nullptr;
+    try {
+        if (options.attach) {
+            store = &KvStore::get_instance(0, options.mode, ConnectionMode::CLIENT);
+        } else {
+            uint64_t records = countRecords(options, input, input_end);
+            std::size_t expected_keys =
+                options.expected_keys > 0 ? static_cast<std::size_t>(options.expected_keys) : records;
+            store = &KvStore::get_instance(segmentSize(options, input_bytes, records), options.mode,
+                                           ConnectionMode::SERVER, expected_keys);
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Opening the store failed: " << e.what() << std::endl;
+        return 1;
+    }
+
+    int threads = options.threads > 0 ? static_cast<int>(options.threads)
+                                      : static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+    std::size_t block_bytes = static_cast<std::size_t>(options.block_mb) * 1024 * 1024;
+    bool truncated = false;
+    auto parseNext = [&](const char* begin) -> std::pair<const char*, std::future<ParsedBlock>> {
+        const char* end = blockEnd(options, begin, input_end, block_bytes, truncated);
+        std::future<ParsedBlock> parsed = std::async(std::launch::async, [&options, begin, end, threads] {
+            return options.format == "csv" ? parseCsvBlock(begin, end, threads) : parseBinaryBlock(begin, end);
+        });
+        return {end, std::move(parsed)};
+    };
+
+    uint64_t records = 0;
+    uint64_t malformed = 0;
+    uint64_t loaded = 0;
+    KvStatus status = KvStatus::OK;
+    auto next = parseNext(input);
+    while (status == KvStatus::OK) {
+        ParsedBlock block = next.second.get();
+        const char* block_end = next.first;
+        // The next block is parsed while this one is written
+        bool more = block_end < input_end && !truncated;
+        if (more) {
+            next = parseNext(block_end);
+        }
+        records += block.records;
+        malformed += block.malformed;
+        Entries batch;
+        for (Entries& part : block.parts) {
+            for (std::size_t i = 0; i < part.size() && status == KvStatus::OK; i += options.batch) {
+                std::size_t n = std::min<std::size_t>(options.batch, part.size() - i);
+                batch.assign(std::make_move_iterator(part.begin() + i), std::make_move_iterator(part.begin() + i + n));
+                std::size_t written = 0;
+                status = store->BulkLoad(batch, written);
+                loaded += written;
+            }
+        }
+        if (!more) {
+            break;
+        }
+    }
+    if (status != KvStatus::OK && next.second.valid()) {
+        next.second.wait();
+    }
+    store->Sync();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::cout << "Imported " << loaded << " of " << records << " records from " << options.path << " in "
+              << std::fixed << std::setprecision(2) << seconds << " s (" << std::setprecision(0)
+              << (seconds > 0 ? loaded / seconds : 0.0) << " keys/s, " << std::setprecision(1)
+              << (seconds > 0 ? input_bytes / seconds / (1024 * 1024) : 0.0) << " MB/s); " << store->GetMapSize()
+              << " keys in the store" << std::endl;
+    if (malformed > 0) {
+        std::cout << "Skipped " << malformed << " malformed lines" << std::endl;
+    }
+    if (truncated) {
+        std::cout << "Dropped a truncated record at the end of the input" << std::endl;
+    }
+    if (status != KvStatus::OK) {
+        std::cout << "Import stopped: " << KvStatusName(status) << std::endl;
+    }
+    // Leaves without running KvStore's destructor, which would take down the store
+    // just built (or, attached, is not needed)
+    std::cout.flush();
+    std::_Exit(status == KvStatus::OK ? 0 : 1);
+}
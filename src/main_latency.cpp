@@ -0,0 +1,218 @@
+#include "config.hpp"
+#include <algorithm>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <thallium.hpp>
+#include <thallium/serialization/stl/string.hpp>
+#include <unistd.h>
+#include <vector>
+
+namespace tl = thallium;
+
+// Round-trip latency of an echo RPC on loopback under each progress mode. Every
+// mode gets a fresh server and client process, both using that mode, so the
+// numbers include the full Mercury/Margo path but no store work. The CPU columns
+// show what the latency costs: busy polling keeps a core per engine busy.
+// Usage: kvm_latency [protocol] [mode|all] [requests] [payload_bytes] [port]
+
+namespace {
+
+struct Result {
+    double mean_us = 0;
+    double p50_us = 0;
+    double p99_us = 0;
+    double p999_us = 0;
+    double max_us = 0;
+};
+
+double percentile(const std::vector<double>& sorted, double q) {
+    std::size_t index = static_cast<std::size_t>(q / 100.0 * (sorted.size() - 1));
+    return sorted[index];
+}
+
+double cpuSeconds(const struct rusage& usage) {
+    return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec +
+           (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+std::string readLine(int fd) {
+    std::string line;
+    char c = 0;
+    while (read(fd, &c, 1) == 1 && c != '\n') {
+        line.push_back(c);
+    }
+    return line;
+}
+
+void writeLine(int fd, const std::string& line) {
+    std::string data = line + "\n";
+    ssize_t written = write(fd, data.data(), data.size());
+    (void)written;
+}
+
+// Child: serves kv_ping until killed, after reporting its address
+[[noreturn]] void runServer(const std::string& address, const ProgressConfig& progress, int report_fd) {
+    try {
+        tl::engine engine(address, THALLIUM_SERVER_MODE, MargoConfigJson(progress));
+        engine.define("kv_ping", [](const tl::request& req, const std::string& payload) {
+            req.respond(payload);
+        });
+        writeLine(report_fd, std::string(engine.self()));
+        close(report_fd);
+        engine.wait_for_finalize();
+    } catch (const std::exception& e) {
+        std::cerr << "Server failed: " << e.what() << std::endl;
+        _exit(1);
+    }
+    _exit(0);
+}
+
+// Child: times requests pings to server and reports the result
+[[noreturn]] void runClient(const std::string& protocol, const std::string& server, const ProgressConfig& progress,
+                            int requests, std::size_t payload_bytes, int report_fd) {
+    Result result;
+    try {
+        tl::engine engine(protocol, THALLIUM_CLIENT_MODE, MargoConfigJson(progress));
+        tl::remote_procedure ping = engine.define("kv_ping");
+        tl::endpoint server_ep = engine.lookup(server);
+        std::string payload(payload_bytes, 'x');
+
+        // Warm up connections, handle caches and the servers' handler pools
+        for (int i = 0; i < std::min(requests, 1000); ++i) {
+            ping.on(server_ep)(payload).as<std::string>();
+        }
+        std::vector<double> latencies;
+        latencies.reserve(requests);
+        for (int i = 0; i < requests; ++i) {
+            auto start = std::chrono::steady_clock::now();
+            std::string echo = ping.on(server_ep)(payload).as<std::string>();
+            auto end = std::chrono::steady_clock::now();
+            latencies.push_back(std::chrono::duration<double, std::micro>(end - start).count());
+        }
+        std::sort(latencies.begin(), latencies.end());
+        double total = 0;
+        for (double latency : latencies) {
+            total += latency;
+        }
+        result.mean_us = total / latencies.size();
+        result.p50_us = percentile(latencies, 50);
+        result.p99_us = percentile(latencies, 99);
+        result.p999_us = percentile(latencies, 99.9);
+        result.max_us = latencies.back();
+    } catch (const std::exception& e) {
+        std::cerr << "Client failed: " << e.what() << std::endl;
+        _exit(1);
+    }
+    std::ostringstream line;
+    line << result.mean_us << " " << result.p50_us << " " << result.p99_us << " " << result.p999_us << " "
+         << result.max_us;
+    writeLine(report_fd, line.str());
+    close(report_fd);
+    _exit(0);
+}
+
+bool measure(const std::string& protocol, const std::string& address, const std::string& mode, int requests,
+             std::size_t payload_bytes) {
+    ProgressConfig progress;
+    progress.mode = mode;
+
+    int server_pipe[2];
+    int client_pipe[2];
+    if (pipe(server_pipe) != 0 || pipe(client_pipe) != 0) {
+        std::perror("pipe");
+        return false;
+    }
+    std::cout.flush();
+
+    pid_t server_pid = fork();
+    if (server_pid == 0) {
+        close(server_pipe[0]);
+        runServer(address, progress, server_pipe[1]);
+    }
+    close(server_pipe[1]);
+    std::string server = readLine(server_pipe[0]);
+    close(server_pipe[0]);
+    if (server.empty()) {
+        std::cerr << "Server for mode " << mode << " did not start on " << address << std::endl;
+        waitpid(server_pid, nullptr, 0);
+        return false;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    pid_t client_pid = fork();
+    if (client_pid == 0) {
+        close(client_pipe[0]);
+        runClient(protocol, server, progress, requests, payload_bytes, client_pipe[1]);
+    }
+    close(client_pipe[1]);
+    std::string report = readLine(client_pipe[0]);
+    close(client_pipe[0]);
+
+    int status = 0;
+    struct rusage client_usage {};
+    struct rusage server_usage {};
+    wait4(client_pid, &status, 0, &client_usage);
+    double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    kill(server_pid, SIGTERM);
+    wait4(server_pid, nullptr, 0, &server_usage);
+    if (report.empty() || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        std::cerr << "Client for mode " << mode << " failed" << std::endl;
+        return false;
+    }
+
+    Result result;
+    std::istringstream fields(report);
+    fields >> result.mean_us >> result.p50_us >> result.p99_us >> result.p999_us >> result.max_us;
+    std::cout << std::left << std::setw(11) << mode << std::right << std::fixed << std::setprecision(1)
+              << std::setw(10) << result.mean_us
+              << std::setw(10) << result.p50_us
+              << std::setw(10) << result.p99_us
+              << std::setw(10) << result.p999_us
+              << std::setw(10) << result.max_us
+              << std::setw(11) << 100.0 * cpuSeconds(client_usage) / wall << "%"
+              << std::setw(11) << 100.0 * cpuSeconds(server_usage) / wall << "%" << std::endl;
+    return true;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    std::string protocol = argc > 1 ? argv[1] : "ofi+tcp";
+    std::string mode = argc > 2 ? argv[2] : "all";
+    int requests = argc > 3 ? std::stoi(argv[3]) : 100000;
+    std::size_t payload_bytes = argc > 4 ? std::stoul(argv[4]) : 8;
+    int port = argc > 5 ? std::stoi(argv[5]) : 8090;
+
+    std::vector<std::string> modes;
+    if (mode == "all") {
+        modes = {"blocking", "adaptive", "busy_poll"};
+    } else if (mode == "blocking" || mode == "adaptive" || mode == "busy_poll") {
+        modes = {mode};
+    }
+    if (modes.empty() || requests < 1) {
+        std::cerr << "Usage: " << argv[0] << " [protocol] [blocking|adaptive|busy_poll|all] [requests] [payload_bytes] [port]"
+                  << std::endl;
+        return 1;
+    }
+
+    std::string address = protocol + "://127.0.0.1:" + std::to_string(port);
+    std::cout << "Loopback echo latency over " << protocol << ": " << requests << " requests of " << payload_bytes
+              << " bytes per mode, dedicated progress threads" << std::endl;
+    std::cout << std::left << std::setw(11) << "mode" << std::right
+              << std::setw(10) << "mean us" << std::setw(10) << "p50" << std::setw(10) << "p99"
+              << std::setw(10) << "p99.9" << std::setw(10) << "max"
+              << std::setw(12) << "client cpu" << std::setw(12) << "server cpu" << std::endl;
+
+    bool ok = true;
+    for (const std::string& name : modes) {
+        ok = measure(protocol, address, name, requests, payload_bytes) && ok;
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,116 @@
+#include "KVPlacement.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Offline simulation of the placement strategies: how evenly keys spread over the
+// nodes, how many keys move when a node joins or leaves, and what a lookup costs.
+// Usage: kvm_placement_sim [strategy|all] [nodes] [keys] [vnodes]
+
+namespace {
+
+std::vector<PlacementNode> makeNodes(int count) {
+    std::vector<PlacementNode> nodes;
+    for (int i = 0; i < count; ++i) {
+        nodes.push_back({i, 1.0});
+    }
+    return nodes;
+}
+
+std::vector<int> assign(const KVPlacement& placement, int keys) {
+    std::vector<int> owners(keys);
+    for (int key = 0; key < keys; ++key) {
+        owners[key] = placement.nodeFor(key);
+    }
+    return owners;
+}
+
+double movedPercent(const std::vector<int>& before, const std::vector<int>& after) {
+    std::size_t moved = 0;
+    for (std::size_t i = 0; i < before.size(); ++i) {
+        if (before[i] != after[i]) {
+            ++moved;
+        }
+    }
+    return 100.0 * moved / before.size();
+}
+
+void simulate(const std::string& strategy, int node_count, int keys, std::size_t vnodes) {
+    auto placement = makePlacement(strategy, makeNodes(node_count), vnodes);
+
+    auto start = std::chrono::high_resolution_clock::now();
+    std::vector<int> owners = assign(*placement, keys);
+    auto end = std::chrono::high_resolution_clock::now();
+    double lookup_ns = std::chrono::duration<double, std::nano>(end - start).count() / keys;
+
+    std::vector<double> load(node_count, 0.0);
+    for (int owner : owners) {
+        load[owner] += 1.0;
+    }
+    double mean = static_cast<double>(keys) / node_count;
+    double variance = 0.0;
+    for (double l : load) {
+        variance += (l - mean) * (l - mean);
+    }
+    double stddev = std::sqrt(variance / node_count);
+    auto [min_load, max_load] = std::minmax_element(load.begin(), load.end());
+
+    // Growth: one node joins. Shrink: the highest id leaves (the only removal jump supports).
+    auto grown = makePlacement(strategy, makeNodes(node_count + 1), vnodes);
+    double moved_join = movedPercent(owners, assign(*grown, keys));
+    double moved_leave = 0.0;
+    if (node_count > 1) {
+        auto shrunk = makePlacement(strategy, makeNodes(node_count - 1), vnodes);
+        moved_leave = movedPercent(owners, assign(*shrunk, keys));
+    }
+
+    std::cout << std::left << std::setw(12) << placement->name() << std::right << std::fixed
+              << std::setprecision(3)
+              << std::setw(10) << *min_load / mean
+              << std::setw(10) << *max_load / mean
+              << std::setw(10) << stddev / mean
+              << std::setprecision(2)
+              << std::setw(11) << moved_join << "%"
+              << std::setw(11) << moved_leave << "%"
+              << std::setw(12) << lookup_ns << std::endl;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    std::string strategy = argc > 1 ? argv[1] : "all";
+    int node_count = argc > 2 ? std::stoi(argv[2]) : 8;
+    int keys = argc > 3 ? std::stoi(argv[3]) : 1000000;
+    std::size_t vnodes = argc > 4 ? std::stoul(argv[4]) : 128;
+
+    if (node_count < 1 || keys < 1) {
+        std::cerr << "Usage: " << argv[0] << " [strategy|all] [nodes] [keys] [vnodes]" << std::endl;
+        return 1;
+    }
+
+    std::cout << "Placement simulation: " << node_count << " nodes, " << keys << " keys, "
+              << vnodes << " vnodes per node (ring)" << std::endl;
+    std::cout << "Ideal movement on join: " << std::fixed << std::setprecision(2)
+              << 100.0 / (node_count + 1) << "%, on leave: " << 100.0 / node_count << "%" << std::endl;
+    std::cout << std::left << std::setw(12) << "strategy" << std::right
+              << std::setw(10) << "min/mean" << std::setw(10) << "max/mean" << std::setw(10) << "cv"
+              << std::setw(12) << "join" << std::setw(12) << "leave" << std::setw(12) << "ns/lookup" << std::endl;
+
+    try {
+        if (strategy == "all") {
+            for (const char* name : {"modulo", "ring", "jump", "rendezvous", "range"}) {
+                simulate(name, node_count, keys, vnodes);
+            }
+        } else {
+            simulate(strategy, node_count, keys, vnodes);
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -1,9 +1,19 @@
 #include "KVServer.hpp"
+#include "KVShards.hpp"
 #include "KVStore.hpp"
 #include <iostream>
+#include <memory>
 #include <string>
 #include <algorithm>
 #include <stdexcept>
+#include <vector>
+#include <cerrno>
+#include <csignal>
+#include <cstdlib>
+#include <sched.h>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
 
 // Helper function to parse memory size from string with unit suffix
 std::size_t parseMemorySize(const std::string& size_str) {
@@ -46,6 +56,117 @@ std::size_t parseMemorySize(const std::string& size_str) {
     return size;
 }
 
+// Shard servers started by this process, for forwarding termination signals
+std::vector<pid_t> shard_pids;
+
+void forwardSignal(int sig) {
+    for (pid_t pid : shard_pids) {
+        kill(pid, sig);
+    }
+}
+
+// Starts shards.count servers, each re-executing this binary pinned to its own
+// core, on port + i with an equal part of the memory and KVM_INSTANCE suffixed
+// with shard<i>. Pinning happens before the shard creates its segment, so its
+// pages are first touched, and placed, on the shard's own NUMA node. Waits for
+// all of them and returns non-zero if any failed.
+//
+// Shards are separate processes rather than streams of one server so that local
+// clients keep reading each shard's segment directly. Keys reach a shard through
+// the cluster placement, which is why every shard must be a node of the config,
+// and why the layout is refused when a node's backups would share its host.
+int runShards(const ShardConfig& shards, const std::string& protocol, const std::string& host, int port,
+              std::size_t mem_size, StorageMode storage_mode, const std::string& config_path) {
+    const char* instance_env = std::getenv("KVM_INSTANCE");
+    std::vector<ShardPlan> plans = PlanShards(shards, port, mem_size, std::thread::hardware_concurrency(),
+                                              instance_env ? instance_env : "");
+
+    try {
+        Config config(config_path);
+        PlacementSpec spec = PlacementSpecFromConfig(config);
+        std::string colocated = ColocatedBackups(spec);
+        if (!colocated.empty()) {
+            std::cerr << "Refusing to start shards: " << colocated << ".\n"
+                      << "Backups are the next node ids, so interleave node ids across hosts "
+                      << "(host A: 0, 2, 4...; host B: 1, 3, 5...)" << std::endl;
+            return 1;
+        }
+        for (const ShardPlan& plan : plans) {
+            std::string endpoint = protocol + "://" + host + ":" + std::to_string(plan.port);
+            bool listed = std::any_of(spec.nodes.begin(), spec.nodes.end(),
+                                      [&endpoint](const MemberNode& node) { return node.endpoint == endpoint; });
+            if (!listed) {
+                std::cout << "Warning: shard " << plan.index << " (" << endpoint
+                          << ") is not in ip_addresses; no keys will be routed to it\n";
+            }
+        }
+    } catch (const std::exception& e) {
+        std::cout << "Cluster config not checked (" << e.what() << ")\n";
+    }
+
+    std::cout << "\n==== Shard-per-core layout: " << plans.size() << " shards ====\n";
+    for (const ShardPlan& plan : plans) {
+        std::string shard_port = std::to_string(plan.port);
+        std::string shard_mem = std::to_string(plan.mem_size / 1024) + "K";
+        pid_t pid = fork();
+        if (pid < 0) {
+            std::perror("fork");
+            forwardSignal(SIGTERM);
+            return 1;
+        }
+        if (pid == 0) {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(plan.cpu, &set);
+            if (sched_setaffinity(0, sizeof(set), &set) != 0) {
+                std::perror("sched_setaffinity");
+            }
+            setenv("KVM_INSTANCE", plan.instance.c_str(), 1);
+            setenv("KVM_SHARD", std::to_string(plan.index).c_str(), 1);
+            std::string mode = storage_mode == StorageMode::PERSISTENT ? "persistent" : "memory";
+            std::vector<std::string> args = {protocol, shard_port, shard_mem, mode, host, config_path};
+            std::vector<char*> shard_argv = {const_cast<char*>("kvm_server")};
+            for (std::string& arg : args) {
+                shard_argv.push_back(arg.data());
+            }
+            shard_argv.push_back(nullptr);
+            execv("/proc/self/exe", shard_argv.data());
+            std::perror("execv");
+            _exit(127);
+        }
+        shard_pids.push_back(pid);
+        std::cout << "Shard " << plan.index << ": pid " << pid << ", cpu " << plan.cpu
+                  << ", KVM_INSTANCE=" << plan.instance << ", " << shard_mem << "\n";
+    }
+    std::signal(SIGINT, forwardSignal);
+    std::signal(SIGTERM, forwardSignal);
+
+    // Each shard is a node of the cluster config; with replication, give the
+    // shards of one host ids that are not consecutive
+    std::cout << "Shard endpoints (one ip_addresses entry each):\n";
+    for (const ShardPlan& plan : plans) {
+        std::cout << "    " << protocol << "://" << host << ":" << plan.port << "\n";
+    }
+    std::cout << "================================\n\n";
+
+    int failed = 0;
+    for (std::size_t remaining = shard_pids.size(); remaining > 0;) {
+        int status = 0;
+        pid_t pid = waitpid(-1, &status, 0);
+        if (pid < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        --remaining;
+        bool ok = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+        failed += ok ? 0 : 1;
+        std::cout << "Shard server " << pid << (ok ? " exited" : " failed") << std::endl;
+    }
+    return failed ? 1 : 0;
+}
+
 int main(int argc, char** argv) {
     // Default values
     std::string protocol = "ofi+tcp";
@@ -98,13 +219,21 @@ int main(int argc, char** argv) {
         std::cout << "[Server] No storage mode specified, defaulting to MEMORY\n";
     }
     
-    // Get server IP address
-    char ip_buffer[128];
-    FILE* fp = popen("hostname -I | awk '{print $1}'", "r");
-    fgets(ip_buffer, sizeof(ip_buffer), fp);
-    pclose(fp);
+    // Get server IP address: the 5th argument if given (e.g. 127.0.0.1 to run
+    // several servers on one machine, each with its own KVM_INSTANCE), else the
+    // host's first address
+    std::string host;
+    if (argc >= 6) {
+        host = argv[5];
+    } else {
+        char ip_buffer[128] = {0};
+        FILE* fp = popen("hostname -I | awk '{print $1}'", "r");
+        fgets(ip_buffer, sizeof(ip_buffer), fp);
+        pclose(fp);
+        host = ip_buffer;
+    }
     
-    std::string address = protocol + "://" + std::string(ip_buffer) + ":" + std::to_string(port);
+    std::string address = protocol + "://" + host + ":" + std::to_string(port);
     address.erase(std::remove(address.begin(), address.end(), '\n'), address.end());
     
     uint16_t provider_id = 1;
@@ -121,8 +250,50 @@ int main(int argc, char** argv) {
     }
     std::cout << "================================\n\n";
     
+    // Server settings from the cluster config (the 6th argument, else the default
+    // path); built-in defaults apply if it cannot be read
+    std::string config_path = argc >= 7 ? argv[6] : "../config/config.json";
+    AdmissionConfig admission;
+    ProgressConfig progress;
+    MetricsConfig metrics;
+    TracingConfig tracing;
+    StoreConfig store;
+    ShardConfig shards;
+    try {
+        Config config(config_path);
+        admission = config.read_admission_config();
+        progress = config.read_progress_config();
+        metrics = config.read_metrics_config();
+        tracing = config.read_tracing_config();
+        store = config.read_store_config();
+        shards = config.read_shard_config();
+        std::cout << "Admission control: queue limit " << admission.max_queue << ", per-client limit "
+                  << admission.client_ops_per_sec << " ops/s (0 = none)\n";
+    } catch (const std::exception& e) {
+        std::cout << "No usable config (" << e.what() << "), using default admission limits and progress mode\n";
+    }
+
+    // The first server of a sharded layout only starts and supervises the shards
+    const char* shard_env = std::getenv("KVM_SHARD");
+    if (!shard_env && shards.count > 1) {
+        std::string shard_host = host;
+        shard_host.erase(std::remove(shard_host.begin(), shard_host.end(), '\n'), shard_host.end());
+        return runShards(shards, protocol, shard_host, port, mem_size, storage_mode, config_path);
+    }
+    if (shard_env) {
+        // A shard owns one core: progress and handlers share a single execution
+        // stream, and the table is sized for this shard's part of the keys
+        progress.dedicated_thread = false;
+        progress.handler_threads = 0;
+        store.expected_keys /= std::max<uint32_t>(shards.count, 1);
+        std::cout << "Shard " << shard_env << " of " << shards.count << ", one execution stream\n";
+    }
+    std::cout << "Progress mode: " << progress.mode
+              << (progress.dedicated_thread ? ", dedicated progress thread" : ", progress shares the handler thread")
+              << ", " << progress.handler_threads << " extra handler thread(s)\n";
+
     // Start the Thallium engine
-    tl::engine myEngine(address, THALLIUM_SERVER_MODE);
+    tl::engine myEngine(address, THALLIUM_SERVER_MODE, MargoConfigJson(progress));
     std::cout << "Server running at " << myEngine.self() << std::endl;
     
     // Get hostname for logging
@@ -136,12 +307,32 @@ int main(int argc, char** argv) {
     
     // CRITICAL CHANGE: Pass both memory size AND storage mode
     // In your server main function
-    KvStore& kv = KvStore::get_instance(mem_size, storage_mode, ConnectionMode::SERVER);
+    KvStore& kv = KvStore::get_instance(mem_size, storage_mode, ConnectionMode::SERVER, store.expected_keys);
     std::cout << "KvStore initialized successfully" << std::endl;
+    kv.SetIncrementalRehash(store.rehash_step);
+    kv.SetLockProfiling(metrics.lock_sample_every);
+    // Servers trace the requests their clients chose to trace, none on their own
+    ConfigureTracing(0, tracing.buffer_spans);
+    std::cout << "Store lock profiling: "
+              << (metrics.lock_sample_every ? "1 acquisition in " + std::to_string(metrics.lock_sample_every) : "off")
+              << std::endl;
     
     // Create and start the KVServer
-    KVServer server(myEngine, kv, provider_id);
+    KVServer server(myEngine, kv, provider_id, admission);
     std::cout << "KVServer started with provider ID: " << provider_id << std::endl;
+    if (shard_env) {
+        server.requireDistinctBackupHosts();
+    }
+
+    // Metrics are always collected (see kv_stats); this only publishes them locally
+    std::unique_ptr<KVMetricsExporter> exporter;
+    if (!metrics.file.empty() || !metrics.socket.empty()) {
+        try {
+            exporter = std::make_unique<KVMetricsExporter>(metrics, [&server] { return server.stats().prometheus(); });
+        } catch (const std::exception& e) {
+            std::cerr << "Metrics export disabled: " << e.what() << std::endl;
+        }
+    }
     std::cout << "Server is running. Connect using: " << myEngine.self() << std::endl;
     
     // Print final status
@@ -0,0 +1,653 @@
+#include "KVHistogram.hpp"
+#include "KVProtocol.hpp"
+#include "KVStore.hpp"
+#include <algorithm>
+#include <boost/interprocess/shared_memory_object.hpp>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <iomanip>
+#include <iostream>
+#include <linux/perf_event.h>
+#include <pthread.h>
+#include <random>
+#include <string>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// Microbenchmark of the storage engine alone: KvStore::Insert, Find, Update and
+// Delete called directly, with no RPC layer. Every scenario (storage mode x key
+// count x value size x process count) gets a fresh store: one process creates it
+// as SERVER and preloads the keys, then the worker processes attach as CLIENT and
+// run each operation in lockstep, so with more than one they contend for the
+// segment and its lock. Per-operation cost is reported in TSC cycles (p50, p99,
+// mean) and, with --perf, as hardware counters per operation. The store's own
+// per-operation logging goes to /dev/null but its cost is part of what is measured.
+// --locks turns on the store's lock profiling in every worker and adds how long
+// each operation waited for and held the store lock. --presize creates the map with
+// buckets for every key the scenario will hold, and --rehash-step sets how many
+// entries move per operation when it grows (0: the map rehashes all at once); the
+// max column shows what growth costs the unluckiest call.
+//
+// The benchmark runs under a private KVM_INSTANCE, so it never touches the segment
+// or files of a server on the same host.
+//
+// Usage: kvm_storebench [--modes=memory,persistent] [--keys=N[,N...]]
+//            [--value-sizes=bytes[,bytes...]] [--processes=N[,N...]] [--ops=N]
+//            [--size-mb=N] [--presize] [--rehash-step=N] [--perf] [--locks]
+//            [--format=table|csv]
+
+namespace {
+
+struct StoreBenchOptions {
+    std::vector<std::string> modes = {"memory", "persistent"};
+    std::vector<int64_t> keys = {10000, 100000};
+    std::vector<int64_t> value_sizes = {16, 256, 4096};
+    std::vector<int64_t> processes = {1, 4};
+    int64_t ops = 20000;       // Per process and operation
+    int64_t size_mb = 0;       // 0: sized from the scenario
+    bool presize = false;
+    int64_t rehash_step = 8;
+    bool perf = false;
+    bool locks = false;
+    std::string format = "table";
+};
+
+struct Scenario {
+    StorageMode mode;
+    int64_t keys;
+    std::size_t value_size;
+    int processes;
+    std::size_t segment_size;
+};
+
+enum StoreOp { OP_INSERT, OP_FIND, OP_UPDATE, OP_DELETE, STORE_OP_COUNT };
+const char* STORE_OP_NAMES[STORE_OP_COUNT] = {"Insert", "Find", "Update", "Delete"};
+const StoreLockSite STORE_OP_LOCK_SITES[STORE_OP_COUNT] = {StoreLockSite::INSERT, StoreLockSite::FIND,
+                                                           StoreLockSite::UPDATE, StoreLockSite::DELETE};
+
+enum PerfEvent { EV_CYCLES, EV_INSTRUCTIONS, EV_CACHE_MISSES, EV_BRANCH_MISSES, PERF_EVENT_COUNT };
+
+// Per operation, one worker or all of them merged
+struct OpResult {
+    KVHistogram ticks;                      // Per call
+    uint64_t errors = 0;
+    uint64_t wall_ns = 0;                   // Slowest worker's time for the phase
+    uint8_t perf_valid = 0;
+    uint64_t perf[PERF_EVENT_COUNT] = {};   // Summed over the phase
+    KVHistogram lock_wait;                  // ns, with --locks
+    KVHistogram lock_hold;
+
+    void merge(const OpResult& other) {
+        ticks.merge(other.ticks);
+        lock_wait.merge(other.lock_wait);
+        lock_hold.merge(other.lock_hold);
+        errors += other.errors;
+        wall_ns = std::max(wall_ns, other.wall_ns);
+        perf_valid = other.perf_valid;
+        for (int i = 0; i < PERF_EVENT_COUNT; ++i) {
+            perf[i] += other.perf[i];
+        }
+    }
+
+    template <typename A>
+    void save(A& ar) const {
+        ticks.save(ar);
+        ar.write(&errors);
+        ar.write(&wall_ns);
+        ar.write(&perf_valid);
+        ar.write(perf, PERF_EVENT_COUNT);
+        lock_wait.save(ar);
+        lock_hold.save(ar);
+    }
+
+    template <typename A>
+    void load(A& ar) {
+        ticks.load(ar);
+        ar.read(&errors);
+        ar.read(&wall_ns);
+        ar.read(&perf_valid);
+        ar.read(perf, PERF_EVENT_COUNT);
+        lock_wait.load(ar);
+        lock_hold.load(ar);
+    }
+};
+
+// Time stamp counter where there is one, nanoseconds elsewhere
+inline uint64_t ticksNow() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return static_cast<uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count());
+#endif
+}
+
+// Hardware counters of the calling thread through perf_event_open. Kernel time is
+// counted when perf_event_paranoid allows it (lock waits are spent there), user
+// time only otherwise; if the events cannot be opened at all, valid() is false.
+class PerfCounters {
+public:
+    explicit PerfCounters(bool enabled) {
+        if (!enabled) {
+            return;
+        }
+        const uint64_t configs[PERF_EVENT_COUNT] = {PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+                                                    PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES};
+        for (int exclude_kernel = 0; exclude_kernel <= 1 && !opened; ++exclude_kernel) {
+            opened = true;
+            for (int i = 0; i < PERF_EVENT_COUNT; ++i) {
+                perf_event_attr attr;
+                std::memset(&attr, 0, sizeof(attr));
+                attr.type = PERF_TYPE_HARDWARE;
+                attr.size = sizeof(attr);
+                attr.config = configs[i];
+                attr.disabled = 1;
+                attr.exclude_kernel = exclude_kernel;
+                attr.exclude_hv = 1;
+                fds[i] = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+                if (fds[i] < 0) {
+                    opened = false;
+                }
+            }
+            if (!opened) {
+                closeAll();
+            }
+        }
+    }
+
+    ~PerfCounters() { closeAll(); }
+
+    bool valid() const { return opened; }
+
+    void start() {
+        for (int i = 0; opened && i < PERF_EVENT_COUNT; ++i) {
+            ioctl(fds[i], PERF_EVENT_IOC_RESET, 0);
+            ioctl(fds[i], PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+
+    void stop(uint64_t* counts) {
+        for (int i = 0; opened && i < PERF_EVENT_COUNT; ++i) {
+            ioctl(fds[i], PERF_EVENT_IOC_DISABLE, 0);
+            if (read(fds[i], &counts[i], sizeof(counts[i])) != sizeof(counts[i])) {
+                counts[i] = 0;
+            }
+        }
+    }
+
+private:
+    void closeAll() {
+        for (int& fd : fds) {
+            if (fd >= 0) {
+                close(fd);
+            }
+            fd = -1;
+        }
+    }
+
+    int fds[PERF_EVENT_COUNT] = {-1, -1, -1, -1};
+    bool opened = false;
+};
+
+std::vector<int64_t> parseList(const std::string& list) {
+    std::vector<int64_t> values;
+    std::size_t start = 0;
+    while (start <= list.size()) {
+        std::size_t comma = list.find(',', start);
+        if (comma == std::string::npos) {
+            comma = list.size();
+        }
+        values.push_back(std::stoll(list.substr(start, comma - start)));
+        start = comma + 1;
+    }
+    return values;
+}
+
+std::vector<std::string> parseNames(const std::string& list) {
+    std::vector<std::string> names;
+    std::size_t start = 0;
+    while (start <= list.size()) {
+        std::size_t comma = list.find(',', start);
+        if (comma == std::string::npos) {
+            comma = list.size();
+        }
+        names.push_back(list.substr(start, comma - start));
+        start = comma + 1;
+    }
+    return names;
+}
+
+bool parseOptions(int argc, char* argv[], StoreBenchOptions& options) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--perf") {
+            options.perf = true;
+            continue;
+        }
+        if (arg == "--locks") {
+            options.locks = true;
+            continue;
+        }
+        if (arg == "--presize") {
+            options.presize = true;
+            continue;
+        }
+        std::size_t eq = arg.find('=');
+        if (arg.rfind("--", 0) != 0 || eq == std::string::npos) {
+            std::cerr << "Unrecognized argument: " << arg << std::endl;
+            return false;
+        }
+        std::string name = arg.substr(2, eq - 2);
+        std::string value = arg.substr(eq + 1);
+        if (name == "modes") {
+            options.modes = parseNames(value);
+        } else if (name == "keys") {
+            options.keys = parseList(value);
+        } else if (name == "value-sizes") {
+            options.value_sizes = parseList(value);
+        } else if (name == "processes") {
+            options.processes = parseList(value);
+        } else if (name == "ops") {
+            options.ops = std::stoll(value);
+        } else if (name == "size-mb") {
+            options.size_mb = std::stoll(value);
+        } else if (name == "rehash-step") {
+            options.rehash_step = std::stoll(value);
+        } else if (name == "format") {
+            options.format = value;
+        } else {
+            std::cerr << "Unknown option: --" << name << std::endl;
+            return false;
+        }
+    }
+    auto positive = [](const std::vector<int64_t>& values) {
+        return std::all_of(values.begin(), values.end(), [](int64_t v) { return v > 0; });
+    };
+    bool modes_ok = std::all_of(options.modes.begin(), options.modes.end(),
+                                [](const std::string& m) { return m == "memory" || m == "persistent"; });
+    int64_t max_keys = *std::max_element(options.keys.begin(), options.keys.end());
+    int64_t max_processes = *std::max_element(options.processes.begin(), options.processes.end());
+    if (!modes_ok || !positive(options.keys) || !positive(options.value_sizes) || !positive(options.processes) ||
+        options.ops < 1 || options.size_mb < 0 || options.rehash_step < 0 || options.rehash_step > UINT32_MAX ||
+        max_keys + max_processes * options.ops > INT32_MAX ||
+        (options.format != "table" && options.format != "csv")) {
+        std::cerr << "Invalid option value" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Room for the preloaded keys and every worker's inserts, with slack for the
+// allocator and the map's buckets
+std::size_t segmentSize(const StoreBenchOptions& options, int64_t keys, std::size_t value_size, int processes) {
+    if (options.size_mb > 0) {
+        return static_cast<std::size_t>(options.size_mb) * 1024 * 1024;
+    }
+    std::size_t entries = static_cast<std::size_t>(keys + processes * options.ops);
+    return entries * (value_size + 128) * 2 + 64 * 1024 * 1024;
+}
+
+// Removes what a store of this instance leaves behind (see KvStore's static names)
+void removeStore(const std::string& instance) {
+    boost::interprocess::shared_memory_object::remove(("Project_" + instance).c_str());
+    boost::interprocess::named_mutex::remove(("SharedMapMutex_" + instance).c_str());
+    std::error_code ec;
+    std::filesystem::remove("./kvstore_persistent_" + instance + ".dat", ec);
+}
+
+// Creates the store and preloads keys 0 .. keys-1. Exits without running KvStore's
+// destructor, which would remove the segment the workers are about to attach to.
+int createStore(const StoreBenchOptions& options, const Scenario& scenario) {
+    if (!std::freopen("/dev/null", "w", stdout)) {
+        return 1;
+    }
+    try {
+        std::size_t expected_keys =
+            options.presize ? static_cast<std::size_t>(scenario.keys + scenario.processes * options.ops) : 0;
+        KvStore& store =
+            KvStore::get_instance(scenario.segment_size, scenario.mode, ConnectionMode::SERVER, expected_keys);
+        store.SetIncrementalRehash(static_cast<uint32_t>(options.rehash_step));
+        std::string value(scenario.value_size, 'v');
+        for (int64_t key = 0; key < scenario.keys; ++key) {
+            if (store.Insert(static_cast<int>(key), value) != KvStatus::OK) {
+                std::cerr << "Preloading key " << key << " failed" << std::endl;
+                return 1;
+            }
+        }
+        store.Sync();
+    } catch (const std::exception& e) {
+        std::cerr << "Creating the store failed: " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+bool writeAll(int fd, const std::string& data) {
+    std::size_t offset = 0;
+    while (offset < data.size()) {
+        ssize_t written = write(fd, data.data() + offset, data.size() - offset);
+        if (written <= 0) {
+            return false;
+        }
+        offset += static_cast<std::size_t>(written);
+    }
+    return true;
+}
+
+// Worker: attaches as CLIENT and runs every operation between barriers shared with
+// the other workers. Inserts (and later deletes) keys of its own past the preloaded
+// ones; finds and updates pick preloaded keys at random. A worker that cannot
+// attach still passes the barriers so the others are not left waiting.
+int runWorker(const StoreBenchOptions& options, const Scenario& scenario, int index, pthread_barrier_t* barrier,
+              int report_fd) {
+    if (!std::freopen("/dev/null", "w", stdout)) {
+        return 1;
+    }
+    KvStore* store = nullptr;
+    try {
+        store = &KvStore::get_instance(scenario.segment_size, scenario.mode, ConnectionMode::CLIENT);
+    } catch (const std::exception& e) {
+        std::cerr << "Worker " << index << " could not attach: " << e.what() << std::endl;
+    }
+    if (store && options.locks) {
+        store->SetLockProfiling(1);
+    }
+
+    std::string value(scenario.value_size, 'w');
+    std::vector<int> own_keys(options.ops);
+    std::vector<int> random_keys(options.ops);
+    std::mt19937 gen(index + 1);
+    std::uniform_int_distribution<int64_t> pick(0, scenario.keys - 1);
+    for (int64_t i = 0; i < options.ops; ++i) {
+        own_keys[i] = static_cast<int>(scenario.keys + index * options.ops + i);
+        random_keys[i] = static_cast<int>(pick(gen));
+    }
+
+    PerfCounters perf(options.perf);
+    OpResult results[STORE_OP_COUNT];
+    for (int op = 0; op < STORE_OP_COUNT; ++op) {
+        pthread_barrier_wait(barrier);
+        if (!store) {
+            continue;
+        }
+        OpResult& result = results[op];
+        if (options.locks) {
+            store->ResetLockProfile();
+        }
+        auto start = std::chrono::steady_clock::now();
+        perf.start();
+        for (int64_t i = 0; i < options.ops; ++i) {
+            uint64_t before = ticksNow();
+            bool ok = true;
+            switch (op) {
+                case OP_INSERT:
+                    ok = store->Insert(own_keys[i], value) == KvStatus::OK;
+                    break;
+                case OP_FIND:
+                    ok = store->Find(random_keys[i]).size() == scenario.value_size;
+                    break;
+                case OP_UPDATE:
+                    ok = store->Update(random_keys[i], value) == KvStatus::OK;
+                    break;
+                case OP_DELETE:
+                    ok = store->Delete(own_keys[i]) == KvStatus::OK;
+                    break;
+            }
+            result.ticks.record(ticksNow() - before);
+            result.errors += ok ? 0 : 1;
+        }
+        perf.stop(result.perf);
+        result.perf_valid = perf.valid() ? 1 : 0;
+        result.wall_ns = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                                   std::chrono::steady_clock::now() - start).count());
+        if (options.locks) {
+            StoreLockProfile locks = store->GetLockProfile();
+            result.lock_wait = locks.wait[static_cast<int>(STORE_OP_LOCK_SITES[op])];
+            result.lock_hold = locks.hold[static_cast<int>(STORE_OP_LOCK_SITES[op])];
+        }
+    }
+    if (!store) {
+        return 1;
+    }
+
+    std::string data;
+    kvwire::StringWriter writer(data);
+    for (const OpResult& result : results) {
+        result.save(writer);
+    }
+    bool ok = writeAll(report_fd, data);
+    close(report_fd);
+    return ok ? 0 : 1;
+}
+
+std::string readAll(int fd) {
+    std::string data;
+    char buffer[65536];
+    ssize_t n = 0;
+    while ((n = read(fd, buffer, sizeof(buffer))) > 0) {
+        data.append(buffer, static_cast<std::size_t>(n));
+    }
+    return data;
+}
+
+// Runs one scenario; false if any of its processes failed
+bool runScenario(const StoreBenchOptions& options, const Scenario& scenario, const std::string& instance,
+                 OpResult* merged) {
+    removeStore(instance);
+    std::cout.flush();
+    pid_t creator = fork();
+    if (creator == 0) {
+        _exit(createStore(options, scenario));
+    }
+    int status = 0;
+    waitpid(creator, &status, 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        removeStore(instance);
+        return false;
+    }
+
+    // Process-shared barrier in an anonymous shared mapping inherited by the workers
+    void* shared = mmap(nullptr, sizeof(pthread_barrier_t), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS,
+                        -1, 0);
+    if (shared == MAP_FAILED) {
+        removeStore(instance);
+        return false;
+    }
+    auto* barrier = static_cast<pthread_barrier_t*>(shared);
+    pthread_barrierattr_t attr;
+    pthread_barrierattr_init(&attr);
+    pthread_barrierattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_barrier_init(barrier, &attr, static_cast<unsigned>(scenario.processes));
+    pthread_barrierattr_destroy(&attr);
+
+    std::vector<pid_t> workers;
+    std::vector<int> pipes;
+    for (int p = 0; p < scenario.processes; ++p) {
+        int fds[2];
+        if (pipe(fds) != 0) {
+            std::perror("pipe");
+            break;
+        }
+        pid_t pid = fork();
+        if (pid == 0) {
+            close(fds[0]);
+            for (int fd : pipes) {
+                close(fd);
+            }
+            _exit(runWorker(options, scenario, p, barrier, fds[1]));
+        }
+        close(fds[1]);
+        workers.push_back(pid);
+        pipes.push_back(fds[0]);
+    }
+
+    bool ok = static_cast<int>(workers.size()) == scenario.processes;
+    for (std::size_t p = 0; p < workers.size(); ++p) {
+        std::string data = readAll(pipes[p]);
+        close(pipes[p]);
+        waitpid(workers[p], &status, 0);
+        try {
+            kvwire::StringReader reader(data);
+            for (int op = 0; op < STORE_OP_COUNT; ++op) {
+                OpResult result;
+                result.load(reader);
+                merged[op].merge(result);
+            }
+        } catch (const std::exception&) {
+            std::cerr << "Worker " << p << " reported no result" << std::endl;
+            ok = false;
+        }
+    }
+    pthread_barrier_destroy(barrier);
+    munmap(shared, sizeof(pthread_barrier_t));
+    removeStore(instance);
+    return ok;
+}
+
+void printHeader(const StoreBenchOptions& options) {
+    if (options.format == "csv") {
+        std::cout << "mode,keys,value_size,processes,op,ops,errors,ops_per_sec,p50_ticks,p99_ticks,mean_ticks,max_ticks,"
+                     "cycles_per_op,instructions_per_op,cache_misses_per_op,branch_misses_per_op,lock_wait_p50_ns,"
+                     "lock_wait_p99_ns,lock_hold_p50_ns,lock_hold_p99_ns\n";
+        return;
+    }
+    std::cout << std::left << std::setw(11) << "mode" << std::right << std::setw(9) << "keys" << std::setw(7)
+              << "value" << std::setw(6) << "procs" << std::setw(8) << "op" << std::setw(12) << "ops/s"
+              << std::setw(10) << "p50" << std::setw(10) << "p99" << std::setw(10) << "mean" << std::setw(12) << "max";
+    if (options.perf) {
+        std::cout << std::setw(10) << "cycles" << std::setw(10) << "instr" << std::setw(10) << "cache-m"
+                  << std::setw(10) << "branch-m";
+    }
+    if (options.locks) {
+        std::cout << std::setw(10) << "wait p50" << std::setw(10) << "wait p99" << std::setw(10) << "hold p50"
+                  << std::setw(10) << "hold p99";
+    }
+    std::cout << std::setw(8) << "errors" << std::endl;
+}
+
+void printResult(const StoreBenchOptions& options, const Scenario& scenario, const OpResult* merged) {
+    const char* mode = scenario.mode == StorageMode::MEMORY ? "memory" : "persistent";
+    for (int op = 0; op < STORE_OP_COUNT; ++op) {
+        const OpResult& r = merged[op];
+        double ops = static_cast<double>(r.ticks.count());
+        double ops_per_sec = r.wall_ns ? ops * 1e9 / r.wall_ns : 0.0;
+        double per_op[PERF_EVENT_COUNT];
+        for (int i = 0; i < PERF_EVENT_COUNT; ++i) {
+            per_op[i] = ops > 0 ? r.perf[i] / ops : 0.0;
+        }
+        if (options.format == "csv") {
+            std::cout << mode << "," << scenario.keys << "," << scenario.value_size << "," << scenario.processes << ","
+                      << STORE_OP_NAMES[op] << "," << r.ticks.count() << "," << r.errors << "," << ops_per_sec << ","
+                      << r.ticks.valueAt(50) << "," << r.ticks.valueAt(99) << "," << r.ticks.mean() << ","
+                      << r.ticks.max();
+            for (int i = 0; i < PERF_EVENT_COUNT; ++i) {
+                std::cout << ",";
+                if (r.perf_valid) {
+                    std::cout << per_op[i];
+                }
+            }
+            for (const KVHistogram* h : {&r.lock_wait, &r.lock_hold}) {
+                for (double percentile : {50.0, 99.0}) {
+                    std::cout << ",";
+                    if (options.locks) {
+                        std::cout << h->valueAt(percentile);
+                    }
+                }
+            }
+            std::cout << "\n";
+            continue;
+        }
+        std::cout << std::left << std::setw(11) << mode << std::right << std::setw(9) << scenario.keys << std::setw(7)
+                  << scenario.value_size << std::setw(6) << scenario.processes << std::setw(8) << STORE_OP_NAMES[op]
+                  << std::fixed << std::setprecision(0) << std::setw(12) << ops_per_sec << std::setw(10)
+                  << r.ticks.valueAt(50) << std::setw(10) << r.ticks.valueAt(99) << std::setw(10) << r.ticks.mean()
+                  << std::setw(12) << r.ticks.max();
+        if (options.perf) {
+            for (int i = 0; i < PERF_EVENT_COUNT; ++i) {
+                if (r.perf_valid) {
+                    std::cout << std::setprecision(1) << std::setw(10) << per_op[i];
+                } else {
+                    std::cout << std::setw(10) << "-";
+                }
+            }
+        }
+        if (options.locks) {
+            std::cout << std::setw(10) << r.lock_wait.valueAt(50) << std::setw(10) << r.lock_wait.valueAt(99)
+                      << std::setw(10) << r.lock_hold.valueAt(50) << std::setw(10) << r.lock_hold.valueAt(99);
+        }
+        std::cout << std::setw(8) << r.errors << std::endl;
+    }
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    StoreBenchOptions options;
+    try {
+        if (!parseOptions(argc, argv, options)) {
+            std::cerr << "Usage: " << argv[0] << " [--modes=memory,persistent] [--keys=N[,N...]]\n"
+                      << "    [--value-sizes=bytes[,bytes...]] [--processes=N[,N...]] [--ops=N]\n"
+                      << "    [--size-mb=N] [--presize] [--rehash-step=N] [--perf] [--locks]\n"
+                      << "    [--format=table|csv]" << std::endl;
+            return 1;
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+
+    // KvStore derives its segment, mutex and file names from KVM_INSTANCE during
+    // static initialization, so a private instance needs a fresh image
+    const char* instance_env = std::getenv("KVM_INSTANCE");
+    std::string instance = instance_env ? instance_env : "";
+    if (instance.rfind("storebench_", 0) != 0) {
+        instance = "storebench_" + std::to_string(getpid());
+        setenv("KVM_INSTANCE", instance.c_str(), 1);
+        execv("/proc/self/exe", argv);
+        std::perror("execv");
+        return 1;
+    }
+
+    if (options.format == "table") {
+        std::cout << "KvStore microbenchmark: " << options.ops << " ops per process and operation, "
+#if defined(__x86_64__) || defined(__i386__)
+                  << "latency in TSC cycles"
+#else
+                  << "latency in ns"
+#endif
+                  << (options.perf ? ", hardware counters per op" : "")
+                  << (options.locks ? ", store lock wait and hold in ns" : "") << std::endl;
+    }
+    printHeader(options);
+    bool all_ok = true;
+    for (const std::string& mode_name : options.modes) {
+        StorageMode mode = mode_name == "persistent" ? StorageMode::PERSISTENT : StorageMode::MEMORY;
+        for (int64_t keys : options.keys) {
+            for (int64_t value_size : options.value_sizes) {
+                for (int64_t processes : options.processes) {
+                    Scenario scenario{mode, keys, static_cast<std::size_t>(value_size), static_cast<int>(processes),
+                                      segmentSize(options, keys, static_cast<std::size_t>(value_size),
+                                                  static_cast<int>(processes))};
+                    OpResult merged[STORE_OP_COUNT];
+                    if (!runScenario(options, scenario, instance, merged)) {
+                        std::cerr << "Scenario " << mode_name << "/" << keys << "/" << value_size << "/" << processes
+                                  << " failed" << std::endl;
+                        all_ok = false;
+                        continue;
+                    }
+                    printResult(options, scenario, merged);
+                }
+            }
+        }
+    }
+    return all_ok ? 0 : 1;
+}
@@ -0,0 +1,79 @@
+// Client cache behaviour: leases, invalidation and CLOCK eviction.
+// Exits non-zero on a failed check.
+#include "KVCache.hpp"
+#include <iostream>
+#include <string>
+#include <thread>
+
+namespace {
+
+int failures = 0;
+
+void check(bool ok, const std::string& what) {
+    if (!ok) {
+        std::cerr << "FAILED: " << what << std::endl;
+        ++failures;
+    }
+}
+
+KVCache::Clock::time_point in(std::chrono::milliseconds ms) {
+    return KVCache::Clock::now() + ms;
+}
+
+void testLease() {
+    KVCache cache(16, 1);
+    std::string value;
+    check(!cache.get(1, value), "empty cache misses");
+    cache.put(1, "a", in(std::chrono::milliseconds(20)));
+    check(cache.get(1, value) && value == "a", "value served within its lease");
+    std::this_thread::sleep_for(std::chrono::milliseconds(30));
+    check(!cache.get(1, value), "value dropped once its lease ran out");
+    cache.put(2, "b", KVCache::Clock::now() - std::chrono::milliseconds(1));
+    check(!cache.get(2, value), "an expired lease is not cached");
+    check(cache.hits() == 1 && cache.misses() == 3, "hits and misses counted");
+}
+
+void testInvalidate() {
+    KVCache cache(16, 4);
+    std::string value;
+    cache.put(1, "a", in(std::chrono::seconds(10)));
+    cache.put(1, "b", in(std::chrono::seconds(10)));
+    check(cache.get(1, value) && value == "b", "put replaces the value");
+    cache.invalidate(1);
+    check(!cache.get(1, value), "invalidated key misses");
+    cache.put(2, "c", in(std::chrono::seconds(10)));
+    cache.clear();
+    check(!cache.get(2, value), "clear drops everything");
+}
+
+void testEviction() {
+    KVCache cache(4, 1);
+    std::string value;
+    for (int key = 0; key < 4; ++key) {
+        cache.put(key, "v", in(std::chrono::seconds(10)));
+    }
+    // A read sets the reference bit, so key 0 gets a second chance
+    check(cache.get(0, value), "key 0 cached");
+    cache.put(4, "v", in(std::chrono::seconds(10)));
+    check(cache.get(0, value), "referenced key survives eviction");
+    check(cache.get(4, value), "new key cached");
+    int cached = 0;
+    for (int key = 0; key <= 4; ++key) {
+        cached += cache.get(key, value) ? 1 : 0;
+    }
+    check(cached == 4, "capacity is respected");
+}
+
+}  // namespace
+
+int main() {
+    testLease();
+    testInvalidate();
+    testEviction();
+    if (failures) {
+        std::cerr << failures << " check(s) failed" << std::endl;
+        return 1;
+    }
+    std::cout << "All cache checks passed" << std::endl;
+    return 0;
+}
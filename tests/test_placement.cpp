@@ -0,0 +1,115 @@
+// Placement strategies: ownership is total and stable, weights and ranges are
+// honoured, and consistent strategies move few keys. Exits non-zero on a failed check.
+#include "KVPlacement.hpp"
+#include <climits>
+#include <iostream>
+#include <map>
+#include <stdexcept>
+#include <string>
+
+namespace {
+
+int failures = 0;
+
+void check(bool ok, const std::string& what) {
+    if (!ok) {
+        std::cerr << "FAILED: " << what << std::endl;
+        ++failures;
+    }
+}
+
+std::vector<PlacementNode> nodes(int count) {
+    std::vector<PlacementNode> result;
+    for (int i = 0; i < count; ++i) {
+        result.push_back({i, 1.0});
+    }
+    return result;
+}
+
+const int KEYS = 100000;
+
+// Share of KEYS whose owner differs between two placements
+double moved(const KVPlacement& before, const KVPlacement& after) {
+    int count = 0;
+    for (int key = 0; key < KEYS; ++key) {
+        count += before.nodeFor(key) != after.nodeFor(key) ? 1 : 0;
+    }
+    return static_cast<double>(count) / KEYS;
+}
+
+void testModulo() {
+    auto placement = makePlacement("modulo", nodes(3), 128);
+    check(std::string(placement->name()) == "modulo", "modulo built by name");
+    check(placement->nodeFor(7) == 1 && placement->nodeFor(9) == 0, "key % N for non-negative keys");
+    check(placement->nodeFor(-1) == 2, "negative keys wrap to a valid node");
+}
+
+void testConsistentStrategies() {
+    for (const std::string strategy : {"ring", "jump", "rendezvous"}) {
+        auto four = makePlacement(strategy, nodes(4), 128);
+        auto five = makePlacement(strategy, nodes(5), 128);
+        std::map<int, int> owned;
+        for (int key = 0; key < KEYS; ++key) {
+            int node = four->nodeFor(key);
+            check(node >= 0 && node < 4, strategy + " owner is a member");
+            ++owned[node];
+            check(four->nodeFor(key) == node, strategy + " is deterministic");
+        }
+        for (const auto& entry : owned) {
+            check(entry.second > KEYS / 8, strategy + " spreads keys over every node");
+        }
+        // Adding a fifth node should move about a fifth of the keys
+        check(moved(*four, *five) < 0.3, strategy + " moves few keys when a node joins");
+    }
+    auto modulo_four = makePlacement("modulo", nodes(4), 128);
+    auto modulo_five = makePlacement("modulo", nodes(5), 128);
+    check(moved(*modulo_four, *modulo_five) > 0.5, "modulo remaps most keys");
+}
+
+void testWeights() {
+    std::vector<PlacementNode> weighted = {{0, 1.0}, {1, 3.0}};
+    for (const std::string strategy : {"ring", "rendezvous"}) {
+        auto placement = makePlacement(strategy, weighted, 256);
+        int heavy = 0;
+        for (int key = 0; key < KEYS; ++key) {
+            heavy += placement->nodeFor(key) == 1 ? 1 : 0;
+        }
+        double share = static_cast<double>(heavy) / KEYS;
+        check(share > 0.65 && share < 0.85, strategy + " honours weights");
+    }
+}
+
+void testRanges() {
+    std::vector<KeyRange> table = {{INT_MIN, 0}, {100, 1}, {200, 0}};
+    RangePlacement placement(nodes(2), table);
+    check(placement.nodeFor(-5) == 0 && placement.nodeFor(99) == 0, "keys below the first split");
+    check(placement.nodeFor(100) == 1 && placement.nodeFor(199) == 1, "range start is inclusive");
+    check(placement.nodeFor(200) == 0 && placement.nodeFor(INT_MAX) == 0, "last range runs to INT_MAX");
+    check(placement.rangeEnd(2) == static_cast<int64_t>(INT_MAX) + 1, "last range end");
+
+    std::vector<KeyRange> initial = RangePlacement::initialRanges(nodes(4), 1000);
+    check(initial.size() == 4 && initial[0].start == INT_MIN && initial[2].start == 500, "initial split by weight");
+
+    bool rejected = false;
+    try {
+        RangePlacement bad(nodes(2), {{INT_MIN, 0}, {10, 5}});
+    } catch (const std::invalid_argument&) {
+        rejected = true;
+    }
+    check(rejected, "range owned by an unknown node is rejected");
+}
+
+}  // namespace
+
+int main() {
+    testModulo();
+    testConsistentStrategies();
+    testWeights();
+    testRanges();
+    if (failures) {
+        std::cerr << failures << " check(s) failed" << std::endl;
+        return 1;
+    }
+    std::cout << "All placement checks passed" << std::endl;
+    return 0;
+}
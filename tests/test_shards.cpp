@@ -0,0 +1,101 @@
+// Shard layout and replica placement checks behind the shard-per-core mode.
+// Exits non-zero on the first failed check.
+#include "KVMembership.hpp"
+#include "KVShards.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <unistd.h>
+
+namespace {
+
+int failures = 0;
+
+void check(bool ok, const std::string& what) {
+    if (!ok) {
+        std::cerr << "FAILED: " << what << std::endl;
+        ++failures;
+    }
+}
+
+PlacementSpec spec(uint32_t replicas, const std::vector<std::string>& endpoints) {
+    PlacementSpec result;
+    result.replicas = replicas;
+    for (std::size_t i = 0; i < endpoints.size(); ++i) {
+        result.nodes.push_back({static_cast<int>(i), endpoints[i], 1.0});
+    }
+    return result;
+}
+
+void testPlanShards() {
+    ShardConfig shards;
+    shards.count = 4;
+    shards.first_cpu = 2;
+    shards.cpu_stride = 2;
+    std::vector<ShardPlan> plans = PlanShards(shards, 8080, 400 * 1024 * 1024, 6, "node");
+    check(plans.size() == 4, "one plan per shard");
+    const unsigned cpus[] = {2, 4, 0, 2};   // Wraps around the 6 cores
+    for (uint32_t i = 0; i < plans.size(); ++i) {
+        check(plans[i].index == i, "shard index");
+        check(plans[i].port == 8080 + static_cast<int>(i), "port is base + index");
+        check(plans[i].cpu == cpus[i], "cpu " + std::to_string(i) + " is first_cpu + i * stride mod cpus");
+        check(plans[i].instance == "node_shard" + std::to_string(i), "instance suffixed with shard<i>");
+        check(plans[i].mem_size == 100 * 1024 * 1024, "memory split evenly");
+    }
+    check(PlanShards(shards, 8080, 1024, 0, "")[0].instance == "shard0", "no base instance");
+    check(PlanShards(shards, 8080, 1024, 0, "")[3].mem_size == 1024, "at least 1K per shard");
+}
+
+void testEndpointHost() {
+    check(EndpointHost("ofi+tcp://10.0.0.1:8080") == "10.0.0.1", "host of a tcp endpoint");
+    check(EndpointHost("ofi+tcp://10.0.0.1") == "10.0.0.1", "host without a port");
+    check(EndpointHost("node7:9000") == "node7", "host without a scheme");
+}
+
+void testColocatedBackups() {
+    // Two hosts with two shards each, numbered host by host: node 0 is backed up
+    // by its sibling node 1
+    std::vector<std::string> by_host = {"ofi+tcp://a:8080", "ofi+tcp://a:8081", "ofi+tcp://b:8080", "ofi+tcp://b:8081"};
+    check(!ColocatedBackups(spec(2, by_host)).empty(), "sibling shard as backup is refused");
+    check(ColocatedBackups(spec(1, by_host)).empty(), "no backups, nothing to refuse");
+
+    // Interleaved ids: every backup is on the other host
+    std::vector<std::string> interleaved = {"ofi+tcp://a:8080", "ofi+tcp://b:8080", "ofi+tcp://a:8081", "ofi+tcp://b:8081"};
+    check(ColocatedBackups(spec(2, interleaved)).empty(), "interleaved ids pass");
+    // Three copies on two hosts cannot avoid a shared host
+    check(!ColocatedBackups(spec(3, interleaved)).empty(), "more copies than hosts is refused");
+}
+
+void testSpecFromConfig() {
+    std::string path = "/tmp/kvm_test_shards_" + std::to_string(getpid()) + ".json";
+    {
+        std::ofstream out(path);
+        out << R"({"count_of_node": 2,
+                   "ip_addresses": {"0": "ofi+tcp://a:8080", "1": "ofi+tcp://a:8081"},
+                   "replication": {"factor": 2, "ack": "backup"}})";
+    }
+    Config config(path);
+    PlacementSpec from_config = PlacementSpecFromConfig(config);
+    std::remove(path.c_str());
+    check(from_config.strategy == "modulo", "modulo by default");
+    check(from_config.nodes.size() == 2 && from_config.nodes[1].endpoint == "ofi+tcp://a:8081", "nodes from ip_addresses");
+    check(from_config.replicas == 2 && from_config.wait_for_backups, "replication from config");
+    check(!ColocatedBackups(from_config).empty(), "shards of one host backing each other up are refused");
+}
+
+}  // namespace
+
+int main() {
+    testPlanShards();
+    testEndpointHost();
+    testColocatedBackups();
+    testSpecFromConfig();
+    if (failures) {
+        std::cerr << failures << " check(s) failed" << std::endl;
+        return 1;
+    }
+    std::cout << "All shard checks passed" << std::endl;
+    return 0;
+}
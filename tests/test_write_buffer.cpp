@@ -0,0 +1,164 @@
+// Write-behind buffer behaviour: which ops merge, the order they are sent in,
+// and that every failed write is reported. Exits non-zero on a failed check.
+#include "KVWriteBuffer.hpp"
+#include <iostream>
+#include <map>
+#include <string>
+
+namespace {
+
+int failures = 0;
+
+void check(bool ok, const std::string& what) {
+    if (!ok) {
+        std::cerr << "FAILED: " << what << std::endl;
+        ++failures;
+    }
+}
+
+// Applies batches to an in-memory map per node the way a server would, and
+// keeps every op it was sent
+struct FakeNodes {
+    std::map<int, std::map<int, std::string>> data;
+    std::vector<KvOp> sent;
+    std::size_t largest_batch = 0;
+
+    KvStatus apply(int node_id, const KvOp& op) {
+        std::map<int, std::string>& store = data[node_id];
+        bool exists = store.count(op.key) > 0;
+        switch (op.type) {
+            case KvOpType::INSERT:
+                if (exists) return KvStatus::ALREADY_EXISTS;
+                store[op.key] = op.value;
+                return KvStatus::OK;
+            case KvOpType::UPDATE:
+                if (!exists) return KvStatus::NOT_FOUND;
+                store[op.key] = op.value;
+                return KvStatus::OK;
+            case KvOpType::DELETE:
+                return store.erase(op.key) ? KvStatus::OK : KvStatus::NOT_FOUND;
+            default:
+                return KvStatus::ERROR;
+        }
+    }
+
+    KVWriteBuffer::SendFn sender() {
+        return [this](const KVWriteBuffer::Batches& batches) {
+            std::unordered_map<int, BatchResult> results;
+            for (const auto& entry : batches) {
+                largest_batch = std::max(largest_batch, entry.second.size());
+                for (const KvOp& op : entry.second) {
+                    sent.push_back(op);
+                    KvReply reply;
+                    reply.status = apply(entry.first, op);
+                    results[entry.first].replies.push_back(reply);
+                }
+            }
+            return results;
+        };
+    }
+};
+
+KvOp op(KvOpType type, int key, const std::string& value = "") {
+    KvOp result;
+    result.type = type;
+    result.key = key;
+    result.value = value;
+    return result;
+}
+
+// Long enough that the background flusher never runs during a test
+const uint32_t NO_TIMER_MS = 60000;
+
+void testUpdatesMerge() {
+    FakeNodes nodes;
+    nodes.data[0][1] = "old";
+    KVWriteBuffer buffer(256, NO_TIMER_MS, 65536, nodes.sender());
+    buffer.add(0, op(KvOpType::UPDATE, 1, "a"));
+    buffer.add(0, op(KvOpType::UPDATE, 1, "b"));
+    buffer.add(0, op(KvOpType::UPDATE, 1, "c"));
+    check(buffer.holds(1), "buffered key is held");
+    check(buffer.flush().empty(), "merged updates succeed");
+    check(nodes.sent.size() == 1, "consecutive updates are sent as one");
+    check(nodes.data[0][1] == "c", "the newest update wins");
+    check(!buffer.holds(1), "flushed key is no longer held");
+}
+
+void testDeletesAndInsertsAreNotMerged() {
+    FakeNodes nodes;
+    nodes.data[0][1] = "x";
+    KVWriteBuffer buffer(256, NO_TIMER_MS, 65536, nodes.sender());
+    buffer.add(0, op(KvOpType::DELETE, 1));
+    buffer.add(0, op(KvOpType::DELETE, 1));
+    buffer.add(0, op(KvOpType::INSERT, 2, "a"));
+    buffer.add(0, op(KvOpType::INSERT, 2, "b"));
+    std::vector<WriteFailure> failed = buffer.flush();
+    check(nodes.sent.size() == 4, "deletes and inserts are sent one by one");
+    check(failed.size() == 2, "the second delete and the second insert fail");
+    bool delete_failed = false;
+    bool insert_failed = false;
+    for (const WriteFailure& failure : failed) {
+        delete_failed = delete_failed || (failure.key == 1 && failure.status == KvStatus::NOT_FOUND);
+        insert_failed = insert_failed || (failure.key == 2 && failure.status == KvStatus::ALREADY_EXISTS);
+    }
+    check(delete_failed, "second delete reports NOT_FOUND");
+    check(insert_failed, "second insert reports ALREADY_EXISTS");
+    check(nodes.data[0][2] == "a", "the first insert stays");
+}
+
+void testOrderPerKey() {
+    FakeNodes nodes;
+    KVWriteBuffer buffer(256, NO_TIMER_MS, 65536, nodes.sender());
+    buffer.add(0, op(KvOpType::INSERT, 1, "a"));
+    buffer.add(0, op(KvOpType::UPDATE, 1, "b"));
+    buffer.add(0, op(KvOpType::DELETE, 1));
+    buffer.add(0, op(KvOpType::INSERT, 1, "c"));
+    check(buffer.flush().empty(), "writes of one key apply in order");
+    check(nodes.sent.size() == 4, "ops of different types are all sent");
+    check(nodes.data[0][1] == "c", "the last write wins");
+}
+
+void testBatchSize() {
+    FakeNodes nodes;
+    KVWriteBuffer buffer(2, NO_TIMER_MS, 65536, nodes.sender());
+    for (int key = 0; key < 5; ++key) {
+        buffer.add(key % 2, op(KvOpType::INSERT, key, "v"));
+    }
+    check(buffer.flush().empty(), "batched inserts succeed");
+    check(nodes.sent.size() == 5, "every op is sent");
+    check(nodes.largest_batch <= 2, "batches hold at most batch_size ops");
+    check(nodes.data[0].size() == 3 && nodes.data[1].size() == 2, "ops reach their own node");
+}
+
+void testSendError() {
+    KVWriteBuffer buffer(256, NO_TIMER_MS, 65536, [](const KVWriteBuffer::Batches& batches) {
+        std::unordered_map<int, BatchResult> results;
+        for (const auto& entry : batches) {
+            results[entry.first].error = "unreachable";
+        }
+        return results;
+    });
+    buffer.add(3, op(KvOpType::UPDATE, 7, "a"));
+    buffer.add(3, op(KvOpType::DELETE, 8));
+    std::vector<WriteFailure> failed = buffer.flush();
+    check(failed.size() == 2, "every op of a failed batch is reported");
+    check(!failed.empty() && failed[0].status == KvStatus::UNAVAILABLE && failed[0].error == "unreachable",
+          "an RPC error reports UNAVAILABLE with its text");
+    check(buffer.flush().empty(), "failures are reported once");
+}
+
+}  // namespace
+
+int main() {
+    testUpdatesMerge();
+    testDeletesAndInsertsAreNotMerged();
+    testOrderPerKey();
+    testBatchSize();
+    testSendError();
+    if (failures) {
+        std::cerr << failures << " check(s) failed" << std::endl;
+        return 1;
+    }
+    std::cout << "All write buffer checks passed" << std::endl;
+    return 0;
+}